@@ -0,0 +1,290 @@
+#include <stddef.h>
+
+#include "bench.h"
+
+#include "cart.h"
+#include "file.h"
+#include "thread.h"
+
+#define BUS_CLOCK 33513982
+
+struct bench {
+  unsigned char *buf;
+  struct file h;
+  unsigned int data_offset;
+  // set by the completion callback of async cart reads
+  volatile bool read_done;
+  struct thread_list waiting;
+  struct bench_result results[BENCH_PAGES][BENCH_COLUMNS][BENCH_SIZES];
+};
+
+static bool bench_run_case(int page, int column, int size_index);
+static bool bench_read(int page, bool async, unsigned int offset,
+                       unsigned char *dst, unsigned int size,
+                       unsigned int *blocked);
+static void bench_read_done(int arg);
+static void bench_wait_cart(void);
+static void bench_wait_file(void);
+static bool bench_check(const unsigned char *p, unsigned int offset,
+                        unsigned int size);
+static void bench_print_cell(const struct bench_result *r, bool blocked,
+                             bench_print_fn *print);
+
+
+static struct bench bench;
+
+
+bool bench_init(void *buf, int size)
+{
+  if (size < BENCH_BUF_SIZE) {
+    return false;
+  }
+
+  bench.buf = buf;
+  bench.waiting.first = NULL;
+  bench.waiting.last = NULL;
+
+  for (int p = 0; p < BENCH_PAGES; p++) {
+    for (int c = 0; c < BENCH_COLUMNS; c++) {
+      for (int s = 0; s < BENCH_SIZES; s++) {
+        bench.results[p][c][s] = (struct bench_result) { 0 };
+      }
+    }
+  }
+
+  ndk_file_init_handle(&bench.h);
+
+  if (!ndk_file_open(&bench.h, BENCH_DATA_PATH)) {
+    return false;
+  }
+
+  if (ndk_file_size(&bench.h) < BENCH_DATA_SIZE) {
+    ndk_file_close(&bench.h);
+    return false;
+  }
+
+  bench.data_offset = bench.h.start_offset;
+
+  return true;
+}
+
+unsigned int bench_data_offset(void)
+{
+  return bench.data_offset;
+}
+
+bool bench_run(int page)
+{
+  bool ok = true;
+
+  for (int s = 0; s < BENCH_SIZES; s++) {
+    for (int c = 0; c < BENCH_COLUMNS; c++) {
+      ok = bench_run_case(page, c, s) && ok;
+    }
+  }
+
+  return ok;
+}
+
+const struct bench_result *bench_get_result(int page, int column,
+                                            int size_index)
+{
+  return &bench.results[page][column][size_index];
+}
+
+void bench_print(int page, bench_print_fn *print)
+{
+  static const char *titles[BENCH_PAGES] = {
+    "ndk_cart_read DMA", "ndk_cart_read CPU", "ndk_file_read"
+  };
+
+  print("%-17s", titles[page]);
+
+  if (page != BENCH_FILE) {
+    print("%15s\n", "KiB/s");
+  } else if (fat_dma_channel <= 3) {
+    print(" DMA %u%9s\n", fat_dma_channel, "KiB/s");
+  } else {
+    print(" CPU%11s\n", "KiB/s");
+  }
+
+  print("%5s%7s%7s%7s%6s\n", "size", "sync", "unal", "async", "blk%");
+
+  for (int s = 0; s < BENCH_SIZES; s++) {
+    unsigned int size = BENCH_MIN_SIZE << s;
+
+    if (size >= 0x100000) {
+      print("%4uM", size >> 20);
+    } else if (size >= 0x400) {
+      print("%4uK", size >> 10);
+    } else {
+      print("%5u", size);
+    }
+
+    for (int c = 0; c < BENCH_COLUMNS; c++) {
+      bench_print_cell(&bench.results[page][c][s], false, print);
+    }
+
+    bench_print_cell(&bench.results[page][BENCH_ASYNC][s], true, print);
+    print("\n");
+  }
+}
+
+/*
+ * Read one size repeatedly, at least BENCH_MIN_BYTES in total, and check the
+ * data of the last read.
+ */
+bool bench_run_case(int page, int column, int size_index)
+{
+  struct bench_result *r = &bench.results[page][column][size_index];
+  unsigned int size = BENCH_MIN_SIZE << size_index;
+  unsigned int offset = column == BENCH_UNALIGNED ? BENCH_MISALIGN : 0;
+  unsigned char *dst = bench.buf + offset;
+  int count = size < BENCH_MIN_BYTES ? BENCH_MIN_BYTES / size : 1;
+  unsigned int *words = (unsigned int *)bench.buf;
+
+  // Clear, a read that doesn't write its destination must not pass
+  for (unsigned int i = 0; i < (size + offset + 3) / 4; i++) {
+    words[i] = 0;
+  }
+
+  r->ok = true;
+  r->blocked = 0;
+
+  unsigned int start = bench_clock();
+
+  for (int i = 0; i < count && r->ok; i++) {
+    r->ok = bench_read(page, column == BENCH_ASYNC, offset, dst, size,
+                       &r->blocked);
+  }
+
+  r->cycles = bench_clock() - start;
+  r->bytes = count * size;
+  r->ok = r->ok && bench_check(dst, offset, size);
+  r->done = true;
+
+  return r->ok;
+}
+
+/*
+ * One read of the data file, adds the time spent in the read call to
+ * blocked.
+ */
+bool bench_read(int page, bool async, unsigned int offset,
+                unsigned char *dst, unsigned int size, unsigned int *blocked)
+{
+  unsigned int src = bench.data_offset + offset;
+  unsigned int start = bench_clock();
+  int n = size;
+
+  if (page == BENCH_FILE) {
+    ndk_file_seek(&bench.h, offset, FILE_SEEK_SET);
+    n = ndk_file_read_impl(&bench.h, dst, size, async);
+    *blocked += bench_clock() - start;
+
+    if (async) {
+      bench_wait_file();
+    }
+
+    return n == (int)size && bench.h.error == 0;
+  }
+
+  unsigned int dma = page == BENCH_CART_DMA ? BENCH_DMA_CHANNEL : -1;
+
+  bench.read_done = false;
+  ndk_cart_read(dma, src, dst, size, async ? &bench_read_done : NULL, 0,
+                async);
+  *blocked += bench_clock() - start;
+
+  if (async) {
+    bench_wait_cart();
+  }
+
+  return true;
+}
+
+/*
+ * Completion callback of async cart reads, called from the cart IRQ handler
+ * or the cart thread.
+ */
+void bench_read_done(int arg)
+{
+  bench.read_done = true;
+  ndk_thread_schedule_list(&bench.waiting);
+}
+
+void bench_wait_cart(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  while (!bench.read_done) {
+    ndk_thread_yield(&bench.waiting);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+/*
+ * Wait for the ongoing operation on the file handle, see CORO_AWAIT_FILE.
+ */
+void bench_wait_file(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  while (bench.h.flags & 1) {
+    ndk_thread_yield(&bench.h.waiting);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+/*
+ * Compare size bytes read from an offset of the data file with the pattern.
+ */
+bool bench_check(const unsigned char *p, unsigned int offset,
+                 unsigned int size)
+{
+  for (unsigned int i = 0; i < size; i++) {
+    unsigned int k = offset + i;
+    unsigned char expected = bench_pattern(k & ~3) >> ((k & 3) * 8);
+
+    if (p[i] != expected) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Throughput in KiB/s or, with blocked set, the blocked part of the time in
+ * percent. Seven characters wide, six for the blocked part.
+ */
+void bench_print_cell(const struct bench_result *r, bool blocked,
+                      bench_print_fn *print)
+{
+  const char *text = NULL;
+  unsigned int value = 0;
+
+  if (!r->done) {
+    text = "-";
+  } else if (!r->ok) {
+    text = "bad";
+  } else if (r->cycles == 0) {
+    text = "?";
+  } else if (blocked) {
+    value = (unsigned long long)r->blocked * 100 / r->cycles;
+  } else {
+    value = (unsigned long long)r->bytes * BUS_CLOCK / 1024 / r->cycles;
+  }
+
+  if (text != NULL) {
+    print(blocked ? "%6s" : "%7s", text);
+  } else {
+    print(blocked ? "%6u" : "%7u", value);
+  }
+}
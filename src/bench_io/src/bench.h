@@ -0,0 +1,134 @@
+/**
+ * Cart and file read throughput sweep.
+ *
+ * Times ndk_cart_read with DMA and with the CPU, and ndk_file_read through
+ * the mounted file system, for read sizes from BENCH_MIN_SIZE to
+ * BENCH_MAX_SIZE. Every size is read:
+ *  sync   from a 512 byte aligned ROM offset to a 32 byte aligned buffer.
+ *  unal   the same plus BENCH_MISALIGN on both sides. The SDK falls back to
+ *         CPU reads through a bounce buffer for these (see cart.h).
+ *  async  aligned with async set, waiting for the completion callback or the
+ *         file operation to finish.
+ *
+ * The results of an API and transfer mode make a page, printed as a table in
+ * KiB/s with one row per size. The last column is the part of the async time
+ * the caller was blocked in the read call, the rest of the time it could do
+ * other work.
+ *
+ * The data comes from the file BENCH_DATA_PATH, written by the host tool
+ * benchio (benchio -g <file>). It holds bench_pattern, so every read is
+ * checked and a case that read wrong data is printed as "bad". That's what
+ * the low level cart reads do on some flash carts, see cart.h.
+ *
+ * The module is shared with src/host/benchio.c which runs the sweep on the
+ * cart simulation (src/host/sim_cart.h), so the same table can be compared
+ * with the one of a real DS.
+ *
+ * NOTE: The file system must be mounted (ndk_fat_mount) first, the file page
+ * uses its DMA channel.
+ */
+#ifndef BENCH_INCLUDE_FILE
+#define BENCH_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#define BENCH_DATA_PATH "/bench.bin"
+
+#define BENCH_MIN_SIZE 32
+#define BENCH_MAX_SIZE 0x100000
+// Sizes are powers of two from BENCH_MIN_SIZE to BENCH_MAX_SIZE
+#define BENCH_SIZES 16
+
+// Added to the ROM offset and the destination of the unaligned reads
+#define BENCH_MISALIGN 1
+
+// Size of the data file, the largest unaligned read fits
+#define BENCH_DATA_SIZE (BENCH_MAX_SIZE + 0x200)
+
+// Memory needed by bench_init
+#define BENCH_BUF_SIZE (BENCH_MAX_SIZE + 32)
+
+// Small sizes are read repeatedly until this many bytes have been read
+#define BENCH_MIN_BYTES 0x10000
+
+// Pages
+#define BENCH_CART_DMA 0
+#define BENCH_CART_CPU 1
+#define BENCH_FILE 2
+#define BENCH_PAGES 3
+
+// Columns of a page
+#define BENCH_SYNC 0
+#define BENCH_UNALIGNED 1
+#define BENCH_ASYNC 2
+#define BENCH_COLUMNS 3
+
+// DMA channel of the cart DMA page
+#define BENCH_DMA_CHANNEL 3
+
+struct bench_result {
+  // false until the case has run
+  bool done;
+  // every read returned all bytes and the data matched
+  bool ok;
+  unsigned int bytes;
+  // bus cycles from the first call until the last read completed
+  unsigned int cycles;
+  // bus cycles spent inside the read calls
+  unsigned int blocked;
+};
+
+typedef void bench_print_fn(const char *fmt, ...);
+
+/**
+ * Word at a byte offset (a multiple of 4) of the data file, little endian.
+ */
+static inline unsigned int bench_pattern(unsigned int offset)
+{
+  return (offset / 4 + 1) * 0x9e3779b1;
+}
+
+/**
+ * Bus cycle counter (33.5MHz), defined by the program running the sweep.
+ */
+unsigned int bench_clock(void);
+
+/**
+ * Open the data file and clear the results.
+ *
+ * @param buf destination of the reads, 32 byte aligned
+ * @param size of buf, at least BENCH_BUF_SIZE
+ * @return false if the data file is missing or too small
+ */
+bool bench_init(void *buf, int size);
+
+/**
+ * @return ROM offset of the data file
+ */
+unsigned int bench_data_offset(void);
+
+/**
+ * Run every case of a page.
+ *
+ * @param page BENCH_CART_DMA, BENCH_CART_CPU or BENCH_FILE
+ * @return false if any case read wrong data
+ */
+bool bench_run(int page);
+
+/**
+ * @param page
+ * @param column BENCH_SYNC, BENCH_UNALIGNED or BENCH_ASYNC
+ * @param size_index 0 for BENCH_MIN_SIZE
+ */
+const struct bench_result *bench_get_result(int page, int column,
+                                            int size_index);
+
+/**
+ * Print a page as a table of 32 columns and BENCH_SIZES + 2 rows.
+ *
+ * @param page
+ * @param print term_printf or a printf wrapper
+ */
+void bench_print(int page, bench_print_fn *print);
+
+#endif // BENCH_INCLUDE_FILE
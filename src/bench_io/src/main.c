@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nds.h"
+#include "gfx.h"
+#include "cart.h"
+#include "file.h"
+#include "heap.h"
+#include "interrupts.h"
+#include "timers.h"
+#include "cpu.h"
+#include "dtcm.h"
+
+#include "term.h"
+#include "util.h"
+
+#include "bench.h"
+
+// DMA channel of the file system, build with FILE_DMA=-1 for CPU reads
+#ifndef FILE_DMA
+#define FILE_DMA 3
+#endif
+
+static void init(void);
+static void init_displays(void);
+static void run_page(int page);
+static void show_page(int page);
+static void read_key_presses(void);
+static void vblank_handler(void);
+
+unsigned short old_gamepad_state;
+unsigned short gamepad_btn_down;
+
+const char *instructions =
+"Cart and file read benchmark\n"
+"Instructions:\n"
+" A to run the shown page\n"
+" B to run all pages\n"
+" Left/Right to change page\n\n"
+"The cart pages can read bad data\n"
+"or hang on some flash carts, see\n"
+"cart.h.\n";
+
+/*
+ * The definition below is needed so the linker can patch the original
+ * main function with our own main function.
+ */
+__attribute__((section("text_main_fcn"), target("arm")))
+int main()
+{
+  init();
+  ndk_cart_init();
+  init_displays();
+
+  term_init((unsigned short *)0x06000000, (unsigned short *)0x06002000, 0);
+
+  ndk_fat_mount(FILE_DMA);
+  timer_start();
+
+  // The reads go to all of the free main RAM, it's more than 2MB
+  unsigned int start = (unsigned int)ndk_area_get_memory_start(AREA_MAIN);
+  unsigned int end = (unsigned int)ndk_area_get_memory_end(AREA_MAIN);
+  unsigned int buf = (start + 31) & ~31;
+  bool ready = bench_init((void *)buf, end - buf);
+  int page = BENCH_CART_DMA;
+
+  term_set_cursor(0, 1);
+  term_printf("%s", instructions);
+
+  if (!ready) {
+    term_printf("\n%s is missing or smaller\nthan %u bytes\n",
+                BENCH_DATA_PATH, BENCH_DATA_SIZE);
+  }
+
+  while(1) {
+    read_key_presses();
+
+    if ((ext_gamepad & 0x8000) != 0) {
+      ndk_handle_lid_closed(0xc, 0, 0);
+    }
+
+    if (ready && (gamepad_btn_down & PAD_A)) {
+      run_page(page);
+      show_page(page);
+    }
+
+    if (ready && (gamepad_btn_down & PAD_B)) {
+      for (int i = 0; i < BENCH_PAGES; i++) {
+        run_page(i);
+      }
+
+      show_page(page);
+    }
+
+    if (gamepad_btn_down & PAD_Right) {
+      page = (page + 1) % BENCH_PAGES;
+      show_page(page);
+    }
+
+    if (gamepad_btn_down & PAD_Left) {
+      page = (page + BENCH_PAGES - 1) % BENCH_PAGES;
+      show_page(page);
+    }
+
+    ndk_wait_vblank_intr();
+    term_draw();
+  }
+}
+
+void init()
+{
+  ndk_platform_init();
+
+  ndk_irq_set_handler(IS_VBLANK, &vblank_handler);
+
+  ndk_gfx_init();
+  ndk_irq_enable_interrupt_sources(IS_VBLANK);
+  // Master IRQ enable
+  IME = 1;
+  ndk_cpu_enable_irq();
+  ndk_lcd_set_vblank_irq_enable(1);
+}
+
+void init_displays()
+{
+  VRAMCNT_A = 0x81;
+  VRAMCNT_B = 0x00;
+  VRAMCNT_C = 0x84;
+  VRAMCNT_D = 0x00;
+
+  //set up 16-color text BG on engine A
+  DISPCNT = 0x00010403;
+  BG2CNT = 0x0400;
+
+  // setup palette 0
+  *(unsigned short *)0x05000000 = 0;  // Background color
+  *(unsigned short *)0x05000002 = 0x7fff; // Palette 0 color 1
+
+  //set up 256*256 16bit color bitmap on engines B
+  DB_DISPCNT = 0x00010803;
+  DB_BG3CNT = 0x4084;
+}
+
+/*
+ * Show a message while a page runs, it takes a few seconds.
+ */
+void run_page(int page)
+{
+  term_clear();
+  term_set_cursor(0, 0);
+  term_printf("Running page %d/%d...", page + 1, BENCH_PAGES);
+  term_draw();
+
+  bench_run(page);
+}
+
+void show_page(int page)
+{
+  term_clear();
+  term_set_cursor(0, 0);
+  bench_print(page, &term_printf);
+
+  term_set_cursor(0, 19);
+  term_printf("bench.bin at ROM offset %x", bench_data_offset());
+  term_set_cursor(0, 21);
+  term_printf("page %d/%d  A run  B run all", page + 1, BENCH_PAGES);
+}
+
+unsigned int bench_clock(void)
+{
+  return timer_value();
+}
+
+void vblank_handler(void)
+{
+  thread_irq_bits |= IS_VBLANK;
+}
+
+void read_key_presses()
+{
+  int new_keys = ext_gamepad;
+
+  new_keys |= KEYINPUT;
+
+  new_keys ^= 0x2fff;
+  new_keys &= 0x2fff;
+
+  int old_keys = old_gamepad_state;
+
+  old_gamepad_state = new_keys;
+
+  int change_mask = new_keys ^ old_keys;
+
+  new_keys &= change_mask;
+
+  gamepad_btn_down = (unsigned short) new_keys;
+}
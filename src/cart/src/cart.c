@@ -9,7 +9,14 @@
 #include "cpu.h"
 #include "dtcm.h"
 
+#include "cart_cpu.h"
 #include "term.h"
+#include "util.h"
+
+#define BENCH_SIZE (16*1024)
+// Real carts don't return the secure area (0x4000-0x7fff) to normal reads,
+// so read from just after it. The ROM is much larger (the FAT is at 0xD2600).
+#define BENCH_ROM_OFFSET 0x8000
 
 struct FAT_entry {
   unsigned int start;
@@ -18,6 +25,8 @@ struct FAT_entry {
 
 static void init(void);
 static void init_displays(void);
+static void run_benchmark(void);
+static unsigned int time_read(unsigned int src, void *dst, int count);
 static void read_key_presses(void);
 static void vblank_handler(void);
 
@@ -29,7 +38,26 @@ const char *instructions =
 "Instructions:\n"
 " Y get ROM chip id\n"
 " X to read data from first.txt\n"
-" A to read data from second.txt\n";
+" A to read data from second.txt\n"
+" B to time CPU reads\n";
+
+/*
+ * CPU read benchmark cases: ROM offset and destination offset from a 32 byte
+ * aligned buffer.
+ */
+static const struct {
+  const char *name;
+  unsigned int src;
+  unsigned int dst;
+  int count;
+} bench_cases[] = {
+  { "aligned", BENCH_ROM_OFFSET, 0, BENCH_SIZE },
+  { "src+3", BENCH_ROM_OFFSET + 3, 3, BENCH_SIZE - 8 },
+  { "dst+1", BENCH_ROM_OFFSET, 1, BENCH_SIZE - 8 },
+  { "small", BENCH_ROM_OFFSET + 0x123, 2, 100 }
+};
+
+static unsigned char bench_buf[2][BENCH_SIZE] __attribute__((aligned(32)));
 
 struct FAT_entry FAT[2];
 char data[256];
@@ -85,6 +113,10 @@ int main()
       print_file_data(1);
     }
 
+    if (gamepad_btn_down & PAD_B) {
+      run_benchmark();
+    }
+
     ndk_wait_vblank_intr();
     term_draw();
   }
@@ -124,6 +156,55 @@ void init_displays()
   DB_BG3CNT = 0x4084;
 }
 
+/*
+ * Time every case with the firmware CPU read path (ndk_cart_cpu_read_data)
+ * and with cart_cpu_read_data, in bus cycles, and check they read the same.
+ */
+void run_benchmark(void)
+{
+  int count = sizeof bench_cases / sizeof bench_cases[0];
+
+  term_set_cursor(0, 8);
+  term_printf("%-8s%10s%10s", "CPU read", "firmware", "cart_cpu");
+
+  for (int i = 0; i < count; i++) {
+    unsigned int src = bench_cases[i].src;
+    unsigned char *a = bench_buf[0] + bench_cases[i].dst;
+    unsigned char *b = bench_buf[1] + bench_cases[i].dst;
+    int n = bench_cases[i].count;
+
+    cart_cpu_uninstall();
+    unsigned int firmware = time_read(src, a, n);
+
+    cart_cpu_install();
+    unsigned int fast = time_read(src, b, n);
+
+    bool same = true;
+
+    for (int j = 0; j < n; j++) {
+      same = same && a[j] == b[j];
+    }
+
+    term_set_cursor(0, 9 + i);
+    term_printf("%-8s%10u%10u%s", bench_cases[i].name, firmware, fast,
+                same ? "" : " !=");
+  }
+
+  cart_cpu_uninstall();
+}
+
+unsigned int time_read(unsigned int src, void *dst, int count)
+{
+  timer_start();
+
+  unsigned int start = timer_value();
+
+  // No DMA channel, ndk_cart_read always reads with the CPU
+  ndk_cart_read(-1, src, dst, count, NULL, 0, false);
+
+  return timer_value() - start;
+}
+
 void vblank_handler(void)
 {
   thread_irq_bits |= IS_VBLANK;
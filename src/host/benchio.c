@@ -0,0 +1,132 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sim_cart.h"
+#include "sim_thread.h"
+
+#include "bench.h"
+#include "file.h"
+
+/*
+ * Run the cart and file read sweep of src/bench_io on the simulated cart
+ * (see sim_cart.h) and print the same tables as the bench_io ROM, so the
+ * model can be compared with a real DS.
+ *
+ * The ROM must hold the data file of the sweep, like the bench_io ROM. -g
+ * writes that file instead, the bench_io makefile uses it.
+ *
+ * -d sets the DMA channel passed to ndk_fat_mount (-1 for the CPU), it's
+ * shown on the file page. The simulation times DMA and CPU reads the same
+ * and async reads complete before the call returns, so on the host those
+ * columns show the cost of the cart protocol alone.
+ *
+ * Usage: benchio [-d dma] <ROM file>
+ *        benchio -g <data file>
+ */
+
+static unsigned char buf[BENCH_BUF_SIZE] __attribute__((aligned(32)));
+
+unsigned int bench_clock(void)
+{
+  struct sim_cart_stats stats;
+
+  sim_cart_get_stats(&stats);
+
+  return stats.cycles;
+}
+
+void print(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+bool write_data(const char *path)
+{
+  FILE *f = fopen(path, "wb");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  for (unsigned int offset = 0; offset < BENCH_DATA_SIZE; offset += 4) {
+    unsigned int word = bench_pattern(offset);
+
+    for (int i = 0; i < 4; i++) {
+      fputc(word >> (i * 8), f);
+    }
+  }
+
+  if (fclose(f) != 0) {
+    perror(path);
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  bool generate = false;
+  int dma = 3;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "gd:")) != -1) {
+    switch (opt) {
+      case 'g':
+        generate = true;
+        break;
+      case 'd':
+        dma = atoi(optarg);
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-d dma] <ROM file>\n"
+            "       %s -g <data file>\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  if (generate) {
+    return write_data(argv[optind]) ? 0 : 1;
+  }
+
+  if (!sim_cart_init(argv[optind])) {
+    return 1;
+  }
+
+  sim_init(1, 0);
+  ndk_fat_mount(dma);
+
+  if (!bench_init(buf, sizeof buf)) {
+    fprintf(stderr, "%s: %s is missing or smaller than %u bytes\n",
+            argv[optind], BENCH_DATA_PATH, BENCH_DATA_SIZE);
+    sim_cart_shutdown();
+    return 1;
+  }
+
+  bool ok = true;
+
+  for (int page = 0; page < BENCH_PAGES; page++) {
+    ok = bench_run(page) && ok;
+    bench_print(page, &print);
+    printf("\n");
+  }
+
+  sim_cart_print_report(stdout);
+
+  sim_shutdown();
+  sim_cart_shutdown();
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashseed.h"
+#include "ndsrom.h"
+
+#include "file_index.h"
+#include "hash.h"
+
+/*
+ * Generate a hashed filename index for the runtime lookup in
+ * src/util/file_index.h.
+ *
+ * Reads the file name table of a built ROM and writes a table from path hash
+ * to FAT id. Seeds are tried until every path has a unique hash. Every entry
+ * also gets a check hash (hash_path_check) and the path length, so lookups
+ * of paths that aren't in the ROM fail.
+ *
+ * Usage: fidxgen <ROM file> <index file>
+ */
+
+struct file_list {
+  int count;
+  int capacity;
+  char **paths;
+  int *fat_ids;
+};
+
+bool add_file(const char *path, int fat_id, void *arg)
+{
+  struct file_list *list = arg;
+
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 256;
+    list->paths = realloc(list->paths, list->capacity * sizeof(char *));
+    list->fat_ids = realloc(list->fat_ids, list->capacity * sizeof(int));
+
+    if (list->paths == NULL || list->fat_ids == NULL) {
+      return false;
+    }
+  }
+
+  list->paths[list->count] = strdup(path);
+  list->fat_ids[list->count] = fat_id;
+  list->count++;
+
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    printf("Usage: fidxgen <ROM file> <index file>\n");
+    return 1;
+  }
+
+  struct ndsrom rom;
+  struct file_list list = { 0 };
+
+  if (!ndsrom_open(&rom, argv[1], false)) {
+    return 1;
+  }
+
+  if (!ndsrom_walk_files(&rom, &add_file, &list)) {
+    fprintf(stderr, "%s: corrupt file name table\n", argv[1]);
+    return 1;
+  }
+
+  ndsrom_close(&rom);
+
+  struct hashseed_set set = { list.paths, list.count };
+  unsigned int seed;
+
+  if (!hashseed_find(&set, 1, &seed)) {
+    fprintf(stderr, "no collision free hash seed found\n");
+    return 1;
+  }
+
+  // At most 3/4 full so lookups of missing paths always hit an empty slot.
+  unsigned int slots = 1;
+
+  while (slots * 3 < list.count * 4 + 4) {
+    slots *= 2;
+  }
+
+  struct file_index_header hdr = {
+    .magic = FILE_INDEX_MAGIC,
+    .version = FILE_INDEX_VERSION,
+    .seed = seed,
+    .count = list.count,
+    .slots = slots
+  };
+
+  struct file_index_entry *table = malloc(slots * sizeof *table);
+  int probes = 0;
+  int max_probes = 0;
+
+  for (int i = 0; i < slots; i++) {
+    table[i] = (struct file_index_entry) { 0 };
+    table[i].fat_id = FILE_INDEX_EMPTY;
+  }
+
+  for (int i = 0; i < list.count; i++) {
+    unsigned int hash = hash_path(list.paths[i], seed);
+    unsigned int slot = hash & (slots - 1);
+    int n = 1;
+
+    while (table[slot].fat_id != FILE_INDEX_EMPTY) {
+      slot = (slot + 1) & (slots - 1);
+      n++;
+    }
+
+    table[slot].hash = hash;
+    table[slot].fat_id = list.fat_ids[i];
+    table[slot].check = hash_path_check(list.paths[i]);
+    table[slot].length = file_index_path_length(list.paths[i]);
+
+    probes += n;
+    max_probes = n > max_probes ? n : max_probes;
+  }
+
+  FILE *out = fopen(argv[2], "wb");
+
+  if (out == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  fwrite(&hdr, sizeof hdr, 1, out);
+  fwrite(table, sizeof *table, slots, out);
+
+  if (fclose(out) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  printf("%d files, %u slots, seed 0x%08x, %lu bytes, probes avg %.2f max %d\n",
+         list.count, slots, seed, sizeof hdr + slots * sizeof *table,
+         list.count ? (double)probes / list.count : 0.0, max_probes);
+
+  for (int i = 0; i < list.count; i++) {
+    free(list.paths[i]);
+  }
+
+  free(list.paths);
+  free(list.fat_ids);
+  free(table);
+
+  return 0;
+}
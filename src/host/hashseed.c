@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#include "hashseed.h"
+
+static bool hashseed_unique(const struct hashseed_set *set,
+                            unsigned int *hashes, unsigned int seed);
+static int hashseed_compare(const void *a, const void *b);
+
+
+bool hashseed_find(const struct hashseed_set *sets, int set_count,
+                   unsigned int *seed)
+{
+  int max_count = 1;
+
+  for (int i = 0; i < set_count; i++) {
+    max_count = sets[i].count > max_count ? sets[i].count : max_count;
+  }
+
+  unsigned int *hashes = malloc(max_count * sizeof(unsigned int));
+
+  for (int s = 0; s < HASHSEED_MAX; s++) {
+    bool unique = true;
+
+    for (int i = 0; i < set_count && unique; i++) {
+      unique = hashseed_unique(&sets[i], hashes, HASHSEED(s));
+    }
+
+    if (unique) {
+      *seed = HASHSEED(s);
+      free(hashes);
+      return true;
+    }
+  }
+
+  free(hashes);
+
+  return false;
+}
+
+/*
+ * Hash every name of the set into hashes and check for duplicates.
+ */
+bool hashseed_unique(const struct hashseed_set *set, unsigned int *hashes,
+                     unsigned int seed)
+{
+  for (int i = 0; i < set->count; i++) {
+    hashes[i] = hash_path(set->names[i], seed);
+  }
+
+  qsort(hashes, set->count, sizeof(unsigned int), &hashseed_compare);
+
+  for (int i = 1; i < set->count; i++) {
+    if (hashes[i] == hashes[i - 1]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int hashseed_compare(const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+
+  return x < y ? -1 : x > y;
+}
@@ -0,0 +1,38 @@
+/**
+ * Search for a hash_path seed without collisions, for the host tools that
+ * generate hashed tables (fidxgen, packgen).
+ *
+ * The seeds tried are HASHSEED(0) to HASHSEED(HASHSEED_MAX - 1), the first
+ * one is the standard FNV offset basis.
+ */
+#ifndef HOST_HASHSEED_INCLUDE_FILE
+#define HOST_HASHSEED_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "hash.h"
+
+#define HASHSEED_MAX 4096
+#define HASHSEED(n) (HASH_FNV_OFFSET + (n) * (unsigned int)HASH_FNV_PRIME)
+
+/**
+ * Names that are looked up in the same table and need unique hashes.
+ */
+struct hashseed_set {
+  char **names;
+  int count;
+};
+
+/**
+ * Find a seed that gives every name of a set a unique hash. Names of
+ * different sets may share a hash.
+ *
+ * @param sets
+ * @param set_count
+ * @param seed set to the seed found
+ * @return false if none of the seeds works
+ */
+bool hashseed_find(const struct hashseed_set *sets, int set_count,
+                   unsigned int *seed);
+
+#endif // HOST_HASHSEED_INCLUDE_FILE
@@ -0,0 +1,557 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Choose the code that goes to ITCM from a PC sample profile.
+ *
+ * Code in ITCM runs without wait states and never misses the instruction
+ * cache, but there is only room for about 31 kB of it. This tool maps the
+ * samples of a profile to the code input sections in the link map of the
+ * build that was profiled, then picks the set of sections with the most
+ * samples that fits (a 0/1 knapsack on samples, sizes rounded up to 4
+ * bytes). The time a section saves in ITCM is taken to be proportional to
+ * its samples, so the samples per byte decide. Compile with
+ * -ffunction-sections so every function is an input section of its own.
+ *
+ * The profile is a text file with one sample per line: the PC in hex and
+ * optionally a count, from an emulator or any other sampler. Samples in the
+ * firmware are matched to the function symbols of symbols.txt. They can't be
+ * moved but are listed, since they show how much time the patch code can
+ * win at all.
+ *
+ * The result is written as a linker script fragment, one input section per
+ * line, to be included in the ITCM output section (see src/tcm/link.ld).
+ * Sections in ITCM that the previous fragment didn't place there are fixed
+ * and their size is taken from the room. Sections the previous fragment
+ * placed are candidates like all others. The ITCM bounds are the ITCM_START
+ * and ITCM_END symbols of the linker script, as the map lists them.
+ *
+ * Usage: hotplace <profile> <link map> <symbols.txt> <fragment> [ITCM bytes]
+ */
+
+#define MAX_LINE 1024
+#define TOP_FIRMWARE 10
+
+// symbols.txt has no function sizes, samples further than this from the
+// function before them count as unknown
+#define MAX_FUNCTION_SIZE 0x1000
+
+struct code_section {
+  char *name;
+  char *file;
+  unsigned int start;
+  unsigned int size;
+  unsigned long long samples;
+  // placed by the previous fragment
+  bool was_hot;
+  bool chosen;
+};
+
+struct firmware_function {
+  char *name;
+  unsigned int start;
+  unsigned long long samples;
+};
+
+struct code_map {
+  int count;
+  struct code_section *sections;
+  // ITCM_START and ITCM_END of the linker script, 0 if not in the map
+  unsigned int itcm_start;
+  unsigned int itcm_end;
+};
+
+struct firmware {
+  int count;
+  struct firmware_function *functions;
+};
+
+int compare_sections(const void *a, const void *b)
+{
+  const struct code_section *x = a;
+  const struct code_section *y = b;
+
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+int compare_functions(const void *a, const void *b)
+{
+  const struct firmware_function *x = a;
+  const struct firmware_function *y = b;
+
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+int compare_samples(const void *a, const void *b)
+{
+  const struct firmware_function *x = a;
+  const struct firmware_function *y = b;
+
+  return x->samples > y->samples ? -1 : x->samples < y->samples;
+}
+
+void add_section(struct code_map *m, const char *name, unsigned int start,
+                 unsigned int size, const char *file)
+{
+  m->sections = realloc(m->sections, (m->count + 1) * sizeof *m->sections);
+  m->sections[m->count++] = (struct code_section) {
+    .name = strdup(name),
+    .file = strdup(file),
+    .start = start,
+    .size = size
+  };
+}
+
+bool in_itcm(const struct code_map *m, unsigned int address)
+{
+  return address >= m->itcm_start && address < m->itcm_end;
+}
+
+/*
+ * Read the .text input sections and the ITCM bounds from the memory map part
+ * of a GNU ld map file:
+ *
+ *                  0x01ff8620                ITCM_START = 0x1ff8620
+ *   .text.foo      0x02026588       0x20 src/tcm.o
+ *   .text.a_very_long_section_name
+ *                  0x020265a8       0x20 src/tcm.o
+ */
+bool read_map(struct code_map *m, const char *path)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+  char name[MAX_LINE] = "";
+  bool memory_map = false;
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    char word[MAX_LINE];
+    char file[MAX_LINE];
+    unsigned int start;
+    unsigned int size;
+
+    if (!memory_map) {
+      memory_map = strncmp(line, "Linker script and memory map", 28) == 0;
+      continue;
+    }
+
+    if (sscanf(line, "%x %s %s", &start, word, file) == 3 &&
+        strcmp(file, "=") == 0) {
+      if (strcmp(word, "ITCM_START") == 0) {
+        m->itcm_start = start;
+      } else if (strcmp(word, "ITCM_END") == 0) {
+        m->itcm_end = start;
+      }
+
+      continue;
+    }
+
+    if (line[0] == ' ' && line[1] == '.') {
+      if (sscanf(line, "%s %x %x %s", word, &start, &size, file) == 4) {
+        if (strncmp(word, ".text", 5) == 0 && size > 0) {
+          add_section(m, word, start, size, file);
+        }
+
+        name[0] = '\0';
+      } else if (sscanf(line, "%s", name) != 1) {
+        name[0] = '\0';
+      }
+    } else if (name[0] != '\0') {
+      if (sscanf(line, "%x %x %s", &start, &size, file) == 3 &&
+          strncmp(name, ".text", 5) == 0 && size > 0) {
+        add_section(m, name, start, size, file);
+      }
+
+      name[0] = '\0';
+    }
+  }
+
+  fclose(f);
+
+  if (m->count == 0) {
+    fprintf(stderr, "%s: no code sections, is it a GNU ld map?\n", path);
+    return false;
+  }
+
+  if (m->itcm_end <= m->itcm_start) {
+    fprintf(stderr, "%s: no ITCM_START and ITCM_END, see src/tcm/link.ld\n",
+            path);
+    return false;
+  }
+
+  qsort(m->sections, m->count, sizeof *m->sections, compare_sections);
+
+  return true;
+}
+
+/*
+ * symbols.txt lines look like: ndk_mutex_init=0x02006e2c,function,global
+ */
+bool read_symbols(struct firmware *fw, const char *path)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    char *eq = strchr(line, '=');
+
+    if (line[0] == '#' || eq == NULL || strstr(eq, ",function") == NULL) {
+      continue;
+    }
+
+    *eq = '\0';
+    fw->functions = realloc(fw->functions,
+                            (fw->count + 1) * sizeof *fw->functions);
+    fw->functions[fw->count++] = (struct firmware_function) {
+      .name = strdup(line),
+      .start = strtoul(eq + 1, NULL, 16)
+    };
+  }
+
+  fclose(f);
+
+  qsort(fw->functions, fw->count, sizeof *fw->functions, compare_functions);
+
+  return true;
+}
+
+struct code_section *find_section(struct code_map *m, unsigned int pc)
+{
+  int lo = 0;
+  int hi = m->count - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    struct code_section *s = &m->sections[mid];
+
+    if (pc < s->start) {
+      hi = mid - 1;
+    } else if (pc >= s->start + s->size) {
+      lo = mid + 1;
+    } else {
+      return s;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * The function at or before pc, NULL if that's more than MAX_FUNCTION_SIZE
+ * before pc.
+ */
+struct firmware_function *find_function(struct firmware *fw, unsigned int pc)
+{
+  int lo = 0;
+  int hi = fw->count - 1;
+  struct firmware_function *best = NULL;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if (fw->functions[mid].start <= pc) {
+      best = &fw->functions[mid];
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  return best != NULL && pc - best->start < MAX_FUNCTION_SIZE ? best : NULL;
+}
+
+/*
+ * @return number of samples, -1 on failure
+ */
+long long read_profile(struct code_map *m, struct firmware *fw,
+                       const char *path, unsigned long long *unknown)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  char line[MAX_LINE];
+  long long total = 0;
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    unsigned int pc;
+    unsigned long long count = 1;
+
+    if (line[0] == '#' || sscanf(line, "%x %llu", &pc, &count) < 1) {
+      continue;
+    }
+
+    // Thumb code has bit 0 set in some samplers
+    pc &= ~1;
+    total += count;
+
+    struct code_section *s = find_section(m, pc);
+    struct firmware_function *fn;
+
+    if (s != NULL) {
+      s->samples += count;
+    } else if ((fn = find_function(fw, pc)) != NULL) {
+      fn->samples += count;
+    } else {
+      *unknown += count;
+    }
+  }
+
+  fclose(f);
+
+  return total;
+}
+
+/*
+ * Linker script input section description of a section, the file as the
+ * linker was given it. Archive members are listed as archive(member) in the
+ * map.
+ */
+void input_spec(const struct code_section *s, char *out, size_t size)
+{
+  const char *member = strchr(s->file, '(');
+
+  if (member != NULL && member[strlen(member) - 1] == ')') {
+    const char *archive = s->file;
+
+    for (const char *p = s->file; p < member; p++) {
+      if (*p == '/') {
+        archive = p + 1;
+      }
+    }
+
+    snprintf(out, size, "*%.*s:%.*s(%s)", (int)(member - archive), archive,
+             (int)strlen(member) - 2, member + 1, s->name);
+  } else {
+    snprintf(out, size, "%s(%s)", s->file, s->name);
+  }
+}
+
+/*
+ * Mark the sections listed in the fragment of the previous run. A missing
+ * fragment is the same as an empty one.
+ */
+void read_fragment(struct code_map *m, const char *path)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    return;
+  }
+
+  char line[MAX_LINE];
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    char spec[MAX_LINE];
+    char word[MAX_LINE];
+
+    if (sscanf(line, "%s", word) != 1 || word[0] == '/') {
+      continue;
+    }
+
+    for (int i = 0; i < m->count; i++) {
+      input_spec(&m->sections[i], spec, sizeof spec);
+
+      if (strcmp(spec, word) == 0) {
+        m->sections[i].was_hot = true;
+      }
+    }
+  }
+
+  fclose(f);
+}
+
+/*
+ * 0/1 knapsack over the candidates with samples, in 4 byte units.
+ *
+ * @return bytes chosen
+ */
+unsigned int choose(struct code_map *m, unsigned int room)
+{
+  int units = room / 4;
+  int *items = malloc(m->count * sizeof *items);
+  int n = 0;
+
+  for (int i = 0; i < m->count; i++) {
+    struct code_section *s = &m->sections[i];
+    if (s->samples > 0 && (s->was_hot || !in_itcm(m, s->start)) &&
+        (s->size + 3) / 4 <= units) {
+      items[n++] = i;
+    }
+  }
+
+  unsigned long long *best = calloc(units + 1, sizeof *best);
+  unsigned char *taken = calloc((size_t)n * (units + 1), 1);
+
+  for (int k = 0; k < n; k++) {
+    const struct code_section *s = &m->sections[items[k]];
+    int w = (s->size + 3) / 4;
+
+    for (int u = units; u >= w; u--) {
+      if (best[u - w] + s->samples > best[u]) {
+        best[u] = best[u - w] + s->samples;
+        taken[(size_t)k * (units + 1) + u] = 1;
+      }
+    }
+  }
+
+  unsigned int bytes = 0;
+
+  for (int k = n - 1, u = units; k >= 0; k--) {
+    if (taken[(size_t)k * (units + 1) + u]) {
+      struct code_section *s = &m->sections[items[k]];
+
+      s->chosen = true;
+      bytes += (s->size + 3) & ~3;
+      u -= (s->size + 3) / 4;
+    }
+  }
+
+  free(items);
+  free(best);
+  free(taken);
+
+  return bytes;
+}
+
+bool write_fragment(const struct code_map *m, const char *path,
+                    const char *profile_path)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "/* Generated by hotplace from %s, do not edit */\n",
+          profile_path);
+
+  for (int i = 0; i < m->count; i++) {
+    char spec[MAX_LINE];
+
+    if (m->sections[i].chosen) {
+      input_spec(&m->sections[i], spec, sizeof spec);
+      fprintf(f, "%s\n", spec);
+    }
+  }
+
+  return fclose(f) == 0;
+}
+
+double percent(unsigned long long part, long long total)
+{
+  return total > 0 ? part * 100.0 / total : 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 5 && argc != 6) {
+    printf("Usage: hotplace <profile> <link map> <symbols.txt> <fragment> "
+           "[ITCM bytes]\n");
+    return 1;
+  }
+
+  struct code_map m = { 0 };
+  struct firmware fw = { 0 };
+  unsigned long long unknown = 0;
+
+  if (!read_map(&m, argv[2]) || !read_symbols(&fw, argv[3])) {
+    return 1;
+  }
+
+  unsigned int itcm_size = argc == 6 ? strtoul(argv[5], NULL, 0)
+                                     : m.itcm_end - m.itcm_start;
+
+  long long total = read_profile(&m, &fw, argv[1], &unknown);
+
+  if (total < 0) {
+    return 1;
+  }
+
+  if (total == 0) {
+    fprintf(stderr, "%s: no samples\n", argv[1]);
+    return 1;
+  }
+
+  read_fragment(&m, argv[4]);
+
+  unsigned int fixed = 0;
+  unsigned long long own = 0;
+
+  for (int i = 0; i < m.count; i++) {
+    const struct code_section *s = &m.sections[i];
+
+    if (in_itcm(&m, s->start) && !s->was_hot) {
+      fixed += (s->size + 3) & ~3;
+    }
+
+    own += s->samples;
+  }
+
+  unsigned int room = fixed < itcm_size ? itcm_size - fixed : 0;
+  unsigned int bytes = choose(&m, room);
+  unsigned long long hot = 0;
+
+  printf("%lld samples: %.1f%% patch code, %.1f%% firmware, %.1f%% "
+         "unknown\n", total, percent(own, total),
+         percent(total - own - unknown, total), percent(unknown, total));
+  printf("ITCM %u bytes, %u fixed, %u of %u left chosen\n\n", itcm_size,
+         fixed, bytes, room);
+
+  printf("%-40s %-20s %6s %8s %6s\n", "ITCM", "file", "bytes", "samples",
+         "%");
+
+  for (int i = 0; i < m.count; i++) {
+    const struct code_section *s = &m.sections[i];
+
+    if (s->chosen) {
+      printf("%-40s %-20s %6u %8llu %6.1f\n", s->name, s->file, s->size,
+             s->samples, percent(s->samples, total));
+      hot += s->samples;
+    }
+  }
+
+  printf("%.1f%% of the samples are in the chosen code\n",
+         percent(hot, total));
+
+  int left = 0;
+
+  for (int i = 0; i < m.count; i++) {
+    left += m.sections[i].samples > 0 && !m.sections[i].chosen &&
+            (!in_itcm(&m, m.sections[i].start) || m.sections[i].was_hot);
+  }
+
+  if (left > 0) {
+    printf("%d sampled sections didn't fit\n", left);
+  }
+
+  qsort(fw.functions, fw.count, sizeof *fw.functions, compare_samples);
+
+  printf("\n%-40s %8s %6s\n", "firmware (can't be moved)", "samples", "%");
+
+  for (int i = 0; i < fw.count && i < TOP_FIRMWARE; i++) {
+    if (fw.functions[i].samples > 0) {
+      printf("%-40s %8llu %6.1f\n", fw.functions[i].name,
+             fw.functions[i].samples, percent(fw.functions[i].samples, total));
+    }
+  }
+
+  return write_fragment(&m, argv[4], argv[1]) ? 0 : 1;
+}
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ndsrom.h"
+#include "tracedump.h"
+
+#include "io_trace.h"
+
+/*
+ * Report on a dump made by io_trace_dump (see src/util/io_trace.h).
+ *
+ * The ROM reads in the dump are mapped to files with the FAT of the ROM the
+ * trace was made with. Prints the totals, the slowest files and how the reads
+ * are spread over the ROM. Files are then listed in the order they were first
+ * read. Placing them in that order in the ROM turns a load into fewer and
+ * longer sequential reads. With an order file argument the list is written
+ * there, one path and its number of reads per line, as input for
+ * src/host/romlayout.
+ *
+ * Usage: iotrace <dump file> <ROM file> [order file]
+ */
+
+#define TOP_FILES 10
+
+struct trace {
+  struct io_trace_header hdr;
+  struct io_trace_file_stats *files;
+  struct io_trace_record *records;
+  char *data;
+};
+
+struct file_info {
+  const char *path;
+  unsigned int start;
+  unsigned int end;
+  unsigned long long cycles;
+  unsigned int requests;
+  unsigned int bytes;
+  unsigned int cpu_requests;
+  // index of the first read, -1 if never read
+  int first_read;
+};
+
+struct rom_files {
+  int count;
+  struct file_info *files;
+  // FAT ids sorted on start offset
+  int *by_offset;
+};
+
+bool load_trace(const char *path, struct trace *t)
+{
+  static const struct tracedump_format format = {
+    "io_trace", IO_TRACE_MAGIC, IO_TRACE_VERSION,
+    sizeof(struct io_trace_header),
+    { sizeof(struct io_trace_file_stats), sizeof(struct io_trace_record) }
+  };
+  void *tables[2];
+
+  t->data = tracedump_load(path, &format, &t->hdr, tables);
+
+  if (t->data == NULL) {
+    return false;
+  }
+
+  t->files = tables[0];
+  t->records = tables[1];
+
+  return true;
+}
+
+bool set_path(const char *path, int fat_id, void *arg)
+{
+  struct rom_files *rf = arg;
+
+  if (fat_id < rf->count) {
+    rf->files[fat_id].path = strdup(path);
+  }
+
+  return true;
+}
+
+static const struct rom_files *sort_files;
+
+int compare_start(const void *a, const void *b)
+{
+  unsigned int x = sort_files->files[*(const int *)a].start;
+  unsigned int y = sort_files->files[*(const int *)b].start;
+
+  return x < y ? -1 : x > y;
+}
+
+bool load_rom_files(const char *path, struct rom_files *rf)
+{
+  struct ndsrom rom;
+
+  if (!ndsrom_open(&rom, path, false)) {
+    return false;
+  }
+
+  rf->count = rom.file_count;
+  rf->files = calloc(rf->count, sizeof *rf->files);
+  rf->by_offset = malloc(rf->count * sizeof(int) + 1);
+
+  for (int i = 0; i < rf->count; i++) {
+    rf->files[i].start = rom.fat[i].start;
+    rf->files[i].end = rom.fat[i].end;
+    rf->files[i].first_read = -1;
+    rf->by_offset[i] = i;
+  }
+
+  ndsrom_walk_files(&rom, &set_path, rf);
+  ndsrom_close(&rom);
+
+  // Overlays have no names
+  for (int i = 0; i < rf->count; i++) {
+    if (rf->files[i].path == NULL) {
+      char name[32];
+
+      snprintf(name, sizeof name, "#%d", i);
+      rf->files[i].path = strdup(name);
+    }
+  }
+
+  sort_files = rf;
+  qsort(rf->by_offset, rf->count, sizeof(int), &compare_start);
+
+  return true;
+}
+
+/*
+ * @return the FAT id of the file that holds offset or -1
+ */
+int find_file(const struct rom_files *rf, unsigned int offset)
+{
+  int lo = 0;
+  int hi = rf->count - 1;
+  int found = -1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if (rf->files[rf->by_offset[mid]].start <= offset) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  if (found < 0) {
+    return -1;
+  }
+
+  int id = rf->by_offset[found];
+
+  return offset < rf->files[id].end ? id : -1;
+}
+
+double cycles_to_ms(const struct trace *t, unsigned long long cycles)
+{
+  return cycles * 1000.0 / t->hdr.clock;
+}
+
+void print_summary(const struct trace *t)
+{
+  const struct io_trace_summary *s = &t->hdr.summary;
+
+  printf("requests %u, %u bytes in %.2f ms, %.1f kB/s, %u%% of bytes on the "
+         "DMA path\n", s->requests, s->bytes, cycles_to_ms(t, s->cycles),
+         s->bytes_per_second / 1024.0, s->dma_percent);
+
+  if (t->hdr.overwritten > 0) {
+    printf("NOTE: %u records were overwritten, the report only covers the "
+           "last %d\n", t->hdr.overwritten, t->hdr.record_count);
+  }
+}
+
+int compare_cycles(const void *a, const void *b)
+{
+  const struct file_info *x = &sort_files->files[*(const int *)a];
+  const struct file_info *y = &sort_files->files[*(const int *)b];
+
+  return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : 0;
+}
+
+int compare_first_read(const void *a, const void *b)
+{
+  const struct file_info *x = &sort_files->files[*(const int *)a];
+  const struct file_info *y = &sort_files->files[*(const int *)b];
+
+  return x->first_read - y->first_read;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3 && argc != 4) {
+    printf("Usage: iotrace <dump file> <ROM file> [order file]\n");
+    return 1;
+  }
+
+  struct trace t;
+  struct rom_files rf;
+
+  if (!load_trace(argv[1], &t) || !load_rom_files(argv[2], &rf)) {
+    return 1;
+  }
+
+  print_summary(&t);
+
+  int reads = 0;
+  int discontinuous = 0;
+  int unmapped = 0;
+  unsigned int prev_end = 0;
+
+  for (int i = 0; i < t.hdr.record_count; i++) {
+    const struct io_trace_record *r = &t.records[i];
+
+    if (r->type != IO_TRACE_ROM && r->type != IO_TRACE_CART) {
+      continue;
+    }
+
+    if (reads > 0 && r->rom_offset != prev_end) {
+      discontinuous++;
+    }
+
+    prev_end = r->rom_offset + r->size;
+
+    int id = find_file(&rf, r->rom_offset);
+
+    if (id < 0) {
+      unmapped++;
+      reads++;
+      continue;
+    }
+
+    struct file_info *f = &rf.files[id];
+
+    if (f->first_read < 0) {
+      f->first_read = reads;
+    }
+
+    f->cycles += r->cycles;
+    f->requests++;
+    f->bytes += r->size;
+
+    if (!(r->flags & IO_TRACE_FLAG_DMA)) {
+      f->cpu_requests++;
+    }
+
+    reads++;
+  }
+
+  printf("%d ROM reads, %d start away from where the previous one ended, "
+         "%d outside any file (FAT, FNT)\n\n", reads, discontinuous, unmapped);
+
+  int used = 0;
+  int *order = malloc(rf.count * sizeof(int) + 1);
+
+  for (int i = 0; i < rf.count; i++) {
+    if (rf.files[i].first_read >= 0) {
+      order[used++] = i;
+    }
+  }
+
+  sort_files = &rf;
+  qsort(order, used, sizeof(int), &compare_cycles);
+
+  printf("%-40s %8s %8s %10s %6s\n", "slowest files", "ms", "reads", "bytes",
+         "cpu");
+
+  for (int i = 0; i < used && i < TOP_FILES; i++) {
+    const struct file_info *f = &rf.files[order[i]];
+
+    printf("%-40s %8.2f %8u %10u %6u\n", f->path, cycles_to_ms(&t, f->cycles),
+           f->requests, f->bytes, f->cpu_requests);
+  }
+
+  qsort(order, used, sizeof(int), &compare_first_read);
+
+  printf("\nsuggested order (first read):\n");
+
+  int moves = 0;
+
+  for (int i = 0; i < used; i++) {
+    const struct file_info *f = &rf.files[order[i]];
+    bool follows = i > 0 &&
+                   f->start == NDSROM_ALIGN_UP(rf.files[order[i - 1]].end);
+
+    bool moved = i > 0 && !follows;
+
+    moves += moved;
+    printf("  %-40s 0x%08x%s\n", f->path, f->start, moved ? " *" : "");
+  }
+
+  printf("%d of %d files don't follow the previous one in ROM (*)\n", moves,
+         used);
+
+  if (argc == 4) {
+    FILE *out = fopen(argv[3], "w");
+
+    if (out == NULL) {
+      perror(argv[3]);
+      return 1;
+    }
+
+    for (int i = 0; i < used; i++) {
+      fprintf(out, "%s\t%u\n", rf.files[order[i]].path,
+              rf.files[order[i]].requests);
+    }
+
+    fclose(out);
+  }
+
+  return 0;
+}
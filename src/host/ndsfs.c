@@ -0,0 +1,566 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "ndsrom.h"
+
+/*
+ * Inspect the file system of a built ROM.
+ *
+ * Commands:
+ *  info     header, ROM sections, overlay tables and banner title
+ *  ls       every file with its FAT id, ROM offset, size and path
+ *  extract  write all files, or the given paths, below a directory
+ *  verify   check FAT, FNT, overlay tables and CRCs. Exits with 1 on any
+ *           problem so it can run in a build.
+ *  align    how many files a whole-file read can load on the DMA path (see
+ *           file.h)
+ *  du       total size and number of files of every directory
+ *
+ * Files without a name (overlays) are shown as #<FAT id>, like in the order
+ * files of src/host/iotrace. extract writes them to overlay/.
+ *
+ * Usage: ndsfs <command> <ROM file> [extract: <dir> [path...]]
+ */
+
+struct names {
+  int count;
+  // NULL for files that are not in the FNT
+  char **paths;
+  int duplicates;
+};
+
+struct dir_size {
+  char *path;
+  unsigned long long bytes;
+  int files;
+};
+
+bool set_name(const char *path, int fat_id, void *arg)
+{
+  struct names *n = arg;
+
+  if (fat_id >= n->count) {
+    fprintf(stderr, "%s: FAT id %d outside the FAT\n", path, fat_id);
+    n->duplicates++;
+    return true;
+  }
+
+  if (n->paths[fat_id] != NULL) {
+    n->duplicates++;
+    return true;
+  }
+
+  n->paths[fat_id] = strdup(path);
+
+  return true;
+}
+
+bool load_names(const struct ndsrom *rom, struct names *n)
+{
+  n->count = rom->file_count;
+  n->paths = calloc(n->count + 1, sizeof(char *));
+  n->duplicates = 0;
+
+  return ndsrom_walk_files(rom, &set_name, n);
+}
+
+const char *file_name(const struct names *n, int fat_id, char *buffer,
+                      size_t size)
+{
+  if (n->paths[fat_id] != NULL) {
+    return n->paths[fat_id];
+  }
+
+  snprintf(buffer, size, "#%d", fat_id);
+
+  return buffer;
+}
+
+void print_title(const struct ndsrom_banner *banner)
+{
+  // English, non ASCII characters as '?'
+  const uint16_t *title = banner->title[1];
+
+  for (int i = 0; i < NDSROM_BANNER_TITLE_LENGTH && title[i] != 0; i++) {
+    putchar(title[i] == '\n' ? ' ' : title[i] < 0x80 ? title[i] : '?');
+  }
+}
+
+void print_overlays(const struct ndsrom *rom, bool arm7)
+{
+  int count;
+  const struct overlay_info *ovt = ndsrom_overlays(rom, arm7, &count);
+
+  for (int i = 0; i < count; i++) {
+    const struct overlay_info *o = &ovt[i];
+
+    printf("  overlay%d %4d: ram 0x%08x size 0x%06x bss 0x%06x #%d%s\n",
+           arm7 ? 7 : 9, o->overlay_id, o->ram_address, o->ram_size,
+           o->bss_size, o->fat_id, (o->flags & 1) ? " compressed" : "");
+  }
+}
+
+int cmd_info(const struct ndsrom *rom)
+{
+  const struct ndsrom_header *h = rom->header;
+  int arm9_overlays;
+  int arm7_overlays;
+  uint32_t banner_size;
+  const struct ndsrom_banner *banner = ndsrom_banner(rom, &banner_size);
+
+  ndsrom_overlays(rom, false, &arm9_overlays);
+  ndsrom_overlays(rom, true, &arm7_overlays);
+
+  printf("title     %.12s\n", h->title);
+  printf("game code %.4s, maker %.2s, unit 0x%02x, version %d\n",
+         h->game_code, h->maker_code, h->unit_code, h->version);
+  printf("size      0x%08x used, 0x%08zx image, chip %d MB\n", h->rom_size,
+         rom->size, (0x20000 << h->capacity) >> 20);
+
+  if (banner != NULL) {
+    printf("banner    0x%08x version 0x%x \"", h->icon_offset, banner->version);
+    print_title(banner);
+    printf("\"\n");
+  }
+
+  printf("\n%-10s %10s %10s %10s\n", "section", "offset", "size", "ram");
+  printf("%-10s 0x%08x 0x%08x 0x%08x\n", "arm9", h->arm9_rom_offset,
+         h->arm9_size, h->arm9_ram_address);
+  printf("%-10s 0x%08x 0x%08x 0x%08x\n", "arm7", h->arm7_rom_offset,
+         h->arm7_size, h->arm7_ram_address);
+  printf("%-10s 0x%08x 0x%08x\n", "fnt", h->fnt_offset, h->fnt_size);
+  printf("%-10s 0x%08x 0x%08x %d files\n", "fat", h->fat_offset, h->fat_size,
+         rom->file_count);
+  printf("%-10s 0x%08x 0x%08x %d overlays\n", "ovt9", h->arm9_overlay_offset,
+         h->arm9_overlay_size, arm9_overlays);
+  printf("%-10s 0x%08x 0x%08x %d overlays\n", "ovt7", h->arm7_overlay_offset,
+         h->arm7_overlay_size, arm7_overlays);
+
+  if (arm9_overlays + arm7_overlays > 0) {
+    printf("\noverlays:\n");
+    print_overlays(rom, false);
+    print_overlays(rom, true);
+  }
+
+  return 0;
+}
+
+int cmd_ls(const struct ndsrom *rom, const struct names *n)
+{
+  char buffer[32];
+
+  for (int i = 0; i < rom->file_count; i++) {
+    const struct ndsrom_fat_entry *f = &rom->fat[i];
+
+    printf("%5d 0x%08x %10u %s\n", i, f->start, f->end - f->start,
+           file_name(n, i, buffer, sizeof buffer));
+  }
+
+  return 0;
+}
+
+/*
+ * Create the directories of path. path is changed and restored.
+ */
+bool make_dirs(char *path)
+{
+  for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+    *p = '\0';
+
+    bool ok = mkdir(path, 0777) == 0 || errno == EEXIST;
+
+    *p = '/';
+
+    if (!ok) {
+      perror(path);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool extract_file(const struct ndsrom *rom, const struct names *n, int fat_id,
+                  const char *dir)
+{
+  char path[NDSROM_MAX_PATH * 2];
+  uint32_t size;
+  const void *data = ndsrom_file(rom, fat_id, &size);
+
+  if (data == NULL) {
+    fprintf(stderr, "#%d: outside the image\n", fat_id);
+    return false;
+  }
+
+  if (n->paths[fat_id] != NULL) {
+    snprintf(path, sizeof path, "%s/%s", dir, n->paths[fat_id]);
+  } else {
+    snprintf(path, sizeof path, "%s/overlay/%04d.bin", dir, fat_id);
+  }
+
+  if (!make_dirs(path)) {
+    return false;
+  }
+
+  FILE *f = fopen(path, "wb");
+
+  if (f == NULL || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+    perror(path);
+    return false;
+  }
+
+  return true;
+}
+
+int cmd_extract(const struct ndsrom *rom, const struct names *n, bool fnt_ok,
+                const char *dir, char **paths, int path_count)
+{
+  int failed = 0;
+
+  // Names like ".." would put files outside dir, see ndsrom_walk_files
+  if (!fnt_ok) {
+    fprintf(stderr, "%s: corrupt file name table, nothing extracted\n",
+            rom->path);
+    return 1;
+  }
+
+  if (path_count == 0) {
+    for (int i = 0; i < rom->file_count; i++) {
+      failed += !extract_file(rom, n, i, dir);
+    }
+  }
+
+  for (int i = 0; i < path_count; i++) {
+    int fat_id = paths[i][0] == '#' ? atoi(paths[i] + 1)
+                                    : ndsrom_find_file(rom, paths[i]);
+
+    if (fat_id < 0 || fat_id >= rom->file_count) {
+      fprintf(stderr, "%s: not in the ROM\n", paths[i]);
+      failed++;
+      continue;
+    }
+
+    failed += !extract_file(rom, n, fat_id, dir);
+  }
+
+  return failed > 0;
+}
+
+static const struct ndsrom *sort_rom;
+
+int compare_start(const void *a, const void *b)
+{
+  uint32_t x = sort_rom->fat[*(const int *)a].start;
+  uint32_t y = sort_rom->fat[*(const int *)b].start;
+
+  return x < y ? -1 : x > y;
+}
+
+int check_banner(const struct ndsrom *rom)
+{
+  static const uint32_t ranges[][2] = {
+    { 0x20, NDSROM_BANNER_SIZE_V1 },
+    { 0x20, NDSROM_BANNER_SIZE_V2 },
+    { 0x20, NDSROM_BANNER_SIZE_V3 },
+    { 0x1240, NDSROM_BANNER_SIZE_DSI }
+  };
+  uint32_t size;
+  const struct ndsrom_banner *banner = ndsrom_banner(rom, &size);
+  int problems = 0;
+
+  if (banner == NULL) {
+    return 0;
+  }
+
+  for (int i = 0; i < 4 && ranges[i][1] <= size; i++) {
+    const uint8_t *start = (const uint8_t *)banner + ranges[i][0];
+
+    if (ndsrom_crc16(start, ranges[i][1] - ranges[i][0]) != banner->crc[i]) {
+      printf("banner CRC %d is wrong\n", i);
+      problems++;
+    }
+  }
+
+  return problems;
+}
+
+int check_overlays(const struct ndsrom *rom, const struct names *n, bool arm7,
+                   bool *is_overlay)
+{
+  int count;
+  const struct overlay_info *ovt = ndsrom_overlays(rom, arm7, &count);
+  uint32_t offset = arm7 ? rom->header->arm7_overlay_offset
+                         : rom->header->arm9_overlay_offset;
+  uint32_t size = arm7 ? rom->header->arm7_overlay_size
+                       : rom->header->arm9_overlay_size;
+  int problems = 0;
+
+  if (size != 0 && ovt == NULL) {
+    printf("overlay%d table outside the image\n", arm7 ? 7 : 9);
+    return 1;
+  }
+
+  if (size % sizeof(struct overlay_info) != 0 || (offset & 3) != 0) {
+    printf("overlay%d table has a bad size or alignment\n", arm7 ? 7 : 9);
+    problems++;
+  }
+
+  for (int i = 0; i < count; i++) {
+    const struct overlay_info *o = &ovt[i];
+
+    if (o->overlay_id != i) {
+      printf("overlay%d %d: id is %d\n", arm7 ? 7 : 9, i, o->overlay_id);
+      problems++;
+    }
+
+    if (o->fat_id < 0 || o->fat_id >= rom->file_count) {
+      printf("overlay%d %d: FAT id %d outside the FAT\n", arm7 ? 7 : 9, i,
+             o->fat_id);
+      problems++;
+      continue;
+    }
+
+    if (n->paths[o->fat_id] != NULL || is_overlay[o->fat_id]) {
+      printf("overlay%d %d: #%d is used by another file\n", arm7 ? 7 : 9, i,
+             o->fat_id);
+      problems++;
+    }
+
+    is_overlay[o->fat_id] = true;
+  }
+
+  return problems;
+}
+
+int cmd_verify(const struct ndsrom *rom, const struct names *n, bool fnt_ok)
+{
+  const struct ndsrom_header *h = rom->header;
+  char buffer[32];
+  int problems = 0;
+  uint16_t crc;
+
+  if (rom->size >= NDSROM_HEADER_CRC_OFFSET + sizeof crc) {
+    memcpy(&crc, rom->data + NDSROM_HEADER_CRC_OFFSET, sizeof crc);
+  }
+
+  if (rom->size < NDSROM_HEADER_CRC_OFFSET + sizeof crc ||
+      ndsrom_crc16(rom->data, NDSROM_HEADER_CRC_OFFSET) != crc) {
+    printf("header CRC is wrong\n");
+    problems++;
+  }
+
+  if (h->rom_size > rom->size) {
+    printf("used size 0x%x is larger than the image\n", h->rom_size);
+    problems++;
+  }
+
+  if (!fnt_ok) {
+    printf("FNT is corrupt\n");
+    problems++;
+  }
+
+  if (n->duplicates > 0) {
+    printf("%d FNT entries with a FAT id that is used twice or invalid\n",
+           n->duplicates);
+    problems++;
+  }
+
+  int *by_start = malloc(rom->file_count * sizeof(int) + 1);
+  bool *is_overlay = calloc(rom->file_count + 1, sizeof(bool));
+  int valid = 0;
+
+  for (int i = 0; i < rom->file_count; i++) {
+    const struct ndsrom_fat_entry *f = &rom->fat[i];
+
+    if (f->end < f->start || f->end > rom->size) {
+      printf("%s: bad FAT entry 0x%08x-0x%08x\n",
+             file_name(n, i, buffer, sizeof buffer), f->start, f->end);
+      problems++;
+    } else if (f->end > f->start) {
+      by_start[valid++] = i;
+    }
+  }
+
+  // Sorting keeps this fast for ROMs with many thousands of files
+  sort_rom = rom;
+  qsort(by_start, valid, sizeof(int), &compare_start);
+
+  for (int i = 1; i < valid; i++) {
+    const struct ndsrom_fat_entry *prev = &rom->fat[by_start[i - 1]];
+
+    if (rom->fat[by_start[i]].start < prev->end) {
+      printf("%s overlaps ", file_name(n, by_start[i], buffer, sizeof buffer));
+      printf("%s\n", file_name(n, by_start[i - 1], buffer, sizeof buffer));
+      problems++;
+    }
+  }
+
+  problems += check_overlays(rom, n, false, is_overlay);
+  problems += check_overlays(rom, n, true, is_overlay);
+
+  int overlays = 0;
+
+  for (int i = 0; i < rom->file_count; i++) {
+    overlays += is_overlay[i];
+
+    if (n->paths[i] == NULL && !is_overlay[i]) {
+      printf("#%d has no name and isn't an overlay\n", i);
+      problems++;
+    }
+  }
+
+  problems += check_banner(rom);
+
+  printf("%d files, %d overlays, %d problems\n", rom->file_count, overlays,
+         problems);
+
+  return problems > 0;
+}
+
+int cmd_align(const struct ndsrom *rom)
+{
+  int aligned = 0;
+  int ready = 0;
+  int empty = 0;
+  unsigned long long bytes = 0;
+  unsigned long long ready_bytes = 0;
+  unsigned long long padding = 0;
+
+  for (int i = 0; i < rom->file_count; i++) {
+    const struct ndsrom_fat_entry *f = &rom->fat[i];
+    uint32_t size = f->end - f->start;
+
+    if (f->end <= f->start) {
+      empty++;
+      continue;
+    }
+
+    bytes += size;
+
+    if ((f->start & (NDSROM_ALIGN - 1)) != 0) {
+      continue;
+    }
+
+    aligned++;
+
+    if ((size & (NDSROM_ALIGN - 1)) == 0) {
+      ready++;
+      ready_bytes += size;
+    } else {
+      padding += NDSROM_ALIGN_UP(size) - size;
+    }
+  }
+
+  int files = rom->file_count - empty;
+
+  printf("%d files (%d empty), %llu bytes\n", files, empty, bytes);
+  printf("start at a 512 byte boundary: %d (%.1f%%)\n", aligned,
+         files > 0 ? aligned * 100.0 / files : 0.0);
+  printf("whole-file read on the DMA path: %d files, %llu bytes (%.1f%%)\n",
+         ready, ready_bytes, bytes > 0 ? ready_bytes * 100.0 / bytes : 0.0);
+  printf("padding to make the aligned files DMA ready: %llu bytes\n",
+         padding);
+
+  return 0;
+}
+
+int cmd_du(const struct ndsrom *rom, const struct names *n)
+{
+  int count = 1;
+  struct dir_size *dirs = calloc(rom->file_count + 1, sizeof *dirs);
+
+  dirs[0].path = "/";
+
+  for (int i = 0; i < rom->file_count; i++) {
+    const struct ndsrom_fat_entry *f = &rom->fat[i];
+    uint32_t size = f->end > f->start ? f->end - f->start : 0;
+    const char *path = n->paths[i];
+
+    dirs[0].bytes += size;
+    dirs[0].files++;
+
+    if (path == NULL) {
+      continue;
+    }
+
+    // Every directory of the path. Files of a directory are consecutive in
+    // the FNT, so the last matching entry is found first.
+    for (const char *p = strchr(path, '/'); p != NULL; p = strchr(p + 1, '/')) {
+      int len = p - path;
+      int d = count - 1;
+
+      while (d > 0 && (strncmp(dirs[d].path, path, len) != 0 ||
+                       dirs[d].path[len] != '\0')) {
+        d--;
+      }
+
+      if (d == 0) {
+        d = count++;
+        dirs[d].path = strndup(path, len);
+
+        if (count > rom->file_count) {
+          dirs = realloc(dirs, (count + 1) * sizeof *dirs);
+        }
+
+        dirs[d].bytes = 0;
+        dirs[d].files = 0;
+      }
+
+      dirs[d].bytes += size;
+      dirs[d].files++;
+    }
+  }
+
+  printf("%12s %6s %s\n", "bytes", "files", "directory");
+
+  for (int i = 0; i < count; i++) {
+    printf("%12llu %6d %s\n", dirs[i].bytes, dirs[i].files, dirs[i].path);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3 || (strcmp(argv[1], "extract") == 0 && argc < 4)) {
+    printf("Usage: ndsfs info|ls|verify|align|du <ROM file>\n"
+           "       ndsfs extract <ROM file> <dir> [path...]\n");
+    return 1;
+  }
+
+  const char *cmd = argv[1];
+  struct ndsrom rom;
+  struct names names;
+
+  if (!ndsrom_open(&rom, argv[2], false)) {
+    return 1;
+  }
+
+  bool fnt_ok = load_names(&rom, &names);
+  int result;
+
+  if (strcmp(cmd, "info") == 0) {
+    result = cmd_info(&rom);
+  } else if (strcmp(cmd, "ls") == 0) {
+    result = cmd_ls(&rom, &names);
+  } else if (strcmp(cmd, "extract") == 0) {
+    result = cmd_extract(&rom, &names, fnt_ok, argv[3], argv + 4,
+                         argc - 4);
+  } else if (strcmp(cmd, "verify") == 0) {
+    result = cmd_verify(&rom, &names, fnt_ok);
+  } else if (strcmp(cmd, "align") == 0) {
+    result = cmd_align(&rom);
+  } else if (strcmp(cmd, "du") == 0) {
+    result = cmd_du(&rom, &names);
+  } else {
+    fprintf(stderr, "unknown command: %s\n", cmd);
+    result = 1;
+  }
+
+  ndsrom_close(&rom);
+
+  return result;
+}
@@ -0,0 +1,347 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ndsrom.h"
+
+_Static_assert(sizeof(struct ndsrom_header) == 0x88, "ndsrom_header size");
+_Static_assert(sizeof(struct ndsrom_banner) == NDSROM_BANNER_SIZE_V1,
+               "ndsrom_banner size");
+_Static_assert(sizeof(struct overlay_info) == 0x20, "overlay_info size");
+
+// Directory ids in the FNT have the top four bits set
+#define FNT_DIR_ID_BASE 0xf000
+#define FNT_MAX_DEPTH 32
+
+struct find_arg {
+  const char *path;
+  int fat_id;
+};
+
+static bool ndsrom_walk_dir(const struct ndsrom *rom, int dir_id, char *path,
+                            int path_len, int depth, ndsrom_file_fn *fn,
+                            void *arg);
+static bool ndsrom_name_ok(const uint8_t *name, int len);
+static bool ndsrom_find_fn(const char *path, int fat_id, void *arg);
+
+
+bool ndsrom_open(struct ndsrom *rom, const char *path, bool writable)
+{
+  memset(rom, 0, sizeof *rom);
+  rom->path = path;
+  rom->writable = writable;
+
+  int fd = open(path, writable ? O_RDWR : O_RDONLY);
+
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct ndsrom_header)) {
+    fprintf(stderr, "%s: not a ROM image\n", path);
+    close(fd);
+    return false;
+  }
+
+  rom->size = st.st_size;
+  rom->data = mmap(NULL, rom->size, PROT_READ | (writable ? PROT_WRITE : 0),
+                   writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (rom->data == MAP_FAILED) {
+    perror(path);
+    rom->data = NULL;
+    return false;
+  }
+
+  rom->header = (const struct ndsrom_header *)rom->data;
+
+  const struct ndsrom_header *h = rom->header;
+
+  rom->fat = ndsrom_at(rom, h->fat_offset, h->fat_size);
+
+  if (rom->fat == NULL || ndsrom_at(rom, h->fnt_offset, h->fnt_size) == NULL) {
+    fprintf(stderr, "%s: FAT or FNT outside the image\n", path);
+    ndsrom_close(rom);
+    return false;
+  }
+
+  rom->file_count = h->fat_size / sizeof(struct ndsrom_fat_entry);
+
+  return true;
+}
+
+void ndsrom_close(struct ndsrom *rom)
+{
+  if (rom->data != NULL) {
+    munmap(rom->data, rom->size);
+  }
+
+  rom->data = NULL;
+}
+
+void *ndsrom_at(const struct ndsrom *rom, uint32_t offset, uint32_t size)
+{
+  if (offset > rom->size || size > rom->size - offset) {
+    return NULL;
+  }
+
+  return rom->data + offset;
+}
+
+bool ndsrom_walk_files(const struct ndsrom *rom, ndsrom_file_fn *fn,
+                       void *arg)
+{
+  char path[NDSROM_MAX_PATH];
+
+  path[0] = '\0';
+
+  return ndsrom_walk_dir(rom, FNT_DIR_ID_BASE, path, 0, 0, fn, arg);
+}
+
+int ndsrom_find_file(const struct ndsrom *rom, const char *path)
+{
+  struct find_arg find = { path[0] == '/' ? path + 1 : path, -1 };
+
+  ndsrom_walk_files(rom, &ndsrom_find_fn, &find);
+
+  return find.fat_id;
+}
+
+const void *ndsrom_file(const struct ndsrom *rom, int fat_id, uint32_t *size)
+{
+  if (fat_id < 0 || fat_id >= rom->file_count ||
+      rom->fat[fat_id].end < rom->fat[fat_id].start) {
+    return NULL;
+  }
+
+  *size = rom->fat[fat_id].end - rom->fat[fat_id].start;
+
+  return ndsrom_at(rom, rom->fat[fat_id].start, *size);
+}
+
+const struct overlay_info *ndsrom_overlays(const struct ndsrom *rom, bool arm7,
+                                           int *count)
+{
+  const struct ndsrom_header *h = rom->header;
+  uint32_t offset = arm7 ? h->arm7_overlay_offset : h->arm9_overlay_offset;
+  uint32_t size = arm7 ? h->arm7_overlay_size : h->arm9_overlay_size;
+
+  *count = 0;
+
+  if (offset == 0 || size == 0) {
+    return NULL;
+  }
+
+  const struct overlay_info *ovt = ndsrom_at(rom, offset, size);
+
+  if (ovt != NULL) {
+    *count = size / sizeof *ovt;
+  }
+
+  return ovt;
+}
+
+const struct ndsrom_banner *ndsrom_banner(const struct ndsrom *rom,
+                                          uint32_t *size)
+{
+  uint32_t offset = rom->header->icon_offset;
+  const struct ndsrom_banner *banner =
+                      ndsrom_at(rom, offset, sizeof(struct ndsrom_banner));
+
+  if (offset == 0 || banner == NULL) {
+    return NULL;
+  }
+
+  switch (banner->version) {
+    case 2:
+      *size = NDSROM_BANNER_SIZE_V2;
+      break;
+    case 3:
+      *size = NDSROM_BANNER_SIZE_V3;
+      break;
+    case 0x103:
+      *size = NDSROM_BANNER_SIZE_DSI;
+      break;
+    default:
+      *size = NDSROM_BANNER_SIZE_V1;
+      break;
+  }
+
+  // Fall back to the version 1 part if a newer banner is cut off
+  if (ndsrom_at(rom, offset, *size) == NULL) {
+    *size = NDSROM_BANNER_SIZE_V1;
+  }
+
+  return banner;
+}
+
+uint32_t ndsrom_fixed_end(const struct ndsrom *rom)
+{
+  const struct ndsrom_header *h = rom->header;
+  uint32_t ends[] = {
+    h->header_size,
+    h->arm9_rom_offset + h->arm9_size,
+    h->arm7_rom_offset + h->arm7_size,
+    h->fnt_offset + h->fnt_size,
+    h->fat_offset + h->fat_size,
+    h->arm9_overlay_offset + h->arm9_overlay_size,
+    h->arm7_overlay_offset + h->arm7_overlay_size,
+    0
+  };
+  uint32_t banner_size;
+
+  if (ndsrom_banner(rom, &banner_size) != NULL) {
+    ends[7] = h->icon_offset + banner_size;
+  }
+
+  uint32_t end = 0;
+
+  for (int i = 0; i < sizeof ends / sizeof ends[0]; i++) {
+    end = ends[i] > end ? ends[i] : end;
+  }
+
+  return end;
+}
+
+uint16_t ndsrom_crc16(const void *data, size_t size)
+{
+  const uint8_t *p = data;
+  uint16_t crc = 0xffff;
+
+  for (size_t i = 0; i < size; i++) {
+    crc ^= p[i];
+
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+  }
+
+  return crc;
+}
+
+void ndsrom_update_header_crc(uint8_t *header)
+{
+  uint16_t crc = ndsrom_crc16(header, NDSROM_HEADER_CRC_OFFSET);
+
+  memcpy(header + NDSROM_HEADER_CRC_OFFSET, &crc, sizeof crc);
+}
+
+/*
+ * The FNT starts with one 8 byte entry per directory: offset of its sub
+ * table (relative to the FNT), FAT id of its first file and parent id. A sub
+ * table is a list of names, each a length byte (bit 7 set for directories),
+ * the name and for directories a 16 bit directory id. A zero length byte ends
+ * the list. Files in a directory get consecutive FAT ids.
+ */
+bool ndsrom_walk_dir(const struct ndsrom *rom, int dir_id, char *path,
+                     int path_len, int depth, ndsrom_file_fn *fn, void *arg)
+{
+  const struct ndsrom_header *h = rom->header;
+  const uint8_t *fnt = rom->data + h->fnt_offset;
+  int index = dir_id - FNT_DIR_ID_BASE;
+
+  if (depth > FNT_MAX_DEPTH || (index + 1) * 8 > h->fnt_size) {
+    return false;
+  }
+
+  uint32_t sub_offset;
+  uint16_t fat_id;
+
+  memcpy(&sub_offset, fnt + index * 8, 4);
+  memcpy(&fat_id, fnt + index * 8 + 4, 2);
+
+  uint32_t pos = sub_offset;
+
+  for (;;) {
+    if (pos >= h->fnt_size) {
+      return false;
+    }
+
+    uint8_t len = fnt[pos++];
+
+    if (len == 0) {
+      return true;
+    }
+
+    int name_len = len & 0x7f;
+
+    if (pos + name_len > h->fnt_size ||
+        path_len + name_len + 2 > NDSROM_MAX_PATH ||
+        !ndsrom_name_ok(fnt + pos, name_len)) {
+      return false;
+    }
+
+    int len_before = path_len;
+
+    if (path_len > 0) {
+      path[path_len++] = '/';
+    }
+
+    memcpy(path + path_len, fnt + pos, name_len);
+    path_len += name_len;
+    path[path_len] = '\0';
+    pos += name_len;
+
+    if (len & 0x80) {
+      uint16_t sub_id;
+
+      if (pos + 2 > h->fnt_size) {
+        return false;
+      }
+
+      memcpy(&sub_id, fnt + pos, 2);
+      pos += 2;
+
+      if (!ndsrom_walk_dir(rom, sub_id, path, path_len, depth + 1, fn, arg)) {
+        return false;
+      }
+    } else {
+      if (!fn(path, fat_id++, arg)) {
+        return false;
+      }
+    }
+
+    path_len = len_before;
+    path[path_len] = '\0';
+  }
+}
+
+/*
+ * A name must be a single path component so a path built from the FNT can't
+ * point outside the directory it's extracted to.
+ */
+bool ndsrom_name_ok(const uint8_t *name, int len)
+{
+  if (len == 0 || (len == 1 && name[0] == '.') ||
+      (len == 2 && name[0] == '.' && name[1] == '.')) {
+    return false;
+  }
+
+  for (int i = 0; i < len; i++) {
+    if (name[i] == '/' || name[i] == '\\' || name[i] == '\0') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ndsrom_find_fn(const char *path, int fat_id, void *arg)
+{
+  struct find_arg *find = arg;
+
+  if (strcasecmp(path, find->path) == 0) {
+    find->fat_id = fat_id;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,205 @@
+/**
+ * Read access to NDS ROM images on the host.
+ *
+ * The image is mapped into memory. Offsets are ROM offsets, the same offsets
+ * the cart read functions on the DS use.
+ *
+ * See https://problemkaputt.de/gbatek.htm#dscartridgeheader and
+ * https://problemkaputt.de/gbatek.htm#dscartridgenitroromandnitroarcfilesystems
+ */
+#ifndef HOST_NDSROM_INCLUDE_FILE
+#define HOST_NDSROM_INCLUDE_FILE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "overlay.h"
+
+#define NDSROM_MAX_PATH 512
+
+// Files are placed at multiples of this by ndstool
+#define NDSROM_ALIGN 0x200
+#define NDSROM_ALIGN_UP(x) (((x) + NDSROM_ALIGN - 1) & ~(NDSROM_ALIGN - 1))
+
+// CRC16 of header bytes 0x000-0x15d
+#define NDSROM_HEADER_CRC_OFFSET 0x15e
+
+struct ndsrom_header {
+  char title[12];                   // 0x000
+  char game_code[4];                // 0x00c
+  char maker_code[2];               // 0x010
+  uint8_t unit_code;                // 0x012
+  uint8_t seed_select;              // 0x013
+  uint8_t capacity;                 // 0x014
+  uint8_t reserved[7];              // 0x015
+  uint8_t reserved2;                // 0x01c
+  uint8_t region;                   // 0x01d
+  uint8_t version;                  // 0x01e
+  uint8_t autostart;                // 0x01f
+  uint32_t arm9_rom_offset;         // 0x020
+  uint32_t arm9_entry;              // 0x024
+  uint32_t arm9_ram_address;        // 0x028
+  uint32_t arm9_size;               // 0x02c
+  uint32_t arm7_rom_offset;         // 0x030
+  uint32_t arm7_entry;              // 0x034
+  uint32_t arm7_ram_address;        // 0x038
+  uint32_t arm7_size;               // 0x03c
+  uint32_t fnt_offset;              // 0x040
+  uint32_t fnt_size;                // 0x044
+  uint32_t fat_offset;              // 0x048
+  uint32_t fat_size;                // 0x04c
+  uint32_t arm9_overlay_offset;     // 0x050
+  uint32_t arm9_overlay_size;       // 0x054
+  uint32_t arm7_overlay_offset;     // 0x058
+  uint32_t arm7_overlay_size;       // 0x05c
+  uint32_t port_normal;             // 0x060
+  uint32_t port_key1;               // 0x064
+  uint32_t icon_offset;             // 0x068
+  uint16_t secure_crc;              // 0x06c
+  uint16_t secure_delay;            // 0x06e
+  uint32_t arm9_autoload;           // 0x070
+  uint32_t arm7_autoload;           // 0x074
+  uint8_t secure_disable[8];        // 0x078
+  uint32_t rom_size;                // 0x080 used size
+  uint32_t header_size;             // 0x084
+  // 0x088
+};
+
+struct ndsrom_fat_entry {
+  uint32_t start;
+  uint32_t end;
+};
+
+// Banner sizes by version, see gbatek "DS Cartridge Icon/Title"
+#define NDSROM_BANNER_SIZE_V1 0x840
+#define NDSROM_BANNER_SIZE_V2 0x940
+#define NDSROM_BANNER_SIZE_V3 0xa40
+#define NDSROM_BANNER_SIZE_DSI 0x23c0
+
+#define NDSROM_BANNER_TITLES 6
+#define NDSROM_BANNER_TITLE_LENGTH 0x80
+
+/**
+ * Version 1 part of the banner. Versions 2 and 3 add Chinese and Korean
+ * titles after it.
+ */
+struct ndsrom_banner {
+  uint16_t version;                 // 0x000
+  // CRC16 of 0x020-0x83f, 0x020-0x93f, 0x020-0xa3f and 0x1240-0x23bf
+  uint16_t crc[4];                  // 0x002
+  uint8_t reserved[0x16];           // 0x00a
+  uint8_t icon[0x200];              // 0x020 4 bpp, 4x4 tiles
+  uint16_t palette[16];             // 0x220
+  // UTF-16: Japanese, English, French, German, Italian, Spanish
+  uint16_t title[NDSROM_BANNER_TITLES][NDSROM_BANNER_TITLE_LENGTH]; // 0x240
+  // 0x840
+};
+
+struct ndsrom {
+  const char *path;
+  uint8_t *data;
+  size_t size;
+  bool writable;
+  const struct ndsrom_header *header;
+  const struct ndsrom_fat_entry *fat;
+  int file_count;
+};
+
+/**
+ * Called for every file in the file name table.
+ *
+ * @param path full path without a leading '/'
+ * @param fat_id
+ * @param arg user argument
+ * @return false to stop the walk
+ */
+typedef bool ndsrom_file_fn(const char *path, int fat_id, void *arg);
+
+/**
+ * Map a ROM image.
+ *
+ * @param rom
+ * @param path
+ * @param writable map it shared and writable, changes go to the file
+ * @return false on failure, an error has been printed to stderr
+ */
+bool ndsrom_open(struct ndsrom *rom, const char *path, bool writable);
+
+void ndsrom_close(struct ndsrom *rom);
+
+/**
+ * Get a pointer into the image.
+ *
+ * @return NULL if [offset, offset + size) is outside the image
+ */
+void *ndsrom_at(const struct ndsrom *rom, uint32_t offset, uint32_t size);
+
+/**
+ * Walk the file name table. Files are visited in FNT order. A name that is
+ * empty, "." or "..", or contains '/', '\\' or a zero byte makes the FNT
+ * corrupt.
+ *
+ * @return false if the FNT is corrupt or fn stopped the walk
+ */
+bool ndsrom_walk_files(const struct ndsrom *rom, ndsrom_file_fn *fn,
+                       void *arg);
+
+/**
+ * Look up a file by path.
+ *
+ * @return FAT id or -1 if not found
+ */
+int ndsrom_find_file(const struct ndsrom *rom, const char *path);
+
+/**
+ * Get the data of a file.
+ *
+ * @param rom
+ * @param fat_id
+ * @param[out] size size of the file
+ * @return NULL if fat_id is invalid or the file is outside the image
+ */
+const void *ndsrom_file(const struct ndsrom *rom, int fat_id, uint32_t *size);
+
+/**
+ * Get the overlay table of one CPU.
+ *
+ * @param rom
+ * @param arm7 the ARM7 table, else the ARM9 table
+ * @param[out] count number of entries
+ * @return NULL if there is no table or it's outside the image
+ */
+const struct overlay_info *ndsrom_overlays(const struct ndsrom *rom, bool arm7,
+                                           int *count);
+
+/**
+ * Get the banner.
+ *
+ * @param rom
+ * @param[out] size size of the banner for its version
+ * @return NULL if the ROM has no banner or it's outside the image
+ */
+const struct ndsrom_banner *ndsrom_banner(const struct ndsrom *rom,
+                                          uint32_t *size);
+
+/**
+ * End of everything in the ROM that isn't file data in the FAT: header,
+ * binaries, FNT, FAT, overlay tables and banner. ndstool places overlays
+ * before this and the named files after it.
+ */
+uint32_t ndsrom_fixed_end(const struct ndsrom *rom);
+
+/**
+ * CRC16 as used in the ROM header (polynomial 0xa001, initial value 0xffff).
+ */
+uint16_t ndsrom_crc16(const void *data, size_t size);
+
+/**
+ * Recompute the header CRC after the header has been changed.
+ *
+ * @param header at least NDSROM_HEADER_CRC_OFFSET + 2 bytes
+ */
+void ndsrom_update_header_crc(uint8_t *header);
+
+#endif // HOST_NDSROM_INCLUDE_FILE
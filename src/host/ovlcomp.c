@@ -0,0 +1,415 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "overlay.h"
+
+/*
+ * Compress overlays and mark them compressed in the overlay table.
+ *
+ * ndk_overlay_init_in_ram decompresses an overlay with flags bit 0 set in
+ * place, from the end of the file backwards (ndk_decompress_firmware_lz).
+ * The format, known as BLZ, from the start of the file:
+ *  - a part that is stored as is
+ *  - LZ data of the rest of the overlay, stored back to front
+ *  - 0xff padding to a multiple of 4
+ *  - u32: size of the LZ data, padding and footer (bits 0-23) and size of the
+ *    padding and footer (bits 24-31)
+ *  - u32: decompressed size minus file size
+ *
+ * Read back to front the LZ data is groups of a flag byte and 8 items, bit 7
+ * first. A clear bit is a literal byte. A set bit is a big endian u16 with
+ * length - 3 in the top 4 bits and distance - 3 in the low 12 bits.
+ *
+ * The decompressed data is written over the file. The stored part is chosen
+ * so the writes never pass the LZ data that hasn't been read yet.
+ *
+ * The compressed size and flag are set in the overlay table entry, the RAM
+ * size stays the decompressed size. Every result is decompressed and compared
+ * before anything is written. An overlay that doesn't get smaller is left as
+ * it is.
+ *
+ * Usage: ovlcomp <overlay table> <overlay dir> [overlay id...]
+ *
+ * Overlay files are <overlay dir>/overlay_<id, 4 digits>.bin like in the
+ * makefile of src/overlay.
+ */
+
+#define MIN_MATCH 3
+#define MAX_MATCH 18
+#define MIN_DISTANCE 3
+#define MAX_DISTANCE (0xfff + MIN_DISTANCE)
+#define HASH_BITS 16
+#define MAX_CHAIN 512
+
+#define FOOTER_SIZE 8
+
+struct lz {
+  const uint8_t *data;
+  size_t size;
+  int32_t *head;
+  int32_t *prev;
+};
+
+uint8_t *load(const char *path, size_t *size)
+{
+  FILE *f = fopen(path, "rb");
+
+  if (f == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t *data = malloc(*size + 1);
+
+  if (data == NULL || fread(data, 1, *size, f) != *size) {
+    fprintf(stderr, "%s: read failed\n", path);
+    fclose(f);
+    free(data);
+    return NULL;
+  }
+
+  fclose(f);
+
+  return data;
+}
+
+bool save(const char *path, const void *data, size_t size)
+{
+  FILE *f = fopen(path, "wb");
+
+  if (f == NULL || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+    perror(path);
+    return false;
+  }
+
+  return true;
+}
+
+uint32_t hash3(const uint8_t *p)
+{
+  return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void lz_insert(struct lz *lz, size_t pos)
+{
+  if (pos + MIN_MATCH <= lz->size) {
+    uint32_t h = hash3(lz->data + pos);
+
+    lz->prev[pos] = lz->head[h];
+    lz->head[h] = pos;
+  }
+}
+
+/*
+ * @return length of the longest match at pos, 0 if shorter than MIN_MATCH
+ */
+int lz_match(const struct lz *lz, size_t pos, int *distance)
+{
+  if (pos + MIN_MATCH > lz->size) {
+    return 0;
+  }
+
+  size_t max = lz->size - pos < MAX_MATCH ? lz->size - pos : MAX_MATCH;
+  int best = 0;
+  int chain = 0;
+
+  for (int32_t q = lz->head[hash3(lz->data + pos)];
+       q >= 0 && pos - q <= MAX_DISTANCE && chain < MAX_CHAIN;
+       q = lz->prev[q], chain++) {
+    if (pos - q < MIN_DISTANCE) {
+      continue;
+    }
+
+    int len = 0;
+
+    while (len < max && lz->data[q + len] == lz->data[pos + len]) {
+      len++;
+    }
+
+    if (len > best) {
+      best = len;
+      *distance = pos - q;
+
+      if (len == max) {
+        break;
+      }
+    }
+  }
+
+  return best >= MIN_MATCH ? best : 0;
+}
+
+/*
+ * Compress raw into out (at least size + size / 8 + 16 bytes).
+ *
+ * The data is reversed and compressed front to back. After every item the
+ * decoder has written in bytes and read out bytes. Writing over the file is
+ * safe as long as in - out never was larger than it is where the LZ data
+ * ends, so it ends at the point where in - out is the largest and the rest
+ * is stored.
+ *
+ * @return size of the compressed file, 0 if it's not smaller than raw
+ */
+size_t blz_encode(const uint8_t *raw, size_t size, uint8_t *out)
+{
+  uint8_t *data = malloc(size + 1);
+  uint8_t *lz_data = malloc(size + size / 8 + 16);
+  struct lz lz = {
+    .data = data,
+    .size = size,
+    .head = malloc(sizeof(int32_t) << HASH_BITS),
+    .prev = malloc(size * sizeof(int32_t) + 1)
+  };
+
+  for (size_t i = 0; i < size; i++) {
+    data[i] = raw[size - 1 - i];
+  }
+
+  memset(lz.head, 0xff, sizeof(int32_t) << HASH_BITS);
+
+  size_t pos = 0;
+  size_t n = 0;
+  size_t flag_pos = 0;
+  int bit = 0;
+  long best_saved = 0;
+  size_t best_in = 0;
+  size_t best_out = 0;
+
+  while (pos < size) {
+    if (bit == 0) {
+      flag_pos = n++;
+      lz_data[flag_pos] = 0;
+      bit = 0x80;
+    }
+
+    int distance;
+    int len = lz_match(&lz, pos, &distance);
+
+    if (len > 0) {
+      int v = (len - MIN_MATCH) << 12 | (distance - MIN_DISTANCE);
+
+      lz_data[flag_pos] |= bit;
+      lz_data[n++] = v >> 8;
+      lz_data[n++] = v & 0xff;
+
+      for (int i = 0; i < len; i++) {
+        lz_insert(&lz, pos++);
+      }
+    } else {
+      lz_data[n++] = data[pos];
+      lz_insert(&lz, pos++);
+    }
+
+    bit >>= 1;
+
+    if ((long)pos - (long)n > best_saved) {
+      best_saved = pos - n;
+      best_in = pos;
+      best_out = n;
+    }
+  }
+
+  size_t stored = size - best_in;
+  size_t padding = (4 - (stored + best_out) % 4) % 4;
+  size_t file_size = stored + best_out + padding + FOOTER_SIZE;
+
+  if (file_size < size) {
+    uint32_t header_size = padding + FOOTER_SIZE;
+    uint32_t footer[2] = {
+      (best_out + header_size) | header_size << 24,
+      size - file_size
+    };
+
+    memcpy(out, raw, stored);
+
+    for (size_t i = 0; i < best_out; i++) {
+      out[stored + i] = lz_data[best_out - 1 - i];
+    }
+
+    memset(out + stored + best_out, 0xff, padding);
+    memcpy(out + file_size - FOOTER_SIZE, footer, FOOTER_SIZE);
+  }
+
+  free(data);
+  free(lz_data);
+  free(lz.head);
+  free(lz.prev);
+
+  return file_size < size ? file_size : 0;
+}
+
+/*
+ * Decompress in place like the DS does. buf holds the file and has room for
+ * the decompressed data.
+ *
+ * @return decompressed size, 0 if the data is corrupt
+ */
+size_t blz_decode(uint8_t *buf, size_t file_size)
+{
+  uint32_t footer[2];
+
+  if (file_size < FOOTER_SIZE) {
+    return 0;
+  }
+
+  memcpy(footer, buf + file_size - FOOTER_SIZE, FOOTER_SIZE);
+
+  size_t lz_size = footer[0] & 0xffffff;
+  size_t header_size = footer[0] >> 24;
+  size_t size = file_size + footer[1];
+
+  if (lz_size > file_size || header_size > lz_size) {
+    return 0;
+  }
+
+  size_t src = file_size - header_size;
+  size_t end = file_size - lz_size;
+  size_t dst = size;
+
+  while (src > end) {
+    uint8_t flags = buf[--src];
+
+    for (int bit = 0x80; bit != 0 && src > end; bit >>= 1) {
+      if (flags & bit) {
+        if (src - end < 2) {
+          return 0;
+        }
+
+        int v = buf[--src] << 8;
+
+        v |= buf[--src];
+
+        int len = (v >> 12) + MIN_MATCH;
+        int distance = (v & 0xfff) + MIN_DISTANCE;
+
+        if (dst < end + len || dst + distance > size) {
+          return 0;
+        }
+
+        while (len-- > 0) {
+          dst--;
+          buf[dst] = buf[dst + distance];
+        }
+      } else {
+        if (dst <= end) {
+          return 0;
+        }
+
+        buf[--dst] = buf[--src];
+      }
+
+      // The output must never catch up with the unread input
+      if (dst < src) {
+        return 0;
+      }
+    }
+  }
+
+  return dst == end ? size : 0;
+}
+
+bool compress_overlay(struct overlay_info *info, const char *dir)
+{
+  char path[1024];
+  size_t size;
+  uint8_t *out = NULL;
+  uint8_t *check = NULL;
+  bool result = false;
+
+  snprintf(path, sizeof path, "%s/overlay_%04d.bin", dir, info->overlay_id);
+
+  uint8_t *raw = load(path, &size);
+
+  if (raw == NULL) {
+    return false;
+  }
+
+  if (info->flags & 1) {
+    printf("overlay %d: already compressed\n", info->overlay_id);
+    result = true;
+    goto error;
+  }
+
+  if (size != info->ram_size) {
+    fprintf(stderr, "%s: size %zu doesn't match the overlay table (%d)\n",
+            path, size, info->ram_size);
+    goto error;
+  }
+
+  out = malloc(size + size / 8 + 16);
+  size_t file_size = blz_encode(raw, size, out);
+
+  if (file_size == 0) {
+    printf("overlay %d: %zu bytes, doesn't compress, stored\n",
+           info->overlay_id, size);
+    result = true;
+    goto error;
+  }
+
+  check = malloc(size);
+  memcpy(check, out, file_size);
+
+  if (blz_decode(check, file_size) != size || memcmp(check, raw, size) != 0) {
+    fprintf(stderr, "%s: compression check failed\n", path);
+    goto error;
+  }
+
+  if (!save(path, out, file_size)) {
+    goto error;
+  }
+
+  info->compressed_size = file_size;
+  info->flags |= 1;
+
+  printf("overlay %d: %zu -> %zu bytes (%zu%%)\n", info->overlay_id, size,
+         file_size, file_size * 100 / size);
+
+  result = true;
+
+error:
+  free(raw);
+  free(out);
+  free(check);
+
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3) {
+    printf("Usage: ovlcomp <overlay table> <overlay dir> [overlay id...]\n");
+    return 1;
+  }
+
+  size_t size;
+  struct overlay_info *table = (struct overlay_info *)load(argv[1], &size);
+  int count = size / sizeof *table;
+
+  if (table == NULL) {
+    return 1;
+  }
+
+  bool ok = true;
+
+  for (int i = 3; i < argc && ok; i++) {
+    int id = atoi(argv[i]);
+
+    if (id < 0 || id >= count || table[id].overlay_id != id) {
+      fprintf(stderr, "%s: no overlay %s\n", argv[1], argv[i]);
+      ok = false;
+    } else {
+      ok = compress_overlay(&table[id], argv[2]);
+    }
+  }
+
+  ok = ok && save(argv[1], table, size);
+  free(table);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,500 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Generate the overlay build files from a manifest.
+ *
+ * The manifest has one line per overlay. The overlay id (and FAT id) is the
+ * line order:
+ *
+ *   # <name> <region>[:<slot>] [lz] <object file>...
+ *   ovr0  main:0 lz src/ovr0.o
+ *   ovr1  main:1 lz src/ovr1.o
+ *   itcm1 itcm      src/ovr_tcm.o
+ *
+ * The region is main (the overlay region after the BSS), itcm or dtcm. main
+ * overlays get code, data and BSS of their objects, itcm overlays only code
+ * and dtcm overlays only data and BSS, so one object can be split over an
+ * itcm and a dtcm overlay. Overlays with the same slot are linked to the
+ * same address and replace each other when loaded. Slots follow each other
+ * in their region (32 byte aligned), overlays in different slots can be
+ * resident together. The slot defaults to 0. lz stores the overlay
+ * compressed (see ovlcomp).
+ *
+ * The .init_array and .fini_array of the objects go with the data, into main
+ * and dtcm overlays. The init array is set in the overlay table entry,
+ * ndk_overlay_init_in_ram calls it. An object split over an itcm and a dtcm
+ * overlay has its arrays in the dtcm overlay, load the itcm overlay first.
+ * The firmware doesn't know about fini arrays, overlay_fini.c registers them
+ * (see util/overlay_fini.h).
+ *
+ * Written to the output directory:
+ *  - overlay.ld: linker script fragment with a section per overlay, its
+ *    _<name>_start/_end/_bss_start/_bss_end, _<name>_init_array_start/_end
+ *    and _<name>_fini_array_start/_end symbols, the slot addresses, the
+ *    region sizes (OVERLAY_RAM_SIZE, ITCM_OVERLAY_SIZE, DTCM_OVERLAY_SIZE)
+ *    and the overlay table as section ovr_tbl.
+ *  - overlay.mk: OVERLAY_SECTIONS, the sections to extract in overlay id
+ *    order, and OVERLAY_COMPRESSED, the ids of the lz overlays.
+ *  - overlay_ids.h: OVERLAY_ID_<NAME> for every overlay and OVERLAY_COUNT.
+ *  - overlay_fini.c: OVERLAY_FINI_ARRAY for every main and dtcm overlay, to
+ *    be compiled and linked with the objects of the game.
+ *
+ * Usage: ovlgen <manifest> <output dir>
+ */
+
+#define MAX_LINE 1024
+#define MAX_OBJECTS 64
+
+#define REGIONS 3
+
+struct region_def {
+  const char *name;
+  // start symbol from link.ld
+  const char *start;
+  const char *slot_prefix;
+  const char *size;
+  bool code;
+  bool data;
+};
+
+struct overlay_def {
+  char *name;
+  int region;
+  int slot;
+  bool compressed;
+  int object_count;
+  char *objects[MAX_OBJECTS];
+};
+
+struct manifest {
+  int count;
+  struct overlay_def *overlays;
+};
+
+static const struct region_def regions[REGIONS] = {
+  { "main", "OVERLAY_START", "OVERLAY_SLOT", "OVERLAY_RAM_SIZE", true, true },
+  { "itcm", "ITCM_OVERLAY_START", "ITCM_OVERLAY_SLOT", "ITCM_OVERLAY_SIZE",
+    true, false },
+  { "dtcm", "DTCM_OVERLAY_START", "DTCM_OVERLAY_SLOT", "DTCM_OVERLAY_SIZE",
+    false, true }
+};
+
+bool valid_name(const char *s)
+{
+  if (!isalpha((unsigned char)*s) && *s != '_') {
+    return false;
+  }
+
+  for (; *s != '\0'; s++) {
+    if (!isalnum((unsigned char)*s) && *s != '_') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool parse_line(struct manifest *m, char *line, const char *path,
+                int line_number)
+{
+  struct overlay_def o = { 0 };
+  char *word = strtok(line, " \t\r\n");
+
+  if (word == NULL || *word == '#') {
+    return true;
+  }
+
+  if (!valid_name(word)) {
+    fprintf(stderr, "%s:%d: %s is not a valid section name\n", path,
+            line_number, word);
+    return false;
+  }
+
+  for (int i = 0; i < m->count; i++) {
+    if (strcmp(m->overlays[i].name, word) == 0) {
+      fprintf(stderr, "%s:%d: %s listed twice\n", path, line_number, word);
+      return false;
+    }
+  }
+
+  o.name = strdup(word);
+
+  char *region = strtok(NULL, " \t\r\n");
+  char *slot = region != NULL ? strchr(region, ':') : NULL;
+
+  if (slot != NULL) {
+    *slot++ = '\0';
+    o.slot = atoi(slot);
+  }
+
+  o.region = -1;
+
+  for (int i = 0; region != NULL && i < REGIONS; i++) {
+    if (strcmp(region, regions[i].name) == 0) {
+      o.region = i;
+    }
+  }
+
+  if (o.region < 0 || o.slot < 0) {
+    fprintf(stderr, "%s:%d: expected main, itcm or dtcm and a slot >= 0\n",
+            path, line_number);
+    return false;
+  }
+
+  while ((word = strtok(NULL, " \t\r\n")) != NULL && *word != '#') {
+    if (strcmp(word, "lz") == 0 && o.object_count == 0) {
+      o.compressed = true;
+    } else if (o.object_count == MAX_OBJECTS) {
+      fprintf(stderr, "%s:%d: too many objects\n", path, line_number);
+      return false;
+    } else {
+      o.objects[o.object_count++] = strdup(word);
+    }
+  }
+
+  if (o.object_count == 0) {
+    fprintf(stderr, "%s:%d: no object files\n", path, line_number);
+    return false;
+  }
+
+  m->overlays = realloc(m->overlays, (m->count + 1) * sizeof *m->overlays);
+  m->overlays[m->count++] = o;
+
+  return true;
+}
+
+bool read_manifest(struct manifest *m, const char *path)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+  int line_number = 0;
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    if (!parse_line(m, line, path, ++line_number)) {
+      fclose(f);
+      return false;
+    }
+  }
+
+  fclose(f);
+
+  if (m->count == 0) {
+    fprintf(stderr, "%s: no overlays\n", path);
+    return false;
+  }
+
+  return true;
+}
+
+void write_inputs(FILE *f, const struct overlay_def *o, const char *sections)
+{
+  for (int i = 0; i < o->object_count; i++) {
+    fprintf(f, "    %s(%s)\n", o->objects[i], sections);
+  }
+}
+
+/*
+ * A function pointer array, kept even though nothing refers to it. Entries
+ * with a priority (.init_array.<n>) come first, lowest priority first, like
+ * in the main binary of a regular program. first is an input section put
+ * before them, NULL for none.
+ */
+void write_array(FILE *f, const struct overlay_def *o, const char *array,
+                 bool inputs, const char *first)
+{
+  fprintf(f, "    _%s_%s_start = .;\n", o->name, array + 1);
+
+  if (inputs && first != NULL) {
+    fprintf(f, "    KEEP(*(%s.%s))\n", first, o->name);
+  }
+
+  for (int i = 0; inputs && i < o->object_count; i++) {
+    fprintf(f, "    KEEP(%s(SORT_BY_INIT_PRIORITY(%s.*)))\n", o->objects[i],
+            array);
+  }
+
+  for (int i = 0; inputs && i < o->object_count; i++) {
+    fprintf(f, "    KEEP(%s(%s))\n", o->objects[i], array);
+  }
+
+  fprintf(f, "    _%s_%s_end = .;\n", o->name, array + 1);
+}
+
+void write_section(FILE *f, const struct overlay_def *o)
+{
+  const struct region_def *r = &regions[o->region];
+  const char *n = o->name;
+
+  fprintf(f, "%s %s_%d : {\n", n, r->slot_prefix, o->slot);
+  fprintf(f, "    _%s_start = .;\n", n);
+
+  if (r->code) {
+    write_inputs(f, o, ".text .text*");
+  }
+
+  if (r->data) {
+    write_inputs(f, o, ".data");
+    write_inputs(f, o, ".rodata .rodata*");
+    fprintf(f, "    KEEP(*(.ovl_fini.%s))\n", n);
+  }
+
+  fprintf(f, "    . = ALIGN(4);\n");
+  // The fini array registration runs before the constructors
+  write_array(f, o, ".init_array", r->data, ".ovl_fini_init");
+  write_array(f, o, ".fini_array", r->data, NULL);
+  fprintf(f, "    _%s_end = .;\n", n);
+  fprintf(f, "    _%s_bss_start = .;\n", n);
+
+  if (r->data) {
+    write_inputs(f, o, ".bss .bss* COMMON");
+  }
+
+  fprintf(f, "    . = ALIGN(4);\n");
+  fprintf(f, "    _%s_bss_end = .;\n", n);
+  fprintf(f, "} AT>dummy\n\n");
+}
+
+/*
+ * Slot addresses and the size of a region. Slot n starts where the largest
+ * overlay of the slot before it ends.
+ */
+void write_slots(FILE *f, const struct manifest *m, int region)
+{
+  const struct region_def *r = &regions[region];
+  int prev = -1;
+
+  for (;;) {
+    int slot = -1;
+
+    for (int i = 0; i < m->count; i++) {
+      const struct overlay_def *o = &m->overlays[i];
+
+      if (o->region == region && o->slot > prev &&
+          (slot < 0 || o->slot < slot)) {
+        slot = o->slot;
+      }
+    }
+
+    if (slot < 0) {
+      break;
+    }
+
+    if (prev < 0) {
+      fprintf(f, "%s_%d = %s;\n", r->slot_prefix, slot, r->start);
+    } else {
+      fprintf(f, "%s_%d = ALIGN(%s_%d + %s_%d_SIZE, 32);\n", r->slot_prefix,
+              slot, r->slot_prefix, prev, r->slot_prefix, prev);
+    }
+
+    // Size of the largest overlay in the slot, as nested MAX(a, b)
+    int members = 0;
+
+    for (int i = 0; i < m->count; i++) {
+      const struct overlay_def *o = &m->overlays[i];
+
+      members += o->region == region && o->slot == slot;
+    }
+
+    fprintf(f, "%s_%d_SIZE = ", r->slot_prefix, slot);
+
+    for (int i = 1; i < members; i++) {
+      fprintf(f, "MAX(");
+    }
+
+    for (int i = 0, first = 1; i < m->count; i++) {
+      const struct overlay_def *o = &m->overlays[i];
+
+      if (o->region == region && o->slot == slot) {
+        fprintf(f, first ? "SIZEOF(%s)" : ", SIZEOF(%s))", o->name);
+        first = 0;
+      }
+    }
+
+    fprintf(f, ";\n");
+    prev = slot;
+  }
+
+  if (prev < 0) {
+    fprintf(f, "%s = 0;\n\n", r->size);
+  } else {
+    fprintf(f, "%s = %s_%d + %s_%d_SIZE - %s;\n\n", r->size, r->slot_prefix,
+            prev, r->slot_prefix, prev, r->start);
+  }
+}
+
+bool write_linker_script(const struct manifest *m, const char *path,
+                         const char *manifest_path)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "/* Generated by ovlgen from %s, do not edit */\n\n",
+          manifest_path);
+
+  for (int i = 0; i < m->count; i++) {
+    write_section(f, &m->overlays[i]);
+  }
+
+  fprintf(f, "ovr_tbl 0x0 : {\n");
+
+  for (int i = 0; i < m->count; i++) {
+    const char *n = m->overlays[i].name;
+
+    fprintf(f, "%s", i > 0 ? "\n" : "");
+    fprintf(f, "    LONG(%d);\n", i);
+    fprintf(f, "    LONG(_%s_start);\n", n);
+    fprintf(f, "    LONG(_%s_end - _%s_start);\n", n, n);
+    fprintf(f, "    LONG(_%s_bss_end - _%s_bss_start);\n", n, n);
+    fprintf(f, "    LONG(_%s_init_array_start);\n", n);
+    fprintf(f, "    LONG(_%s_init_array_end);\n", n);
+    fprintf(f, "    LONG(%d);\n", i);
+    fprintf(f, "    LONG(0);    /* compressed size and flags, set by "
+               "ovlcomp */\n");
+  }
+
+  fprintf(f, "} AT>dummy\n\n");
+
+  for (int i = 0; i < REGIONS; i++) {
+    write_slots(f, m, i);
+  }
+
+  return fclose(f) == 0;
+}
+
+bool write_makefile(const struct manifest *m, const char *path,
+                    const char *manifest_path)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "# Generated by ovlgen from %s, do not edit\n\n", manifest_path);
+  fprintf(f, "OVERLAY_SECTIONS =");
+
+  for (int i = 0; i < m->count; i++) {
+    fprintf(f, " %s", m->overlays[i].name);
+  }
+
+  fprintf(f, "\n\nOVERLAY_COMPRESSED =");
+
+  for (int i = 0; i < m->count; i++) {
+    if (m->overlays[i].compressed) {
+      fprintf(f, " %d", i);
+    }
+  }
+
+  fprintf(f, "\n");
+
+  return fclose(f) == 0;
+}
+
+bool write_header(const struct manifest *m, const char *path,
+                  const char *manifest_path)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "// Generated by ovlgen from %s, do not edit\n", manifest_path);
+  fprintf(f, "#ifndef OVERLAY_IDS_INCLUDE_FILE\n");
+  fprintf(f, "#define OVERLAY_IDS_INCLUDE_FILE\n\n");
+  fprintf(f, "// Overlay ids, also the FAT ids of the overlay files\n");
+
+  for (int i = 0; i < m->count; i++) {
+    fprintf(f, "#define OVERLAY_ID_");
+
+    for (const char *s = m->overlays[i].name; *s != '\0'; s++) {
+      fputc(toupper((unsigned char)*s), f);
+    }
+
+    fprintf(f, " %d\n", i);
+  }
+
+  fprintf(f, "\n#define OVERLAY_COUNT %d\n\n", m->count);
+  fprintf(f, "#endif // OVERLAY_IDS_INCLUDE_FILE\n");
+
+  return fclose(f) == 0;
+}
+
+bool write_fini(const struct manifest *m, const char *path,
+                const char *manifest_path)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  fprintf(f, "// Generated by ovlgen from %s, do not edit\n", manifest_path);
+  fprintf(f, "#include \"overlay_fini.h\"\n\n");
+
+  for (int i = 0; i < m->count; i++) {
+    if (regions[m->overlays[i].region].data) {
+      fprintf(f, "OVERLAY_FINI_ARRAY(%s)\n", m->overlays[i].name);
+    }
+  }
+
+  return fclose(f) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    printf("Usage: ovlgen <manifest> <output dir>\n");
+    return 1;
+  }
+
+  struct manifest m = { 0 };
+  char path[MAX_LINE];
+
+  if (!read_manifest(&m, argv[1])) {
+    return 1;
+  }
+
+  snprintf(path, sizeof path, "%s/overlay.ld", argv[2]);
+
+  if (!write_linker_script(&m, path, argv[1])) {
+    return 1;
+  }
+
+  snprintf(path, sizeof path, "%s/overlay.mk", argv[2]);
+
+  if (!write_makefile(&m, path, argv[1])) {
+    return 1;
+  }
+
+  snprintf(path, sizeof path, "%s/overlay_ids.h", argv[2]);
+
+  if (!write_header(&m, path, argv[1])) {
+    return 1;
+  }
+
+  snprintf(path, sizeof path, "%s/overlay_fini.c", argv[2]);
+
+  if (!write_fini(&m, path, argv[1])) {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,352 @@
+#include <ctype.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "hash.h"
+#include "pack.h"
+
+#include "hashseed.h"
+
+/*
+ * Build a pack file for the runtime reader in src/util/pack.h.
+ *
+ * The manifest lists the members one per line, grouped under group lines:
+ *
+ *   # comment
+ *   [level1]
+ *   level1/tiles.bin
+ *   level1/map.bin = build/map1.bin
+ *   [level2]
+ *   ...
+ *
+ * A member line is the member name, optionally followed by '=' and the path
+ * of the data on the host. Without it the name is the path. Host paths are
+ * relative to the directory of the manifest. Members before the first group
+ * line are in a group with an empty name.
+ *
+ * Usage: packgen <manifest> <pack file>
+ */
+
+#define MAX_LINE 1024
+
+struct member {
+  char *name;
+  char *path;
+  int group;
+  struct pack_entry entry;
+};
+
+struct group_def {
+  char *name;
+  struct pack_group group;
+};
+
+struct manifest {
+  int count;
+  int group_count;
+  struct member *members;
+  struct group_def *groups;
+};
+
+char *trim(char *s)
+{
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+
+  char *end = s + strlen(s);
+
+  while (end > s && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+
+  return s;
+}
+
+void add_group(struct manifest *m, const char *name)
+{
+  m->groups = realloc(m->groups, (m->group_count + 1) * sizeof *m->groups);
+  m->groups[m->group_count].name = strdup(name);
+  m->group_count++;
+}
+
+bool read_manifest(struct manifest *m, const char *path)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  char *copy = strdup(path);
+  char *dir = dirname(copy);
+  char line[MAX_LINE];
+  int line_number = 0;
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    char *s = trim(line);
+
+    line_number++;
+
+    if (*s == '\0' || *s == '#') {
+      continue;
+    }
+
+    if (*s == '[') {
+      char *end = strchr(s, ']');
+
+      if (end == NULL) {
+        fprintf(stderr, "%s:%d: missing ']'\n", path, line_number);
+        return false;
+      }
+
+      *end = '\0';
+      s = trim(s + 1);
+
+      for (int i = 0; i < m->group_count; i++) {
+        if (strcasecmp(m->groups[i].name, s) == 0) {
+          fprintf(stderr, "%s:%d: group %s listed twice\n", path, line_number,
+                  s);
+          return false;
+        }
+      }
+
+      add_group(m, s);
+      continue;
+    }
+
+    if (m->group_count == 0) {
+      add_group(m, "");
+    }
+
+    char *name = s;
+    char *data = s;
+    char *eq = strchr(s, '=');
+
+    if (eq != NULL) {
+      *eq = '\0';
+      name = trim(s);
+      data = trim(eq + 1);
+    }
+
+    for (int i = 0; i < m->count; i++) {
+      if (strcasecmp(m->members[i].name, name) == 0) {
+        fprintf(stderr, "%s:%d: %s listed twice\n", path, line_number, name);
+        return false;
+      }
+    }
+
+    m->members = realloc(m->members, (m->count + 1) * sizeof *m->members);
+
+    struct member *mb = &m->members[m->count++];
+
+    mb->name = strdup(name);
+    mb->path = malloc(strlen(dir) + strlen(data) + 2);
+
+    if (data[0] == '/') {
+      strcpy(mb->path, data);
+    } else {
+      sprintf(mb->path, "%s/%s", dir, data);
+    }
+
+    mb->group = m->group_count - 1;
+  }
+
+  fclose(f);
+  free(copy);
+
+  return true;
+}
+
+/*
+ * Find a seed that gives every member and every group a unique hash.
+ * Members and groups are looked up separately so they may share a hash.
+ */
+bool find_seed(const struct manifest *m, unsigned int *seed)
+{
+  char **names = malloc((m->count + m->group_count + 1) * sizeof(char *));
+
+  for (int i = 0; i < m->count; i++) {
+    names[i] = m->members[i].name;
+  }
+
+  for (int i = 0; i < m->group_count; i++) {
+    names[m->count + i] = m->groups[i].name;
+  }
+
+  struct hashseed_set sets[2] = {
+    { names, m->count },
+    { names + m->count, m->group_count }
+  };
+  bool found = hashseed_find(sets, 2, seed);
+
+  free(names);
+
+  return found;
+}
+
+bool write_padding(FILE *out, long size)
+{
+  static const char zero[PACK_ALIGN];
+
+  return fwrite(zero, 1, PACK_PAD(size) - size, out) == PACK_PAD(size) - size;
+}
+
+bool copy_member(FILE *out, const struct member *mb)
+{
+  FILE *in = fopen(mb->path, "rb");
+
+  if (in == NULL) {
+    perror(mb->path);
+    return false;
+  }
+
+  char buf[0x4000];
+  size_t n;
+  long size = 0;
+
+  while ((n = fread(buf, 1, sizeof buf, in)) > 0) {
+    if (fwrite(buf, 1, n, out) != n) {
+      fclose(in);
+      return false;
+    }
+
+    size += n;
+  }
+
+  fclose(in);
+
+  if (size != mb->entry.size) {
+    fprintf(stderr, "%s: changed while packing\n", mb->path);
+    return false;
+  }
+
+  return write_padding(out, size);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    printf("Usage: packgen <manifest> <pack file>\n");
+    return 1;
+  }
+
+  struct manifest m = { 0 };
+
+  if (!read_manifest(&m, argv[1])) {
+    return 1;
+  }
+
+  unsigned int seed;
+
+  if (!find_seed(&m, &seed)) {
+    fprintf(stderr, "no collision free hash seed found\n");
+    return 1;
+  }
+
+  unsigned int dir_size = PACK_PAD(sizeof(struct pack_header) +
+                                   m.count * sizeof(struct pack_entry) +
+                                   m.group_count * sizeof(struct pack_group));
+  unsigned int offset = dir_size;
+
+  // Members are listed in manifest order so the members of a group are
+  // consecutive in the directory and in the data.
+  for (int g = 0; g < m.group_count; g++) {
+    struct pack_group *pg = &m.groups[g].group;
+
+    pg->hash = hash_path(m.groups[g].name, seed);
+    pg->check = hash_path_check(m.groups[g].name);
+    pg->first = m.count;
+    pg->count = 0;
+    pg->offset = offset;
+    pg->size = 0;
+
+    for (int i = 0; i < m.count; i++) {
+      struct member *mb = &m.members[i];
+
+      if (mb->group != g) {
+        continue;
+      }
+
+      FILE *in = fopen(mb->path, "rb");
+
+      if (in == NULL || fseek(in, 0, SEEK_END) != 0) {
+        perror(mb->path);
+        return 1;
+      }
+
+      mb->entry.hash = hash_path(mb->name, seed);
+      mb->entry.check = hash_path_check(mb->name);
+      mb->entry.offset = offset;
+      mb->entry.size = ftell(in);
+      mb->entry.padded_size = PACK_PAD(mb->entry.size);
+      fclose(in);
+
+      pg->first = i < pg->first ? i : pg->first;
+      pg->count++;
+      pg->size += mb->entry.padded_size;
+      offset += mb->entry.padded_size;
+    }
+
+    if (pg->count == 0) {
+      pg->first = 0;
+    }
+  }
+
+  struct pack_header hdr = {
+    .magic = PACK_MAGIC,
+    .version = PACK_VERSION,
+    .count = m.count,
+    .group_count = m.group_count,
+    .dir_size = dir_size,
+    .seed = seed
+  };
+
+  FILE *out = fopen(argv[2], "wb");
+
+  if (out == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  long used = 0;
+  bool ok = fwrite(&hdr, sizeof hdr, 1, out) == 1;
+
+  used += sizeof hdr;
+
+  for (int i = 0; i < m.count && ok; i++) {
+    ok = fwrite(&m.members[i].entry, sizeof(struct pack_entry), 1, out) == 1;
+    used += sizeof(struct pack_entry);
+  }
+
+  for (int i = 0; i < m.group_count && ok; i++) {
+    ok = fwrite(&m.groups[i].group, sizeof(struct pack_group), 1, out) == 1;
+    used += sizeof(struct pack_group);
+  }
+
+  ok = ok && write_padding(out, used);
+
+  for (int i = 0; i < m.count && ok; i++) {
+    ok = copy_member(out, &m.members[i]);
+  }
+
+  if (fclose(out) != 0 || !ok) {
+    fprintf(stderr, "%s: write failed\n", argv[2]);
+    return 1;
+  }
+
+  long data = 0;
+
+  for (int i = 0; i < m.count; i++) {
+    data += m.members[i].entry.size;
+  }
+
+  printf("%d members in %d groups, seed 0x%08x, %u bytes, %ld bytes padding\n",
+         m.count, m.group_count, seed, offset, offset - data);
+
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+/*
+ * Stress util/ring.h with a producer and a consumer that really overlap.
+ *
+ * simthread runs the ring between a simulated IRQ handler and a thread, but
+ * the simulation is cooperative, so a push and a pop never overlap there.
+ * Here the producer and the consumer are two host threads, in parallel on
+ * a multi core host and preempted at any instruction on a single core. The
+ * producer pushes sequence numbers as fast as it can, the consumer checks
+ * that they arrive in order without gaps and that every word of an element
+ * belongs to the same message (no torn elements). The exit status is 1 on
+ * any error.
+ *
+ * With -i the producer is a signal handler run from an interval timer
+ * instead. It interrupts the consumer at random instructions like an IRQ
+ * handler on the DS, which finds ordering bugs of the consumer on a single
+ * core host too, where thread preemption inside a pop is rare. Like on the
+ * DS the handler itself is never interrupted.
+ *
+ * ring.h only has compiler barriers, which is enough on the single core DS
+ * and on hosts that keep stores in order (x86). On a weakly ordered multi
+ * core host, e.g. ARM64, the thread mode is expected to fail.
+ *
+ * -n is the number of messages, -c the ring size (a power of two) and -w
+ * the words per element.
+ *
+ * Usage: ringstress [-i] [-n messages] [-c count] [-w words]
+ */
+
+#define MAX_WORDS 8
+#define MAX_COUNT 4096
+#define MAX_BURST 7
+#define MAGIC 0x9e3779b1
+
+struct stress {
+  struct ring ring;
+  unsigned int buf[MAX_COUNT * MAX_WORDS];
+  unsigned int messages;
+  unsigned int words;
+  // next sequence number of the producer
+  volatile unsigned int seq;
+  unsigned long long full;
+  unsigned long long empty;
+  unsigned long long errors;
+};
+
+static struct stress stress;
+
+/*
+ * Push the next message, false if the ring is full.
+ */
+bool push_next(void)
+{
+  unsigned int msg[MAX_WORDS];
+
+  msg[0] = stress.seq;
+
+  for (unsigned int i = 1; i < stress.words; i++) {
+    msg[i] = msg[0] * MAGIC + i;
+  }
+
+  if (!ring_push(&stress.ring, msg)) {
+    stress.full++;
+    return false;
+  }
+
+  stress.seq++;
+
+  return true;
+}
+
+void *producer_fn(void *arg)
+{
+  while (stress.seq < stress.messages) {
+    if (!push_next()) {
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Interval timer signal, push a burst of messages or until the ring is full.
+ */
+void producer_irq(int sig)
+{
+  unsigned int burst = 1 + stress.seq % MAX_BURST;
+
+  for (unsigned int n = 0; n < burst && stress.seq < stress.messages; n++) {
+    if (!push_next()) {
+      break;
+    }
+  }
+}
+
+/*
+ * Pop and check every message. Yields when the ring is empty, unless
+ * polling is set.
+ */
+void consume(bool polling)
+{
+  unsigned int msg[MAX_WORDS];
+  unsigned int expected = 0;
+
+  while (expected < stress.messages) {
+    if (!ring_pop(&stress.ring, msg)) {
+      stress.empty++;
+
+      if (!polling) {
+        sched_yield();
+      }
+
+      continue;
+    }
+
+    bool ok = msg[0] == expected;
+
+    for (unsigned int i = 1; i < stress.words; i++) {
+      ok = ok && msg[i] == msg[0] * MAGIC + i;
+    }
+
+    if (!ok) {
+      if (stress.errors < 10) {
+        fprintf(stderr, "message %u: got %u\n", expected, msg[0]);
+      }
+
+      stress.errors++;
+    }
+
+    expected++;
+  }
+}
+
+void *consumer_fn(void *arg)
+{
+  consume(false);
+
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  bool irq = false;
+  int count = 64;
+  int opt;
+
+  stress.messages = 10000000;
+  stress.words = 4;
+
+  while ((opt = getopt(argc, argv, "in:c:w:")) != -1) {
+    switch (opt) {
+      case 'i':
+        irq = true;
+        break;
+      case 'n':
+        stress.messages = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        count = atoi(optarg);
+        break;
+      case 'w':
+        stress.words = atoi(optarg);
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind != argc || count < 1 || count > MAX_COUNT ||
+      (count & (count - 1)) != 0 || stress.words < 1 ||
+      stress.words > MAX_WORDS) {
+    fprintf(stderr, "Usage: %s [-i] [-n messages] [-c count] [-w words]\n",
+            argv[0]);
+    return 1;
+  }
+
+  ring_init(&stress.ring, stress.buf, count, stress.words * 4);
+
+  if (irq) {
+    struct itimerval timer = { { 0, 10 }, { 0, 10 } };
+    struct itimerval off = { { 0, 0 }, { 0, 0 } };
+
+    signal(SIGALRM, &producer_irq);
+    setitimer(ITIMER_REAL, &timer, NULL);
+    // Busy polling, so the signals land anywhere in ring_pop
+    consume(true);
+    setitimer(ITIMER_REAL, &off, NULL);
+  } else {
+    pthread_t producer;
+    pthread_t consumer;
+
+    pthread_create(&consumer, NULL, &consumer_fn, NULL);
+    pthread_create(&producer, NULL, &producer_fn, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+  }
+
+  printf("%u messages of %u words through %d elements\n", stress.messages,
+         stress.words, count);
+  printf("ring full %llu times, empty %llu times, %llu errors\n",
+         stress.full, stress.empty, stress.errors);
+
+  return stress.errors == 0 && ring_empty(&stress.ring) ? 0 : 1;
+}
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "ndsrom.h"
+
+/*
+ * Reorder the files of a built ROM from access traces.
+ *
+ * Every order file is one trace, e.g. the load of one level: the paths of the
+ * files in the order they were first read, one per line, optionally followed
+ * by a tab and the number of reads. A path listed again adds to its reads.
+ * src/host/iotrace writes them. Overlays and other unnamed files are written
+ * as #<FAT id>.
+ *
+ * The cost of a layout is the reads of every file that doesn't start where
+ * the previous file of its trace ended, summed over the traces. Files are
+ * placed trace by trace in first read order, so the files of a load end up
+ * back to back and the load becomes a few long sequential reads. A file in
+ * several traces can only follow one of them, it goes with the trace that
+ * reads it most often, the earlier one on a tie. List the traces in order of
+ * importance. Files that are in no trace keep their relative order after the
+ * traced ones. Every file starts at a multiple of 512 so reads of whole files
+ * can take the DMA path.
+ *
+ * Only the file data area after the fixed parts (binaries, FNT, FAT, overlay
+ * tables, banner) is rewritten. FAT ids and the FNT don't change, so the game
+ * code is unaffected. Data after the last file is kept after the moved ones.
+ * The new ROM gets the new FAT, size and header CRC. The FAT can also be
+ * written to a separate file for a ROM builder.
+ *
+ * Usage: romlayout [-F <FAT file>] <ROM file> <new ROM file> <order file>...
+ */
+
+#define MAX_LINE 1024
+
+struct layout {
+  int count;
+  char **paths;
+  // position in the new order
+  int *placed;
+  // trace a traced file is placed with
+  int *owner;
+  struct ndsrom_fat_entry *fat;
+  struct ndsrom_fat_entry *new_fat;
+  int order_count;
+  int *order;
+};
+
+struct trace {
+  // files in first read order, each once
+  int count;
+  int *ids;
+  // reads of every file in ids
+  unsigned int *reads;
+};
+
+bool set_path(const char *path, int fat_id, void *arg)
+{
+  struct layout *l = arg;
+
+  if (fat_id < l->count) {
+    l->paths[fat_id] = strdup(path);
+  }
+
+  return true;
+}
+
+int find_path(const struct layout *l, const char *path)
+{
+  if (path[0] == '#') {
+    int id = atoi(path + 1);
+
+    return id >= 0 && id < l->count ? id : -1;
+  }
+
+  if (path[0] == '/') {
+    path++;
+  }
+
+  for (int i = 0; i < l->count; i++) {
+    if (l->paths[i] != NULL && strcasecmp(l->paths[i], path) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+bool read_trace(const struct layout *l, const char *path, struct trace *t)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+  // position of every file in ids, -1 if not listed yet
+  int *index = malloc(l->count * sizeof(int) + 1);
+
+  for (int i = 0; i < l->count; i++) {
+    index[i] = -1;
+  }
+
+  t->count = 0;
+  t->ids = malloc(l->count * sizeof(int) + 1);
+  t->reads = malloc(l->count * sizeof(unsigned int) + 1);
+
+  while (fgets(line, sizeof line, f) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] == '\0' || line[0] == ';') {
+      continue;
+    }
+
+    char *tab = strchr(line, '\t');
+    unsigned int reads = 1;
+
+    if (tab != NULL) {
+      *tab = '\0';
+      reads = strtoul(tab + 1, NULL, 0);
+    }
+
+    int id = find_path(l, line);
+
+    if (id < 0) {
+      fprintf(stderr, "%s: %s is not in the ROM, ignored\n", path, line);
+      continue;
+    }
+
+    if (index[id] < 0) {
+      index[id] = t->count;
+      t->ids[t->count] = id;
+      t->reads[t->count++] = 0;
+    }
+
+    t->reads[index[id]] += reads;
+  }
+
+  fclose(f);
+  free(index);
+
+  return true;
+}
+
+/*
+ * Whether file i of a trace has to start a new read: it doesn't start where
+ * the previous one ended (rounded up to 512).
+ */
+bool is_jump(const struct ndsrom_fat_entry *fat, const struct trace *t, int i)
+{
+  if (i == 0) {
+    return true;
+  }
+
+  uint32_t prev_end = fat[t->ids[i - 1]].end;
+  uint32_t start = fat[t->ids[i]].start;
+
+  return start != prev_end && start != NDSROM_ALIGN_UP(prev_end);
+}
+
+/*
+ * Number of times a trace has to start a new read.
+ */
+int count_jumps(const struct ndsrom_fat_entry *fat, const struct trace *t)
+{
+  int jumps = 0;
+
+  for (int i = 0; i < t->count; i++) {
+    jumps += is_jump(fat, t, i);
+  }
+
+  return jumps;
+}
+
+/*
+ * The cost of the layout for a trace: the reads of the files that start a
+ * new read.
+ */
+unsigned long long trace_cost(const struct ndsrom_fat_entry *fat,
+                              const struct trace *t)
+{
+  unsigned long long cost = 0;
+
+  for (int i = 0; i < t->count; i++) {
+    cost += is_jump(fat, t, i) ? t->reads[i] : 0;
+  }
+
+  return cost;
+}
+
+int count_unaligned(const struct ndsrom_fat_entry *fat, const struct trace *t)
+{
+  int unaligned = 0;
+
+  for (int i = 0; i < t->count; i++) {
+    unaligned += (fat[t->ids[i]].start & (NDSROM_ALIGN - 1)) != 0;
+  }
+
+  return unaligned;
+}
+
+void place(struct layout *l, int id)
+{
+  if (l->placed[id] < 0) {
+    l->placed[id] = l->order_count;
+    l->order[l->order_count++] = id;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *fat_path = NULL;
+  int arg = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-F") == 0) {
+    fat_path = argv[2];
+    arg = 3;
+  }
+
+  if (argc - arg < 3) {
+    printf("Usage: romlayout [-F <FAT file>] <ROM file> <new ROM file> "
+           "<order file>...\n");
+    return 1;
+  }
+
+  struct ndsrom rom;
+
+  if (!ndsrom_open(&rom, argv[arg], false)) {
+    return 1;
+  }
+
+  if (rom.header->unit_code & 0x02) {
+    fprintf(stderr, "%s: DSi ROMs are not supported\n", argv[arg]);
+    return 1;
+  }
+
+  struct layout l = { .count = rom.file_count };
+
+  l.paths = calloc(l.count + 1, sizeof(char *));
+  l.placed = malloc((l.count + 1) * sizeof(int));
+  l.owner = malloc((l.count + 1) * sizeof(int));
+  l.order = malloc((l.count + 1) * sizeof(int));
+  l.fat = malloc((l.count + 1) * sizeof *l.fat);
+  l.new_fat = malloc((l.count + 1) * sizeof *l.new_fat);
+
+  memcpy(l.fat, rom.fat, l.count * sizeof *l.fat);
+  memcpy(l.new_fat, rom.fat, l.count * sizeof *l.fat);
+  ndsrom_walk_files(&rom, &set_path, &l);
+
+  int trace_count = argc - arg - 2;
+  struct trace *traces = malloc(trace_count * sizeof *traces);
+
+  for (int i = 0; i < trace_count; i++) {
+    if (!read_trace(&l, argv[arg + 2 + i], &traces[i])) {
+      return 1;
+    }
+  }
+
+  // Files before the end of the fixed parts (overlays) stay where they are.
+  uint32_t end = ndsrom_fixed_end(&rom);
+  uint32_t region_start = NDSROM_ALIGN_UP(end);
+  bool *movable = calloc(l.count + 1, sizeof(bool));
+  unsigned int *most_reads = calloc(l.count + 1, sizeof(unsigned int));
+
+  for (int i = 0; i < l.count; i++) {
+    l.placed[i] = -1;
+    l.owner[i] = -1;
+    movable[i] = l.fat[i].start >= end &&
+                 l.fat[i].end >= l.fat[i].start && l.fat[i].end <= rom.size;
+  }
+
+  // Every file goes with the trace that reads it most
+  for (int t = 0; t < trace_count; t++) {
+    for (int i = 0; i < traces[t].count; i++) {
+      int id = traces[t].ids[i];
+
+      if (l.owner[id] < 0 || traces[t].reads[i] > most_reads[id]) {
+        l.owner[id] = t;
+        most_reads[id] = traces[t].reads[i];
+      }
+    }
+  }
+
+  for (int t = 0; t < trace_count; t++) {
+    for (int i = 0; i < traces[t].count; i++) {
+      int id = traces[t].ids[i];
+
+      if (movable[id] && l.owner[id] == t) {
+        place(&l, id);
+      }
+    }
+  }
+
+  int traced = l.order_count;
+
+  // The rest in their current ROM order
+  for (;;) {
+    int next = -1;
+
+    for (int i = 0; i < l.count; i++) {
+      if (movable[i] && l.placed[i] < 0 &&
+          (next < 0 || l.fat[i].start < l.fat[next].start)) {
+        next = i;
+      }
+    }
+
+    if (next < 0) {
+      break;
+    }
+
+    place(&l, next);
+  }
+
+  uint32_t offset = region_start;
+
+  for (int i = 0; i < l.order_count; i++) {
+    int id = l.order[i];
+    uint32_t size = l.fat[id].end - l.fat[id].start;
+
+    l.new_fat[id].start = offset;
+    l.new_fat[id].end = offset + size;
+    offset = NDSROM_ALIGN_UP(offset + size);
+  }
+
+  // Whatever follows the last file, e.g. the RSA signature of a download
+  // play ROM or padding, moves along with the end of the files.
+  uint32_t files_end = end;
+  uint32_t new_files_end = end;
+
+  for (int i = 0; i < l.count; i++) {
+    if (movable[i] && l.fat[i].end > files_end) {
+      files_end = l.fat[i].end;
+    }
+  }
+
+  if (l.order_count > 0) {
+    new_files_end = l.new_fat[l.order[l.order_count - 1]].end;
+  }
+
+  uint32_t tail = rom.size > files_end ? rom.size - files_end : 0;
+  uint32_t new_size = new_files_end + tail;
+  uint8_t *out = calloc(new_size, 1);
+
+  memcpy(out, rom.data, end < rom.size ? end : rom.size);
+  memcpy(out + new_files_end, rom.data + files_end, tail);
+
+  for (int i = 0; i < l.order_count; i++) {
+    int id = l.order[i];
+
+    memcpy(out + l.new_fat[id].start, rom.data + l.fat[id].start,
+           l.fat[id].end - l.fat[id].start);
+  }
+
+  struct ndsrom_header *h = (struct ndsrom_header *)out;
+
+  memcpy(out + h->fat_offset, l.new_fat, l.count * sizeof *l.new_fat);
+  h->rom_size = h->rom_size >= files_end ?
+                h->rom_size - files_end + new_files_end : new_files_end;
+
+  // Chip capacity is 128 kB << capacity
+  while ((0x20000u << h->capacity) < new_size && h->capacity < 15) {
+    h->capacity++;
+  }
+
+  ndsrom_update_header_crc(out);
+
+  for (int t = 0; t < trace_count; t++) {
+    struct trace *tr = &traces[t];
+
+    printf("%s: %d files, reads started %d -> %d, cost %llu -> %llu, "
+           "unaligned files %d -> %d\n", argv[arg + 2 + t], tr->count,
+           count_jumps(l.fat, tr), count_jumps(l.new_fat, tr),
+           trace_cost(l.fat, tr), trace_cost(l.new_fat, tr),
+           count_unaligned(l.fat, tr), count_unaligned(l.new_fat, tr));
+  }
+
+  printf("%d files moved (%d traced), ROM size 0x%x -> 0x%x\n", l.order_count,
+         traced, (unsigned int)rom.size, new_size);
+
+  ndsrom_close(&rom);
+
+  FILE *f = fopen(argv[arg + 1], "wb");
+
+  if (f == NULL || fwrite(out, 1, new_size, f) != new_size || fclose(f) != 0) {
+    perror(argv[arg + 1]);
+    return 1;
+  }
+
+  if (fat_path != NULL) {
+    f = fopen(fat_path, "wb");
+
+    if (f == NULL ||
+        fwrite(l.new_fat, sizeof *l.new_fat, l.count, f) != l.count ||
+        fclose(f) != 0) {
+      perror(fat_path);
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,348 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim_backup.h"
+
+#include "cart.h"
+
+#define BUS_CLOCK 33513982
+
+#define TYPE_EEPROM 1
+#define TYPE_FLASH 2
+#define TYPE_FRAM 3
+
+// ndk_backup_command IPC messages, see the macros in backup.h
+#define MESSAGE_READ 6
+#define MESSAGE_WRITE 8
+
+#define ERASED 0xff
+
+struct sim_backup {
+  const char *path;
+  unsigned char *data;
+  struct sim_backup_config config;
+  bool power_lost;
+  // bytes left until the power is cut, -1 for never
+  long long power_budget;
+  unsigned int rng;
+  void (*tick)(unsigned int cycles);
+  struct sim_backup_stats stats;
+};
+
+static bool sim_backup_map(unsigned int size);
+static bool sim_backup_program(unsigned int dest, const unsigned char *src,
+                               unsigned int count);
+static unsigned char sim_backup_garbage(void);
+static void sim_backup_charge(unsigned long long cycles);
+
+
+static struct sim_backup sim = { .power_budget = -1, .rng = 1 };
+
+/*
+ * Definitions of the SDK objects the simulation replaces.
+ */
+struct backup cart_backup_state;
+
+
+void sim_backup_open(const char *path)
+{
+  sim_backup_close();
+  sim.path = path;
+}
+
+void sim_backup_close(void)
+{
+  if (sim.data != NULL) {
+    msync(sim.data, sim.config.size, MS_SYNC);
+    munmap(sim.data, sim.config.size);
+  }
+
+  sim.data = NULL;
+}
+
+unsigned char *sim_backup_data(unsigned int *size)
+{
+  *size = sim.config.size;
+
+  return sim.data;
+}
+
+void sim_backup_get_config(struct sim_backup_config *config)
+{
+  *config = sim.config;
+}
+
+void sim_backup_set_config(const struct sim_backup_config *config)
+{
+  unsigned int size = sim.config.size;
+
+  sim.config = *config;
+  sim.config.size = size;
+
+  cart_backup_state.page_size = sim.config.page_size;
+  cart_backup_state.max_write_count = sim.config.max_write_count;
+}
+
+void sim_backup_power_loss(unsigned long long bytes)
+{
+  sim.power_budget = bytes;
+}
+
+bool sim_backup_power_lost(void)
+{
+  return sim.power_lost;
+}
+
+void sim_backup_power_on(void)
+{
+  sim.power_lost = false;
+  sim.power_budget = -1;
+}
+
+void sim_backup_set_tick(void (*tick)(unsigned int cycles))
+{
+  sim.tick = tick;
+}
+
+void sim_backup_seed(unsigned int seed)
+{
+  sim.rng = seed != 0 ? seed : 1;
+}
+
+void sim_backup_get_stats(struct sim_backup_stats *stats)
+{
+  *stats = sim.stats;
+}
+
+void sim_backup_reset_stats(void)
+{
+  memset(&sim.stats, 0, sizeof sim.stats);
+}
+
+void sim_backup_print_report(FILE *out)
+{
+  struct sim_backup_stats *s = &sim.stats;
+
+  fprintf(out, "reads         %10llu (%llu bytes)\n", s->reads,
+          s->bytes_read);
+  fprintf(out, "writes        %10llu (%llu bytes, %llu pages)\n", s->writes,
+          s->bytes_written, s->pages_written);
+  fprintf(out, "errors        %10llu\n", s->errors);
+  fprintf(out, "time          %10.3f ms (%llu cycles)\n",
+          s->cycles * 1000.0 / BUS_CLOCK, s->cycles);
+}
+
+// ----------------------------------------------------------------------------
+//  backup.h
+// ----------------------------------------------------------------------------
+
+void ndk_backup_init(unsigned short spec)
+{
+  ndk_backup_set_type(spec);
+}
+
+void ndk_backup_set_type(unsigned short spec)
+{
+  struct sim_backup_config *c = &sim.config;
+  int type = spec & 0xff;
+  unsigned int size = type != 0 ? 1u << (spec >> 8) : 0;
+
+  sim_backup_close();
+
+  memset(c, 0, sizeof *c);
+  memset(&cart_backup_state, 0, sizeof cart_backup_state);
+
+  c->type = type;
+  c->command_cycles = SIM_BACKUP_COMMAND_CYCLES;
+  c->byte_cycles = SIM_BACKUP_BYTE_CYCLES;
+
+  switch (type) {
+    case TYPE_EEPROM:
+      // 512 bytes, 8k, 64k and 128k chips
+      c->page_size = size <= 512 ? 16 : size <= 0x2000 ? 32 :
+                     size <= 0x10000 ? 128 : 256;
+      c->address_bytes = size <= 512 ? 2 : 3;
+      c->program_cycles = SIM_BACKUP_EEPROM_PROGRAM_CYCLES;
+      break;
+    case TYPE_FLASH:
+      c->page_size = 256;
+      c->address_bytes = 4;
+      c->program_cycles = SIM_BACKUP_FLASH_PROGRAM_CYCLES;
+      c->erase_cycles = SIM_BACKUP_FLASH_ERASE_CYCLES;
+      break;
+    case TYPE_FRAM:
+      c->address_bytes = 3;
+      break;
+    default:
+      return;
+  }
+
+  if (sim.path == NULL || !sim_backup_map(size)) {
+    c->type = 0;
+    return;
+  }
+
+  c->size = size;
+  cart_backup_state.size = size;
+  cart_backup_state.page_size = c->page_size;
+}
+
+bool ndk_backup_command(unsigned int src, unsigned int dest,
+                        unsigned int count, void (*cb)(int), int arg,
+                        bool async, int unk7, int unk8, int unk9)
+{
+  struct sim_backup_config *c = &sim.config;
+  bool read = unk7 == MESSAGE_READ;
+  unsigned int address = read ? src : dest;
+  bool ok = !sim.power_lost && sim.data != NULL &&
+            (read || unk7 == MESSAGE_WRITE) &&
+            address <= c->size && count <= c->size - address &&
+            (read || c->max_write_count == 0 || count <= c->max_write_count);
+
+  sim_backup_charge(c->command_cycles);
+
+  if (ok && read) {
+    memcpy((void *)(unsigned long)dest, sim.data + src, count);
+    sim_backup_charge((unsigned long long)(c->address_bytes + count) *
+                      c->byte_cycles);
+    sim.stats.reads++;
+    sim.stats.bytes_read += count;
+  } else if (ok) {
+    ok = sim_backup_program(dest, (const unsigned char *)(unsigned long)src,
+                            count);
+    sim.stats.writes++;
+  }
+
+  if (!ok) {
+    sim.stats.errors++;
+  }
+
+  cart_backup_state.status = ok ? BACKUP_SUCCESS : SIM_BACKUP_ERROR;
+
+  if (cb != NULL) {
+    cb(arg);
+  }
+
+  return ok || async;
+}
+
+unsigned int ndk_backup_get_status(void)
+{
+  return cart_backup_state.status;
+}
+
+/*
+ * Map the file, growing it to size with erased bytes.
+ */
+bool sim_backup_map(unsigned int size)
+{
+  int fd = open(sim.path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(sim.path);
+
+    if (fd >= 0) {
+      close(fd);
+    }
+
+    return false;
+  }
+
+  if (st.st_size < size && ftruncate(fd, size) != 0) {
+    perror(sim.path);
+    close(fd);
+    return false;
+  }
+
+  sim.data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (sim.data == MAP_FAILED) {
+    perror(sim.path);
+    sim.data = NULL;
+    return false;
+  }
+
+  if (st.st_size < size) {
+    memset(sim.data + st.st_size, ERASED, size - st.st_size);
+  }
+
+  return true;
+}
+
+/*
+ * Program a write page by page. Returns false if the power is cut on the
+ * way, the page being programmed is torn.
+ */
+bool sim_backup_program(unsigned int dest, const unsigned char *src,
+                        unsigned int count)
+{
+  struct sim_backup_config *c = &sim.config;
+  unsigned int page_size = c->page_size > 0 ? c->page_size : c->size;
+
+  while (count > 0) {
+    unsigned int n = page_size - dest % page_size;
+
+    n = n < count ? n : count;
+
+    sim_backup_charge((unsigned long long)(c->address_bytes + n) *
+                      c->byte_cycles + c->erase_cycles + c->program_cycles);
+
+    if (sim.power_budget >= 0 && sim.power_budget < n) {
+      unsigned int done = sim.power_budget;
+
+      memcpy(sim.data + dest, src, done);
+
+      for (unsigned int i = done; i < n; i++) {
+        sim.data[dest + i] = c->type == TYPE_FLASH ? ERASED
+                                                   : sim_backup_garbage();
+      }
+
+      sim.power_lost = true;
+      sim.power_budget = -1;
+      sim.stats.bytes_written += done;
+
+      return false;
+    }
+
+    memcpy(sim.data + dest, src, n);
+
+    if (sim.power_budget >= 0) {
+      sim.power_budget -= n;
+    }
+
+    sim.stats.bytes_written += n;
+    sim.stats.pages_written++;
+    dest += n;
+    src += n;
+    count -= n;
+  }
+
+  return true;
+}
+
+unsigned char sim_backup_garbage(void)
+{
+  // xorshift32
+  sim.rng ^= sim.rng << 13;
+  sim.rng ^= sim.rng >> 17;
+  sim.rng ^= sim.rng << 5;
+
+  return sim.rng;
+}
+
+void sim_backup_charge(unsigned long long cycles)
+{
+  sim.stats.cycles += cycles;
+
+  while (sim.tick != NULL && cycles > 0) {
+    unsigned int n = cycles > 0xffffffff ? 0xffffffff : cycles;
+
+    sim.tick(n);
+    cycles -= n;
+  }
+}
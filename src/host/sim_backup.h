@@ -0,0 +1,150 @@
+/**
+ * Host simulation of backup (save) memory.
+ *
+ * Implements the API in backup.h (ndk_backup_init, ndk_backup_command and
+ * ndk_backup_get_status) and cart_backup_state on top of a file, so save code
+ * written for the ARM9 can be run, timed and crash tested on the development
+ * host. The file keeps the backup content between runs, like the .sav file
+ * of an emulator.
+ *
+ * The device model follows the chips used on DS carts, see
+ * https://problemkaputt.de/gbatek.htm#dscartridgebackup
+ *
+ * - ndk_backup_init picks the size, page size and timing from the spec.
+ * - Every command costs an IPC round trip to the ARM7, then every byte is
+ *   clocked over SPI at 4MHz. Writes go to the chip one page at a time, a
+ *   command, the address and the data of the page, followed by the program
+ *   time of the page. FLASH erases the page before programming it, FRAM has
+ *   no program time.
+ * - A write with more than max_write_count bytes fails, when it's set.
+ *
+ * Power loss can be injected after a number of programmed bytes. The page
+ * being programmed at that point is left torn: its bytes of the write that
+ * weren't programmed yet hold garbage, on FLASH the erased value. Every
+ * command fails after that until sim_backup_power_on, which is a reboot.
+ *
+ * Time is counted in bus cycles (33.5MHz). Pass sim_tick to
+ * sim_backup_set_tick to run together with sim_thread.h.
+ *
+ * NOTE: backup.h passes RAM addresses as unsigned int. On a 64 bit host the
+ * RAM buffers must be below 4GB, link with -no-pie and use static buffers
+ * (not the stack, not large malloc blocks). The DS has the same kind of
+ * rule, the ARM7 can't reach DTCM.
+ *
+ * NOTE: Commands complete before ndk_backup_command returns, also when async
+ * is set. Callbacks are called before returning.
+ */
+#ifndef HOST_SIM_BACKUP_INCLUDE_FILE
+#define HOST_SIM_BACKUP_INCLUDE_FILE
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "backup.h"
+
+// Backup status after power loss and on bad commands
+#define SIM_BACKUP_ERROR 1
+
+// IPC to the ARM7 and back, an estimate
+#define SIM_BACKUP_COMMAND_CYCLES 3000
+// One byte over SPI at 4MHz
+#define SIM_BACKUP_BYTE_CYCLES 67
+// EEPROM write cycle, 5ms
+#define SIM_BACKUP_EEPROM_PROGRAM_CYCLES 167570
+// FLASH page program 0.8ms and page erase 10ms
+#define SIM_BACKUP_FLASH_PROGRAM_CYCLES 26811
+#define SIM_BACKUP_FLASH_ERASE_CYCLES 335140
+
+struct sim_backup_config {
+  // 0: none, 1: EEPROM, 2: FLASH, 3: FRAM, see ndk_backup_init
+  int type;
+  unsigned int size;
+  // 0 when writes aren't split into pages (FRAM)
+  unsigned int page_size;
+  // 0 for no limit
+  unsigned int max_write_count;
+  // bytes of command and address sent before the data
+  unsigned int address_bytes;
+  unsigned int command_cycles;
+  unsigned int byte_cycles;
+  // every page written
+  unsigned int program_cycles;
+  unsigned int erase_cycles;
+};
+
+struct sim_backup_stats {
+  unsigned long long reads;
+  unsigned long long writes;
+  unsigned long long bytes_read;
+  unsigned long long bytes_written;
+  unsigned long long pages_written;
+  // commands that failed
+  unsigned long long errors;
+  unsigned long long cycles;
+};
+
+/**
+ * Set the backing file. It's created or resized by ndk_backup_init, new
+ * bytes are 0xff like an erased chip.
+ *
+ * @param path
+ */
+void sim_backup_open(const char *path);
+
+/**
+ * Write the content back to the file and unmap it.
+ */
+void sim_backup_close(void);
+
+/**
+ * Direct access to the content, e.g. to corrupt it on purpose.
+ *
+ * @param[out] size
+ * @return NULL before ndk_backup_init
+ */
+unsigned char *sim_backup_data(unsigned int *size);
+
+void sim_backup_get_config(struct sim_backup_config *config);
+
+/**
+ * Change the device model after ndk_backup_init. The size can't change.
+ * cart_backup_state is updated to match.
+ */
+void sim_backup_set_config(const struct sim_backup_config *config);
+
+/**
+ * Cut the power after a number of programmed bytes.
+ *
+ * @param bytes 0 cuts it at the next write
+ */
+void sim_backup_power_loss(unsigned long long bytes);
+
+/**
+ * @return true if the power was cut and sim_backup_power_on wasn't called
+ */
+bool sim_backup_power_lost(void);
+
+/**
+ * Restore the power, cancels a pending power loss.
+ */
+void sim_backup_power_on(void);
+
+/**
+ * Pass the cycles of every command on, e.g. to sim_tick.
+ *
+ * @param tick NULL to only count them
+ */
+void sim_backup_set_tick(void (*tick)(unsigned int cycles));
+
+/**
+ * Seed of the garbage in torn pages.
+ */
+void sim_backup_seed(unsigned int seed);
+
+void sim_backup_get_stats(struct sim_backup_stats *stats);
+
+void sim_backup_reset_stats(void);
+
+void sim_backup_print_report(FILE *out);
+
+#endif // HOST_SIM_BACKUP_INCLUDE_FILE
@@ -0,0 +1,503 @@
+#include <string.h>
+#include <strings.h>
+
+#include "sim_cart.h"
+
+#include "cart.h"
+#include "file.h"
+
+#define BUS_CLOCK 33513982
+
+// ROMCTRL fields, see gbatek "DS Cartridge I/O Ports"
+#define ROMCTRL_GAP1_MASK 0x1fff
+#define ROMCTRL_SLOW_CLOCK (1 << 27)
+// Bus cycles per transfer clock at 6.7MHz and 4.2MHz
+#define FAST_CLOCK_CYCLES 5
+#define SLOW_CLOCK_CYCLES 8
+#define COMMAND_BYTES 8
+
+// Directory ids in the FNT have the top four bits set
+#define FNT_DIR_ID_BASE 0xf000
+#define FNT_MAX_DEPTH 32
+
+// file.operation when no operation is pending
+#define FILE_OPERATION_NONE 14
+
+// Value read from ROM addresses past the end of the image
+#define OPEN_BUS 0xff
+
+struct sim_cart {
+  struct ndsrom rom;
+  bool open;
+  bool mounted;
+  struct sim_cart_timing timing;
+  void (*tick)(unsigned int cycles);
+  struct sim_cart_stats stats;
+  // a FAT or FNT read is in fat_volume.fn_3
+  bool table_read;
+};
+
+static int sim_cart_volume_read(struct fat_volume *volume, void *dst,
+                                unsigned int src, unsigned int len);
+static int sim_cart_volume_write(struct fat_volume *volume, void *dst,
+                                 unsigned int src, unsigned int len);
+static bool sim_cart_table_read(bool fnt, unsigned int offset, void *dst,
+                                unsigned int len);
+static int sim_cart_find(const char *path);
+
+
+static struct sim_cart sim;
+
+/*
+ * Definitions of the SDK objects the simulation replaces.
+ */
+unsigned int fat_dma_channel;
+struct fat_volume fat_volume;
+
+
+bool sim_cart_init(const char *path)
+{
+  memset(&sim, 0, sizeof sim);
+
+  if (!ndsrom_open(&sim.rom, path, false)) {
+    return false;
+  }
+
+  sim.open = true;
+
+  unsigned int control = sim.rom.header->port_normal;
+  unsigned int gap1 = control & ROMCTRL_GAP1_MASK;
+  unsigned int cycles = control & ROMCTRL_SLOW_CLOCK ? SLOW_CLOCK_CYCLES
+                                                     : FAST_CLOCK_CYCLES;
+
+  if (gap1 == 0) {
+    gap1 = SIM_CART_DEFAULT_GAP1;
+  }
+
+  sim.timing.call_cycles = SIM_CART_CALL_CYCLES;
+  sim.timing.command_cycles = (COMMAND_BYTES + gap1) * cycles;
+  sim.timing.block_cycles = CART_BLOCK_SIZE * cycles;
+
+  return true;
+}
+
+void sim_cart_shutdown(void)
+{
+  if (sim.open) {
+    ndsrom_close(&sim.rom);
+  }
+
+  memset(&sim, 0, sizeof sim);
+  memset(&fat_volume, 0, sizeof fat_volume);
+}
+
+const struct ndsrom *sim_cart_rom(void)
+{
+  return &sim.rom;
+}
+
+void sim_cart_get_timing(struct sim_cart_timing *timing)
+{
+  *timing = sim.timing;
+}
+
+void sim_cart_set_timing(const struct sim_cart_timing *timing)
+{
+  sim.timing = *timing;
+}
+
+void sim_cart_set_tick(void (*tick)(unsigned int cycles))
+{
+  sim.tick = tick;
+}
+
+void sim_cart_get_stats(struct sim_cart_stats *stats)
+{
+  *stats = sim.stats;
+}
+
+void sim_cart_reset_stats(void)
+{
+  memset(&sim.stats, 0, sizeof sim.stats);
+}
+
+void sim_cart_print_report(FILE *out)
+{
+  struct sim_cart_stats *s = &sim.stats;
+  unsigned long long transferred = s->blocks * CART_BLOCK_SIZE;
+
+  fprintf(out, "cart reads    %10llu (%llu DMA, %llu file table)\n",
+          s->reads, s->dma_reads, s->table_reads);
+  fprintf(out, "blocks        %10llu\n", s->blocks);
+  fprintf(out, "bytes         %10llu (%llu transferred, %.1f%% used)\n",
+          s->bytes, transferred,
+          transferred > 0 ? s->bytes * 100.0 / transferred : 100.0);
+  fprintf(out, "time          %10.3f ms (%llu cycles)\n",
+          s->cycles * 1000.0 / BUS_CLOCK, s->cycles);
+
+  if (s->cycles > 0) {
+    fprintf(out, "throughput    %10.1f KiB/s\n",
+            s->bytes / 1024.0 / ((double)s->cycles / BUS_CLOCK));
+  }
+}
+
+// ----------------------------------------------------------------------------
+//  cart.h
+// ----------------------------------------------------------------------------
+
+void ndk_cart_read(unsigned dma_channel, unsigned int src, void *dst,
+                   unsigned int count, void (*cb)(int), int cb_arg,
+                   bool async)
+{
+  unsigned int first = src / CART_BLOCK_SIZE;
+  unsigned int last = (src + count + CART_BLOCK_SIZE - 1) / CART_BLOCK_SIZE;
+  unsigned int blocks = count > 0 ? last - first : 0;
+  unsigned int cycles = sim.timing.call_cycles +
+                        blocks * (sim.timing.command_cycles +
+                                  sim.timing.block_cycles);
+  unsigned int n = 0;
+
+  if (src < sim.rom.size) {
+    n = sim.rom.size - src < count ? sim.rom.size - src : count;
+    memcpy(dst, sim.rom.data + src, n);
+  }
+
+  memset((char *)dst + n, OPEN_BUS, count - n);
+
+  sim.stats.reads++;
+  sim.stats.table_reads += sim.table_read;
+  sim.stats.blocks += blocks;
+  sim.stats.bytes += count;
+  sim.stats.cycles += cycles;
+
+  if (dma_channel <= 3 && src % CART_BLOCK_SIZE == 0 &&
+      ((unsigned long)dst & 3) == 0 && count % CART_BLOCK_SIZE == 0) {
+    sim.stats.dma_reads++;
+  }
+
+  if (sim.tick != NULL) {
+    sim.tick(cycles);
+  }
+
+  if (cb != NULL) {
+    cb(cb_arg);
+  }
+}
+
+// ----------------------------------------------------------------------------
+//  file.h
+// ----------------------------------------------------------------------------
+
+void ndk_fat_mount(unsigned int dma_number)
+{
+  const struct ndsrom_header *h = sim.rom.header;
+
+  fat_dma_channel = dma_number;
+
+  memset(&fat_volume, 0, sizeof fat_volume);
+  memcpy(fat_volume.name, "rom", 4);
+  fat_volume.fat_table_size = h->fat_size;
+  fat_volume.fnt_table_size = h->fnt_size;
+  fat_volume.fat_rom_offset = h->fat_offset;
+  fat_volume.fnt_rom_offset = h->fnt_offset;
+  fat_volume.fn_1 = &sim_cart_volume_read;
+  fat_volume.fn_2 = &sim_cart_volume_write;
+  fat_volume.fn_3 = &sim_cart_volume_read;
+
+  sim.mounted = true;
+}
+
+int ndk_fat_cache_file_tables(void *cache, int size)
+{
+  int fat_size = (fat_volume.fat_table_size + 3) & ~3;
+  int total = fat_size + fat_volume.fnt_table_size;
+
+  if (cache == NULL || size < total || fat_volume.cache != NULL) {
+    return total;
+  }
+
+  char *p = cache;
+
+  sim_cart_table_read(false, 0, p, fat_volume.fat_table_size);
+  sim_cart_table_read(true, 0, p + fat_size, fat_volume.fnt_table_size);
+
+  fat_volume.cache = cache;
+  fat_volume.fat = (struct fat_entry *)p;
+  fat_volume.fnt = (struct fnt_entry *)(p + fat_size);
+
+  return total;
+}
+
+bool ndk_fat_mounted()
+{
+  return sim.mounted;
+}
+
+void ndk_file_init_handle(struct file *h)
+{
+  memset(h, 0, sizeof *h);
+  h->operation = FILE_OPERATION_NONE;
+}
+
+bool ndk_file_seek(struct file *h, int offset, int whence)
+{
+  int base;
+
+  switch (whence) {
+    case FILE_SEEK_SET:
+      base = h->start_offset;
+      break;
+    case FILE_SEEK_CURR:
+      base = h->current_offset;
+      break;
+    case FILE_SEEK_END:
+      base = h->end_offset;
+      break;
+    default:
+      return false;
+  }
+
+  long long pos = (long long)base + offset;
+
+  if (pos < h->start_offset) {
+    pos = h->start_offset;
+  } else if (pos > h->end_offset) {
+    pos = h->end_offset;
+  }
+
+  h->current_offset = (int)pos;
+
+  return true;
+}
+
+int ndk_file_read(struct file *h, void *dest, int count)
+{
+  return ndk_file_read_impl(h, dest, count, false);
+}
+
+int ndk_file_read_impl(struct file *h, void *dest, int count, bool async)
+{
+  if (h->volume == NULL || count < 0) {
+    return -1;
+  }
+
+  int left = h->end_offset - h->current_offset;
+  int n = count < left ? count : left;
+
+  h->dest = (int)(long)dest;
+  h->count = count;
+  h->real_count = n;
+
+  if (n > 0) {
+    h->error = h->volume->fn_1(h->volume, dest, h->current_offset, n);
+
+    if (h->error != 0) {
+      return -1;
+    }
+  }
+
+  h->current_offset += n;
+
+  return n;
+}
+
+bool ndk_file_open(struct file *h, char *filename)
+{
+  struct fat_handle f = { &fat_volume, -1 };
+
+  if (!ndk_fat_get_fat_id_from_filename(&f, filename)) {
+    return false;
+  }
+
+  return ndk_file_open_by_fat_id(h, &fat_volume, f.id);
+}
+
+void ndk_file_close(struct file *h)
+{
+  h->volume = NULL;
+  h->operation = FILE_OPERATION_NONE;
+}
+
+bool ndk_fat_get_fat_id_from_filename(struct fat_handle *f, char *filename)
+{
+  if (!sim.mounted) {
+    return false;
+  }
+
+  int id = sim_cart_find(filename);
+
+  if (id < 0) {
+    return false;
+  }
+
+  f->id = id;
+
+  return true;
+}
+
+bool ndk_file_open_by_fat_id(struct file *h, struct fat_volume *fs, int FAT_id)
+{
+  struct fat_entry entry;
+
+  if (!sim.mounted || FAT_id < 0 ||
+      (FAT_id + 1) * sizeof entry > fs->fat_table_size ||
+      !sim_cart_table_read(false, FAT_id * sizeof entry, &entry,
+                           sizeof entry)) {
+    return false;
+  }
+
+  if (!ndk_file_open_by_rom_range(h, fs, entry.ROM_start, entry.ROM_end, -1)) {
+    return false;
+  }
+
+  h->FAT_id = FAT_id;
+
+  return true;
+}
+
+bool ndk_file_open_by_rom_range(struct file *h, struct fat_volume *fs,
+                                int start, int end, int unk)
+{
+  if (!sim.mounted || start < 0 || end < start) {
+    return false;
+  }
+
+  h->volume = fs;
+  h->error = 0;
+  h->FAT_id = -1;
+  h->start_offset = start;
+  h->end_offset = end;
+  h->current_offset = start;
+
+  return true;
+}
+
+/*
+ * fn_1 and fn_3 of the volume, like the SDK they read with the file system
+ * DMA channel.
+ */
+int sim_cart_volume_read(struct fat_volume *volume, void *dst,
+                         unsigned int src, unsigned int len)
+{
+  ndk_cart_read(fat_dma_channel, src, dst, len, NULL, 0, false);
+
+  return 0;
+}
+
+/*
+ * The ROM can't be written, the SDK hook just returns 1.
+ */
+int sim_cart_volume_write(struct fat_volume *volume, void *dst,
+                          unsigned int src, unsigned int len)
+{
+  return 1;
+}
+
+/*
+ * Read from the FAT or the FNT, from the cache if they are cached else from
+ * the cart through fn_3.
+ */
+bool sim_cart_table_read(bool fnt, unsigned int offset, void *dst,
+                         unsigned int len)
+{
+  unsigned int size = fnt ? fat_volume.fnt_table_size
+                          : fat_volume.fat_table_size;
+
+  if (offset > size || len > size - offset) {
+    return false;
+  }
+
+  void *table = fnt ? (void *)fat_volume.fnt : (void *)fat_volume.fat;
+
+  if (fat_volume.cache != NULL) {
+    memcpy(dst, (char *)table + offset, len);
+    return true;
+  }
+
+  unsigned int rom_offset = fnt ? fat_volume.fnt_rom_offset
+                                : fat_volume.fat_rom_offset;
+
+  // A hook in fn_3 may serve the read without going to the cart, only the
+  // cart reads it makes are counted
+  sim.table_read = true;
+
+  bool ok = fat_volume.fn_3(&fat_volume, dst, rom_offset + offset, len) == 0;
+
+  sim.table_read = false;
+
+  return ok;
+}
+
+/*
+ * Walk the FNT down the path, see ndsrom_walk_dir for the layout. Every
+ * directory entry, length byte, name and sub directory id is a table read.
+ */
+int sim_cart_find(const char *path)
+{
+  int dir_id = FNT_DIR_ID_BASE;
+
+  while (*path == '/') {
+    path++;
+  }
+
+  for (int depth = 0; depth < FNT_MAX_DEPTH; depth++) {
+    const char *slash = strchr(path, '/');
+    int len = slash != NULL ? slash - path : strlen(path);
+    unsigned char entry[8];
+
+    if (!sim_cart_table_read(true, (dir_id - FNT_DIR_ID_BASE) * 8, entry,
+                             sizeof entry)) {
+      return -1;
+    }
+
+    unsigned int pos = entry[0] | entry[1] << 8 | entry[2] << 16 |
+                       entry[3] << 24;
+    int fat_id = entry[4] | entry[5] << 8;
+    int next_dir = -1;
+
+    for (;;) {
+      unsigned char type;
+      char name[0x80];
+
+      if (!sim_cart_table_read(true, pos++, &type, 1) || type == 0) {
+        return -1;
+      }
+
+      int name_len = type & 0x7f;
+
+      if (!sim_cart_table_read(true, pos, name, name_len)) {
+        return -1;
+      }
+
+      pos += name_len;
+
+      bool match = name_len == len && strncasecmp(name, path, len) == 0;
+
+      if (type & 0x80) {
+        unsigned char id[2];
+
+        if (!sim_cart_table_read(true, pos, id, 2)) {
+          return -1;
+        }
+
+        pos += 2;
+
+        if (match && slash != NULL) {
+          next_dir = id[0] | id[1] << 8;
+          break;
+        }
+      } else {
+        if (match && slash == NULL) {
+          return fat_id;
+        }
+
+        fat_id++;
+      }
+    }
+
+    path = slash + 1;
+    dir_id = next_dir;
+  }
+
+  return -1;
+}
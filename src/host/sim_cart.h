@@ -0,0 +1,108 @@
+/**
+ * Host simulation of the cart and file system layers.
+ *
+ * Implements ndk_cart_read and the file API in file.h (mount, table caching,
+ * open, seek, read and close) on top of a ROM image mapped with ndsrom.h, so
+ * code written for the ARM9 can load real data on the development host.
+ *
+ * The simulation follows the SDK where it matters for performance:
+ *
+ * - File data is read through fat_volume.fn_1 and the FAT and FNT through
+ *   fat_volume.fn_3, unless they have been cached with
+ *   ndk_fat_cache_file_tables. Hooks installed there (block_cache, io_trace)
+ *   see the same reads they would on the DS.
+ * - Opening a file by name walks the FNT one entry at a time, every piece is
+ *   a separate table read when the tables are not cached.
+ * - ndk_cart_read reads whole 512 byte blocks with one command each. A read
+ *   is counted as DMA when the file.h DMA rules are met, the time is the
+ *   same, the transfer clock is the bottleneck either way.
+ *
+ * Reads are timed in bus cycles (33.5MHz) with a latency model: a fixed cost
+ * per ndk_cart_read call for the SDK, plus a command cost (8 command bytes
+ * and the gap before the data) and a transfer cost for every block. The
+ * defaults come from the normal command ROMCTRL setting in the ROM header,
+ * see https://problemkaputt.de/gbatek.htm#dscartridgeioports
+ *
+ * Time only advances through the reads. To run together with sim_thread.h
+ * pass sim_tick to sim_cart_set_tick, a thread reading from the cart then
+ * spends the time of the read like any other work.
+ *
+ * NOTE: Reads complete before ndk_cart_read and ndk_file_read_impl return,
+ * also when async is set. Completion callbacks are called before returning.
+ */
+#ifndef HOST_SIM_CART_INCLUDE_FILE
+#define HOST_SIM_CART_INCLUDE_FILE
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "ndsrom.h"
+
+// SDK overhead of one ndk_cart_read call, an estimate
+#define SIM_CART_CALL_CYCLES 600
+
+// Used when the header has no gap1 length: ROMCTRL 0x00416657
+#define SIM_CART_DEFAULT_GAP1 0x657
+
+struct sim_cart_timing {
+  // every ndk_cart_read call
+  unsigned int call_cycles;
+  // every 512 byte block: command bytes and gap1
+  unsigned int command_cycles;
+  // every 512 byte block: data transfer
+  unsigned int block_cycles;
+};
+
+struct sim_cart_stats {
+  // ndk_cart_read calls
+  unsigned long long reads;
+  // reads that meet the DMA rules with a DMA channel set
+  unsigned long long dma_reads;
+  // reads of the FAT and FNT through fat_volume.fn_3 that reach the cart
+  unsigned long long table_reads;
+  // commands sent, one per 512 byte block
+  unsigned long long blocks;
+  // bytes asked for, blocks * 512 is what the cart transferred
+  unsigned long long bytes;
+  unsigned long long cycles;
+};
+
+/**
+ * Map a ROM image and reset the timing to the defaults of its header.
+ *
+ * @param path
+ * @return false on failure, an error has been printed to stderr
+ */
+bool sim_cart_init(const char *path);
+
+/**
+ * Unmap the image and unmount the file system.
+ */
+void sim_cart_shutdown(void);
+
+/**
+ * The mapped image, to find files and check data on the host side.
+ */
+const struct ndsrom *sim_cart_rom(void);
+
+void sim_cart_get_timing(struct sim_cart_timing *timing);
+
+void sim_cart_set_timing(const struct sim_cart_timing *timing);
+
+/**
+ * Pass the cycles of every read on, e.g. to sim_tick.
+ *
+ * @param tick NULL to only count them
+ */
+void sim_cart_set_tick(void (*tick)(unsigned int cycles));
+
+void sim_cart_get_stats(struct sim_cart_stats *stats);
+
+void sim_cart_reset_stats(void);
+
+/**
+ * Print the counters and the time they add up to.
+ */
+void sim_cart_print_report(FILE *out);
+
+#endif // HOST_SIM_CART_INCLUDE_FILE
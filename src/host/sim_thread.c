@@ -0,0 +1,1121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "sim_thread.h"
+
+#include "cpu.h"
+#include "dtcm.h"
+#include "interrupts.h"
+#include "thread.h"
+
+#define NAME_SIZE 16
+#define IRQ_DISABLED 0x80
+
+struct fiber {
+  struct thread *t;
+  ucontext_t uc;
+  void *stack;
+  thread_worker_fn *fn;
+  void *arg;
+  char name[NAME_SIZE];
+  bool sleeping;
+  bool ready_pending;
+  unsigned long long ready_time;
+  unsigned long long switches;
+  unsigned long long latency_count;
+  unsigned long long latency_sum;
+  unsigned long long latency_min;
+  unsigned long long latency_max;
+  unsigned long long latency[SIM_LATENCY_BUCKETS];
+};
+
+#define EVENT_IRQ 0
+#define EVENT_SLEEP 1
+
+struct event {
+  unsigned long long time;
+  int type;
+  // EVENT_IRQ
+  unsigned int irq_mask;
+  unsigned int period;
+  unsigned int jitter;
+  // EVENT_SLEEP
+  struct thread *t;
+};
+
+struct sim {
+  unsigned long long now;
+  unsigned int rng;
+  unsigned int switch_cycles;
+  int irq_flag;
+  // IRQ handlers are running
+  bool in_irq;
+  unsigned int pending_irqs;
+  // a thread was woken while IRQs were disabled
+  bool pending_switch;
+  int event_count;
+  struct event events[SIM_MAX_EVENTS];
+  int fiber_count;
+  struct fiber fibers[SIM_MAX_THREADS];
+  // stack of a thread that deleted itself, freed at the next switch
+  void *dead_stack;
+  unsigned char idle_stack[1024];
+};
+
+static struct fiber *sim_fiber(struct thread *t);
+static void sim_entry(int index);
+static void sim_make_ready(struct thread *t);
+static void sim_remove_thread(struct thread *t);
+static bool sim_add_event(struct event *ev);
+static void sim_fire_next_event(void);
+static void sim_deliver_irqs(void);
+static void sim_deadlock(void);
+static void sim_list_remove(struct thread_list *list, struct thread *t);
+
+
+static struct sim sim;
+
+/*
+ * Definitions of the SDK objects the simulation replaces.
+ */
+unsigned int thread_switch_lock;
+int thread_id_count;
+thread_switch_fn *thread_post_stop_fn;
+struct thread **current_thread;
+bool thread_subsystem_initialized;
+__typeof__(thread_base) thread_base;
+struct thread main_thread;
+struct thread idle_thread;
+struct thread_list waiting_irq_thread_list;
+ndk_irq_handler_fn *irq_handlers[16];
+volatile unsigned int thread_irq_bits;
+
+// External definitions of the inline functions in thread.h
+extern inline void ndk_thread_critical_enter(int *lock);
+extern inline void ndk_thread_critical_leave(int *lock);
+
+
+void sim_init(unsigned int seed, unsigned int switch_cycles)
+{
+  memset(&sim, 0, sizeof sim);
+
+  sim.rng = seed != 0 ? seed : 1;
+  sim.switch_cycles = switch_cycles;
+
+  thread_switch_lock = 0;
+  thread_id_count = 0;
+  thread_post_stop_fn = NULL;
+  current_thread = &thread_base.current;
+  memset(&thread_base, 0, sizeof thread_base);
+  memset(&waiting_irq_thread_list, 0, sizeof waiting_irq_thread_list);
+  memset(irq_handlers, 0, sizeof irq_handlers);
+  thread_irq_bits = 0;
+
+  ndk_thread_init();
+}
+
+void sim_shutdown(void)
+{
+  for (int i = 0; i < sim.fiber_count; i++) {
+    if (sim.fibers[i].t != &main_thread) {
+      free(sim.fibers[i].stack);
+    }
+  }
+
+  free(sim.dead_stack);
+
+  memset(&sim, 0, sizeof sim);
+  thread_subsystem_initialized = false;
+}
+
+unsigned long long sim_now(void)
+{
+  return sim.now;
+}
+
+void sim_tick(unsigned int cycles)
+{
+  unsigned long long remaining = cycles;
+
+  for (;;) {
+    struct event *next = sim.event_count > 0 ? &sim.events[0] : NULL;
+
+    if (next == NULL || next->time > sim.now + remaining) {
+      sim.now += remaining;
+      return;
+    }
+
+    // Work done up to the event, then the event may preempt this thread.
+    remaining -= next->time - sim.now;
+    sim.now = next->time;
+    sim_fire_next_event();
+  }
+}
+
+bool sim_add_irq_source(unsigned int irq_mask, unsigned int period,
+                        unsigned int jitter)
+{
+  struct event ev = {
+    .time = sim.now + period + sim_random(jitter),
+    .type = EVENT_IRQ,
+    .irq_mask = irq_mask,
+    .period = period,
+    .jitter = jitter
+  };
+
+  return sim_add_event(&ev);
+}
+
+void sim_raise_irq(unsigned int irq_mask)
+{
+  sim.pending_irqs |= irq_mask;
+
+  if (sim.irq_flag == 0) {
+    sim_deliver_irqs();
+  }
+}
+
+void sim_thread_name(struct thread *t, const char *name)
+{
+  struct fiber *f = sim_fiber(t);
+
+  if (f != NULL) {
+    snprintf(f->name, NAME_SIZE, "%s", name);
+  }
+}
+
+unsigned int sim_random(unsigned int range)
+{
+  // xorshift32
+  sim.rng ^= sim.rng << 13;
+  sim.rng ^= sim.rng >> 17;
+  sim.rng ^= sim.rng << 5;
+
+  return range > 0 ? sim.rng % range : 0;
+}
+
+void sim_print_report(FILE *out)
+{
+  fprintf(out, "virtual time %.3f ms\n\n", sim.now * 1000.0 / SIM_CLOCK);
+  fprintf(out, "%-16s %4s %4s %9s %9s %9s %9s %9s %9s\n", "thread", "id",
+          "prio", "switches", "wakeups", "min us", "mean us", "p99 us",
+          "max us");
+
+  for (int i = 0; i < sim.fiber_count; i++) {
+    struct fiber *f = &sim.fibers[i];
+    unsigned long long p99 = 0;
+
+    // Upper bound of the bucket holding the 99th percentile
+    unsigned long long target = (f->latency_count * 99 + 99) / 100;
+    unsigned long long seen = 0;
+
+    for (int b = 0; b < SIM_LATENCY_BUCKETS && f->latency_count > 0; b++) {
+      seen += f->latency[b];
+
+      if (seen >= target) {
+        p99 = (1ULL << b) - 1;
+        p99 = p99 > f->latency_max ? f->latency_max : p99;
+        break;
+      }
+    }
+
+    double us = 1000000.0 / SIM_CLOCK;
+
+    fprintf(out, "%-16s %4d %4d %9llu %9llu %9.2f %9.2f %9.2f %9.2f\n",
+            f->name, f->t->id, f->t->priority, f->switches, f->latency_count,
+            f->latency_min * us,
+            f->latency_count ? f->latency_sum * us / f->latency_count : 0.0,
+            p99 * us, f->latency_max * us);
+  }
+
+  fprintf(out, "\nscheduling latency histogram (cycles, log2 buckets)\n");
+
+  for (int i = 0; i < sim.fiber_count; i++) {
+    struct fiber *f = &sim.fibers[i];
+
+    if (f->latency_count == 0) {
+      continue;
+    }
+
+    fprintf(out, "%s:\n", f->name);
+
+    for (int b = 0; b < SIM_LATENCY_BUCKETS; b++) {
+      if (f->latency[b] == 0) {
+        continue;
+      }
+
+      int bar = (int)(f->latency[b] * 50 / f->latency_count);
+
+      fprintf(out, "  < %10llu %9llu ", 1ULL << b, f->latency[b]);
+
+      for (int j = 0; j < bar; j++) {
+        fputc('#', out);
+      }
+
+      fputc('\n', out);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+//  cpu.h
+// ----------------------------------------------------------------------------
+
+int ndk_cpu_enable_irq(void)
+{
+  return ndk_cpu_write_irq_flag(0);
+}
+
+int ndk_cpu_disable_irq(void)
+{
+  return ndk_cpu_write_irq_flag(IRQ_DISABLED);
+}
+
+int ndk_cpu_write_irq_flag(int value)
+{
+  int old = sim.irq_flag;
+
+  sim.irq_flag = value & IRQ_DISABLED;
+
+  if (sim.irq_flag == 0 && (sim.pending_irqs != 0 || sim.pending_switch)) {
+    sim_deliver_irqs();
+  }
+
+  return old;
+}
+
+int ndk_cpu_get_current_mode(void)
+{
+  return sim.in_irq ? CPU_MODE_IRQ : CPU_MODE_SYSTEM;
+}
+
+// The host has no data cache to maintain
+
+void ndk_cpu_invalidate_dcache_lines(void *address, int size)
+{
+}
+
+void ndk_cpu_clean_and_invalidate_dcache_lines(void *address, int size)
+{
+}
+
+void ndk_cpu_halt_and_wake_on_irq(void)
+{
+  if (sim.event_count == 0) {
+    sim_deadlock();
+  }
+
+  sim.now = sim.events[0].time;
+  sim_fire_next_event();
+}
+
+// ----------------------------------------------------------------------------
+//  interrupts.h
+// ----------------------------------------------------------------------------
+
+void ndk_irq_set_handler(unsigned int irq_mask, ndk_irq_handler_fn *handler)
+{
+  for (int i = 0; i < 16; i++) {
+    if (irq_mask & (1 << i)) {
+      irq_handlers[i] = handler;
+    }
+  }
+}
+
+void ndk_thread_wait_irq(bool clear, unsigned int irq_mask)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (clear) {
+    thread_irq_bits &= ~irq_mask;
+  }
+
+  while ((thread_irq_bits & irq_mask) == 0) {
+    ndk_thread_yield(&waiting_irq_thread_list);
+  }
+
+  thread_irq_bits &= ~irq_mask;
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_wait_vblank_intr(void)
+{
+  ndk_thread_wait_irq(true, 1);
+}
+
+// ----------------------------------------------------------------------------
+//  thread.h
+// ----------------------------------------------------------------------------
+
+bool ndk_thread_is_subsystem_initialized()
+{
+  return thread_subsystem_initialized;
+}
+
+void ndk_thread_set_exit_fn(struct thread *t, thread_exit_fn *exit)
+{
+  t->exit_fn = exit;
+}
+
+void ndk_thread_idle_cpu_fn(void *arg)
+{
+  ndk_cpu_enable_irq();
+
+  for (;;) {
+    ndk_cpu_halt_and_wake_on_irq();
+  }
+}
+
+thread_switch_fn *ndk_thread_set_pre_resume_fn(thread_switch_fn *fn)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  thread_switch_fn *prev = thread_base.pre_resume_fn;
+  thread_base.pre_resume_fn = fn;
+
+  ndk_thread_critical_leave(&lock);
+
+  return prev;
+}
+
+void ndk_thread_sleep(int milis)
+{
+  int lock;
+  struct fiber *f = sim_fiber(thread_base.current);
+  struct event ev = {
+    .time = sim.now + (unsigned long long)milis * SIM_CLOCK / 1000,
+    .type = EVENT_SLEEP,
+    .t = thread_base.current
+  };
+
+  ndk_thread_critical_enter(&lock);
+
+  if (sim_add_event(&ev)) {
+    f->sleeping = true;
+
+    while (f->sleeping) {
+      ndk_thread_yield(NULL);
+    }
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+int ndk_thread_get_priority(struct thread *t)
+{
+  return t->priority;
+}
+
+bool ndk_thread_set_priority(struct thread *t, int priority)
+{
+  int lock;
+
+  if (priority < 0 || priority > 31) {
+    return false;
+  }
+
+  ndk_thread_critical_enter(&lock);
+
+  if (t->status == 2) {
+    ndk_thread_critical_leave(&lock);
+    return false;
+  }
+
+  ndk_thread_remove_from_priority_list(t);
+  t->priority = priority;
+  ndk_thread_add_to_priority_list(t);
+
+  ndk_thread_switch();
+
+  ndk_thread_critical_leave(&lock);
+
+  return true;
+}
+
+void ndk_thread_push_back(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  // Re-inserting puts the thread after all threads of the same priority.
+  ndk_thread_remove_from_priority_list(thread_base.current);
+  ndk_thread_add_to_priority_list(thread_base.current);
+
+  ndk_thread_switch();
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_thread_switch(void)
+{
+  if (thread_switch_lock != 0) {
+    return;
+  }
+
+  struct thread *current = thread_base.current;
+  struct thread *next = ndk_thread_get_scheduled();
+
+  if (next == current || next == NULL) {
+    return;
+  }
+
+  struct fiber *from = sim_fiber(current);
+  struct fiber *to = sim_fiber(next);
+
+  if (thread_post_stop_fn != NULL) {
+    thread_post_stop_fn(current, next);
+  }
+
+  if (thread_base.pre_resume_fn != NULL) {
+    thread_base.pre_resume_fn(current, next);
+  }
+
+  sim.now += sim.switch_cycles;
+
+  to->switches++;
+
+  if (to->ready_pending) {
+    unsigned long long latency = sim.now - to->ready_time;
+    int bucket = 0;
+
+    while (bucket < SIM_LATENCY_BUCKETS - 1 && (1ULL << bucket) <= latency) {
+      bucket++;
+    }
+
+    to->ready_pending = false;
+    to->latency[bucket]++;
+    to->latency_sum += latency;
+    to->latency_max = latency > to->latency_max ? latency : to->latency_max;
+    to->latency_min = to->latency_count == 0 || latency < to->latency_min
+                    ? latency : to->latency_min;
+    to->latency_count++;
+  }
+
+  thread_base.current = next;
+
+  if (current->status == 2) {
+    // Can't free the stack we are running on. Free it after the switch.
+    free(sim.dead_stack);
+    sim.dead_stack = from->stack;
+    from->stack = NULL;
+    setcontext(&to->uc);
+  }
+
+  // The IRQ state belongs to the thread.
+  int irq_flag = sim.irq_flag;
+
+  swapcontext(&from->uc, &to->uc);
+
+  sim.irq_flag = irq_flag;
+}
+
+struct thread *ndk_thread_get_scheduled(void)
+{
+  for (struct thread *t = thread_base.priority_list; t != NULL;
+       t = t->priority_next) {
+    if (t->status == 1) {
+      return t;
+    }
+  }
+
+  return NULL;
+}
+
+void ndk_thread_schedule(struct thread *t)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  sim_make_ready(t);
+  ndk_thread_switch();
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_thread_schedule_list(struct thread_list *list)
+{
+  int lock;
+  struct thread *t;
+
+  ndk_thread_critical_enter(&lock);
+
+  while ((t = ndk_thread_pop_from_waiting_list(list)) != NULL) {
+    t->waiting_list = NULL;
+    sim_make_ready(t);
+  }
+
+  ndk_thread_switch();
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_thread_yield(struct thread_list *waiting_list)
+{
+  int lock;
+  struct thread *current = thread_base.current;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (waiting_list != NULL) {
+    current->waiting_list = waiting_list;
+    ndk_thread_add_to_waiting_list(waiting_list, current);
+  }
+
+  current->status = 0;
+  ndk_thread_switch();
+
+  ndk_thread_critical_leave(&lock);
+}
+
+bool ndk_thread_has_been_removed(struct thread *t)
+{
+  return t->status == 2;
+}
+
+void ndk_thread_delete(struct thread *t)
+{
+  int lock;
+
+  if (t == thread_base.current) {
+    ndk_thread_delete_self();
+  }
+
+  ndk_thread_critical_enter(&lock);
+
+  if (t->status != 2) {
+    sim_remove_thread(t);
+    ndk_thread_switch();
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_thread_delete_self(void)
+{
+  ndk_cpu_disable_irq();
+
+  sim_remove_thread(thread_base.current);
+  ndk_thread_switch();
+
+  // Only reached if the scheduler is locked.
+  abort();
+}
+
+void ndk_thread_exit(void)
+{
+  struct thread *t = thread_base.current;
+
+  if (t->exit_fn != NULL) {
+    t->exit_fn(0);
+  }
+
+  ndk_thread_delete_self();
+}
+
+void ndk_thread_create(struct thread *t, thread_worker_fn *fn, void *arg,
+                       void *stack_top, int size, int priority)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  struct fiber *f = sim_fiber(t);
+
+  if (f == NULL) {
+    if (sim.fiber_count == SIM_MAX_THREADS) {
+      fprintf(stderr, "sim: too many threads\n");
+      abort();
+    }
+
+    f = &sim.fibers[sim.fiber_count++];
+  } else {
+    ndk_thread_remove_from_priority_list(t);
+    free(f->stack);
+  }
+
+  memset(f, 0, sizeof *f);
+  memset(t, 0, sizeof *t);
+
+  f->t = t;
+  f->fn = fn;
+  f->arg = arg;
+  f->stack = malloc(SIM_STACK_SIZE);
+
+  snprintf(f->name, NAME_SIZE, "thread %d", thread_id_count);
+
+  getcontext(&f->uc);
+  f->uc.uc_stack.ss_sp = f->stack;
+  f->uc.uc_stack.ss_size = SIM_STACK_SIZE;
+  f->uc.uc_link = NULL;
+  makecontext(&f->uc, (void (*)(void))sim_entry, 1, (int)(f - sim.fibers));
+
+  t->id = ndk_thread_create_id();
+  t->priority = priority;
+  t->status = 0;
+  // Same layout as the SDK, the stack grows down from stack_top
+  t->stack_bottom = (char *)stack_top - size;
+  t->stack_top = stack_top;
+
+  ndk_thread_add_to_priority_list(t);
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_thread_init(void)
+{
+  if (thread_subsystem_initialized) {
+    return;
+  }
+
+  thread_subsystem_initialized = true;
+
+  // The calling host thread becomes the main thread.
+  struct fiber *f = &sim.fibers[sim.fiber_count++];
+
+  memset(&main_thread, 0, sizeof main_thread);
+  f->t = &main_thread;
+  snprintf(f->name, NAME_SIZE, "main");
+
+  main_thread.id = ndk_thread_create_id();
+  main_thread.priority = 16;
+  main_thread.status = 1;
+  ndk_thread_add_to_priority_list(&main_thread);
+  thread_base.current = &main_thread;
+
+  ndk_thread_create(&idle_thread, &ndk_thread_idle_cpu_fn, NULL,
+                    sim.idle_stack + sizeof sim.idle_stack,
+                    sizeof sim.idle_stack, 31);
+  sim_thread_name(&idle_thread, "idle");
+  idle_thread.status = 1;
+}
+
+void ndk_thread_remove_from_priority_list(struct thread *t)
+{
+  struct thread **p = &thread_base.priority_list;
+
+  while (*p != NULL && *p != t) {
+    p = &(*p)->priority_next;
+  }
+
+  if (*p == t) {
+    *p = t->priority_next;
+    t->priority_next = NULL;
+  }
+}
+
+void ndk_thread_add_to_priority_list(struct thread *t)
+{
+  struct thread **p = &thread_base.priority_list;
+
+  while (*p != NULL && (*p)->priority <= t->priority) {
+    p = &(*p)->priority_next;
+  }
+
+  t->priority_next = *p;
+  *p = t;
+}
+
+struct thread *ndk_thread_remove_from_waiting_list(struct thread_list *list,
+                                                   struct thread *t)
+{
+  for (struct thread *i = list->first; i != NULL; i = i->waiting_node.next) {
+    if (i == t) {
+      sim_list_remove(list, t);
+      return t;
+    }
+  }
+
+  return NULL;
+}
+
+struct thread *ndk_thread_pop_from_waiting_list(struct thread_list *list)
+{
+  struct thread *t = list->first;
+
+  if (t != NULL) {
+    sim_list_remove(list, t);
+  }
+
+  return t;
+}
+
+void ndk_thread_add_to_waiting_list(struct thread_list *list,
+                                    struct thread *t)
+{
+  struct thread *next = list->first;
+
+  while (next != NULL && next->priority <= t->priority) {
+    next = next->waiting_node.next;
+  }
+
+  struct thread *prev = next != NULL ? next->waiting_node.prev : list->last;
+
+  t->waiting_node.next = next;
+  t->waiting_node.prev = prev;
+
+  if (prev != NULL) {
+    prev->waiting_node.next = t;
+  } else {
+    list->first = t;
+  }
+
+  if (next != NULL) {
+    next->waiting_node.prev = t;
+  } else {
+    list->last = t;
+  }
+}
+
+int ndk_thread_create_id(void)
+{
+  return thread_id_count++;
+}
+
+// ----------------------------------------------------------------------------
+//  Mutex API
+// ----------------------------------------------------------------------------
+
+void ndk_thread_remove_mutex_from_held_by_me(struct thread *holder,
+                                             struct mutex *m)
+{
+  struct mutex_list *list = &holder->held_by_me;
+
+  if (m->elem.prev != NULL) {
+    m->elem.prev->elem.next = m->elem.next;
+  } else {
+    list->first = m->elem.next;
+  }
+
+  if (m->elem.next != NULL) {
+    m->elem.next->elem.prev = m->elem.prev;
+  } else {
+    list->last = m->elem.prev;
+  }
+
+  m->elem.next = NULL;
+  m->elem.prev = NULL;
+}
+
+void ndk_thread_add_mutex_to_held_by_me(struct thread *holder,
+                                        struct mutex *m)
+{
+  struct mutex_list *list = &holder->held_by_me;
+
+  m->elem.next = NULL;
+  m->elem.prev = list->last;
+
+  if (list->last != NULL) {
+    list->last->elem.next = m;
+  } else {
+    list->first = m;
+  }
+
+  list->last = m;
+}
+
+struct mutex *ndk_mutex_list_pop(struct mutex_list *list)
+{
+  struct mutex *m = list->first;
+
+  if (m != NULL) {
+    list->first = m->elem.next;
+
+    if (list->first != NULL) {
+      list->first->elem.prev = NULL;
+    } else {
+      list->last = NULL;
+    }
+
+    m->elem.next = NULL;
+    m->elem.prev = NULL;
+  }
+
+  return m;
+}
+
+bool ndk_mutex_trylock(struct mutex *m)
+{
+  int lock;
+  bool locked = false;
+  struct thread *current = thread_base.current;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (m->thread == NULL) {
+    m->thread = current;
+    m->lock_count = 1;
+    ndk_thread_add_mutex_to_held_by_me(current, m);
+    locked = true;
+  } else if (m->thread == current) {
+    m->lock_count++;
+    locked = true;
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return locked;
+}
+
+void ndk_thread_unlock_all_mutexes(struct thread *t)
+{
+  struct mutex *m;
+
+  while ((m = ndk_mutex_list_pop(&t->held_by_me)) != NULL) {
+    m->lock_count = 0;
+    m->thread = NULL;
+
+    // Wake without switching, the caller switches.
+    struct thread *w;
+
+    while ((w = ndk_thread_pop_from_waiting_list(&m->queue)) != NULL) {
+      w->waiting_list = NULL;
+      sim_make_ready(w);
+    }
+  }
+}
+
+void ndk_mutex_unlock(struct mutex *m)
+{
+  int lock;
+  struct thread *current = thread_base.current;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (m->thread == current && --m->lock_count == 0) {
+    ndk_thread_remove_mutex_from_held_by_me(current, m);
+    m->thread = NULL;
+    ndk_thread_schedule_list(&m->queue);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_mutex_lock(struct mutex *m)
+{
+  int lock;
+  struct thread *current = thread_base.current;
+
+  ndk_thread_critical_enter(&lock);
+
+  while (!ndk_mutex_trylock(m)) {
+    current->blocked_at = m;
+    ndk_thread_yield(&m->queue);
+    current->blocked_at = NULL;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void ndk_mutex_init(struct mutex *m)
+{
+  memset(m, 0, sizeof *m);
+}
+
+struct fiber *sim_fiber(struct thread *t)
+{
+  for (int i = 0; i < sim.fiber_count; i++) {
+    if (sim.fibers[i].t == t) {
+      return &sim.fibers[i];
+    }
+  }
+
+  return NULL;
+}
+
+void sim_entry(int index)
+{
+  struct fiber *f = &sim.fibers[index];
+
+  // A new thread starts with IRQs enabled.
+  sim.irq_flag = 0;
+
+  if (sim.pending_irqs != 0 || sim.pending_switch) {
+    sim_deliver_irqs();
+  }
+
+  f->fn(f->arg);
+
+  ndk_thread_exit();
+}
+
+void sim_make_ready(struct thread *t)
+{
+  struct fiber *f = sim_fiber(t);
+
+  if (t->status == 0) {
+    t->status = 1;
+
+    if (f != NULL && !f->ready_pending) {
+      f->ready_pending = true;
+      f->ready_time = sim.now;
+    }
+  }
+}
+
+void sim_remove_thread(struct thread *t)
+{
+  struct fiber *f = sim_fiber(t);
+
+  ndk_thread_unlock_all_mutexes(t);
+
+  if (t->waiting_list != NULL) {
+    ndk_thread_remove_from_waiting_list(t->waiting_list, t);
+    t->waiting_list = NULL;
+  }
+
+  if (f != NULL) {
+    f->sleeping = false;
+    f->ready_pending = false;
+  }
+
+  ndk_thread_remove_from_priority_list(t);
+  t->status = 2;
+
+  // Wake threads waiting for this thread to be deleted.
+  struct thread *w;
+
+  while ((w = ndk_thread_pop_from_waiting_list(&t->deleted_waiting_list))) {
+    w->waiting_list = NULL;
+    sim_make_ready(w);
+  }
+}
+
+/*
+ * Insert an event, the queue is kept sorted on time. Events at the same time
+ * keep their insertion order.
+ */
+bool sim_add_event(struct event *ev)
+{
+  if (sim.event_count == SIM_MAX_EVENTS) {
+    return false;
+  }
+
+  int i = sim.event_count++;
+
+  while (i > 0 && sim.events[i - 1].time > ev->time) {
+    sim.events[i] = sim.events[i - 1];
+    i--;
+  }
+
+  sim.events[i] = *ev;
+
+  return true;
+}
+
+/*
+ * Pop the first event and act on it. Called when the event is due.
+ */
+void sim_fire_next_event(void)
+{
+  struct event ev = sim.events[0];
+
+  sim.event_count--;
+  memmove(&sim.events[0], &sim.events[1],
+          sim.event_count * sizeof(struct event));
+
+  if (ev.type == EVENT_IRQ) {
+    ev.time += ev.period;
+    ev.time += sim_random(ev.jitter);
+    sim_add_event(&ev);
+    sim_raise_irq(ev.irq_mask);
+  } else {
+    struct fiber *f = sim_fiber(ev.t);
+
+    if (f != NULL && f->sleeping) {
+      f->sleeping = false;
+      sim_make_ready(ev.t);
+      sim.pending_switch = true;
+
+      if (sim.irq_flag == 0) {
+        sim_deliver_irqs();
+      }
+    }
+  }
+}
+
+/*
+ * Same as the SDK IRQ handler. Run the handlers, wake the threads waiting for
+ * IRQs and switch if a thread with higher priority became ready.
+ */
+void sim_deliver_irqs(void)
+{
+  unsigned int mask = sim.pending_irqs;
+
+  sim.pending_irqs = 0;
+  sim.pending_switch = false;
+
+  int old = sim.irq_flag;
+  bool old_in_irq = sim.in_irq;
+  sim.irq_flag = IRQ_DISABLED;
+  sim.in_irq = true;
+
+  for (int i = 0; i < 32; i++) {
+    if ((mask & (1u << i)) == 0) {
+      continue;
+    }
+
+    if (i < 16 && irq_handlers[i] != NULL) {
+      irq_handlers[i]();
+    } else {
+      thread_irq_bits |= 1u << i;
+    }
+  }
+
+  sim.in_irq = old_in_irq;
+
+  struct thread *t;
+
+  while ((t = ndk_thread_pop_from_waiting_list(&waiting_irq_thread_list))) {
+    t->waiting_list = NULL;
+    sim_make_ready(t);
+  }
+
+  ndk_thread_switch();
+
+  sim.irq_flag = old;
+}
+
+void sim_deadlock(void)
+{
+  fprintf(stderr, "sim: deadlock at %llu cycles, no thread can run and no "
+                  "event is pending\n", sim.now);
+
+  for (int i = 0; i < sim.fiber_count; i++) {
+    struct thread *t = sim.fibers[i].t;
+
+    fprintf(stderr, "  %-16s status %d blocked at %p waiting list %p\n",
+            sim.fibers[i].name, t->status, (void *)t->blocked_at,
+            (void *)t->waiting_list);
+  }
+
+  exit(2);
+}
+
+void sim_list_remove(struct thread_list *list, struct thread *t)
+{
+  struct thread *prev = t->waiting_node.prev;
+  struct thread *next = t->waiting_node.next;
+
+  if (prev != NULL) {
+    prev->waiting_node.next = next;
+  } else {
+    list->first = next;
+  }
+
+  if (next != NULL) {
+    next->waiting_node.prev = prev;
+  } else {
+    list->last = prev;
+  }
+
+  t->waiting_node.next = NULL;
+  t->waiting_node.prev = NULL;
+}
@@ -0,0 +1,117 @@
+/**
+ * Host simulation of the thread and mutex subsystem.
+ *
+ * Implements the API in thread.h (and the parts of cpu.h and interrupts.h the
+ * scheduler depends on) on top of ucontext so code written for the ARM9 can
+ * be run and measured on the development host.
+ *
+ * The simulation follows the scheduler semantics of the SDK:
+ *
+ * - The thread to run is always the first scheduled thread in the priority
+ *   list. Threads are never time sliced, a running thread is only preempted
+ *   when an IRQ wakes up a thread with higher priority.
+ * - ndk_thread_yield with a waiting list inserts the thread in priority order,
+ *   ndk_thread_schedule_list wakes every thread in the list.
+ * - Mutexes are recursive, lock_count is the recursion count. On unlock all
+ *   blocked threads are woken up and compete for the mutex again, there is no
+ *   direct hand-off to the first waiter.
+ * - While thread_switch_lock is non-zero no context switches take place.
+ * - IRQs raised while IRQs are disabled are delivered when they are enabled
+ *   again.
+ *
+ * Time is virtual. It's counted in bus cycles (33.5MHz) like the hardware
+ * timers and only advances when a thread calls sim_tick to account for work it
+ * does, or when the idle thread waits for the next event. IRQ sources fire
+ * periodically with a pseudo random jitter. Given the same seed a simulation
+ * always produces the same interleaving.
+ *
+ * Scheduling latency, the time from a thread being woken up until it's
+ * resumed, is recorded per thread. Print the distributions with
+ * sim_print_report.
+ *
+ * NOTE: Every thread gets a host stack of SIM_STACK_SIZE bytes. The stack
+ * passed to ndk_thread_create is only recorded in stack_bottom and stack_top.
+ */
+#ifndef HOST_SIM_THREAD_INCLUDE_FILE
+#define HOST_SIM_THREAD_INCLUDE_FILE
+
+#include <stdio.h>
+
+#include "thread.h"
+
+#define SIM_CLOCK 33513982
+#define SIM_MAX_THREADS 64
+#define SIM_MAX_EVENTS 64
+#define SIM_STACK_SIZE (256 * 1024)
+#define SIM_LATENCY_BUCKETS 32
+
+// Cycles per frame at 59.8261Hz
+#define SIM_FRAME_CYCLES 560190
+
+/**
+ * Initialize the simulation. The calling host thread becomes main_thread and
+ * the idle thread is created.
+ *
+ * @param seed for the jitter of IRQ sources
+ * @param switch_cycles cycles charged for every context switch
+ */
+void sim_init(unsigned int seed, unsigned int switch_cycles);
+
+/**
+ * Release all host resources. Call from the main thread when done.
+ */
+void sim_shutdown(void);
+
+/**
+ * Current virtual time.
+ *
+ * @return bus cycles since sim_init
+ */
+unsigned long long sim_now(void);
+
+/**
+ * Account for work done by the current thread. IRQs that become due during
+ * the work are delivered and may preempt the thread.
+ *
+ * @param cycles bus cycles
+ */
+void sim_tick(unsigned int cycles);
+
+/**
+ * Add a periodic IRQ source.
+ *
+ * @param irq_mask IRQ bits raised
+ * @param period cycles between two IRQs
+ * @param jitter every IRQ is delayed by a random amount in [0, jitter)
+ * @return false if the event queue is full
+ */
+bool sim_add_irq_source(unsigned int irq_mask, unsigned int period,
+                        unsigned int jitter);
+
+/**
+ * Raise IRQs now. Runs the handlers set with ndk_irq_set_handler and wakes
+ * threads waiting in ndk_thread_wait_irq.
+ *
+ * @param irq_mask
+ */
+void sim_raise_irq(unsigned int irq_mask);
+
+/**
+ * Give a thread a name used in reports.
+ */
+void sim_thread_name(struct thread *t, const char *name);
+
+/**
+ * Pseudo random number from the simulation seed.
+ *
+ * @return value in [0, range)
+ */
+unsigned int sim_random(unsigned int range);
+
+/**
+ * Print the number of context switches and the scheduling latency
+ * distribution of every thread.
+ */
+void sim_print_report(FILE *out);
+
+#endif // HOST_SIM_THREAD_INCLUDE_FILE
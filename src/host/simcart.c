@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_cart.h"
+#include "sim_thread.h"
+
+#include "cart.h"
+#include "cart_sg.h"
+#include "fat_cache.h"
+#include "file.h"
+#include "memory.h"
+
+/*
+ * Load files of a ROM through the simulated cart and file API (see
+ * sim_cart.h) and print what the reads would cost on the DS.
+ *
+ * Every file, or every given path, is opened by name and read in pieces of
+ * the read size. The data is checked against the image. Per file the number
+ * of cart reads, blocks and the time is printed, followed by the totals.
+ *
+ * -c caches the file tables first, -f puts src/util/fat_cache with that
+ * many name blocks in front of them instead and prints its counters. -p
+ * loads everything that many times. -d sets the DMA channel passed to
+ * ndk_fat_mount (-1 for the CPU) and -r the size of every ndk_file_read.
+ *
+ * -s runs fixed src/util/cart_sg reads at ROM offset SG_BASE instead. Every
+ * case checks the data and that the cart transferred the expected number of
+ * blocks, i.e. no block was read twice and gaps were only read where that
+ * saves a command.
+ *
+ * Usage: simcart [-c | -f blocks] [-p passes] [-d dma] [-r read size]
+ *                <ROM file> [path...]
+ *        simcart -s [-d dma] <ROM file>
+ */
+
+#define BUS_CLOCK 33513982
+
+// Past the secure area, like the first file data of a real ROM
+#define SG_BASE 0x8000
+#define SG_MAX_PARTS 3
+#define SG_BUF_SIZE (16 * CART_BLOCK_SIZE)
+
+// fat_cache keeps addresses in 32 bits, see the makefile
+#define FAT_CACHE_MEM_SIZE (256 * 1024)
+
+struct run {
+  int read_size;
+  int errors;
+  int files;
+};
+
+struct sg_case {
+  const char *name;
+  int count;
+  struct {
+    // from SG_BASE
+    unsigned int offset;
+    unsigned int size;
+    // from a 32 byte aligned buffer
+    unsigned int dst;
+  } parts[SG_MAX_PARTS];
+  // blocks the cart has to transfer
+  unsigned int blocks;
+};
+
+static struct run run;
+
+static const struct sg_case sg_cases[] = {
+  { "head, direct block, tail", 1, { { 100, 1024, 0 } }, 3 },
+  { "direct block between small", 3,
+    { { 0, 100, 0 }, { 512, 512, 0 }, { 1024, 100, 0 } }, 3 },
+  { "small, one block apart", 2, { { 0, 100, 0 }, { 1024, 100, 0 } }, 3 },
+  { "shared block", 2, { { 0, 200, 0 }, { 200, 200, 0 } }, 1 },
+  { "unaligned destination", 1, { { 100, 1024, 1 } }, 3 },
+  { "direct blocks", 1, { { 0, 8 * 512, 0 } }, 8 },
+  { "staged in pieces", 1, { { 100, 12 * 512, 1 } }, 13 }
+};
+
+static unsigned char sg_buf[SG_MAX_PARTS][SG_BUF_SIZE]
+  __attribute__((aligned(32)));
+static unsigned char fat_cache_mem[FAT_CACHE_MEM_SIZE];
+
+bool load(const char *path, int fat_id)
+{
+  const struct ndsrom *rom = sim_cart_rom();
+  uint32_t size;
+  const void *expected = ndsrom_file(rom, fat_id, &size);
+  struct sim_cart_stats before;
+  struct sim_cart_stats after;
+  struct file h;
+
+  if (expected == NULL) {
+    fprintf(stderr, "%s: outside the image\n", path);
+    run.errors++;
+    return true;
+  }
+
+  unsigned char *buf = aligned_alloc(32, (size + 31) & ~31);
+
+  sim_cart_get_stats(&before);
+  ndk_file_init_handle(&h);
+
+  if (!ndk_file_open(&h, (char *)path)) {
+    fprintf(stderr, "%s: open failed\n", path);
+    free(buf);
+    run.errors++;
+    return true;
+  }
+
+  int total = 0;
+
+  for (;;) {
+    int n = ndk_file_read(&h, buf + total, run.read_size);
+
+    if (n <= 0) {
+      break;
+    }
+
+    total += n;
+  }
+
+  ndk_file_close(&h);
+  sim_cart_get_stats(&after);
+
+  if (total != size || memcmp(buf, expected, size) != 0) {
+    fprintf(stderr, "%s: data differs from the image\n", path);
+    run.errors++;
+  }
+
+  printf("%8u %6llu %6llu %10.1f  %s\n", size, after.reads - before.reads,
+         after.blocks - before.blocks,
+         (after.cycles - before.cycles) * 1000000.0 / BUS_CLOCK, path);
+
+  free(buf);
+  run.files++;
+
+  return true;
+}
+
+bool load_fn(const char *path, int fat_id, void *arg)
+{
+  return load(path, fat_id);
+}
+
+bool run_sg_case(const struct sg_case *c)
+{
+  const struct ndsrom *rom = sim_cart_rom();
+  struct cart_sg list[SG_MAX_PARTS];
+  struct sim_cart_stats before;
+  struct sim_cart_stats after;
+
+  memset(sg_buf, 0, sizeof sg_buf);
+
+  for (int i = 0; i < c->count; i++) {
+    list[i].rom_offset = SG_BASE + c->parts[i].offset;
+    list[i].dst = sg_buf[i] + c->parts[i].dst;
+    list[i].size = c->parts[i].size;
+  }
+
+  sim_cart_get_stats(&before);
+  cart_sg_read(list, c->count, NULL, 0);
+  sim_cart_get_stats(&after);
+
+  bool data_ok = true;
+
+  for (int i = 0; i < c->count; i++) {
+    data_ok &= memcmp(sg_buf[i] + c->parts[i].dst,
+                      rom->data + SG_BASE + c->parts[i].offset,
+                      c->parts[i].size) == 0;
+  }
+
+  unsigned int blocks = after.blocks - before.blocks;
+  bool ok = data_ok && blocks == c->blocks;
+
+  printf("%-28s %6u bytes transferred, expected %6u  %s%s\n", c->name,
+         blocks * CART_BLOCK_SIZE, c->blocks * CART_BLOCK_SIZE,
+         ok ? "ok" : "FAILED", data_ok ? "" : ", data differs");
+
+  return ok;
+}
+
+int run_sg_cases(void)
+{
+  int count = sizeof sg_cases / sizeof sg_cases[0];
+  int failed = 0;
+
+  if (sim_cart_rom()->size < SG_BASE + SG_BUF_SIZE) {
+    fprintf(stderr, "ROM too small for the cart_sg cases\n");
+    return 1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    failed += !run_sg_case(&sg_cases[i]);
+  }
+
+  printf("%d of %d cases failed\n", failed, count);
+
+  return failed;
+}
+
+void print_usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-c | -f blocks] [-p passes] [-d dma] "
+          "[-r read size]\n       %*s <ROM file> [path...]\n"
+          "       %s -s [-d dma] <ROM file>\n", name, (int)strlen(name), "",
+          name);
+}
+
+int main(int argc, char *argv[])
+{
+  bool cache = false;
+  bool sg = false;
+  int fat_cache_blocks = 0;
+  int passes = 1;
+  int dma = 3;
+  int opt;
+
+  run.read_size = 0x7fffffff;
+
+  while ((opt = getopt(argc, argv, "cf:p:d:r:s")) != -1) {
+    switch (opt) {
+      case 'c':
+        cache = true;
+        break;
+      case 'f':
+        fat_cache_blocks = atoi(optarg);
+        break;
+      case 'p':
+        passes = atoi(optarg);
+        break;
+      case 'd':
+        dma = atoi(optarg);
+        break;
+      case 'r':
+        run.read_size = atoi(optarg);
+        break;
+      case 's':
+        sg = true;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind >= argc || run.read_size <= 0 || passes <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (!sim_cart_init(argv[optind])) {
+    return 1;
+  }
+
+  sim_init(1, 0);
+  ndk_fat_mount(dma);
+
+  if (sg) {
+    int failed = run_sg_cases();
+
+    sim_cart_shutdown();
+
+    return failed == 0 ? 0 : 1;
+  }
+
+  void *tables = NULL;
+
+  if (cache) {
+    int size = ndk_fat_cache_file_tables(NULL, 0);
+
+    tables = malloc(size);
+    ndk_fat_cache_file_tables(tables, size);
+  } else if (fat_cache_blocks > 0) {
+    int size = fat_cache_size(fat_cache_blocks);
+
+    if (size > FAT_CACHE_MEM_SIZE ||
+        fat_cache_init(fat_cache_mem, size) == 0) {
+      fprintf(stderr, "can't set up fat_cache with %d blocks\n",
+              fat_cache_blocks);
+      return 1;
+    }
+
+    sim_cart_reset_stats();
+  }
+
+  printf("%8s %6s %6s %10s  %s\n", "size", "reads", "blocks", "us", "path");
+
+  for (int pass = 0; pass < passes; pass++) {
+    if (optind + 1 == argc) {
+      ndsrom_walk_files(sim_cart_rom(), &load_fn, NULL);
+    } else {
+      for (int i = optind + 1; i < argc; i++) {
+        int fat_id = ndsrom_find_file(sim_cart_rom(), argv[i]);
+
+        if (fat_id < 0) {
+          fprintf(stderr, "%s: not found\n", argv[i]);
+          run.errors++;
+          continue;
+        }
+
+        load(argv[i], fat_id);
+      }
+    }
+  }
+
+  printf("\n%d files\n", run.files);
+  sim_cart_print_report(stdout);
+
+  if (fat_cache_blocks > 0 && !cache) {
+    struct fat_cache_stats stats;
+
+    fat_cache_get_stats(&stats);
+    printf("fat_cache     %10u reads (%u FAT, %u directory, %u block hits, "
+           "%u misses)\n", stats.reads, stats.fat_hits, stats.dir_hits,
+           stats.hits, stats.misses);
+    fat_cache_disable();
+  }
+
+  sim_cart_shutdown();
+  free(tables);
+
+  return run.errors == 0 ? 0 : 1;
+}
+
+/*
+ * The SDK copies cart_sg uses, see memory.h.
+ */
+void ndk_memory_fast_32bit_copy(void *source, void *dest, int size)
+{
+  memcpy(dest, source, size);
+}
+
+void ndk_memory_copy(void *source, void *dest, int size)
+{
+  memcpy(dest, source, size);
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sim_thread.h"
+
+#include "overlay_fini.h"
+
+/*
+ * Load, unload and replace overlays on the host and check which destructors
+ * src/util/overlay_fini runs.
+ *
+ * Loading an overlay fills its slot with its image and runs the registration
+ * that ovlgen adds to its init array, unloading does what the firmware's
+ * ndk_overlay_fini_in_ram does with the global destructor chain. Every
+ * scenario compares the destructor calls with the expected ones and checks
+ * that only a resident entry of the game is left in the chain. The exit
+ * status is 1 if a scenario fails.
+ *
+ * Usage: simoverlay
+ */
+
+#define SLOTS 2
+#define SLOT_SIZE 256
+#define MAX_FINI 4
+#define LOG_SIZE 64
+// more entries than that is a loop in the chain
+#define MAX_CHAIN 16
+
+struct sim_overlay {
+  // destructor calls are logged as this letter and the array index
+  char letter;
+  int slot;
+  // where the registration's object is in the overlay's data
+  int object_offset;
+  int fini_count;
+  void (*fini_array[MAX_FINI])(void);
+  struct overlay_fini fini;
+};
+
+struct scenario {
+  const char *name;
+  // l<n> loads, u<n> unloads overlay n
+  const char *steps;
+  const char *expected;
+};
+
+static void log_call(char letter, int index);
+static void a0(void);
+static void a1(void);
+static void b0(void);
+static void c0(void);
+static void game_destructor(void *object, int flag);
+
+
+struct destructor_chain *global_destructor_chain;
+
+static char slots[SLOTS][SLOT_SIZE];
+static char log_buf[LOG_SIZE];
+
+static struct sim_overlay overlays[] = {
+  { 'a', 0, 16, 2, { &a0, &a1 } },
+  { 'b', 0, 40, 1, { &b0 } },
+  { 'c', 1, 16, 1, { &c0 } },
+  // no destructors
+  { 'e', 0, 24, 0 }
+};
+
+static const struct scenario scenarios[] = {
+  { "load, unload", "l0 u0", "a1a0" },
+  { "unload and reload", "l0 u0 l0 u0", "a1a0a1a0" },
+  { "reload without unload", "l0 l0 u0", "a1a0" },
+  { "replace without unload", "l0 l1 u1", "b0" },
+  { "replace, other slot resident", "l2 l0 l1 u2 u1", "c0b0" },
+  { "replace by empty fini array", "l0 l3 u3", "" },
+  { "replace, reload the first", "l0 l1 l0 u0", "a1a0" }
+};
+
+static int game_object;
+static struct destructor_chain game_entry = {
+  NULL, &game_destructor, &game_object
+};
+
+
+/*
+ * Fill the slot with the image, then run the init array.
+ */
+void load(struct sim_overlay *o)
+{
+  char *slot = slots[o->slot];
+  struct overlay_fini **object =
+                         (struct overlay_fini **)(slot + o->object_offset);
+
+  memset(slot, o->letter, SLOT_SIZE);
+
+  o->fini.start = o->fini_array;
+  o->fini.end = o->fini_array + o->fini_count;
+  o->fini.ram_start = slot;
+  o->fini.ram_end = slot + SLOT_SIZE;
+  *object = &o->fini;
+
+  overlay_fini_register(&o->fini, object);
+}
+
+/*
+ * What ndk_overlay_fini_in_ram does: take the entries with an object in the
+ * overlay's memory out of the chain and call their destructors.
+ */
+void unload(struct sim_overlay *o)
+{
+  char *start = slots[o->slot];
+  struct destructor_chain **p = &global_destructor_chain;
+
+  for (int n = 0; *p != NULL && n < MAX_CHAIN; n++) {
+    struct destructor_chain *link = *p;
+    char *object = link->object;
+
+    if (object >= start && object < start + SLOT_SIZE) {
+      *p = link->next;
+      link->destructor(link->object, -1);
+    } else {
+      p = &link->next;
+    }
+  }
+}
+
+bool run_scenario(const struct scenario *s)
+{
+  log_buf[0] = '\0';
+  memset(slots, 0, sizeof slots);
+  game_entry.next = NULL;
+  global_destructor_chain = &game_entry;
+
+  for (const char *p = s->steps; *p != '\0'; p++) {
+    if (*p == 'l' || *p == 'u') {
+      struct sim_overlay *o = &overlays[p[1] - '0'];
+
+      if (*p == 'l') {
+        load(o);
+      } else {
+        unload(o);
+      }
+
+      p++;
+    }
+  }
+
+  bool log_ok = strcmp(log_buf, s->expected) == 0;
+  bool chain_ok = global_destructor_chain == &game_entry &&
+                  game_entry.next == NULL;
+
+  printf("%-30s %-16s %s", s->name, s->steps,
+         log_ok && chain_ok ? "ok" : "FAILED");
+
+  if (!log_ok) {
+    printf(", destructors \"%s\", expected \"%s\"", log_buf, s->expected);
+  }
+
+  if (!chain_ok) {
+    printf(", chain not back to the game's entry");
+  }
+
+  printf("\n");
+
+  return log_ok && chain_ok;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 1) {
+    printf("Usage: simoverlay\n");
+    return 1;
+  }
+
+  int count = sizeof scenarios / sizeof scenarios[0];
+  int failed = 0;
+
+  sim_init(1, 0);
+
+  for (int i = 0; i < count; i++) {
+    failed += !run_scenario(&scenarios[i]);
+  }
+
+  printf("%d of %d scenarios failed\n", failed, count);
+
+  return failed > 0 ? 1 : 0;
+}
+
+void log_call(char letter, int index)
+{
+  int n = strlen(log_buf);
+
+  if (n + 2 < LOG_SIZE) {
+    log_buf[n] = letter;
+    log_buf[n + 1] = '0' + index;
+    log_buf[n + 2] = '\0';
+  }
+}
+
+void a0(void)
+{
+  log_call('a', 0);
+}
+
+void a1(void)
+{
+  log_call('a', 1);
+}
+
+void b0(void)
+{
+  log_call('b', 0);
+}
+
+void c0(void)
+{
+  log_call('c', 0);
+}
+
+/*
+ * A resident object of the game, must never be destroyed.
+ */
+void game_destructor(void *object, int flag)
+{
+  log_call('g', 0);
+}
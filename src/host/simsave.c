@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_backup.h"
+#include "sim_thread.h"
+
+#include "save.h"
+
+/*
+ * Run save data workloads on the simulated backup memory (see sim_backup.h).
+ *
+ * A profile of data size bytes gets a number of commits, every commit
+ * changes a few random 4 byte fields. Three ways of saving it are timed:
+ *  image    write the whole profile with one command (not crash safe)
+ *  fields   one command per changed field (not crash safe)
+ *  journal  src/util/save, dirty pages to a two slot journal
+ *
+ * With -f the journal is fuzzed instead: power is cut at a random point of
+ * every commit, then the device is rebooted and the profile loaded. It must
+ * be the data of the last or of the cut commit. The exit status is 1 if it's
+ * anything else.
+ *
+ * -t is the backup spec (see backup.h), -m the largest write in bytes.
+ *
+ * Usage: simsave [-f] [-s seed] [-t spec] [-d data size] [-n commits]
+ *        [-k changes per commit] [-m max write] <backup file>
+ */
+
+#define BUS_CLOCK 33513982
+#define MAX_DATA_SIZE 0x8000
+#define MAX_CHANGES 64
+#define FIELD_SIZE 4
+
+struct workload {
+  unsigned int seed;
+  unsigned int size;
+  int commits;
+  int changes;
+  unsigned int page_size;
+  unsigned int offsets[MAX_CHANGES];
+};
+
+static struct workload work;
+
+// RAM handed to the backup API has to be static, see sim_backup.h
+static unsigned char data[MAX_DATA_SIZE] __attribute__((aligned(4)));
+static unsigned char committed[MAX_DATA_SIZE];
+static unsigned char wanted[MAX_DATA_SIZE];
+
+/*
+ * ndk_backup_write in pieces of at most max_write_count bytes. The RAM
+ * address is cast through unsigned long to keep a 64 bit compiler quiet.
+ */
+bool backup_write(const unsigned char *src, unsigned int dest,
+                  unsigned int count)
+{
+  unsigned int max = cart_backup_state.max_write_count;
+
+  for (unsigned int done = 0; done < count; done += max) {
+    unsigned int n = max == 0 || count - done < max ? count - done : max;
+
+    if (!ndk_backup_command((unsigned int)(unsigned long)(src + done),
+                            dest + done, n, NULL, 0, false, 8, 10, 2)) {
+      return false;
+    }
+
+    if (max == 0) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Change random fields of data and remember where.
+ */
+void change_fields(void)
+{
+  for (int i = 0; i < work.changes; i++) {
+    unsigned int offset = rand() % (work.size / FIELD_SIZE) * FIELD_SIZE;
+    unsigned int value = rand();
+
+    memcpy(data + offset, &value, FIELD_SIZE);
+    work.offsets[i] = offset;
+  }
+}
+
+void erase_backup(void)
+{
+  unsigned int size;
+  unsigned char *backup = sim_backup_data(&size);
+
+  memset(backup, 0xff, size);
+}
+
+bool run_strategy(const char *name)
+{
+  struct sim_backup_stats stats;
+  bool journal = strcmp(name, "journal") == 0;
+
+  erase_backup();
+  srand(work.seed);
+  memset(data, 0, work.size);
+
+  if (journal) {
+    save_init(0, data, work.size);
+    save_load();
+    save_mark_dirty(data, work.size);
+    save_commit();
+  } else {
+    backup_write(data, 0, work.size);
+  }
+
+  sim_backup_reset_stats();
+
+  for (int i = 0; i < work.commits; i++) {
+    change_fields();
+
+    if (journal) {
+      for (int j = 0; j < work.changes; j++) {
+        save_mark_dirty(data + work.offsets[j], FIELD_SIZE);
+      }
+
+      save_commit();
+    } else if (strcmp(name, "image") == 0) {
+      backup_write(data, 0, work.size);
+    } else {
+      for (int j = 0; j < work.changes; j++) {
+        backup_write(data + work.offsets[j], work.offsets[j], FIELD_SIZE);
+      }
+    }
+  }
+
+  sim_backup_get_stats(&stats);
+
+  printf("%-8s %10.3f %8llu %8llu %10llu %8llu\n", name,
+         stats.cycles * 1000.0 / BUS_CLOCK / work.commits, stats.writes,
+         stats.pages_written, stats.bytes_written, stats.errors);
+
+  return stats.errors == 0;
+}
+
+/*
+ * Cut the power during every commit and check what save_load recovers.
+ */
+bool fuzz(void)
+{
+  int cut = 0;
+  int old = 0;
+  int errors = 0;
+
+  srand(work.seed);
+  sim_backup_seed(work.seed);
+  erase_backup();
+  memset(data, 0, work.size);
+
+  save_init(0, data, work.size);
+  save_load();
+  save_mark_dirty(data, work.size);
+  save_commit();
+  memcpy(committed, data, work.size);
+
+  for (int i = 0; i < work.commits; i++) {
+    change_fields();
+
+    for (int j = 0; j < work.changes; j++) {
+      save_mark_dirty(data + work.offsets[j], FIELD_SIZE);
+    }
+
+    memcpy(wanted, data, work.size);
+    // About half of the commits get cut, a commit writes up to two pages per
+    // change and the header
+    sim_backup_power_loss(rand() % ((4 * work.changes + 2) * work.page_size));
+
+    bool ok = save_commit();
+
+    if (sim_backup_power_lost()) {
+      cut++;
+    }
+
+    // Reboot
+    sim_backup_power_on();
+    memset(data, 0xaa, work.size);
+    save_init(0, data, work.size);
+
+    if (!save_load()) {
+      printf("commit %d: no valid slot\n", i);
+      errors++;
+    } else if (memcmp(data, wanted, work.size) == 0) {
+      memcpy(committed, wanted, work.size);
+    } else if (!ok && memcmp(data, committed, work.size) == 0) {
+      old++;
+    } else {
+      printf("commit %d: loaded data is neither the old nor the new\n", i);
+      errors++;
+    }
+  }
+
+  printf("%d commits, power cut in %d, %d of those kept the old data, "
+         "%d errors\n", work.commits, cut, old, errors);
+
+  return errors == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  bool fuzzing = false;
+  unsigned short spec = BACKUP_SPEC_EEPROM_8K;
+  int max_write = -1;
+  int opt;
+
+  work.seed = 1;
+  work.size = 2048;
+  work.commits = 200;
+  work.changes = 4;
+
+  while ((opt = getopt(argc, argv, "fs:t:d:n:k:m:")) != -1) {
+    switch (opt) {
+      case 'f':
+        fuzzing = true;
+        break;
+      case 's':
+        work.seed = strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        spec = strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        work.size = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        work.commits = atoi(optarg);
+        break;
+      case 'k':
+        work.changes = atoi(optarg);
+        break;
+      case 'm':
+        max_write = atoi(optarg);
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+
+  if (optind != argc - 1 || work.size < FIELD_SIZE ||
+      work.size > MAX_DATA_SIZE || work.changes < 1 ||
+      work.changes > MAX_CHANGES || work.commits < 1) {
+    fprintf(stderr, "Usage: %s [-f] [-s seed] [-t spec] [-d data size] "
+            "[-n commits]\n       [-k changes per commit] [-m max write] "
+            "<backup file>\n", argv[0]);
+    return 1;
+  }
+
+  sim_init(work.seed, 0);
+  sim_backup_open(argv[optind]);
+  ndk_backup_init(spec);
+
+  struct sim_backup_config config;
+
+  sim_backup_get_config(&config);
+
+  if (max_write >= 0) {
+    config.max_write_count = max_write;
+    sim_backup_set_config(&config);
+  }
+
+  work.page_size = config.page_size > 0 ? config.page_size
+                                         : SAVE_DEFAULT_PAGE_SIZE;
+
+  if (save_backup_size(work.size, work.page_size) > config.size) {
+    fprintf(stderr, "%u bytes of data don't fit twice in %u bytes\n",
+            work.size, config.size);
+    return 1;
+  }
+
+  bool ok;
+
+  if (fuzzing) {
+    ok = fuzz();
+  } else {
+    printf("%u bytes, %d commits of %d fields, page size %u\n\n", work.size,
+           work.commits, work.changes, config.page_size);
+    printf("%-8s %10s %8s %8s %10s %8s\n", "", "ms/commit", "writes",
+           "pages", "bytes", "errors");
+
+    ok = run_strategy("image");
+    ok = run_strategy("fields") && ok;
+    ok = run_strategy("journal") && ok;
+  }
+
+  sim_backup_close();
+  sim_shutdown();
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sim_thread.h"
+
+#include "ring.h"
+
+#include "dtcm.h"
+#include "interrupts.h"
+#include "thread.h"
+
+/*
+ * Run a workload on the simulated thread subsystem (see sim_thread.h) and
+ * print the scheduling latency of every thread.
+ *
+ * The workload mimics a game frame: the main thread waits for VBlank, worker
+ * threads wake up on timer IRQs and compete for a shared mutex,
+ * and a producer hands items to a consumer through a waiting list. A DMA IRQ
+ * handler passes sequence numbers to a thread through a ring buffer (see
+ * util/ring.h). The invariants of the mutex and of the hand-offs are checked.
+ * The exit status is 1 if any of them are violated.
+ *
+ * Usage: simthread [-s seed] [-f frames] [-w workers] [-c switch cycles]
+ */
+
+#define IRQ_VBLANK 0x1
+#define IRQ_TIMER2 0x20
+#define IRQ_TIMER3 0x40
+#define IRQ_DMA0 0x100
+#define IRQ_DMA0_BIT 8
+
+#define MAX_WORKERS 16
+#define ITEM_COUNT 64
+#define RING_COUNT 8
+
+struct workload {
+  bool stop;
+  int errors;
+  struct mutex lock;
+  int in_critical;
+  // producer/consumer
+  struct thread_list consumer_wait;
+  struct thread_list producer_wait;
+  int items[ITEM_COUNT];
+  unsigned int head;
+  unsigned int tail;
+  int produced;
+  int consumed;
+  // IRQ to thread ring buffer
+  struct ring ring;
+  unsigned int ring_buf[RING_BUFFER_WORDS(RING_COUNT, 8)];
+  unsigned int ring_pushed;
+  unsigned int ring_dropped;
+  unsigned int ring_popped;
+};
+
+static struct workload work;
+static struct thread workers[MAX_WORKERS];
+static struct thread producer;
+static struct thread consumer;
+static struct thread ring_reader;
+// Stacks are only recorded, the simulation runs every thread on a host stack.
+static char stacks[MAX_WORKERS + 3][0x400];
+
+void worker_fn(void *arg)
+{
+  int index = (int)(long)arg;
+  /*
+   * Not VBlank, ndk_thread_wait_irq clears the IRQ bit when it returns so the
+   * main thread would miss frames.
+   */
+  unsigned int irq = index % 2 == 0 ? IRQ_TIMER2 : IRQ_TIMER3;
+
+  while (!work.stop) {
+    ndk_thread_wait_irq(true, irq);
+    sim_tick(200 + sim_random(2000));
+
+    ndk_mutex_lock(&work.lock);
+
+    if (work.in_critical++ != 0) {
+      work.errors++;
+    }
+
+    // Recursive locking must not release the mutex early.
+    ndk_mutex_lock(&work.lock);
+    sim_tick(100 + sim_random(1000));
+    ndk_mutex_unlock(&work.lock);
+
+    if (work.lock.thread != &workers[index]) {
+      work.errors++;
+    }
+
+    sim_tick(100 + sim_random(500));
+    work.in_critical--;
+
+    ndk_mutex_unlock(&work.lock);
+  }
+}
+
+void producer_fn(void *arg)
+{
+  while (!work.stop) {
+    int lock;
+
+    ndk_thread_critical_enter(&lock);
+
+    while (work.head - work.tail == ITEM_COUNT && !work.stop) {
+      ndk_thread_yield(&work.producer_wait);
+    }
+
+    if (work.head - work.tail != ITEM_COUNT) {
+      work.items[work.head++ % ITEM_COUNT] = work.produced++;
+    }
+
+    ndk_thread_schedule_list(&work.consumer_wait);
+
+    ndk_thread_critical_leave(&lock);
+
+    sim_tick(500 + sim_random(5000));
+  }
+}
+
+void consumer_fn(void *arg)
+{
+  while (!work.stop) {
+    int lock;
+
+    ndk_thread_critical_enter(&lock);
+
+    while (work.head == work.tail && !work.stop) {
+      ndk_thread_yield(&work.consumer_wait);
+    }
+
+    if (work.head != work.tail) {
+      if (work.items[work.tail++ % ITEM_COUNT] != work.consumed++) {
+        work.errors++;
+      }
+    }
+
+    ndk_thread_schedule_list(&work.producer_wait);
+
+    ndk_thread_critical_leave(&lock);
+
+    sim_tick(1000 + sim_random(8000));
+  }
+}
+
+void dma_handler(void)
+{
+  unsigned int msg[2] = { work.ring_pushed, (unsigned int)sim_now() };
+
+  if (ring_push(&work.ring, msg)) {
+    work.ring_pushed++;
+  } else {
+    work.ring_dropped++;
+  }
+
+  thread_irq_bits |= IRQ_DMA0;
+}
+
+void ring_reader_fn(void *arg)
+{
+  unsigned int msg[2];
+
+  while (!work.stop) {
+    ndk_thread_wait_irq(false, IRQ_DMA0);
+
+    while (ring_pop(&work.ring, msg)) {
+      // Sequence numbers must arrive in order without gaps.
+      if (msg[0] != work.ring_popped++) {
+        work.errors++;
+      }
+
+      sim_tick(300 + sim_random(3000));
+    }
+  }
+}
+
+void join(struct thread *t)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  while (!ndk_thread_has_been_removed(t)) {
+    ndk_thread_yield(&t->deleted_waiting_list);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int seed = 1;
+  unsigned int switch_cycles = 300;
+  int frames = 600;
+  int worker_count = 4;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:f:w:c:")) != -1) {
+    switch (opt) {
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'f':
+        frames = atoi(optarg);
+        break;
+      case 'w':
+        worker_count = atoi(optarg);
+        break;
+      case 'c':
+        switch_cycles = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        printf("Usage: simthread [-s seed] [-f frames] [-w workers] "
+               "[-c switch cycles]\n");
+        return 1;
+    }
+  }
+
+  if (worker_count < 0 || worker_count > MAX_WORKERS) {
+    printf("at most %d workers\n", MAX_WORKERS);
+    return 1;
+  }
+
+  sim_init(seed, switch_cycles);
+
+  sim_add_irq_source(IRQ_VBLANK, SIM_FRAME_CYCLES, 0);
+  sim_add_irq_source(IRQ_TIMER2, SIM_FRAME_CYCLES / 4, SIM_FRAME_CYCLES / 10);
+  sim_add_irq_source(IRQ_TIMER3, SIM_FRAME_CYCLES / 7, SIM_FRAME_CYCLES / 20);
+
+  sim_add_irq_source(IRQ_DMA0, SIM_FRAME_CYCLES / 30, SIM_FRAME_CYCLES / 30);
+
+  ndk_mutex_init(&work.lock);
+  ring_init(&work.ring, work.ring_buf, RING_COUNT, 8);
+  irq_handlers[IRQ_DMA0_BIT] = &dma_handler;
+
+  for (int i = 0; i < worker_count; i++) {
+    char name[16];
+
+    ndk_thread_create(&workers[i], &worker_fn, (void *)(long)i,
+                      stacks[i] + sizeof stacks[i], sizeof stacks[i], 8 + i);
+    snprintf(name, sizeof name, "worker %d", i);
+    sim_thread_name(&workers[i], name);
+    ndk_thread_schedule(&workers[i]);
+  }
+
+  ndk_thread_create(&producer, &producer_fn, NULL,
+                    stacks[MAX_WORKERS] + sizeof stacks[0], sizeof stacks[0], 20);
+  sim_thread_name(&producer, "producer");
+  ndk_thread_schedule(&producer);
+
+  ndk_thread_create(&consumer, &consumer_fn, NULL,
+                    stacks[MAX_WORKERS + 1] + sizeof stacks[0],
+                    sizeof stacks[0], 21);
+  sim_thread_name(&consumer, "consumer");
+  ndk_thread_schedule(&consumer);
+
+  ndk_thread_create(&ring_reader, &ring_reader_fn, NULL,
+                    stacks[MAX_WORKERS + 2] + sizeof stacks[0],
+                    sizeof stacks[0], 6);
+  sim_thread_name(&ring_reader, "ring reader");
+  ndk_thread_schedule(&ring_reader);
+
+  for (int frame = 0; frame < frames; frame++) {
+    ndk_wait_vblank_intr();
+    // game logic
+    sim_tick(SIM_FRAME_CYCLES / 4 + sim_random(SIM_FRAME_CYCLES / 4));
+  }
+
+  work.stop = true;
+  ndk_thread_schedule_list(&work.consumer_wait);
+  ndk_thread_schedule_list(&work.producer_wait);
+
+  for (int i = 0; i < worker_count; i++) {
+    join(&workers[i]);
+  }
+
+  join(&producer);
+  join(&consumer);
+  join(&ring_reader);
+
+  sim_print_report(stdout);
+
+  printf("\nproduced %d consumed %d\n", work.produced, work.consumed);
+  printf("ring pushed %u popped %u dropped %u\n", work.ring_pushed,
+         work.ring_popped, work.ring_dropped);
+  printf("errors %d\n", work.errors);
+
+  sim_shutdown();
+
+  return work.errors == 0 ? 0 : 1;
+}
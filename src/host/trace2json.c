@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracedump.h"
+
+#include "thread_trace.h"
+
+/*
+ * Convert a dump made by thread_trace_dump (see src/util/thread_trace.h) into
+ * a Chrome trace event JSON file. Open the result in chrome://tracing or
+ * https://ui.perfetto.dev
+ *
+ * Every interval between two context switches becomes a complete ('X') event
+ * on the track of the thread that was running. The reason the thread was
+ * suspended is attached as an argument. The accumulated per thread statistics
+ * are printed to stderr.
+ *
+ * Usage: trace2json <dump file> <json file>
+ */
+
+static const char *reason_names[THREAD_TRACE_REASONS] = {
+  "preempted", "wait_irq", "wait_mutex", "wait_list", "sleep", "exit"
+};
+
+struct trace {
+  struct thread_trace_header hdr;
+  struct thread_trace_stats *stats;
+  struct thread_trace_event *events;
+  char *data;
+};
+
+bool load_trace(const char *path, struct trace *t)
+{
+  static const struct tracedump_format format = {
+    "thread_trace", THREAD_TRACE_MAGIC, THREAD_TRACE_VERSION,
+    sizeof(struct thread_trace_header),
+    { sizeof(struct thread_trace_stats), sizeof(struct thread_trace_event) }
+  };
+  void *tables[2];
+
+  t->data = tracedump_load(path, &format, &t->hdr, tables);
+
+  if (t->data == NULL) {
+    return false;
+  }
+
+  t->stats = tables[0];
+  t->events = tables[1];
+
+  return true;
+}
+
+double cycles_to_us(const struct trace *t, unsigned long long cycles)
+{
+  return cycles * 1000000.0 / t->hdr.clock;
+}
+
+int thread_tid(const struct trace *t, int slot)
+{
+  if (slot < 0 || slot >= t->hdr.thread_count) {
+    return -1;
+  }
+
+  return t->stats[slot].id;
+}
+
+void write_metadata(FILE *out, const struct trace *t)
+{
+  for (int i = 0; i < t->hdr.thread_count; i++) {
+    const struct thread_trace_stats *s = &t->stats[i];
+    char name[THREAD_TRACE_NAME_SIZE + 1] = { 0 };
+
+    memcpy(name, s->name, THREAD_TRACE_NAME_SIZE);
+
+    if (name[0] == '\0') {
+      snprintf(name, sizeof name, "thread %d", s->id);
+    }
+
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,"
+                 "\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", s->id, name);
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":0,"
+                 "\"tid\":%d,\"args\":{\"sort_index\":%d}},\n", s->id,
+                 s->priority);
+  }
+}
+
+void write_events(FILE *out, const struct trace *t)
+{
+  unsigned long long now = 0;
+  unsigned int last = t->hdr.start_time;
+  int running = -1;
+
+  if (t->hdr.event_count > 0 && t->hdr.overwritten > 0) {
+    last = t->events[0].timestamp;
+  }
+
+  for (int i = 0; i <= t->hdr.event_count; i++) {
+    unsigned int stamp;
+    int reason = -1;
+
+    if (i < t->hdr.event_count) {
+      stamp = t->events[i].timestamp;
+      reason = t->events[i].reason;
+    } else {
+      stamp = t->hdr.dump_time;
+    }
+
+    // 32 bit bus cycle counter, wraps every ~128 seconds
+    unsigned int delta = stamp - last;
+    int tid = thread_tid(t, running);
+
+    if (tid >= 0 && delta > 0) {
+      fprintf(out, "{\"ph\":\"X\",\"name\":\"run\",\"pid\":0,\"tid\":%d,"
+                   "\"ts\":%.3f,\"dur\":%.3f", tid, cycles_to_us(t, now),
+                   cycles_to_us(t, delta));
+
+      if (reason >= 0 && reason < THREAD_TRACE_REASONS) {
+        fprintf(out, ",\"args\":{\"suspended\":\"%s\"}", reason_names[reason]);
+      }
+
+      fprintf(out, "},\n");
+    }
+
+    now += delta;
+    last = stamp;
+
+    if (i < t->hdr.event_count) {
+      running = t->events[i].to;
+    }
+  }
+}
+
+void print_stats(const struct trace *t)
+{
+  unsigned long long total = 0;
+
+  for (int i = 0; i < t->hdr.thread_count; i++) {
+    total += t->stats[i].run_cycles;
+  }
+
+  fprintf(stderr, "%-12s %4s %4s %8s %6s %9s", "thread", "id", "prio",
+          "cpu ms", "cpu %", "switches");
+
+  for (int r = 0; r < THREAD_TRACE_REASONS; r++) {
+    fprintf(stderr, " %10s", reason_names[r]);
+  }
+
+  fprintf(stderr, "\n");
+
+  for (int i = 0; i < t->hdr.thread_count; i++) {
+    const struct thread_trace_stats *s = &t->stats[i];
+    char name[THREAD_TRACE_NAME_SIZE + 1] = { 0 };
+
+    memcpy(name, s->name, THREAD_TRACE_NAME_SIZE);
+
+    fprintf(stderr, "%-12s %4d %4d %8.2f %6.2f %9u", name, s->id, s->priority,
+            cycles_to_us(t, s->run_cycles) / 1000.0,
+            total ? 100.0 * s->run_cycles / total : 0.0, s->switches_in);
+
+    for (int r = 0; r < THREAD_TRACE_REASONS; r++) {
+      fprintf(stderr, " %10u", s->waits[r]);
+    }
+
+    fprintf(stderr, "\n");
+  }
+
+  if (t->hdr.overwritten > 0) {
+    fprintf(stderr, "NOTE: %u events were overwritten, the timeline only "
+                    "covers the last %d switches\n", t->hdr.overwritten,
+                    t->hdr.event_count);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    printf("Usage: trace2json <dump file> <json file>\n");
+    return 1;
+  }
+
+  struct trace t = { 0 };
+
+  if (!load_trace(argv[1], &t)) {
+    return 1;
+  }
+
+  FILE *out = fopen(argv[2], "w");
+
+  if (out == NULL) {
+    free(t.data);
+    return 1;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  write_metadata(out, &t);
+  write_events(out, &t);
+  fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":0,"
+               "\"args\":{\"name\":\"ARM9\"}}\n]}\n");
+
+  print_stats(&t);
+
+  free(t.data);
+
+  return fclose(out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracedump.h"
+
+#include "io_trace.h"
+#include "thread_trace.h"
+
+_Static_assert(offsetof(struct io_trace_header, file_count) ==
+               offsetof(struct tracedump_header, counts[0]),
+               "io_trace_header layout");
+_Static_assert(offsetof(struct io_trace_header, record_count) ==
+               offsetof(struct tracedump_header, counts[1]),
+               "io_trace_header layout");
+_Static_assert(offsetof(struct thread_trace_header, thread_count) ==
+               offsetof(struct tracedump_header, counts[0]),
+               "thread_trace_header layout");
+_Static_assert(offsetof(struct thread_trace_header, event_count) ==
+               offsetof(struct tracedump_header, counts[1]),
+               "thread_trace_header layout");
+
+char *tracedump_load(const char *path, const struct tracedump_format *format,
+                     void *hdr, void *tables[2])
+{
+  FILE *f = fopen(path, "rb");
+
+  if (f == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char *data = malloc(size);
+
+  if (data == NULL || fread(data, 1, size, f) != size) {
+    fprintf(stderr, "%s: read error\n", path);
+    fclose(f);
+    free(data);
+    return NULL;
+  }
+
+  fclose(f);
+
+  struct tracedump_header common;
+
+  if (size < format->header_size) {
+    fprintf(stderr, "%s: not a dump of %s\n", path, format->name);
+    free(data);
+    return NULL;
+  }
+
+  memcpy(hdr, data, format->header_size);
+  memcpy(&common, data, sizeof common);
+
+  if (common.magic != format->magic || common.version != format->version) {
+    fprintf(stderr, "%s: not a dump of %s\n", path, format->name);
+    free(data);
+    return NULL;
+  }
+
+  long required = format->header_size;
+
+  for (int i = 0; i < 2; i++) {
+    tables[i] = data + required;
+    required += (long)common.counts[i] * format->entry_sizes[i];
+  }
+
+  if (common.counts[0] < 0 || common.counts[1] < 0 || size < required) {
+    fprintf(stderr, "%s: truncated %s dump\n", path, format->name);
+    free(data);
+    return NULL;
+  }
+
+  return data;
+}
@@ -0,0 +1,44 @@
+/**
+ * Loading of the trace dumps written on the DS by io_trace_dump (see
+ * src/util/io_trace.h) and thread_trace_dump (src/util/thread_trace.h).
+ *
+ * Both dumps are a header followed by two tables, the header starts with the
+ * fields of struct tracedump_header.
+ */
+#ifndef HOST_TRACEDUMP_INCLUDE_FILE
+#define HOST_TRACEDUMP_INCLUDE_FILE
+
+#include <stdbool.h>
+
+struct tracedump_header {
+  unsigned int magic;               // 0x00
+  unsigned int version;             // 0x04
+  // timestamp frequency in Hz
+  unsigned int clock;               // 0x08
+  // entries in the two tables
+  int counts[2];                    // 0x0c
+};
+
+struct tracedump_format {
+  // module name for error messages
+  const char *name;
+  unsigned int magic;
+  unsigned int version;
+  int header_size;
+  // entry sizes of the two tables
+  int entry_sizes[2];
+};
+
+/**
+ * Load a dump and check it's complete.
+ *
+ * @param path
+ * @param format
+ * @param hdr set to a copy of the header, format->header_size bytes
+ * @param tables set to the start of the two tables in the returned data
+ * @return the file data, free it when done, or NULL after printing an error
+ */
+char *tracedump_load(const char *path, const struct tracedump_format *format,
+                     void *hdr, void *tables[2]);
+
+#endif // HOST_TRACEDUMP_INCLUDE_FILE
@@ -25,6 +25,13 @@
 #ifndef CPU_INCLUDE_FILE
 #define CPU_INCLUDE_FILE
 
+// CPSR mode bits, see ndk_cpu_get_current_mode
+#define CPU_MODE_IRQ 0x12
+#define CPU_MODE_SYSTEM 0x1f
+
+// DMA invalidates whole data cache lines, keep DMA buffers line aligned.
+#define CPU_CACHE_LINE_SIZE 32
+
 /**
  * Enable IRQ.
  *
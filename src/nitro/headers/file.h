@@ -135,6 +135,20 @@ struct fat_handle
  */
 extern unsigned int fat_dma_channel;
 
+struct fat_volume;
+
+/**
+ * Type of the read and write hooks in fat_volume.
+ *
+ * @param volume
+ * @param dst destination in RAM
+ * @param src ROM address
+ * @param len number of bytes
+ * @return 0 on success, 6 if the operation completes asynchronously
+ */
+typedef int fat_volume_read_fn(struct fat_volume *volume, void *dst,
+                               unsigned int src, unsigned int len);
+
 /**
  * This data structure *is* the ROM file system volume.
  *
@@ -161,12 +175,19 @@ extern struct fat_volume
   int fat_rom_offset;         // 0x3c
   int fnt_rom_offset;         // 0x40
   void *cache;                // 0x44
-  /* Set to a function that calls ndk_cart_read by ndk_fat_mount */
-  int (*fn_1)(int, int, int); // 0x48
-  /* Set to a function that just returns 1 in ndk_fat_mount */
-  int (*fn_2)(); // 0x4c
-  /* Set to the same as fn_1 in ndk_fat_mount */
-  int (*fn_3)(int, int, int);      // 0x50
+  /*
+   * Read hook. Set to a function that calls ndk_cart_read by ndk_fat_mount.
+   * Reads len bytes at ROM address src to dst. Returns a file.error code: 0
+   * when the data has been read or 6 when the read completes asynchronously.
+   */
+  fat_volume_read_fn *fn_1;   // 0x48
+  /* Write hook. Set to a function that just returns 1 in ndk_fat_mount */
+  fat_volume_read_fn *fn_2;   // 0x4c
+  /*
+   * Read hook used for the file tables (FAT and FNT) when they are not
+   * cached. Set to the same as fn_1 in ndk_fat_mount
+   */
+  fat_volume_read_fn *fn_3;        // 0x50
   int (*fn_4)(struct file *, int); // 0x54
   int unk10;                       // 0x58
   // more ?
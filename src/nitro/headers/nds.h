@@ -113,6 +113,22 @@
 #define KEYINPUT      (*(volatile unsigned short *) 0x4000130)
 #define KEYCNT        (*(volatile unsigned short *) 0x4000132)
 
+/**
+ * Slot 1 (cart) registers, the firmware drives them (see cart.h).
+ *
+ * See: https://problemkaputt.de/gbatek.htm#dscartridgeioports
+ */
+#define CARD_AUXSPICNT_H (*(volatile unsigned char *) 0x40001a1)
+#define CARD_ROMCTRL  (*(volatile unsigned int *) 0x40001a4)
+#define CARD_COMMAND  ((volatile unsigned char *) 0x40001a8)
+#define CARD_DATA     (*(volatile unsigned int *) 0x4100010)
+
+#define CARD_ROMCTRL_DATA_READY     (1 << 23)
+#define CARD_ROMCTRL_BLOCK_512      (1 << 24)
+#define CARD_ROMCTRL_BLOCK_MASK     (7 << 24)
+#define CARD_ROMCTRL_RELEASE_RESET  (1 << 29)
+#define CARD_ROMCTRL_START          (1u << 31)
+
 #define EXMEMCNT      (*(volatile unsigned short *) 0x4000204)
 #define IME           (*(volatile unsigned short *) 0x4000208)
 
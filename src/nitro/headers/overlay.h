@@ -44,8 +44,23 @@ struct overlay {
   // 0x2c
 };
 
-// used by ndk_overlay_fini_in_ram
-extern void *overlay_something;
+/**
+ * Entry of the global destructor chain, a list of objects and their
+ * destructor. The layout is the one of the CodeWarrior runtime the game was
+ * built with.
+ *
+ * ndk_overlay_fini_in_ram removes the entries of objects in the memory of
+ * the overlay (ram_address up to the end of the BSS) from the chain and calls
+ * destructor(object, -1) for each of them.
+ */
+struct destructor_chain {
+  struct destructor_chain *next;  // 0x0
+  void (*destructor)(void *object, int flag); // 0x4
+  void *object;                   // 0x8
+  // 0xc
+};
+
+extern struct destructor_chain *global_destructor_chain;
 
 /**
  * Load an overlay file into memory.
@@ -97,14 +112,16 @@ bool ndk_overlay_open(struct overlay *h, int cpu, int id);
  * Executes the static initializers.
  * 
  * If the overlay is compressed it will be decompressed before they are
- * executed.
+ * executed. The initializers are the function pointers from init_array_start
+ * up to init_array_end of the overlay info, NULL entries are skipped.
  *
  * @param h pointer to a overlay handle struct
  */
 void ndk_overlay_init_in_ram(struct overlay *h);
 
 /**
- * Executes the .fini array or dtor chain ???
+ * Executes the destructors in the global destructor chain of objects in the
+ * overlay.
  *
  * NOTE: This could be close overlay file.
  *
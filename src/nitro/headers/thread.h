@@ -104,7 +104,10 @@ struct mutex {
   struct thread_list queue;         // 0x00
   // The thread that holds this lock
   struct thread *thread;            // 0x08
-  // The number of threads that are blocked
+  /*
+   * Number of times the holder has locked this mutex. The mutex is released
+   * when it has been unlocked the same number of times.
+   */
   int lock_count;                   // 0x0c
   /*
    * The thread that holds this lock will have this node in its list of held
@@ -136,7 +139,7 @@ struct thread {
    * is kept sorted in priority order.
    */
   struct thread_list *waiting_list; // 0x78
-  struct thread_list_node *waiting_node;  // 0x7c
+  struct thread_list_node waiting_node;   // 0x7c
   /*
    * If non-null points to the current mutex this thread is blocked at.
    */
@@ -144,8 +147,10 @@ struct thread {
   /*
    * If held_by_me.first is non-null this thread holds one or more mutexes.
    */
-  struct mutex_list *held_by_me;    // 0x88
+  struct mutex_list held_by_me;     // 0x88
+  // Lowest address of the stack: stack_top - size of ndk_thread_create
   void *stack_bottom;               // 0x90
+  // stack_top of ndk_thread_create, the stack grows down from here
   void *stack_top;                  // 0x94
   int unk12;                        // 0x98
   struct thread_list deleted_waiting_list;   // 0x9c
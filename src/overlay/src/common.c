@@ -1,6 +1,3 @@
-#include <limits.h>
-
-#include "file.h"
 #include "nds.h"
 
 #include "common.h"
@@ -26,19 +23,3 @@ unsigned short read_key_presses(void)
 
   return new_keys;
 }
-
-int load_file(char *filename, void *dest)
-{
-  struct file h;
-
-  ndk_file_init_handle(&h);
-
-  if(ndk_file_open(&h, filename) == 0)
-    return 0;
-
-  int read = ndk_file_read(&h, dest, INT_MAX);
-
-  ndk_file_close(&h);
-
-  return read;
-}
@@ -3,6 +3,4 @@
 
 unsigned short read_key_presses(void);
 
-int load_file(char *filename, void *dest);
-
 #endif // COMMON_INCLUDE_FILE
@@ -6,13 +6,21 @@
 #include "interrupts.h"
 #include "nds.h"
 #include "overlay.h"
+#include "thread.h"
 
+#include "aio.h"
+#include "overlay_cache.h"
 #include "ovr.h"
 #include "term.h"
+#include "util.h"
+
+// Above the main thread so preloads start right away
+#define IO_THREAD_PRIORITY 8
 
 static void init(void);
 static void init_fs(void);
 static void init_gfx(void);
+static void print_load_time(int id, int row);
 static void vblank_handler(void);
 
 static const char *info_text =
@@ -22,6 +30,12 @@ static const char *info_text =
 
 static char fs_cache[12*1024];
 
+static struct thread io_thread;
+static unsigned char io_stack[1024] __attribute__((aligned(8)));
+
+// Two staging buffers for overlay preloads
+static unsigned char overlay_pool[32*1024] __attribute__((aligned(32)));
+
 /*
  * These two definitions below are needed so the linker can patch the CRT0
  * code to execute our own main function.
@@ -37,23 +51,33 @@ int main()
   term_init((unsigned short *)0x06200000, (unsigned short *)0x06202000, 0);
 
   // Load code in the ITCM area. Execute it and show the result.
-  ndk_overlay_load(ARM9, ITCM_OVERLAY_FAT_ID);
-  ndk_overlay_load(ARM9, DTCM_OVERLAY_FAT_ID);
+  ndk_overlay_load(ARM9, OVERLAY_ID_ITCM1);
+  ndk_overlay_load(ARM9, OVERLAY_ID_DTCM1);
 
   term_set_cursor(0, 0);
   term_printf("%s", info_text);
   term_set_cursor(0, 5);
   term_printf("tcm1_fibonacci(10) = %i", tcm1_fibonacci(10));
+
+  timer_start();
+  print_load_time(OVERLAY_ID_OVR0, 7);
+  print_load_time(OVERLAY_ID_OVR1, 10);
   term_draw();
 
+  aio_init(&io_thread, io_stack + sizeof io_stack, sizeof io_stack,
+           IO_THREAD_PRIORITY);
+  overlay_cache_init(overlay_pool, sizeof overlay_pool, 2);
+
+  // The overlays are linked to separate parts of the overlay region. After
+  // the first round both stay resident and switching doesn't touch the cart.
   while (1) {
-    ndk_overlay_load(ARM9, OVERLAY0_FAT_ID);
+    overlay_cache_load(OVERLAY_ID_OVR0);
+    overlay_cache_preload(OVERLAY_ID_OVR1);
     _overlay0_entry();
-    ndk_overlay_unload(ARM9, OVERLAY0_FAT_ID);
 
-    ndk_overlay_load(ARM9, OVERLAY1_FAT_ID);
+    overlay_cache_load(OVERLAY_ID_OVR1);
+    overlay_cache_preload(OVERLAY_ID_OVR0);
     _overlay1_entry();
-    ndk_overlay_unload(ARM9, OVERLAY1_FAT_ID);
   }
 }
 
@@ -79,6 +103,40 @@ void init_fs(void)
   ndk_fat_cache_file_tables(&fs_cache, size);
 }
 
+/*
+ * Time the two steps of ndk_overlay_load: reading the file from the cart and
+ * ndk_overlay_init_in_ram, which decompresses compressed overlays. Build with
+ * COMPRESSED_OVERLAYS= (see makefile) to get the numbers for raw overlays.
+ */
+void print_load_time(int id, int row)
+{
+  struct overlay h;
+
+  if (!ndk_overlay_open(&h, ARM9, id)) {
+    return;
+  }
+
+  unsigned int start = timer_value();
+
+  ndk_overlay_read_into_ram(&h);
+
+  unsigned int read = timer_value();
+
+  ndk_overlay_init_in_ram(&h);
+
+  unsigned int init = timer_value();
+
+  ndk_overlay_unload(ARM9, id);
+
+  term_set_cursor(0, row);
+  term_printf("ovr%i %i of %i bytes%s", id, ndk_overlay_get_file_size(&h),
+              h.info.ram_size, (h.info.flags & 1) ? " (lz)" : "");
+  term_set_cursor(0, row + 1);
+  term_printf("read %i us, init %i us",
+              (int)((read - start) * 1000000ull / BUS_CLOCK),
+              (int)((init - read) * 1000000ull / BUS_CLOCK));
+}
+
 void vblank_handler(void)
 {
   thread_irq_bits |= IS_VBLANK;
@@ -1,10 +1,7 @@
 #ifndef OVERLAY_INCLUDE_GUARD
 #define OVERLAY_INCLUDE_GUARD
 
-#define OVERLAY0_FAT_ID 0
-#define OVERLAY1_FAT_ID 1
-#define ITCM_OVERLAY_FAT_ID 2
-#define DTCM_OVERLAY_FAT_ID 3
+#include "overlay_ids.h"
 
 typedef int fix12;
 
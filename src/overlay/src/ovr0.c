@@ -3,6 +3,7 @@
 #include "interrupts.h"
 #include "nds.h"
 #include "util.h"
+#include "vram_stream.h"
 #include "ovr.h"
 #include "common.h"
 
@@ -10,7 +11,8 @@ static fix12 angle = 0;
 
 void _overlay0_entry()
 {
-  load_file("spy_vs_spy.bin", (void *)0x06000000);
+  vram_stream_load("spy_vs_spy.bin", VRAM_STREAM_BG_VRAM_A,
+                   VRAM_STREAM_VBLANK_BUDGET);
 
   while(1) {
     unsigned short keypad = read_key_presses();
@@ -3,14 +3,29 @@
 #include "interrupts.h"
 #include "nds.h"
 #include "util.h"
+#include "vram_stream.h"
 #include "ovr.h"
 #include "common.h"
 
+// Scroll offsets for every step of the angle. The table is in the BSS and
+// filled when the overlay is loaded, instead of taking space in the file.
+#define ANGLE_STEP 16
+#define ANGLE_STEPS (4096 / ANGLE_STEP)
+
 static fix12 angle = 0;
+static short xcoords[ANGLE_STEPS];
+
+__attribute__((constructor)) static void init_xcoords(void)
+{
+  for (int i = 0; i < ANGLE_STEPS; i++) {
+    xcoords[i] = fix_mul(64, tcm1_cos(i * ANGLE_STEP));
+  }
+}
 
 void _overlay1_entry()
 {
-  load_file("c64_grafitti.bin", (void *)0x06000000);
+  vram_stream_load("c64_grafitti.bin", VRAM_STREAM_BG_VRAM_A,
+                   VRAM_STREAM_VBLANK_BUDGET);
 
   while(1) {
     unsigned short keypad = read_key_presses();
@@ -25,10 +40,10 @@ void _overlay1_entry()
       0, F2X(1)
     };
 
-    int xcoord = fix_mul(64, tcm1_cos(angle));
+    int xcoord = xcoords[(angle / ANGLE_STEP) % ANGLE_STEPS];
 
     ndk_bg_set_affine_transform(&BG3PA, transform, 128, 96, xcoord, 0);
 
-    angle += 16;
+    angle += ANGLE_STEP;
   }
 }
@@ -0,0 +1,294 @@
+#include <stddef.h>
+
+#include "aio.h"
+
+#include "file.h"
+
+struct aio {
+  struct aio_request *first;
+  struct aio_request *last;
+  // the I/O thread when the queue is empty
+  struct thread_list idle;
+  // threads in aio_wait
+  struct thread_list done_waiting;
+};
+
+static void aio_thread(void *arg);
+static struct aio_request *aio_resolve(struct aio_request *batch);
+static struct aio_request *aio_sort(struct aio_request *batch);
+static struct aio_request *aio_read_run(struct aio_request *first);
+static void aio_complete(struct aio_request *req, int status);
+
+
+static struct aio aio;
+
+
+void aio_init(struct thread *t, void *stack_top, int size, int priority)
+{
+  ndk_thread_create(t, &aio_thread, NULL, stack_top, size, priority);
+  ndk_thread_schedule(t);
+}
+
+void aio_request_init(struct aio_request *req, int fat_id, unsigned int offset,
+                      void *dst, unsigned int size)
+{
+  req->next = NULL;
+  req->fat_id = fat_id;
+  req->offset = offset;
+  req->dst = dst;
+  req->size = size;
+  req->done = NULL;
+  req->arg = NULL;
+  req->event = NULL;
+  req->status = AIO_IDLE;
+  req->rom_offset = 0;
+}
+
+void aio_submit(struct aio_request *reqs, int count)
+{
+  int lock;
+
+  if (count <= 0) {
+    return;
+  }
+
+  ndk_thread_critical_enter(&lock);
+
+  for (int i = 0; i < count; i++) {
+    struct aio_request *req = &reqs[i];
+
+    req->next = NULL;
+    req->status = AIO_QUEUED;
+
+    if (req->event != NULL) {
+      req->event->pending++;
+    }
+
+    if (aio.last != NULL) {
+      aio.last->next = req;
+    } else {
+      aio.first = req;
+    }
+
+    aio.last = req;
+  }
+
+  ndk_thread_schedule_list(&aio.idle);
+
+  ndk_thread_critical_leave(&lock);
+}
+
+bool aio_wait(struct aio_request *req)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  while (req->status == AIO_QUEUED) {
+    ndk_thread_yield(&aio.done_waiting);
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return req->status == AIO_DONE;
+}
+
+void aio_event_init(struct aio_event *ev)
+{
+  ev->pending = 0;
+  ev->waiting.first = NULL;
+  ev->waiting.last = NULL;
+}
+
+void aio_event_wait(struct aio_event *ev)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  while (ev->pending > 0) {
+    ndk_thread_yield(&ev->waiting);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void aio_thread(void *arg)
+{
+  for (;;) {
+    int lock;
+
+    ndk_thread_critical_enter(&lock);
+
+    while (aio.first == NULL) {
+      ndk_thread_yield(&aio.idle);
+    }
+
+    struct aio_request *batch = aio.first;
+
+    aio.first = NULL;
+    aio.last = NULL;
+
+    ndk_thread_critical_leave(&lock);
+
+    batch = aio_sort(aio_resolve(batch));
+
+    while (batch != NULL) {
+      batch = aio_read_run(batch);
+    }
+  }
+}
+
+/*
+ * Look up the ROM address of every request. Requests for files that can't be
+ * opened or with an offset past the end of the file fail here.
+ */
+struct aio_request *aio_resolve(struct aio_request *batch)
+{
+  struct aio_request *valid = NULL;
+  struct file h;
+
+  while (batch != NULL) {
+    struct aio_request *req = batch;
+
+    batch = batch->next;
+
+    ndk_file_init_handle(&h);
+
+    if (!ndk_file_open_by_fat_id(&h, &fat_volume, req->fat_id)) {
+      aio_complete(req, AIO_ERROR);
+      continue;
+    }
+
+    unsigned int file_start = h.start_offset;
+    unsigned int file_size = ndk_file_size(&h);
+
+    ndk_file_close(&h);
+
+    if (req->offset > file_size) {
+      aio_complete(req, AIO_ERROR);
+      continue;
+    }
+
+    if (req->size > file_size - req->offset) {
+      req->size = file_size - req->offset;
+    }
+
+    req->rom_offset = file_start + req->offset;
+    req->next = valid;
+    valid = req;
+  }
+
+  return valid;
+}
+
+/*
+ * Insertion sort on ROM address. Batches are a few dozen requests at most.
+ */
+struct aio_request *aio_sort(struct aio_request *batch)
+{
+  struct aio_request *sorted = NULL;
+
+  while (batch != NULL) {
+    struct aio_request *req = batch;
+    struct aio_request **p = &sorted;
+
+    batch = batch->next;
+
+    while (*p != NULL && (*p)->rom_offset <= req->rom_offset) {
+      p = &(*p)->next;
+    }
+
+    req->next = *p;
+    *p = req;
+  }
+
+  return sorted;
+}
+
+/*
+ * Read a run of requests that follow each other in ROM through one open file.
+ * Requests that also follow each other in RAM are merged into one read.
+ *
+ * @return the first request after the run
+ */
+struct aio_request *aio_read_run(struct aio_request *first)
+{
+  struct aio_request *end = first->next;
+  unsigned int rom_end = first->rom_offset + first->size;
+
+  while (end != NULL && end->rom_offset == rom_end) {
+    rom_end += end->size;
+    end = end->next;
+  }
+
+  struct file h;
+
+  ndk_file_init_handle(&h);
+
+  bool ok = ndk_file_open_by_rom_range(&h, &fat_volume, first->rom_offset,
+                                       rom_end, -1);
+
+  while (first != end) {
+    struct aio_request *last = first;
+    unsigned int size = first->size;
+
+    while (last->next != end &&
+           last->next->dst == (char *)last->dst + last->size) {
+      last = last->next;
+      size += last->size;
+    }
+
+    int status = AIO_DONE;
+
+    if (!ok) {
+      status = AIO_ERROR;
+    } else if (size > 0 && ndk_file_read(&h, first->dst, size) != size) {
+      status = AIO_ERROR;
+    }
+
+    struct aio_request *next = last->next;
+
+    for (struct aio_request *req = first; req != next; ) {
+      struct aio_request *done = req;
+
+      req = req->next;
+      aio_complete(done, status);
+    }
+
+    first = next;
+  }
+
+  if (ok) {
+    ndk_file_close(&h);
+  }
+
+  return end;
+}
+
+/*
+ * The callback runs first so the request is only seen as done, and may be
+ * submitted again, once it has returned.
+ */
+void aio_complete(struct aio_request *req, int status)
+{
+  int lock;
+
+  req->next = NULL;
+
+  if (req->done != NULL) {
+    req->done(req, status == AIO_DONE);
+  }
+
+  ndk_thread_critical_enter(&lock);
+
+  req->status = status;
+
+  if (req->event != NULL && --req->event->pending == 0) {
+    ndk_thread_schedule_list(&req->event->waiting);
+  }
+
+  ndk_thread_schedule_list(&aio.done_waiting);
+
+  ndk_thread_critical_leave(&lock);
+}
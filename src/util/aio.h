@@ -0,0 +1,156 @@
+/**
+ * Asynchronous file reads.
+ *
+ * Reads are submitted as requests to a queue that is served by an I/O
+ * thread. The submitting thread returns immediately and can keep rendering
+ * while the data is read. Every time the I/O thread wakes up it takes all
+ * queued requests as one batch, sorts them by ROM address and reads them in
+ * that order. Requests that follow each other in ROM are read through one
+ * open file without seeking. If they also follow each other in RAM they are
+ * merged into a single read, which lets the file system use DMA for the whole
+ * range (see file.h).
+ *
+ * Completion is delivered in any combination of three ways:
+ *  - status of the request, poll it with aio_done.
+ *  - a callback called from the I/O thread.
+ *  - an event that counts requests in flight, wait for it with
+ *    aio_event_wait or poll it with aio_event_done.
+ *
+ * Example, load a level:
+ *
+ *   struct aio_event ev;
+ *   struct aio_request reqs[3];
+ *
+ *   aio_event_init(&ev);
+ *   aio_request_init(&reqs[0], tiles_id, 0, tiles, tiles_size);
+ *   aio_request_init(&reqs[1], map_id, 0, map, map_size);
+ *   aio_request_init(&reqs[2], music_id, 0, music, music_size);
+ *
+ *   for (int i = 0; i < 3; i++) {
+ *     reqs[i].event = &ev;
+ *   }
+ *
+ *   aio_submit(reqs, 3);
+ *
+ *   while (!aio_event_done(&ev)) {
+ *     draw_loading_screen();
+ *     ndk_wait_vblank_intr();
+ *   }
+ *
+ * NOTE: Requests are by FAT id. Get it with ndk_fat_get_fat_id_from_filename
+ * or file_index_lookup.
+ *
+ * NOTE: A request and its destination must stay valid until it's done.
+ */
+#ifndef UTIL_AIO_INCLUDE_FILE
+#define UTIL_AIO_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "thread.h"
+
+// Request status
+#define AIO_IDLE 0
+#define AIO_QUEUED 1
+#define AIO_DONE 2
+#define AIO_ERROR 3
+
+struct aio_request;
+
+/**
+ * Called from the I/O thread when a request is done, before its status is
+ * updated.
+ *
+ * NOTE: Keep it short, the next read doesn't start until it returns.
+ *
+ * @param req
+ * @param ok true if the data was read
+ */
+typedef void aio_done_fn(struct aio_request *req, bool ok);
+
+/**
+ * Counts requests in flight.
+ */
+struct aio_event {
+  volatile int pending;
+  struct thread_list waiting;
+};
+
+struct aio_request {
+  struct aio_request *next;         // 0x00
+  int fat_id;                       // 0x04
+  // offset in the file
+  unsigned int offset;              // 0x08
+  void *dst;                        // 0x0c
+  // bytes to read. Clamped to the end of the file.
+  unsigned int size;                // 0x10
+  // optional, set after aio_request_init
+  aio_done_fn *done;                // 0x14
+  void *arg;                        // 0x18
+  struct aio_event *event;          // 0x1c
+  // AIO_IDLE, AIO_QUEUED, AIO_DONE or AIO_ERROR
+  volatile int status;              // 0x20
+  // set by the I/O thread
+  unsigned int rom_offset;          // 0x24
+  // 0x28
+};
+
+/**
+ * Create and start the I/O thread.
+ *
+ * NOTE: The file system must be mounted (ndk_fat_mount) first.
+ *
+ * @param t
+ * @param stack_top pointer to the top of stack
+ * @param size stack size, 1 kB is enough
+ * @param priority 0-31, should be higher (lower value) than the threads that
+ * submit requests so reads start as soon as possible.
+ */
+void aio_init(struct thread *t, void *stack_top, int size, int priority);
+
+/**
+ * @param req
+ * @param fat_id file to read from
+ * @param offset in the file
+ * @param dst
+ * @param size
+ */
+void aio_request_init(struct aio_request *req, int fat_id, unsigned int offset,
+                      void *dst, unsigned int size);
+
+/**
+ * Queue requests. Returns immediately.
+ *
+ * NOTE: Submitting all requests of a load in one call gives the I/O thread the
+ * best chance to order and merge them.
+ *
+ * @param reqs array of requests
+ * @param count
+ */
+void aio_submit(struct aio_request *reqs, int count);
+
+static inline bool aio_done(struct aio_request *req)
+{
+  return req->status == AIO_DONE || req->status == AIO_ERROR;
+}
+
+/**
+ * Block the current thread until the request is done.
+ *
+ * @return true if the data was read
+ */
+bool aio_wait(struct aio_request *req);
+
+void aio_event_init(struct aio_event *ev);
+
+/**
+ * Block the current thread until all requests using the event are done.
+ */
+void aio_event_wait(struct aio_event *ev);
+
+static inline bool aio_event_done(struct aio_event *ev)
+{
+  return ev->pending == 0;
+}
+
+#endif // UTIL_AIO_INCLUDE_FILE
@@ -0,0 +1,382 @@
+#include <stddef.h>
+
+#include "block_cache.h"
+
+#include "cart.h"
+#include "cpu.h"
+#include "file.h"
+#include "memory.h"
+#include "thread.h"
+
+#define NO_SLOT 0xffff
+#define EMPTY 0xffffffff
+
+struct block {
+  // ROM address / BLOCK_CACHE_BLOCK_SIZE or EMPTY
+  unsigned int number;
+  unsigned short hash_next;
+  unsigned short lru_prev;
+  unsigned short lru_next;
+  // read ahead and not used yet
+  unsigned char prefetched;
+  unsigned char unused;
+};
+
+struct block_cache {
+  bool enabled;
+  fat_volume_read_fn *orig_fn_1;
+  fat_volume_read_fn *orig_fn_3;
+  struct mutex lock;
+  int count;
+  struct block *blocks;
+  unsigned char *data;
+  unsigned short *buckets;
+  unsigned int bucket_mask;
+  // most recently used
+  unsigned short lru_first;
+  // least recently used, replaced first
+  unsigned short lru_last;
+  int max_read_ahead;
+  int read_ahead;
+  unsigned int next_miss;
+  struct block_cache_stats stats;
+};
+
+static int block_cache_read_fn_1(struct fat_volume *volume, void *dst,
+                                 unsigned int src, unsigned int len);
+static int block_cache_read_fn_3(struct fat_volume *volume, void *dst,
+                                 unsigned int src, unsigned int len);
+static int block_cache_read(fat_volume_read_fn *orig,
+                            struct fat_volume *volume, void *dst,
+                            unsigned int src, unsigned int len);
+static int block_cache_find(unsigned int number);
+static int block_cache_fill(unsigned int number);
+static int block_cache_load(unsigned int number, bool prefetch);
+static void block_cache_hash_remove(int slot);
+static void block_cache_lru_remove(int slot);
+static void block_cache_lru_push_front(int slot);
+
+
+static struct block_cache cache;
+
+
+int block_cache_init(void *mem, int size, int max_read_ahead)
+{
+  unsigned int start = ((unsigned int)mem + CPU_CACHE_LINE_SIZE - 1) &
+                       ~(CPU_CACHE_LINE_SIZE - 1);
+  int usable = size - (int)(start - (unsigned int)mem);
+  int count = usable / (BLOCK_CACHE_BLOCK_SIZE + sizeof(struct block) +
+                        sizeof(unsigned short));
+
+  if (count < 2) {
+    return 0;
+  }
+
+  if (count >= NO_SLOT) {
+    count = NO_SLOT - 1;
+  }
+
+  block_cache_disable();
+
+  // Largest power of two <= count, at most two bytes of buckets per block.
+  unsigned int buckets = 1;
+
+  while (buckets * 2 <= count) {
+    buckets *= 2;
+  }
+
+  cache.count = count;
+  cache.data = (unsigned char *)start;
+  cache.blocks = (struct block *)(cache.data + count * BLOCK_CACHE_BLOCK_SIZE);
+  cache.buckets = (unsigned short *)(cache.blocks + count);
+  cache.bucket_mask = buckets - 1;
+
+  // Keep room for the block being read when the read-ahead is at its maximum.
+  cache.max_read_ahead = max_read_ahead < count / 2 ? max_read_ahead
+                                                    : count / 2;
+
+  ndk_mutex_init(&cache.lock);
+  block_cache_invalidate();
+  block_cache_reset_stats();
+
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  cache.orig_fn_1 = fat_volume.fn_1;
+  cache.orig_fn_3 = fat_volume.fn_3;
+  fat_volume.fn_1 = &block_cache_read_fn_1;
+  fat_volume.fn_3 = &block_cache_read_fn_3;
+  cache.enabled = true;
+
+  ndk_thread_critical_leave(&lock);
+
+  return count;
+}
+
+void block_cache_disable(void)
+{
+  int lock;
+
+  if (!cache.enabled) {
+    return;
+  }
+
+  // Wait for reads in progress
+  ndk_mutex_lock(&cache.lock);
+  ndk_thread_critical_enter(&lock);
+
+  fat_volume.fn_1 = cache.orig_fn_1;
+  fat_volume.fn_3 = cache.orig_fn_3;
+  cache.enabled = false;
+
+  ndk_thread_critical_leave(&lock);
+  ndk_mutex_unlock(&cache.lock);
+}
+
+void block_cache_invalidate(void)
+{
+  ndk_mutex_lock(&cache.lock);
+
+  for (int i = 0; i <= cache.bucket_mask; i++) {
+    cache.buckets[i] = NO_SLOT;
+  }
+
+  for (int i = 0; i < cache.count; i++) {
+    struct block *b = &cache.blocks[i];
+
+    b->number = EMPTY;
+    b->hash_next = NO_SLOT;
+    b->prefetched = 0;
+    b->lru_prev = i > 0 ? i - 1 : NO_SLOT;
+    b->lru_next = i < cache.count - 1 ? i + 1 : NO_SLOT;
+  }
+
+  cache.lru_first = 0;
+  cache.lru_last = cache.count - 1;
+  cache.read_ahead = 0;
+  cache.next_miss = EMPTY;
+
+  ndk_mutex_unlock(&cache.lock);
+}
+
+void block_cache_get_stats(struct block_cache_stats *stats)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+  *stats = cache.stats;
+  ndk_thread_critical_leave(&lock);
+}
+
+void block_cache_reset_stats(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+  cache.stats = (struct block_cache_stats) { 0 };
+  ndk_thread_critical_leave(&lock);
+}
+
+int block_cache_read_fn_1(struct fat_volume *volume, void *dst,
+                          unsigned int src, unsigned int len)
+{
+  return block_cache_read(cache.orig_fn_1, volume, dst, src, len);
+}
+
+int block_cache_read_fn_3(struct fat_volume *volume, void *dst,
+                          unsigned int src, unsigned int len)
+{
+  return block_cache_read(cache.orig_fn_3, volume, dst, src, len);
+}
+
+int block_cache_read(fat_volume_read_fn *orig, struct fat_volume *volume,
+                     void *dst, unsigned int src, unsigned int len)
+{
+  if (len == 0 || ndk_cpu_get_current_mode() == CPU_MODE_IRQ) {
+    return orig(volume, dst, src, len);
+  }
+
+  unsigned int first = src / BLOCK_CACHE_BLOCK_SIZE;
+  unsigned int last = (src + len - 1) / BLOCK_CACHE_BLOCK_SIZE;
+
+  if (last - first + 1 >= BLOCK_CACHE_BYPASS_BLOCKS) {
+    int lock;
+
+    ndk_thread_critical_enter(&lock);
+    cache.stats.reads++;
+    cache.stats.bypassed++;
+    cache.stats.bypassed_bytes += len;
+    ndk_thread_critical_leave(&lock);
+
+    return orig(volume, dst, src, len);
+  }
+
+  ndk_mutex_lock(&cache.lock);
+
+  cache.stats.reads++;
+
+  unsigned char *out = dst;
+  unsigned int offset = src % BLOCK_CACHE_BLOCK_SIZE;
+
+  for (unsigned int number = first; number <= last; number++) {
+    int slot = block_cache_find(number);
+
+    if (slot == NO_SLOT) {
+      slot = block_cache_fill(number);
+    } else {
+      struct block *b = &cache.blocks[slot];
+
+      cache.stats.hits++;
+
+      if (b->prefetched) {
+        b->prefetched = 0;
+        cache.stats.prefetch_hits++;
+      }
+    }
+
+    unsigned int n = BLOCK_CACHE_BLOCK_SIZE - offset;
+
+    n = n < len ? n : len;
+
+    ndk_memory_copy(cache.data + slot * BLOCK_CACHE_BLOCK_SIZE + offset, out,
+                    n);
+
+    block_cache_lru_remove(slot);
+    block_cache_lru_push_front(slot);
+
+    out += n;
+    len -= n;
+    offset = 0;
+  }
+
+  ndk_mutex_unlock(&cache.lock);
+
+  return 0;
+}
+
+int block_cache_find(unsigned int number)
+{
+  int slot = cache.buckets[number & cache.bucket_mask];
+
+  while (slot != NO_SLOT && cache.blocks[slot].number != number) {
+    slot = cache.blocks[slot].hash_next;
+  }
+
+  return slot;
+}
+
+/*
+ * Read a missing block and the blocks after it according to the read-ahead
+ * state. A miss where the previous read-ahead ended means the file is read
+ * sequentially.
+ */
+int block_cache_fill(unsigned int number)
+{
+  if (cache.max_read_ahead > 0 && number == cache.next_miss) {
+    cache.read_ahead = cache.read_ahead == 0 ? 1 : cache.read_ahead * 2;
+
+    if (cache.read_ahead > cache.max_read_ahead) {
+      cache.read_ahead = cache.max_read_ahead;
+    }
+  } else {
+    cache.read_ahead = 0;
+  }
+
+  int slot = block_cache_load(number, false);
+
+  cache.stats.misses++;
+
+  for (int i = 1; i <= cache.read_ahead; i++) {
+    if (block_cache_find(number + i) == NO_SLOT) {
+      block_cache_load(number + i, true);
+      cache.stats.prefetched++;
+    }
+  }
+
+  cache.next_miss = number + 1 + cache.read_ahead;
+
+  return slot;
+}
+
+/*
+ * Replace the least recently used block.
+ */
+int block_cache_load(unsigned int number, bool prefetch)
+{
+  int slot = cache.lru_last;
+  struct block *b = &cache.blocks[slot];
+
+  if (b->number != EMPTY) {
+    block_cache_hash_remove(slot);
+  }
+
+  ndk_cart_read(fat_dma_channel, number * BLOCK_CACHE_BLOCK_SIZE,
+                cache.data + slot * BLOCK_CACHE_BLOCK_SIZE,
+                BLOCK_CACHE_BLOCK_SIZE, NULL, 0, false);
+
+  unsigned short *bucket = &cache.buckets[number & cache.bucket_mask];
+
+  b->number = number;
+  b->prefetched = prefetch;
+  b->hash_next = *bucket;
+  *bucket = slot;
+
+  block_cache_lru_remove(slot);
+  block_cache_lru_push_front(slot);
+
+  return slot;
+}
+
+void block_cache_hash_remove(int slot)
+{
+  unsigned short *p = &cache.buckets[cache.blocks[slot].number &
+                                     cache.bucket_mask];
+
+  while (*p != NO_SLOT && *p != slot) {
+    p = &cache.blocks[*p].hash_next;
+  }
+
+  if (*p == slot) {
+    *p = cache.blocks[slot].hash_next;
+  }
+
+  cache.blocks[slot].hash_next = NO_SLOT;
+  cache.blocks[slot].number = EMPTY;
+}
+
+void block_cache_lru_remove(int slot)
+{
+  struct block *b = &cache.blocks[slot];
+
+  if (b->lru_prev != NO_SLOT) {
+    cache.blocks[b->lru_prev].lru_next = b->lru_next;
+  } else {
+    cache.lru_first = b->lru_next;
+  }
+
+  if (b->lru_next != NO_SLOT) {
+    cache.blocks[b->lru_next].lru_prev = b->lru_prev;
+  } else {
+    cache.lru_last = b->lru_prev;
+  }
+
+  b->lru_prev = NO_SLOT;
+  b->lru_next = NO_SLOT;
+}
+
+void block_cache_lru_push_front(int slot)
+{
+  struct block *b = &cache.blocks[slot];
+
+  b->lru_prev = NO_SLOT;
+  b->lru_next = cache.lru_first;
+
+  if (cache.lru_first != NO_SLOT) {
+    cache.blocks[cache.lru_first].lru_prev = slot;
+  } else {
+    cache.lru_last = slot;
+  }
+
+  cache.lru_first = slot;
+}
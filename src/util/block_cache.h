@@ -0,0 +1,86 @@
+/**
+ * Block read-ahead cache for the ROM file system.
+ *
+ * Installs itself as the read hooks (fn_1 and fn_3) of fat_volume. ROM data
+ * is cached in 512 byte blocks aligned with the cart block size, so every
+ * block fill is a DMA friendly cart read. Blocks are replaced in least
+ * recently used order.
+ *
+ * Read-ahead adapts to the access pattern. A miss on the block right after
+ * the previous miss doubles the number of blocks read ahead, up to the
+ * configured maximum. Any other miss resets it. Small sequential reads, like
+ * parsing a file header field by field, then mostly hit RAM.
+ *
+ * Large reads (BLOCK_CACHE_BYPASS_BLOCKS or more) go straight to the cart.
+ * They don't benefit from caching and would only evict useful blocks.
+ *
+ * The ROM never changes so the cache never needs to write anything back.
+ *
+ * NOTE: Reads that the file system issues from IRQ context bypass the cache.
+ * A block fill blocks the calling thread.
+ */
+#ifndef UTIL_BLOCK_CACHE_INCLUDE_FILE
+#define UTIL_BLOCK_CACHE_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#define BLOCK_CACHE_BLOCK_SIZE 0x200
+#define BLOCK_CACHE_BYPASS_BLOCKS 8
+
+/**
+ * Approximate memory needed per block, data and bookkeeping.
+ */
+#define BLOCK_CACHE_BYTES_PER_BLOCK (BLOCK_CACHE_BLOCK_SIZE + 16)
+
+struct block_cache_stats {
+  // number of reads through the hooks
+  unsigned int reads;
+  // blocks found in the cache
+  unsigned int hits;
+  // blocks read from the cart on demand
+  unsigned int misses;
+  // blocks read from the cart ahead of use
+  unsigned int prefetched;
+  // prefetched blocks that were used before they were evicted
+  unsigned int prefetch_hits;
+  // reads that bypassed the cache and their total size
+  unsigned int bypassed;
+  unsigned int bypassed_bytes;
+};
+
+/**
+ * Set up the cache and install the read hooks.
+ *
+ * NOTE: The file system must be mounted (ndk_fat_mount) first.
+ *
+ * Memory can be allocated from an area e.g.
+ *   ndk_area_alloc_mem(AREA_MAIN, heap, 64 * BLOCK_CACHE_BYTES_PER_BLOCK)
+ *
+ * @param mem memory for the cache
+ * @param size of mem in bytes
+ * @param max_read_ahead maximum number of blocks to read ahead, 0 to disable
+ * read-ahead
+ * @return the number of blocks that fit in mem, 0 if it's too small
+ */
+int block_cache_init(void *mem, int size, int max_read_ahead);
+
+/**
+ * Restore the original read hooks. The memory can be reused after this.
+ */
+void block_cache_disable(void);
+
+/**
+ * Drop all cached blocks.
+ */
+void block_cache_invalidate(void);
+
+/**
+ * Get the cache counters.
+ *
+ * @param[out] stats
+ */
+void block_cache_get_stats(struct block_cache_stats *stats);
+
+void block_cache_reset_stats(void);
+
+#endif // UTIL_BLOCK_CACHE_INCLUDE_FILE
@@ -0,0 +1,128 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cart_cpu.h"
+
+#include "cart.h"
+#include "memory.h"
+#include "nds.h"
+
+#define CART_READ_COMMAND 0xb7
+
+static void cart_cpu_start_block(unsigned int control, unsigned int src);
+static void cart_cpu_read_block(unsigned int *dst);
+static void cart_cpu_copy(void *src, void *dst, int size);
+
+
+static void (*orig_read)(struct cart_read_buf *);
+
+
+void cart_cpu_install(void)
+{
+  if (cart_read_buffer.read != &cart_cpu_read_data) {
+    orig_read = cart_read_buffer.read;
+    cart_read_buffer.read = &cart_cpu_read_data;
+  }
+}
+
+void cart_cpu_uninstall(void)
+{
+  if (cart_read_buffer.read == &cart_cpu_read_data) {
+    cart_read_buffer.read = orig_read != NULL ? orig_read
+                                              : &ndk_cart_cpu_read_data;
+  }
+}
+
+void cart_cpu_read_data(struct cart_read_buf *tmp)
+{
+  unsigned int src = cart_state.src;
+  unsigned char *dst = (unsigned char *)cart_state.dst;
+  unsigned int count = cart_state.count;
+  unsigned int control = (tmp->ROMCTRL & ~CARD_ROMCTRL_BLOCK_MASK) |
+                         CARD_ROMCTRL_BLOCK_512 | CARD_ROMCTRL_RELEASE_RESET |
+                         CARD_ROMCTRL_START;
+  unsigned int block = src & ~(CART_BLOCK_SIZE - 1);
+
+  if (count == 0) {
+    return;
+  }
+
+  cart_cpu_start_block(control, block);
+
+  while (count > 0) {
+    unsigned int offset = src - block;
+    unsigned int n = CART_BLOCK_SIZE - offset;
+
+    if (n > count) {
+      n = count;
+    }
+
+    bool direct = n == CART_BLOCK_SIZE && ((unsigned int)dst & 3) == 0;
+
+    cart_cpu_read_block(direct ? (unsigned int *)dst
+                               : (unsigned int *)tmp->data);
+
+    // The card looks up the next block while the buffer is copied out
+    if (count > n) {
+      cart_cpu_start_block(control, block + CART_BLOCK_SIZE);
+    }
+
+    if (!direct) {
+      cart_cpu_copy(tmp->data + offset, dst, n);
+    }
+
+    block += CART_BLOCK_SIZE;
+    src += n;
+    dst += n;
+    count -= n;
+  }
+
+  cart_state.src = src;
+  cart_state.dst = (unsigned int)dst;
+  cart_state.count = 0;
+}
+
+/*
+ * Send a data read command (B7 aaaaaaaa 000000) for the block at src.
+ */
+void cart_cpu_start_block(unsigned int control, unsigned int src)
+{
+  CARD_AUXSPICNT_H = 0x80;
+
+  CARD_COMMAND[0] = CART_READ_COMMAND;
+  CARD_COMMAND[1] = src >> 24;
+  CARD_COMMAND[2] = src >> 16;
+  CARD_COMMAND[3] = src >> 8;
+  CARD_COMMAND[4] = src;
+  CARD_COMMAND[5] = 0;
+  CARD_COMMAND[6] = 0;
+  CARD_COMMAND[7] = 0;
+
+  CARD_ROMCTRL = control;
+}
+
+/*
+ * Read the 512 bytes of the block that was started. Every word has to be
+ * read from CARD_DATA before the card sends the next one.
+ */
+void cart_cpu_read_block(unsigned int *dst)
+{
+  unsigned int status;
+
+  do {
+    status = CARD_ROMCTRL;
+
+    if (status & CARD_ROMCTRL_DATA_READY) {
+      *dst++ = CARD_DATA;
+    }
+  } while (status & CARD_ROMCTRL_START);
+}
+
+void cart_cpu_copy(void *src, void *dst, int size)
+{
+  if ((((unsigned int)src | (unsigned int)dst | size) & 3) == 0) {
+    ndk_memory_fast_32bit_copy(src, dst, size);
+  } else {
+    ndk_memory_copy(src, dst, size);
+  }
+}
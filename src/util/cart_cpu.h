@@ -0,0 +1,53 @@
+/**
+ * Faster CPU read path for ndk_cart_read.
+ *
+ * ndk_cart_read reads with the CPU when it can't use DMA: no DMA channel,
+ * src not aligned with 512, dst not aligned with 4 or in TCM, or count not a
+ * multiple of 512. The firmware's ndk_cart_cpu_read_data then sends one 512
+ * byte block command at a time and waits for the card before each block.
+ *
+ * cart_cpu_read_data reads the same data differently:
+ *  - Blocks that cover 512 bytes of dst, with dst aligned with 4, are read
+ *    straight into dst.
+ *  - Other blocks, at most a head and a tail when src and dst have the same
+ *    alignment, go through the 512 byte buffer in cart_read_buffer. The
+ *    command for the next block is sent before the buffer is copied out, so
+ *    the copy runs while the card looks up the next block.
+ *
+ * cart_cpu_install makes it the CPU read path of ndk_cart_read (the read
+ * hook in cart_read_buffer), so the firmware's locking and completion
+ * callback stay as they are and file reads use it too.
+ *
+ *   cart_cpu_install();
+ *   // Unaligned file reads now take the new path
+ *   ndk_file_read(&f, buf + 1, 1000);
+ *
+ * NOTE: The control value for the reads is taken from cart_read_buffer.ROMCTRL
+ * like the firmware does, so KEY2 encryption is set up the same way.
+ */
+#ifndef UTIL_CART_CPU_INCLUDE_FILE
+#define UTIL_CART_CPU_INCLUDE_FILE
+
+#include "cart.h"
+
+/**
+ * Use cart_cpu_read_data for CPU reads in ndk_cart_read.
+ *
+ * NOTE: Call after ndk_cart_init (ndk_platform_init calls it).
+ */
+void cart_cpu_install(void);
+
+/**
+ * Go back to ndk_cart_cpu_read_data.
+ */
+void cart_cpu_uninstall(void);
+
+/**
+ * Read cart_state.count bytes from cart_state.src to cart_state.dst with the
+ * CPU. Same contract as ndk_cart_cpu_read_data.
+ *
+ * @param tmp cart_read_buffer
+ */
+void cart_cpu_read_data(struct cart_read_buf *tmp);
+
+#endif // UTIL_CART_CPU_INCLUDE_FILE
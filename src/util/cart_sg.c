@@ -0,0 +1,308 @@
+#include <stddef.h>
+
+#include "cart_sg.h"
+
+#include "cart.h"
+#include "cpu.h"
+#include "file.h"
+#include "memory.h"
+#include "thread.h"
+
+// A range of cart blocks [start, end) read through the staging buffer
+struct span {
+  unsigned int start;
+  unsigned int end;
+};
+
+struct cart_sg_state {
+  bool initialized;
+  struct mutex lock;
+  int span_count;
+  struct span spans[2 * CART_SG_MAX_ENTRIES];
+  unsigned char stage[CART_SG_STAGE_BLOCKS * CART_BLOCK_SIZE]
+    __attribute__((aligned(32)));
+};
+
+static void cart_sg_sort(struct cart_sg *entries, int count);
+static bool cart_sg_direct(const struct cart_sg *e, unsigned int *start,
+                           unsigned int *end);
+static void cart_sg_add_span(unsigned int start, unsigned int end);
+static void cart_sg_merge_spans(const struct cart_sg *entries, int count);
+static bool cart_sg_gap_direct(const struct cart_sg *entries, int count,
+                               unsigned int start, unsigned int end);
+static void cart_sg_scatter(struct cart_sg *entries, int count,
+                            unsigned int start, unsigned int end);
+static void cart_sg_copy_part(const struct cart_sg *e, unsigned int from,
+                              unsigned int to, unsigned int start,
+                              unsigned int end);
+
+
+static struct cart_sg_state sg;
+
+
+bool cart_sg_file(struct cart_sg *e, int fat_id, unsigned int offset,
+                  void *dst, unsigned int size)
+{
+  struct file h;
+
+  ndk_file_init_handle(&h);
+
+  if (!ndk_file_open_by_fat_id(&h, &fat_volume, fat_id)) {
+    return false;
+  }
+
+  unsigned int file_start = h.start_offset;
+  unsigned int file_size = ndk_file_size(&h);
+
+  ndk_file_close(&h);
+
+  if (offset > file_size) {
+    return false;
+  }
+
+  e->rom_offset = file_start + offset;
+  e->dst = dst;
+  e->size = size < file_size - offset ? size : file_size - offset;
+
+  return true;
+}
+
+bool cart_sg_read(struct cart_sg *entries, int count, void (*cb)(int),
+                  int cb_arg)
+{
+  int lock;
+
+  if (count > CART_SG_MAX_ENTRIES) {
+    return false;
+  }
+
+  ndk_thread_critical_enter(&lock);
+
+  if (!sg.initialized) {
+    ndk_mutex_init(&sg.lock);
+    sg.initialized = true;
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  ndk_mutex_lock(&sg.lock);
+
+  cart_sg_sort(entries, count);
+
+  // Everything that isn't read straight into its destination is staged
+  sg.span_count = 0;
+
+  for (int i = 0; i < count; i++) {
+    struct cart_sg *e = &entries[i];
+    unsigned int start;
+    unsigned int end;
+
+    if (cart_sg_direct(e, &start, &end)) {
+      cart_sg_add_span(e->rom_offset, start);
+      cart_sg_add_span(end, e->rom_offset + e->size);
+    } else {
+      cart_sg_add_span(e->rom_offset, e->rom_offset + e->size);
+    }
+  }
+
+  cart_sg_merge_spans(entries, count);
+
+  // Direct reads go first. The CPU copies of the staged parts may share
+  // cache lines with a direct part, DMA would drop them if they came first.
+  for (int i = 0; i < count; i++) {
+    struct cart_sg *e = &entries[i];
+    unsigned int start;
+    unsigned int end;
+
+    if (cart_sg_direct(e, &start, &end)) {
+      char *dst = (char *)e->dst + (start - e->rom_offset);
+
+      // Dirty lines at the edges hold bytes next to the part, write them
+      // back before DMA replaces the memory under them
+      ndk_cpu_clean_and_invalidate_dcache_lines(dst, end - start);
+      ndk_cart_read(fat_dma_channel, start, dst, end - start, NULL, 0,
+                    false);
+    }
+  }
+
+  for (int s = 0; s < sg.span_count; s++) {
+    struct span *p = &sg.spans[s];
+
+    while (p->start < p->end) {
+      unsigned int n = p->end - p->start;
+
+      if (n > CART_SG_STAGE_BLOCKS) {
+        n = CART_SG_STAGE_BLOCKS;
+      }
+
+      // The read may use DMA, nothing of the buffer may be left in the cache
+      ndk_cpu_invalidate_dcache_lines(sg.stage, n * CART_BLOCK_SIZE);
+      ndk_cart_read(fat_dma_channel, p->start * CART_BLOCK_SIZE, sg.stage,
+                    n * CART_BLOCK_SIZE, NULL, 0, false);
+      cart_sg_scatter(entries, count, p->start * CART_BLOCK_SIZE,
+                      (p->start + n) * CART_BLOCK_SIZE);
+
+      p->start += n;
+    }
+  }
+
+  ndk_mutex_unlock(&sg.lock);
+
+  if (cb != NULL) {
+    cb(cb_arg);
+  }
+
+  return true;
+}
+
+/*
+ * Insertion sort on ROM offset, lists are short.
+ */
+void cart_sg_sort(struct cart_sg *entries, int count)
+{
+  for (int i = 1; i < count; i++) {
+    struct cart_sg e = entries[i];
+    int j = i;
+
+    for (; j > 0 && entries[j - 1].rom_offset > e.rom_offset; j--) {
+      entries[j] = entries[j - 1];
+    }
+
+    entries[j] = e;
+  }
+}
+
+/*
+ * The whole blocks of an entry, if they can be read straight into its
+ * destination.
+ */
+bool cart_sg_direct(const struct cart_sg *e, unsigned int *start,
+                    unsigned int *end)
+{
+  *start = (e->rom_offset + CART_BLOCK_SIZE - 1) & ~(CART_BLOCK_SIZE - 1);
+  *end = (e->rom_offset + e->size) & ~(CART_BLOCK_SIZE - 1);
+
+  return *end > *start &&
+         (((unsigned int)e->dst + (*start - e->rom_offset)) & 3) == 0;
+}
+
+/*
+ * Add the blocks of the ROM bytes [start, end), sorted on the first block.
+ */
+void cart_sg_add_span(unsigned int start, unsigned int end)
+{
+  if (end <= start) {
+    return;
+  }
+
+  struct span p = {
+    start / CART_BLOCK_SIZE,
+    (end + CART_BLOCK_SIZE - 1) / CART_BLOCK_SIZE
+  };
+  int j = sg.span_count++;
+
+  for (; j > 0 && sg.spans[j - 1].start > p.start; j--) {
+    sg.spans[j] = sg.spans[j - 1];
+  }
+
+  sg.spans[j] = p;
+}
+
+/*
+ * Join spans that overlap or are at most CART_SG_MAX_GAP_BLOCKS apart. A gap
+ * with blocks that are read straight into a destination is kept, staging
+ * them too would read them twice.
+ */
+void cart_sg_merge_spans(const struct cart_sg *entries, int count)
+{
+  int n = sg.span_count > 0 ? 1 : 0;
+
+  for (int i = 1; i < sg.span_count; i++) {
+    struct span *p = &sg.spans[i];
+    struct span *last = &sg.spans[n - 1];
+
+    if (p->start <= last->end ||
+        (p->start <= last->end + CART_SG_MAX_GAP_BLOCKS &&
+         !cart_sg_gap_direct(entries, count, last->end, p->start))) {
+      if (p->end > last->end) {
+        last->end = p->end;
+      }
+    } else {
+      sg.spans[n++] = *p;
+    }
+  }
+
+  sg.span_count = n;
+}
+
+/*
+ * Whether any of the blocks [start, end) is read straight into a
+ * destination.
+ */
+bool cart_sg_gap_direct(const struct cart_sg *entries, int count,
+                        unsigned int start, unsigned int end)
+{
+  for (int i = 0; i < count; i++) {
+    unsigned int direct_start;
+    unsigned int direct_end;
+
+    if (cart_sg_direct(&entries[i], &direct_start, &direct_end) &&
+        direct_start / CART_BLOCK_SIZE < end &&
+        direct_end / CART_BLOCK_SIZE > start) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Copy the staged parts of every entry that fall in the staged ROM bytes
+ * [start, end).
+ */
+void cart_sg_scatter(struct cart_sg *entries, int count, unsigned int start,
+                     unsigned int end)
+{
+  for (int i = 0; i < count && entries[i].rom_offset < end; i++) {
+    const struct cart_sg *e = &entries[i];
+    unsigned int direct_start;
+    unsigned int direct_end;
+
+    if (cart_sg_direct(e, &direct_start, &direct_end)) {
+      cart_sg_copy_part(e, e->rom_offset, direct_start, start, end);
+      cart_sg_copy_part(e, direct_end, e->rom_offset + e->size, start, end);
+    } else {
+      cart_sg_copy_part(e, e->rom_offset, e->rom_offset + e->size, start,
+                        end);
+    }
+  }
+}
+
+/*
+ * Copy the ROM bytes [from, to) of an entry, as far as they are staged.
+ */
+void cart_sg_copy_part(const struct cart_sg *e, unsigned int from,
+                       unsigned int to, unsigned int start, unsigned int end)
+{
+  if (from < start) {
+    from = start;
+  }
+
+  if (to > end) {
+    to = end;
+  }
+
+  if (to <= from) {
+    return;
+  }
+
+  unsigned char *src = sg.stage + (from - start);
+  unsigned char *dst = (unsigned char *)e->dst + (from - e->rom_offset);
+  int size = to - from;
+
+  if ((((unsigned int)src | (unsigned int)dst | size) & 3) == 0) {
+    ndk_memory_fast_32bit_copy(src, dst, size);
+  } else {
+    ndk_memory_copy(src, dst, size);
+  }
+}
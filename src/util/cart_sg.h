@@ -0,0 +1,75 @@
+/**
+ * Scatter-gather cart reads.
+ *
+ * ndk_cart_read reads one ROM range into one destination. Loading a group of
+ * small files that sit close together in ROM that way costs a cart read per
+ * file, and the 512 byte blocks they share are read more than once.
+ *
+ * cart_sg_read takes a list of ranges, sorts them on ROM offset and reads
+ * every block once:
+ *  - The 512 byte aligned middle of a range whose destination is aligned
+ *    with 4 is read straight into the destination, with DMA where the file
+ *    system uses it. These reads come first, a CPU copy to a cache line
+ *    shared with a middle would be lost to the DMA otherwise.
+ *  - The rest, the heads and tails of ranges and small ranges, is read in
+ *    whole blocks into a staging buffer and copied out. Blocks needed by
+ *    several ranges are read once. Needed blocks at most
+ *    CART_SG_MAX_GAP_BLOCKS apart are read with one command, the blocks in
+ *    between are read too unless they are read straight into a range.
+ *
+ *   struct cart_sg list[3];
+ *
+ *   cart_sg_file(&list[0], font_id, 0, font, font_size);
+ *   cart_sg_file(&list[1], palette_id, 0, palette, 512);
+ *   cart_sg_file(&list[2], strings_id, 0, strings, strings_size);
+ *
+ *   cart_sg_read(list, 3, NULL, 0);
+ *
+ * NOTE: cart_sg_read blocks the calling thread until everything is read.
+ * Call it from an I/O thread to keep the game running.
+ *
+ * NOTE: The file system must be mounted (ndk_fat_mount) first, its DMA
+ * channel is used.
+ */
+#ifndef UTIL_CART_SG_INCLUDE_FILE
+#define UTIL_CART_SG_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#define CART_SG_MAX_ENTRIES 64
+#define CART_SG_STAGE_BLOCKS 8
+#define CART_SG_MAX_GAP_BLOCKS 2
+
+struct cart_sg {
+  unsigned int rom_offset;          // 0x00
+  void *dst;                        // 0x04
+  unsigned int size;                // 0x08
+  // 0x0c
+};
+
+/**
+ * Fill in an entry for part of a file.
+ *
+ * @param e
+ * @param fat_id file to read from
+ * @param offset in the file
+ * @param dst
+ * @param size bytes to read, clamped to the end of the file
+ * @return false if the file doesn't exist or offset is past its end
+ */
+bool cart_sg_file(struct cart_sg *e, int fat_id, unsigned int offset,
+                  void *dst, unsigned int size);
+
+/**
+ * Read all entries.
+ *
+ * @param entries sorted on rom_offset in place
+ * @param count at most CART_SG_MAX_ENTRIES
+ * @param cb optional, called once when all data has been read
+ * @param cb_arg argument passed to cb
+ * @return false if count is too large, nothing is read then
+ */
+bool cart_sg_read(struct cart_sg *entries, int count, void (*cb)(int),
+                  int cb_arg);
+
+#endif // UTIL_CART_SG_INCLUDE_FILE
@@ -0,0 +1,181 @@
+#include <stddef.h>
+
+#include "coro.h"
+
+#include "interrupts.h"
+#include "nds.h"
+
+static bool coro_ready(struct coro *co);
+static struct file *coro_sched_file_to_wait_for(struct coro_sched *s);
+
+
+void coro_sched_init(struct coro_sched *s)
+{
+  s->first = NULL;
+  s->last = NULL;
+  s->count = 0;
+  s->stop = false;
+}
+
+void coro_start(struct coro_sched *s, struct coro *co, coro_fn *fn)
+{
+  co->next = NULL;
+  co->fn = fn;
+  co->line = 0;
+  co->wait = CORO_WAIT_NONE;
+
+  if (s->last != NULL) {
+    s->last->next = co;
+  } else {
+    s->first = co;
+  }
+
+  s->last = co;
+  s->count++;
+}
+
+void coro_cancel(struct coro_sched *s, struct coro *co)
+{
+  struct coro *prev = NULL;
+
+  for (struct coro *i = s->first; i != NULL; prev = i, i = i->next) {
+    if (i != co) {
+      continue;
+    }
+
+    if (prev != NULL) {
+      prev->next = co->next;
+    } else {
+      s->first = co->next;
+    }
+
+    if (s->last == co) {
+      s->last = prev;
+    }
+
+    co->next = NULL;
+    s->count--;
+    return;
+  }
+}
+
+bool coro_running(struct coro_sched *s, struct coro *co)
+{
+  for (struct coro *i = s->first; i != NULL; i = i->next) {
+    if (i == co) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int coro_sched_run(struct coro_sched *s)
+{
+  struct coro *co = s->first;
+
+  /*
+   * Coroutines started during the pass are appended to the list and run in
+   * the same pass.
+   */
+  while (co != NULL) {
+    if (!coro_ready(co)) {
+      co = co->next;
+      continue;
+    }
+
+    co->wait = CORO_WAIT_NONE;
+
+    int status = co->fn(co);
+
+    // Read after the call, the coroutine may have started or cancelled
+    // others.
+    struct coro *next = co->next;
+
+    if (status == CORO_DONE) {
+      // Unlink from the list as it is now, a cached previous node may have
+      // been cancelled during the call.
+      coro_cancel(s, co);
+    }
+
+    co = next;
+  }
+
+  return s->count;
+}
+
+void coro_sched_loop(void *arg)
+{
+  struct coro_sched *s = arg;
+
+  while (!s->stop) {
+    coro_sched_run(s);
+
+    if (s->stop) {
+      break;
+    }
+
+    struct file *h = coro_sched_file_to_wait_for(s);
+
+    if (h != NULL) {
+      int lock;
+
+      ndk_thread_critical_enter(&lock);
+
+      while (h->flags & 1) {
+        ndk_thread_yield(&h->waiting);
+      }
+
+      ndk_thread_critical_leave(&lock);
+    } else {
+      ndk_wait_vblank_intr();
+    }
+  }
+
+  s->stop = false;
+}
+
+void coro_sched_stop(struct coro_sched *s)
+{
+  s->stop = true;
+}
+
+void coro_wait_frames(struct coro *co, unsigned int n)
+{
+  co->wait = CORO_WAIT_FRAME;
+  co->frame = frame_counter + n;
+}
+
+bool coro_ready(struct coro *co)
+{
+  switch (co->wait) {
+    case CORO_WAIT_FRAME:
+      // Wrap around safe compare
+      return (int)(frame_counter - co->frame) >= 0;
+    case CORO_WAIT_FILE:
+      // bit 0 is set while an operation is ongoing
+      return (co->file->flags & 1) == 0;
+    default:
+      return true;
+  }
+}
+
+/*
+ * Get the file to wait for if all coroutines are waiting for file operations.
+ */
+struct file *coro_sched_file_to_wait_for(struct coro_sched *s)
+{
+  struct file *h = NULL;
+
+  for (struct coro *co = s->first; co != NULL; co = co->next) {
+    if (co->wait != CORO_WAIT_FILE) {
+      return NULL;
+    }
+
+    if (h == NULL && (co->file->flags & 1)) {
+      h = co->file;
+    }
+  }
+
+  return h;
+}
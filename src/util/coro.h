@@ -0,0 +1,224 @@
+/**
+ * Stackless coroutines.
+ *
+ * A coroutine is a function that can suspend itself in the middle and continue
+ * from the same place the next time it's called. It's implemented as a switch
+ * statement on the line number of the last suspension point (protothreads).
+ * All coroutines are run by one scheduler from one thread so they share that
+ * threads stack. A coroutine costs a struct coro, 16 bytes, instead of a
+ * struct thread and a stack.
+ *
+ * The price is that local variables are lost when a coroutine suspends. Keep
+ * all state that must survive a suspension in a struct that embeds the struct
+ * coro as its first member:
+ *
+ *   struct fade {
+ *     struct coro co;
+ *     int level;
+ *   };
+ *
+ *   int fade_fn(struct coro *co)
+ *   {
+ *     struct fade *f = (struct fade *)co;
+ *
+ *     CORO_BEGIN(co);
+ *
+ *     for (f->level = 0; f->level < 16; f->level++) {
+ *       REG_MASTER_BRIGHT = 0x8000 | (16 - f->level);
+ *       CORO_AWAIT_VBLANK(co);
+ *     }
+ *
+ *     CORO_END(co);
+ *   }
+ *
+ *   coro_start(&sched, &fade.co, &fade_fn);
+ *
+ * NOTE: Don't use switch statements that contain a suspension point inside a
+ * coroutine and only one suspension point per source line.
+ */
+#ifndef UTIL_CORO_INCLUDE_FILE
+#define UTIL_CORO_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "file.h"
+#include "thread.h"
+
+// Coroutine function return values
+#define CORO_SUSPENDED 0
+#define CORO_DONE 1
+
+// What a coroutine waits for
+#define CORO_WAIT_NONE 0
+#define CORO_WAIT_FRAME 1
+#define CORO_WAIT_FILE 2
+
+struct coro;
+
+/**
+ * Coroutine body. Must start with CORO_BEGIN and end with CORO_END.
+ *
+ * @return CORO_SUSPENDED or CORO_DONE
+ */
+typedef int coro_fn(struct coro *);
+
+struct coro {
+  struct coro *next;                // 0x00
+  coro_fn *fn;                      // 0x04
+  // line of the suspension point to continue from, 0 at the start
+  unsigned short line;              // 0x08
+  unsigned char wait;               // 0x0a
+  unsigned char unused;             // 0x0b
+  union {
+    // CORO_WAIT_FRAME resume when frame_counter reaches this value
+    unsigned int frame;
+    // CORO_WAIT_FILE resume when the operation on this file is done
+    struct file *file;
+  };                                // 0x0c
+  // 0x10
+};
+
+struct coro_sched {
+  struct coro *first;
+  struct coro *last;
+  int count;
+  bool stop;
+};
+
+#define CORO_BEGIN(co) switch ((co)->line) { case 0:
+
+#define CORO_END(co) } (co)->line = 0; return CORO_DONE
+
+/**
+ * Suspend and continue at the next scheduler pass.
+ */
+#define CORO_YIELD(co) \
+  do { \
+    (co)->line = __LINE__; \
+    return CORO_SUSPENDED; \
+    case __LINE__:; \
+  } while (0)
+
+/**
+ * Suspend until cond is true. cond is evaluated once per scheduler pass.
+ */
+#define CORO_AWAIT(co, cond) \
+  do { \
+    (co)->line = __LINE__; \
+    case __LINE__: \
+    if (!(cond)) \
+      return CORO_SUSPENDED; \
+  } while (0)
+
+/**
+ * Suspend for n frames, n = 1 is the next VBlank.
+ */
+#define CORO_AWAIT_FRAMES(co, n) \
+  do { \
+    coro_wait_frames((co), (n)); \
+    CORO_YIELD(co); \
+  } while (0)
+
+#define CORO_AWAIT_VBLANK(co) CORO_AWAIT_FRAMES(co, 1)
+
+/**
+ * Suspend for at least ms milliseconds, counted in frames (60 per second).
+ * ms is rounded up to whole frames, so the wait is up to 16.7 ms longer and
+ * any ms from 1 to 16 waits until the next VBlank.
+ */
+#define CORO_AWAIT_MS(co, ms) \
+  CORO_AWAIT_FRAMES(co, ((ms) * 60 + 999) / 1000)
+
+/**
+ * Suspend until the ongoing operation on a file handle is done. Start the
+ * operation with ndk_file_read_impl(h, dest, count, true) first.
+ */
+#define CORO_AWAIT_FILE(co, h) \
+  do { \
+    (co)->wait = CORO_WAIT_FILE; \
+    (co)->file = (h); \
+    CORO_YIELD(co); \
+  } while (0)
+
+/**
+ * Stop a coroutine from inside. Same as CORO_END but can be used anywhere in
+ * the body.
+ */
+#define CORO_EXIT(co) \
+  do { \
+    (co)->line = 0; \
+    return CORO_DONE; \
+  } while (0)
+
+/**
+ * Initialize a scheduler.
+ *
+ * @param s
+ */
+void coro_sched_init(struct coro_sched *s);
+
+/**
+ * Add a coroutine to a scheduler. It runs for the first time at the next
+ * scheduler pass.
+ *
+ * NOTE: Only call from the thread that runs the scheduler or from a coroutine.
+ *
+ * @param s
+ * @param co
+ * @param fn
+ */
+void coro_start(struct coro_sched *s, struct coro *co, coro_fn *fn);
+
+/**
+ * Remove a coroutine before it's done.
+ *
+ * NOTE: Must not be called from the coroutine itself, use CORO_EXIT.
+ *
+ * @param s
+ * @param co
+ */
+void coro_cancel(struct coro_sched *s, struct coro *co);
+
+/**
+ * Check if a coroutine has finished or been cancelled.
+ *
+ * @param s
+ * @param co
+ * @return true if it's still in the scheduler
+ */
+bool coro_running(struct coro_sched *s, struct coro *co);
+
+/**
+ * Run every coroutine that isn't waiting once, in the order they were
+ * started. Done coroutines are removed.
+ *
+ * @param s
+ * @return number of coroutines left
+ */
+int coro_sched_run(struct coro_sched *s);
+
+/**
+ * Run the scheduler from the current thread until coro_sched_stop is called.
+ *
+ * Between passes the thread waits for VBlank. If every coroutine is waiting
+ * for a file operation the thread instead waits for the first of those files
+ * so file completions are handled without waiting for the next frame.
+ *
+ * The argument is a struct coro_sched so this can be used as a thread worker
+ * function with ndk_thread_create.
+ *
+ * @param arg struct coro_sched
+ */
+void coro_sched_loop(void *arg);
+
+/**
+ * Make coro_sched_loop return after the current pass.
+ */
+void coro_sched_stop(struct coro_sched *s);
+
+/**
+ * Helper for CORO_AWAIT_FRAMES.
+ */
+void coro_wait_frames(struct coro *co, unsigned int n);
+
+#endif // UTIL_CORO_INCLUDE_FILE
@@ -0,0 +1,279 @@
+#include <stddef.h>
+
+#include "fat_cache.h"
+
+#include "cpu.h"
+#include "file.h"
+#include "memory.h"
+#include "thread.h"
+
+#define EMPTY 0xffffffff
+#define ALIGN4(x) (((x) + 3) & ~3)
+
+struct name_block {
+  // ROM address / FAT_CACHE_BLOCK_SIZE or EMPTY
+  unsigned int number;
+  // value of the use counter at the last use, lowest is replaced first
+  unsigned int used;
+};
+
+struct fat_cache {
+  bool enabled;
+  fat_volume_read_fn *orig_fn_3;
+  struct mutex lock;
+  unsigned char *fat;
+  unsigned char *dirs;
+  unsigned int dir_size;
+  int count;
+  struct name_block *blocks;
+  unsigned char *data;
+  unsigned int use_counter;
+  struct fat_cache_stats stats;
+  // first directory entry, read by fat_cache_dir_size
+  unsigned int root[2];
+};
+
+static int fat_cache_read_fn_3(struct fat_volume *volume, void *dst,
+                               unsigned int src, unsigned int len);
+static unsigned int fat_cache_dir_size(void);
+static int fat_cache_find(unsigned int number);
+static int fat_cache_load(unsigned int number);
+static void fat_cache_count(unsigned int *counter);
+
+
+static struct fat_cache cache;
+
+
+int fat_cache_size(int blocks)
+{
+  return CPU_CACHE_LINE_SIZE + blocks * (FAT_CACHE_BLOCK_SIZE +
+                                         sizeof(struct name_block)) +
+         ALIGN4(fat_volume.fat_table_size) + ALIGN4(fat_cache_dir_size());
+}
+
+int fat_cache_init(void *mem, int size)
+{
+  unsigned int start = ((unsigned int)mem + CPU_CACHE_LINE_SIZE - 1) &
+                       ~(CPU_CACHE_LINE_SIZE - 1);
+  int usable = size - (int)(start - (unsigned int)mem);
+
+  fat_cache_disable();
+
+  unsigned int dir_size = fat_cache_dir_size();
+  int tables = ALIGN4(fat_volume.fat_table_size) + ALIGN4(dir_size);
+  int count = (usable - tables) / (FAT_CACHE_BLOCK_SIZE +
+                                   (int)sizeof(struct name_block));
+
+  if (dir_size == 0 || usable < tables || count < 2) {
+    return 0;
+  }
+
+  cache.count = count;
+  cache.data = (unsigned char *)start;
+  cache.blocks = (struct name_block *)(cache.data +
+                                       count * FAT_CACHE_BLOCK_SIZE);
+  cache.fat = (unsigned char *)(cache.blocks + count);
+  cache.dirs = cache.fat + ALIGN4(fat_volume.fat_table_size);
+  cache.dir_size = dir_size;
+
+  if (fat_volume.fn_3(&fat_volume, cache.fat, fat_volume.fat_rom_offset,
+                      fat_volume.fat_table_size) != 0 ||
+      fat_volume.fn_3(&fat_volume, cache.dirs, fat_volume.fnt_rom_offset,
+                      dir_size) != 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    cache.blocks[i].number = EMPTY;
+    cache.blocks[i].used = 0;
+  }
+
+  cache.use_counter = 0;
+
+  ndk_mutex_init(&cache.lock);
+  fat_cache_reset_stats();
+
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  cache.orig_fn_3 = fat_volume.fn_3;
+  fat_volume.fn_3 = &fat_cache_read_fn_3;
+  cache.enabled = true;
+
+  ndk_thread_critical_leave(&lock);
+
+  return count;
+}
+
+void fat_cache_disable(void)
+{
+  int lock;
+
+  if (!cache.enabled) {
+    return;
+  }
+
+  // Wait for reads in progress
+  ndk_mutex_lock(&cache.lock);
+  ndk_thread_critical_enter(&lock);
+
+  fat_volume.fn_3 = cache.orig_fn_3;
+  cache.enabled = false;
+
+  ndk_thread_critical_leave(&lock);
+  ndk_mutex_unlock(&cache.lock);
+}
+
+void fat_cache_get_stats(struct fat_cache_stats *stats)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+  *stats = cache.stats;
+  ndk_thread_critical_leave(&lock);
+}
+
+void fat_cache_reset_stats(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+  cache.stats = (struct fat_cache_stats) { 0 };
+  ndk_thread_critical_leave(&lock);
+}
+
+int fat_cache_read_fn_3(struct fat_volume *volume, void *dst,
+                        unsigned int src, unsigned int len)
+{
+  unsigned int fat = volume->fat_rom_offset;
+  unsigned int fnt = volume->fnt_rom_offset;
+
+  if (len == 0 || ndk_cpu_get_current_mode() == CPU_MODE_IRQ) {
+    return cache.orig_fn_3(volume, dst, src, len);
+  }
+
+  fat_cache_count(&cache.stats.reads);
+
+  if (src >= fat && src + len <= fat + volume->fat_table_size) {
+    ndk_memory_copy(cache.fat + (src - fat), dst, len);
+    fat_cache_count(&cache.stats.fat_hits);
+    return 0;
+  }
+
+  if (src >= fnt && src + len <= fnt + cache.dir_size) {
+    ndk_memory_copy(cache.dirs + (src - fnt), dst, len);
+    fat_cache_count(&cache.stats.dir_hits);
+    return 0;
+  }
+
+  if (src < fnt || src + len > fnt + volume->fnt_table_size) {
+    fat_cache_count(&cache.stats.bypassed);
+    return cache.orig_fn_3(volume, dst, src, len);
+  }
+
+  ndk_mutex_lock(&cache.lock);
+
+  unsigned char *out = dst;
+  unsigned int first = src / FAT_CACHE_BLOCK_SIZE;
+  unsigned int last = (src + len - 1) / FAT_CACHE_BLOCK_SIZE;
+  unsigned int offset = src % FAT_CACHE_BLOCK_SIZE;
+
+  for (unsigned int number = first; number <= last; number++) {
+    int slot = fat_cache_find(number);
+
+    if (slot < 0) {
+      slot = fat_cache_load(number);
+      cache.stats.misses++;
+
+      if (slot < 0) {
+        ndk_mutex_unlock(&cache.lock);
+        return cache.orig_fn_3(volume, dst, src, len);
+      }
+    } else {
+      cache.stats.hits++;
+    }
+
+    unsigned int n = FAT_CACHE_BLOCK_SIZE - offset;
+
+    n = n < len ? n : len;
+
+    ndk_memory_copy(cache.data + slot * FAT_CACHE_BLOCK_SIZE + offset, out,
+                    n);
+
+    cache.blocks[slot].used = ++cache.use_counter;
+
+    out += n;
+    len -= n;
+    offset = 0;
+  }
+
+  ndk_mutex_unlock(&cache.lock);
+
+  return 0;
+}
+
+/*
+ * Size of the directory table. The first entry holds the number of
+ * directories where the other entries hold the parent id.
+ */
+unsigned int fat_cache_dir_size(void)
+{
+  if (fat_volume.fnt_table_size < 8 ||
+      fat_volume.fn_3(&fat_volume, cache.root, fat_volume.fnt_rom_offset,
+                      8) != 0) {
+    return 0;
+  }
+
+  unsigned int size = (cache.root[1] >> 16) * 8;
+
+  return size < fat_volume.fnt_table_size ? size : fat_volume.fnt_table_size;
+}
+
+int fat_cache_find(unsigned int number)
+{
+  for (int i = 0; i < cache.count; i++) {
+    if (cache.blocks[i].number == number) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Replace the least recently used block, -1 if the read fails.
+ */
+int fat_cache_load(unsigned int number)
+{
+  int slot = 0;
+
+  for (int i = 1; i < cache.count; i++) {
+    if (cache.blocks[i].used < cache.blocks[slot].used) {
+      slot = i;
+    }
+  }
+
+  struct name_block *b = &cache.blocks[slot];
+
+  b->number = EMPTY;
+
+  if (cache.orig_fn_3(&fat_volume, cache.data + slot * FAT_CACHE_BLOCK_SIZE,
+                      number * FAT_CACHE_BLOCK_SIZE,
+                      FAT_CACHE_BLOCK_SIZE) != 0) {
+    return -1;
+  }
+
+  b->number = number;
+
+  return slot;
+}
+
+void fat_cache_count(unsigned int *counter)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+  (*counter)++;
+  ndk_thread_critical_leave(&lock);
+}
@@ -0,0 +1,89 @@
+/**
+ * Partial cache of the file tables (FAT and FNT).
+ *
+ * ndk_fat_cache_file_tables caches both tables or nothing, game.h reserves
+ * 11KB for it and a ROM with many files needs a lot more. Without the cache
+ * every open walks the FNT on the cart a few bytes at a time.
+ *
+ * This cache installs itself as the table read hook (fn_3) of fat_volume
+ * and keeps:
+ *  - the FAT, fixed size and read at a random entry on every open.
+ *  - the directory table at the start of the FNT, 8 bytes per directory and
+ *    read on every step of a path lookup.
+ *  - the name lists of the directories in FAT_CACHE_BLOCK_SIZE blocks, read
+ *    on demand and replaced in least recently used order. Only the
+ *    directories the game opens files in take up memory.
+ *
+ * Use fat_cache_size to pick the memory for a number of blocks and the
+ * counters to see what more blocks would gain.
+ *
+ *   int size = fat_cache_size(8);
+ *
+ *   fat_cache_init(ndk_area_alloc_mem(AREA_MAIN, heap, size), size);
+ *
+ * NOTE: The file system must be mounted (ndk_fat_mount) first and the file
+ * tables must not be cached with ndk_fat_cache_file_tables, the SDK doesn't
+ * call fn_3 then.
+ *
+ * NOTE: Reads that the file system issues from IRQ context bypass the cache.
+ * A block fill blocks the calling thread.
+ */
+#ifndef UTIL_FAT_CACHE_INCLUDE_FILE
+#define UTIL_FAT_CACHE_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#define FAT_CACHE_BLOCK_SIZE 0x200
+
+/**
+ * Approximate memory needed per name block, data and bookkeeping.
+ */
+#define FAT_CACHE_BYTES_PER_BLOCK (FAT_CACHE_BLOCK_SIZE + 8)
+
+struct fat_cache_stats {
+  // table reads through the hook
+  unsigned int reads;
+  // served from the resident FAT and directory table
+  unsigned int fat_hits;
+  unsigned int dir_hits;
+  // name blocks found in the cache and read from the cart
+  unsigned int hits;
+  unsigned int misses;
+  // reads outside the tables, passed on
+  unsigned int bypassed;
+};
+
+/**
+ * Memory needed for the resident tables and a number of name blocks. Reads
+ * the directory count from the cart.
+ *
+ * @param blocks number of name blocks, at least 2
+ * @return bytes to pass to fat_cache_init
+ */
+int fat_cache_size(int blocks);
+
+/**
+ * Read the FAT and the directory table and install the hook.
+ *
+ * @param mem memory for the cache
+ * @param size of mem in bytes
+ * @return the number of name blocks that fit in mem, 0 if it's too small for
+ * the resident tables and 2 blocks. Nothing is installed then.
+ */
+int fat_cache_init(void *mem, int size);
+
+/**
+ * Restore the original hook. The memory can be reused after this.
+ */
+void fat_cache_disable(void);
+
+/**
+ * Get the cache counters.
+ *
+ * @param[out] stats
+ */
+void fat_cache_get_stats(struct fat_cache_stats *stats);
+
+void fat_cache_reset_stats(void);
+
+#endif // UTIL_FAT_CACHE_INCLUDE_FILE
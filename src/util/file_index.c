@@ -0,0 +1,119 @@
+#include <stddef.h>
+
+#include "file_index.h"
+
+#include "hash.h"
+
+static bool file_index_valid(struct file_index_header *hdr, int size);
+
+
+static struct file_index_header *loaded_index;
+
+
+int file_index_load(char *path, void *buffer, int size)
+{
+  struct file h;
+
+  ndk_file_init_handle(&h);
+
+  if (!ndk_file_open(&h, path)) {
+    return -1;
+  }
+
+  int file_size = ndk_file_size(&h);
+
+  if (buffer == NULL) {
+    ndk_file_close(&h);
+    return file_size;
+  }
+
+  if (size < file_size ||
+      ndk_file_read(&h, buffer, file_size) != file_size) {
+    ndk_file_close(&h);
+    return -1;
+  }
+
+  ndk_file_close(&h);
+
+  if (!file_index_valid(buffer, file_size)) {
+    return -1;
+  }
+
+  loaded_index = buffer;
+
+  return file_size;
+}
+
+bool file_index_set(void *buffer)
+{
+  struct file_index_header *hdr = buffer;
+
+  if (!file_index_valid(hdr, sizeof(struct file_index_header) +
+                        hdr->slots * sizeof(struct file_index_entry))) {
+    return false;
+  }
+
+  loaded_index = hdr;
+
+  return true;
+}
+
+int file_index_lookup(const char *path)
+{
+  if (loaded_index == NULL) {
+    return -1;
+  }
+
+  struct file_index_entry *table =
+                              (struct file_index_entry *)(loaded_index + 1);
+  unsigned int mask = loaded_index->slots - 1;
+  unsigned int hash = hash_path(path, loaded_index->seed);
+
+  // The generator keeps the table at most 3/4 full so an empty slot is
+  // always found.
+  for (unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+    if (table[i].fat_id == FILE_INDEX_EMPTY) {
+      return -1;
+    }
+
+    if (table[i].hash == hash) {
+      // Hashes of indexed paths are unique, a failed check means the path
+      // isn't in the index
+      if (table[i].length != file_index_path_length(path) ||
+          table[i].check != hash_path_check(path)) {
+        return -1;
+      }
+
+      return table[i].fat_id;
+    }
+  }
+}
+
+bool file_index_open(struct file *h, char *path)
+{
+  int id = file_index_lookup(path);
+
+  if (id < 0) {
+    return ndk_file_open(h, path);
+  }
+
+  return ndk_file_open_by_fat_id(h, &fat_volume, id);
+}
+
+bool file_index_valid(struct file_index_header *hdr, int size)
+{
+  if (size < sizeof(struct file_index_header) ||
+      hdr->magic != FILE_INDEX_MAGIC ||
+      hdr->version != FILE_INDEX_VERSION) {
+    return false;
+  }
+
+  // slots must be a power of two with room for an empty slot
+  if (hdr->slots == 0 || (hdr->slots & (hdr->slots - 1)) != 0 ||
+      hdr->count >= hdr->slots) {
+    return false;
+  }
+
+  return size >= sizeof(struct file_index_header) +
+                 hdr->slots * sizeof(struct file_index_entry);
+}
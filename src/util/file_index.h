@@ -0,0 +1,121 @@
+/**
+ * Hashed filename index.
+ *
+ * ndk_fat_get_fat_id_from_filename walks the file name table (FNT) and
+ * compares strings for every path component. With thousands of files this
+ * becomes expensive. The host tool src/host/fidxgen reads the FNT of a built
+ * ROM and writes an index file: an open addressing hash table from path hash
+ * to FAT id. The index file is stored in the ROM file system and loaded once
+ * at start up. A lookup then costs one hash of the path and usually one table
+ * probe. Path strings in the ROM are never read.
+ *
+ * The generator picks a hash seed such that no two paths in the ROM share a
+ * hash, so the strings don't need to be stored. A path that isn't in the ROM
+ * can still land on the slot of one that is, so every entry also holds a
+ * second hash (hash_path_check) and the path length. A hit only counts when
+ * both match, a path that isn't in the index is not found even if its first
+ * hash is taken.
+ *
+ * Paths are case insensitive and a leading '/' is ignored, see hash.h.
+ *
+ * Build steps: FAT ids only depend on the file names. First build the ROM
+ * with an empty index file in the data folder, run fidxgen on that ROM to
+ * write the real index file, then build the ROM again.
+ */
+#ifndef UTIL_FILE_INDEX_INCLUDE_FILE
+#define UTIL_FILE_INDEX_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "file.h"
+
+#define FILE_INDEX_MAGIC 0x58444946 // 'FIDX'
+#define FILE_INDEX_VERSION 3
+
+// Marks an empty slot in the table
+#define FILE_INDEX_EMPTY 0xffffffff
+
+struct file_index_header {
+  unsigned int magic;               // 0x00
+  unsigned int version;             // 0x04
+  unsigned int seed;                // 0x08
+  // number of files
+  unsigned int count;               // 0x0c
+  // number of slots, a power of two
+  unsigned int slots;               // 0x10
+  unsigned int unused[3];           // 0x14
+  // 0x20
+};
+
+/**
+ * One slot in the table. The slot for a hash is hash & (slots - 1), linear
+ * probing on collisions.
+ */
+struct file_index_entry {
+  unsigned int hash;                // 0x00
+  unsigned int fat_id;              // 0x04 FILE_INDEX_EMPTY if not used
+  // hash_path_check of the path
+  unsigned int check;               // 0x08
+  // length of the path without a leading '/'
+  unsigned int length;              // 0x0c
+  // 0x10
+};
+
+/**
+ * Length of a path as stored in the index, a leading '/' isn't counted.
+ */
+static inline unsigned int file_index_path_length(const char *path)
+{
+  unsigned int n = 0;
+
+  if (*path == '/') {
+    path++;
+  }
+
+  while (path[n] != '\0') {
+    n++;
+  }
+
+  return n;
+}
+
+/**
+ * Load an index file from the ROM file system.
+ *
+ * NOTE: Call with buffer = NULL to get the required size.
+ *
+ * @param path of the index file
+ * @param buffer where the index is kept, 4 byte aligned
+ * @param size of buffer
+ * @return the size of the index, -1 if the file is missing or invalid or if
+ * buffer is too small.
+ */
+int file_index_load(char *path, void *buffer, int size);
+
+/**
+ * Use an index that is already in memory e.g. linked into the binary.
+ *
+ * @param index
+ * @return false if the index is invalid
+ */
+bool file_index_set(void *index);
+
+/**
+ * Look up the FAT id of a path.
+ *
+ * @param path
+ * @return FAT id or -1 if not found or no index is loaded
+ */
+int file_index_lookup(const char *path);
+
+/**
+ * Open a file through the index. Falls back to ndk_file_open if the path
+ * isn't in the index.
+ *
+ * @param h
+ * @param path
+ * @return true on success
+ */
+bool file_index_open(struct file *h, char *path);
+
+#endif // UTIL_FILE_INDEX_INCLUDE_FILE
@@ -0,0 +1,132 @@
+/**
+ * String and data hashing shared by the ARM9 code and the host tools.
+ *
+ * 32 bit FNV-1a. The seed replaces the standard offset basis so a tool can
+ * pick another seed if two keys collide.
+ *
+ * CRC32 (the zlib one) for data that has to be checked for corruption, it
+ * catches all burst errors up to 32 bits which FNV-1a doesn't.
+ */
+#ifndef UTIL_HASH_INCLUDE_FILE
+#define UTIL_HASH_INCLUDE_FILE
+
+#define HASH_FNV_OFFSET 0x811c9dc5
+#define HASH_FNV_PRIME 0x01000193
+#define HASH_CRC32_INIT 0xffffffff
+
+/**
+ * Hash a ROM file system path.
+ *
+ * ASCII letters are folded to lower case and a leading '/' is ignored so
+ * "/Data/Font.bin" and "data/font.bin" give the same hash.
+ *
+ * @param path zero terminated
+ * @param seed HASH_FNV_OFFSET or a seed picked by the index generator
+ * @return hash
+ */
+static inline unsigned int hash_path(const char *path, unsigned int seed)
+{
+  unsigned int h = seed;
+
+  if (*path == '/') {
+    path++;
+  }
+
+  for (; *path != '\0'; path++) {
+    unsigned int c = (unsigned char)*path;
+
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+
+    h = (h ^ c) * HASH_FNV_PRIME;
+  }
+
+  return h;
+}
+
+/**
+ * Hash a block of memory.
+ *
+ * @param data
+ * @param size in bytes
+ * @param seed HASH_FNV_OFFSET to start a new hash or the result of a previous
+ * call to continue it
+ * @return hash
+ */
+static inline unsigned int hash_data(const void *data, int size,
+                                     unsigned int seed)
+{
+  const unsigned char *p = data;
+  unsigned int h = seed;
+
+  for (int i = 0; i < size; i++) {
+    h = (h ^ p[i]) * HASH_FNV_PRIME;
+  }
+
+  return h;
+}
+
+/**
+ * CRC32 of a block of memory, reflected polynomial 0xedb88320. Uses a four
+ * bit table to stay small.
+ *
+ * @param data
+ * @param size in bytes
+ * @param crc HASH_CRC32_INIT to start a new CRC or the result of a previous
+ * call to continue it
+ * @return CRC, invert it (~crc) for the standard zlib value
+ */
+static inline unsigned int hash_crc32(const void *data, int size,
+                                      unsigned int crc)
+{
+  static const unsigned int table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+  };
+  const unsigned char *p = data;
+
+  for (int i = 0; i < size; i++) {
+    crc ^= p[i];
+    crc = (crc >> 4) ^ table[crc & 0xf];
+    crc = (crc >> 4) ^ table[crc & 0xf];
+  }
+
+  return crc;
+}
+
+/**
+ * Second hash of a path for checking a hash_path match, the CRC32 of the
+ * path folded like hash_path does.
+ *
+ * Two paths of the same length that share a hash_path also share it with
+ * any seed that differs by a multiple of 256, so another seed isn't an
+ * independent check. CRC32 has nothing in common with FNV-1a.
+ *
+ * @param path zero terminated
+ * @return hash
+ */
+static inline unsigned int hash_path_check(const char *path)
+{
+  unsigned int crc = HASH_CRC32_INIT;
+
+  if (*path == '/') {
+    path++;
+  }
+
+  for (; *path != '\0'; path++) {
+    unsigned char c = *path;
+
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+
+    crc = hash_crc32(&c, 1, crc);
+  }
+
+  return crc;
+}
+
+#endif // UTIL_HASH_INCLUDE_FILE
@@ -0,0 +1,409 @@
+#include <stddef.h>
+
+#include "io_trace.h"
+
+#include "nds.h"
+#include "util.h"
+
+#define NO_SLOT 0xff
+
+// Everything below main RAM is ITCM or its mirrors
+#define ITCM_END 0x02000000
+#define DTCM_START 0x027c0000
+#define DTCM_END 0x027c4000
+
+struct io_tracer {
+  bool running;
+  fat_volume_read_fn *orig_fn_1;
+  fat_volume_read_fn *orig_fn_3;
+  struct io_trace_record *records;
+  unsigned int mask;
+  unsigned int write;
+  unsigned int overwritten;
+  unsigned int start_time;
+  struct io_trace_summary totals;
+  int file_count;
+  int last_slot;
+  struct io_trace_file_stats files[IO_TRACE_MAX_FILES];
+};
+
+static int io_trace_read_fn_1(struct fat_volume *volume, void *dst,
+                              unsigned int src, unsigned int len);
+static int io_trace_read_fn_3(struct fat_volume *volume, void *dst,
+                              unsigned int src, unsigned int len);
+static int io_trace_rom_read(fat_volume_read_fn *orig,
+                             struct fat_volume *volume, void *dst,
+                             unsigned int src, unsigned int len);
+static bool io_trace_dma_class(unsigned int src, void *dst, unsigned int size);
+static void io_trace_add(unsigned int start, int type, int fat_id,
+                         unsigned int rom_offset, unsigned int size, void *dst,
+                         int flags);
+static int io_trace_get_slot(int fat_id);
+
+
+static struct io_tracer tracer;
+
+
+void io_trace_init(struct io_trace_record *records, int count)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  tracer.records = records;
+  tracer.mask = count - 1;
+
+  // Share the timers with thread_trace
+  if ((TM2CNT_H & 0x80) == 0) {
+    timer_start();
+  }
+
+  io_trace_reset();
+
+  if (!tracer.running) {
+    tracer.orig_fn_1 = fat_volume.fn_1;
+    tracer.orig_fn_3 = fat_volume.fn_3;
+    fat_volume.fn_1 = &io_trace_read_fn_1;
+    fat_volume.fn_3 = &io_trace_read_fn_3;
+    tracer.running = true;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void io_trace_stop(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (tracer.running) {
+    fat_volume.fn_1 = tracer.orig_fn_1;
+    fat_volume.fn_3 = tracer.orig_fn_3;
+    tracer.running = false;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void io_trace_reset(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  tracer.write = 0;
+  tracer.overwritten = 0;
+  tracer.file_count = 0;
+  tracer.last_slot = NO_SLOT;
+  tracer.totals = (struct io_trace_summary) { 0 };
+  tracer.start_time = timer_value();
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void io_trace_get_summary(struct io_trace_summary *summary)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+  *summary = tracer.totals;
+  ndk_thread_critical_leave(&lock);
+
+  if (summary->cycles > 0) {
+    summary->bytes_per_second =
+                      (unsigned long long)summary->bytes * BUS_CLOCK /
+                      summary->cycles;
+  }
+
+  if (summary->bytes > 0) {
+    summary->dma_percent =
+                      (unsigned long long)summary->dma_bytes * 100 /
+                      summary->bytes;
+  }
+}
+
+int io_trace_slowest_files(struct io_trace_file_stats *stats, int n)
+{
+  int lock;
+  int count = 0;
+
+  ndk_thread_critical_enter(&lock);
+
+  // Insertion into a sorted array of the n slowest
+  for (int i = 0; i < tracer.file_count; i++) {
+    struct io_trace_file_stats *f = &tracer.files[i];
+    int pos = count;
+
+    while (pos > 0 && stats[pos - 1].cycles < f->cycles) {
+      if (pos < n) {
+        stats[pos] = stats[pos - 1];
+      }
+
+      pos--;
+    }
+
+    if (pos < n) {
+      stats[pos] = *f;
+      count += count < n;
+    }
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return count;
+}
+
+int io_trace_dump(void *dest, int size)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  unsigned int capacity = tracer.mask + 1;
+  int record_count = tracer.write < capacity ? tracer.write : capacity;
+  int required = sizeof(struct io_trace_header) +
+                 tracer.file_count * sizeof(struct io_trace_file_stats) +
+                 record_count * sizeof(struct io_trace_record);
+
+  if (dest == NULL || size < required) {
+    ndk_thread_critical_leave(&lock);
+    return dest == NULL ? required : -1;
+  }
+
+  struct io_trace_header *hdr = dest;
+
+  hdr->magic = IO_TRACE_MAGIC;
+  hdr->version = IO_TRACE_VERSION;
+  hdr->clock = BUS_CLOCK;
+  hdr->file_count = tracer.file_count;
+  hdr->record_count = record_count;
+  hdr->overwritten = tracer.overwritten;
+  hdr->start_time = tracer.start_time;
+  hdr->dump_time = timer_value();
+
+  io_trace_get_summary(&hdr->summary);
+
+  struct io_trace_file_stats *files = (struct io_trace_file_stats *)(hdr + 1);
+
+  for (int i = 0; i < tracer.file_count; i++) {
+    files[i] = tracer.files[i];
+  }
+
+  struct io_trace_record *rec =
+                      (struct io_trace_record *)(files + tracer.file_count);
+  unsigned int first = tracer.write - record_count;
+
+  for (int i = 0; i < record_count; i++) {
+    rec[i] = tracer.records[(first + i) & tracer.mask];
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return required;
+}
+
+bool io_trace_file_open(struct file *h, char *filename)
+{
+  unsigned int start = timer_value();
+  bool ok = ndk_file_open(h, filename);
+
+  io_trace_add(start, IO_TRACE_OPEN, ok ? h->FAT_id : IO_TRACE_NO_FILE,
+               ok ? h->start_offset : 0, ok ? ndk_file_size(h) : 0, NULL,
+               ok ? 0 : IO_TRACE_FLAG_ERROR);
+
+  return ok;
+}
+
+int io_trace_file_read(struct file *h, void *dest, int count)
+{
+  unsigned int offset = h->current_offset;
+  unsigned int start = timer_value();
+  int n = ndk_file_read(h, dest, count);
+  int flags = n < 0 ? IO_TRACE_FLAG_ERROR : 0;
+
+  if (n > 0 && io_trace_dma_class(offset, dest, n)) {
+    flags |= IO_TRACE_FLAG_DMA;
+  }
+
+  io_trace_add(start, IO_TRACE_READ, h->FAT_id, offset, n < 0 ? 0 : n, dest,
+               flags);
+
+  return n;
+}
+
+bool io_trace_file_seek(struct file *h, int offset, int whence)
+{
+  unsigned int start = timer_value();
+  bool ok = ndk_file_seek(h, offset, whence);
+
+  io_trace_add(start, IO_TRACE_SEEK, h->FAT_id, h->current_offset, 0, NULL,
+               ok ? 0 : IO_TRACE_FLAG_ERROR);
+
+  return ok;
+}
+
+void io_trace_cart_read(unsigned dma_channel, unsigned int src, void *dst,
+                        unsigned int count, void (*cb)(int), int cb_arg,
+                        bool async)
+{
+  unsigned int start = timer_value();
+  int flags = async ? IO_TRACE_FLAG_ASYNC : 0;
+
+  ndk_cart_read(dma_channel, src, dst, count, cb, cb_arg, async);
+
+  if (dma_channel <= 3 && io_trace_dma_class(src, dst, count)) {
+    flags |= IO_TRACE_FLAG_DMA;
+  }
+
+  io_trace_add(start, IO_TRACE_CART, IO_TRACE_NO_FILE, src, count, dst, flags);
+}
+
+int io_trace_read_fn_1(struct fat_volume *volume, void *dst, unsigned int src,
+                       unsigned int len)
+{
+  return io_trace_rom_read(tracer.orig_fn_1, volume, dst, src, len);
+}
+
+int io_trace_read_fn_3(struct fat_volume *volume, void *dst, unsigned int src,
+                       unsigned int len)
+{
+  return io_trace_rom_read(tracer.orig_fn_3, volume, dst, src, len);
+}
+
+/*
+ * An asynchronous read (6) is timed until the hook returns only.
+ */
+int io_trace_rom_read(fat_volume_read_fn *orig, struct fat_volume *volume,
+                      void *dst, unsigned int src, unsigned int len)
+{
+  unsigned int start = timer_value();
+  int result = orig(volume, dst, src, len);
+  int flags = 0;
+
+  if (result == 6) {
+    flags |= IO_TRACE_FLAG_ASYNC;
+  } else if (result != 0) {
+    flags |= IO_TRACE_FLAG_ERROR;
+  }
+
+  if (io_trace_dma_class(src, dst, len)) {
+    flags |= IO_TRACE_FLAG_DMA;
+  }
+
+  io_trace_add(start, IO_TRACE_ROM, IO_TRACE_NO_FILE, src, len, dst, flags);
+
+  return result;
+}
+
+/*
+ * See the DMA conditions in file.h.
+ */
+bool io_trace_dma_class(unsigned int src, void *dst, unsigned int size)
+{
+  unsigned int d = (unsigned int)dst;
+
+  return fat_dma_channel <= 3 && (src & (CART_BLOCK_SIZE - 1)) == 0 &&
+         (d & 3) == 0 && (size & (CART_BLOCK_SIZE - 1)) == 0 && size > 0 &&
+         d >= ITCM_END && (d < DTCM_START || d >= DTCM_END);
+}
+
+void io_trace_add(unsigned int start, int type, int fat_id,
+                  unsigned int rom_offset, unsigned int size, void *dst,
+                  int flags)
+{
+  int lock;
+  unsigned int now = timer_value();
+
+  ndk_thread_critical_enter(&lock);
+
+  if (!tracer.running) {
+    ndk_thread_critical_leave(&lock);
+    return;
+  }
+
+  if (tracer.write > tracer.mask) {
+    tracer.overwritten++;
+  }
+
+  struct io_trace_record *rec = &tracer.records[tracer.write & tracer.mask];
+
+  rec->timestamp = start;
+  rec->cycles = now - start;
+  rec->rom_offset = rom_offset;
+  rec->size = size;
+  rec->dst = (unsigned int)dst;
+  rec->fat_id = fat_id;
+  rec->type = type;
+  rec->flags = flags;
+
+  tracer.write++;
+
+  if (type == IO_TRACE_ROM || type == IO_TRACE_CART) {
+    tracer.totals.requests++;
+    tracer.totals.cycles += rec->cycles;
+    tracer.totals.bytes += size;
+
+    if (flags & IO_TRACE_FLAG_DMA) {
+      tracer.totals.dma_bytes += size;
+    }
+  }
+
+  if ((type == IO_TRACE_OPEN || type == IO_TRACE_READ) &&
+      fat_id != IO_TRACE_NO_FILE) {
+    int slot = io_trace_get_slot(fat_id);
+
+    if (slot != NO_SLOT) {
+      struct io_trace_file_stats *f = &tracer.files[slot];
+
+      f->cycles += rec->cycles;
+
+      if (type == IO_TRACE_OPEN) {
+        f->opens++;
+      } else {
+        f->reads++;
+        f->bytes += size;
+
+        if (flags & IO_TRACE_FLAG_DMA) {
+          f->dma_bytes += size;
+        }
+      }
+    }
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+/*
+ * Find or register the slot for a file. Reads usually come in runs on the
+ * same file, so the last one is checked first.
+ */
+int io_trace_get_slot(int fat_id)
+{
+  if (tracer.last_slot != NO_SLOT &&
+      tracer.files[tracer.last_slot].fat_id == fat_id) {
+    return tracer.last_slot;
+  }
+
+  for (int i = 0; i < tracer.file_count; i++) {
+    if (tracer.files[i].fat_id == fat_id) {
+      tracer.last_slot = i;
+      return i;
+    }
+  }
+
+  if (tracer.file_count == IO_TRACE_MAX_FILES) {
+    return NO_SLOT;
+  }
+
+  int slot = tracer.file_count++;
+
+  tracer.files[slot] = (struct io_trace_file_stats) {
+    .fat_id = fat_id,
+    .first_use = slot
+  };
+
+  tracer.last_slot = slot;
+
+  return slot;
+}
@@ -0,0 +1,182 @@
+/**
+ * File I/O tracing and throughput statistics.
+ *
+ * Records file and cart requests with their ROM offset, size, whether they
+ * qualify for the DMA path and their latency in bus cycles. The timestamp is
+ * the free running counter formed by timers 2 and 3 (see util.h). Records are
+ * written to a ring buffer, when it's full the oldest records are
+ * overwritten.
+ *
+ * Two levels are traced:
+ *  - every ROM read the file system makes. The tracer installs itself as the
+ *    read hooks (fn_1 and fn_3) of fat_volume, the same way as block_cache.
+ *    These records have no FAT id, the host tool maps the offsets to files.
+ *    Totals and throughput are computed from them.
+ *  - calls made through the wrappers io_trace_file_open, io_trace_file_read,
+ *    io_trace_file_seek and io_trace_cart_read. Define IO_TRACE_WRAP before
+ *    including this file to redirect the ndk_ functions to the wrappers in
+ *    that source file. Per file statistics are kept for these.
+ *
+ * The DMA class follows the conditions in file.h: DMA enabled at mount, ROM
+ * offset aligned to 512, destination aligned to 4 and outside the TCMs and
+ * size a multiple of 512. Anything else is double buffered by the CPU.
+ *
+ * Use io_trace_dump to serialize statistics and records into a memory buffer
+ * and get it off the device like a thread_trace dump. The host tool
+ * src/host/iotrace prints a report and a suggested ROM file order.
+ *
+ * NOTE: Uses timers 2 and 3. They are started if not already running, so the
+ * tracer can run together with thread_trace.
+ *
+ * NOTE: If block_cache is used, initialize the tracer after it to trace the
+ * reads that miss the cache.
+ */
+#ifndef UTIL_IO_TRACE_INCLUDE_FILE
+#define UTIL_IO_TRACE_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "cart.h"
+#include "file.h"
+
+#define IO_TRACE_MAGIC 0x52544f49 // 'IOTR'
+#define IO_TRACE_VERSION 1
+
+#define IO_TRACE_MAX_FILES 128
+
+// Record types
+#define IO_TRACE_ROM 0
+#define IO_TRACE_OPEN 1
+#define IO_TRACE_READ 2
+#define IO_TRACE_SEEK 3
+#define IO_TRACE_CART 4
+#define IO_TRACE_TYPES 5
+
+// Record flags
+#define IO_TRACE_FLAG_DMA 0x01
+#define IO_TRACE_FLAG_ERROR 0x02
+#define IO_TRACE_FLAG_ASYNC 0x04
+
+#define IO_TRACE_NO_FILE 0xffff
+
+struct io_trace_record {
+  // bus cycles when the request started
+  unsigned int timestamp;           // 0x00
+  unsigned int cycles;              // 0x04
+  unsigned int rom_offset;          // 0x08
+  unsigned int size;                // 0x0c
+  unsigned int dst;                 // 0x10
+  unsigned short fat_id;            // 0x14 IO_TRACE_NO_FILE if unknown
+  unsigned char type;               // 0x16
+  unsigned char flags;              // 0x17
+  // 0x18
+};
+
+/**
+ * Accumulated statistics for one file, from the wrapper calls.
+ */
+struct io_trace_file_stats {
+  unsigned long long cycles;        // 0x00
+  unsigned int fat_id;              // 0x08
+  unsigned int opens;               // 0x0c
+  unsigned int reads;               // 0x10
+  unsigned int bytes;               // 0x14
+  unsigned int dma_bytes;           // 0x18
+  // index of the first open or read of this file, in the order of all files
+  unsigned int first_use;           // 0x1c
+  // 0x20
+};
+
+struct io_trace_summary {
+  // ROM reads by the file system and io_trace_cart_read
+  unsigned long long cycles;        // 0x00
+  unsigned int requests;            // 0x08
+  unsigned int bytes;               // 0x0c
+  unsigned int dma_bytes;           // 0x10
+  unsigned int bytes_per_second;    // 0x14
+  // share of bytes read on the DMA path
+  unsigned int dma_percent;         // 0x18
+  unsigned int unused;              // 0x1c
+  // 0x20
+};
+
+/**
+ * Dump header. Followed by file_count io_trace_file_stats structures and
+ * record_count io_trace_record structures in chronological order.
+ */
+struct io_trace_header {
+  unsigned int magic;               // 0x00
+  unsigned int version;             // 0x04
+  // timestamp frequency in Hz
+  unsigned int clock;               // 0x08
+  int file_count;                   // 0x0c
+  int record_count;                 // 0x10
+  // number of records lost because the ring buffer wrapped
+  unsigned int overwritten;         // 0x14
+  unsigned int start_time;          // 0x18
+  unsigned int dump_time;           // 0x1c
+  struct io_trace_summary summary;  // 0x20
+  // 0x40
+};
+
+/**
+ * Start tracing and install the read hooks.
+ *
+ * NOTE: The file system must be mounted (ndk_fat_mount) first.
+ *
+ * @param records ring buffer memory
+ * @param count number of records in the ring buffer. Must be a power of two.
+ */
+void io_trace_init(struct io_trace_record *records, int count);
+
+/**
+ * Stop tracing and restore the read hooks.
+ */
+void io_trace_stop(void);
+
+/**
+ * Clear all statistics and records.
+ */
+void io_trace_reset(void);
+
+void io_trace_get_summary(struct io_trace_summary *summary);
+
+/**
+ * Get the files with the highest total read time.
+ *
+ * @param[out] stats array to fill, slowest first
+ * @param n number of elements in stats
+ * @return number of elements written
+ */
+int io_trace_slowest_files(struct io_trace_file_stats *stats, int n);
+
+/**
+ * Serialize the trace into a buffer.
+ *
+ * NOTE: Call with dest = NULL to get the required size.
+ *
+ * @param dest destination buffer, 8 byte aligned
+ * @param size size of dest
+ * @return number of bytes written, the required size or -1 if dest is too
+ * small.
+ */
+int io_trace_dump(void *dest, int size);
+
+bool io_trace_file_open(struct file *h, char *filename);
+
+int io_trace_file_read(struct file *h, void *dest, int count);
+
+bool io_trace_file_seek(struct file *h, int offset, int whence);
+
+void io_trace_cart_read(unsigned dma_channel, unsigned int src, void *dst,
+                        unsigned int count, void (*cb)(int), int cb_arg,
+                        bool async);
+
+#ifdef IO_TRACE_WRAP
+#define ndk_file_open io_trace_file_open
+#define ndk_file_read io_trace_file_read
+#define ndk_file_seek io_trace_file_seek
+#define ndk_cart_read io_trace_cart_read
+#endif
+
+#endif // UTIL_IO_TRACE_INCLUDE_FILE
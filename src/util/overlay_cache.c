@@ -0,0 +1,317 @@
+#include <stddef.h>
+
+#include "overlay_cache.h"
+
+#include "aio.h"
+#include "cpu.h"
+#include "memory.h"
+#include "nds.h"
+#include "overlay.h"
+#include "thread.h"
+
+#define NO_OVERLAY -1
+
+struct resident {
+  int id;
+  unsigned int start;
+  unsigned int end;
+  unsigned int last_use;
+};
+
+struct staging_buffer {
+  struct aio_request req;
+  unsigned char *data;
+  // NO_OVERLAY if the buffer is free
+  int id;
+  // file size, compressed size for compressed overlays
+  int size;
+  unsigned int last_use;
+};
+
+struct overlay_cache {
+  bool initialized;
+  struct mutex lock;
+  unsigned int clock;
+  int resident_count;
+  struct resident resident[OVERLAY_CACHE_MAX_RESIDENT];
+  int staged_count;
+  int buffer_size;
+  struct staging_buffer staged[OVERLAY_CACHE_MAX_STAGED];
+  struct overlay_cache_stats stats;
+};
+
+static int overlay_cache_find_resident(int id);
+static struct staging_buffer *overlay_cache_find_staged(int id);
+static struct staging_buffer *overlay_cache_get_buffer(void);
+static void overlay_cache_evict(unsigned int start, unsigned int end);
+static void overlay_cache_remove(int index);
+static void overlay_cache_add_resident(int id, unsigned int start,
+                                       unsigned int end);
+static void overlay_cache_copy(struct overlay *h, struct staging_buffer *b);
+
+
+static struct overlay_cache cache;
+
+
+void overlay_cache_init(void *pool, int size, int count)
+{
+  if (!cache.initialized) {
+    ndk_mutex_init(&cache.lock);
+    cache.initialized = true;
+  }
+
+  if (pool == NULL || count < 0) {
+    count = 0;
+  }
+
+  if (count > OVERLAY_CACHE_MAX_STAGED) {
+    count = OVERLAY_CACHE_MAX_STAGED;
+  }
+
+  cache.clock = 0;
+  cache.resident_count = 0;
+  cache.staged_count = count;
+  cache.buffer_size = count > 0 ? (size / count) & ~31 : 0;
+  cache.stats = (struct overlay_cache_stats) { 0 };
+
+  for (int i = 0; i < count; i++) {
+    struct staging_buffer *b = &cache.staged[i];
+
+    b->data = (unsigned char *)pool + i * cache.buffer_size;
+    b->id = NO_OVERLAY;
+    b->size = 0;
+    b->last_use = 0;
+    b->req.status = AIO_IDLE;
+  }
+}
+
+bool overlay_cache_load(int id)
+{
+  ndk_mutex_lock(&cache.lock);
+
+  int index = overlay_cache_find_resident(id);
+
+  if (index >= 0) {
+    cache.resident[index].last_use = ++cache.clock;
+    cache.stats.hits++;
+    ndk_mutex_unlock(&cache.lock);
+    return true;
+  }
+
+  struct overlay h;
+
+  if (!ndk_overlay_open(&h, ARM9, id)) {
+    ndk_mutex_unlock(&cache.lock);
+    return false;
+  }
+
+  unsigned int start = h.info.ram_address;
+  unsigned int end = start + h.info.ram_size + h.info.bss_size;
+  struct staging_buffer *b = overlay_cache_find_staged(id);
+
+  if (b != NULL && !aio_wait(&b->req)) {
+    b->id = NO_OVERLAY;
+    b = NULL;
+  }
+
+  overlay_cache_evict(start, end);
+
+  if (b != NULL) {
+    b->last_use = ++cache.clock;
+    overlay_cache_copy(&h, b);
+    cache.stats.staged++;
+  } else if (ndk_overlay_read_into_ram(&h)) {
+    cache.stats.misses++;
+  } else {
+    ndk_mutex_unlock(&cache.lock);
+    return false;
+  }
+
+  ndk_overlay_init_in_ram(&h);
+  overlay_cache_add_resident(id, start, end);
+
+  ndk_mutex_unlock(&cache.lock);
+
+  return true;
+}
+
+bool overlay_cache_preload(int id)
+{
+  struct overlay h;
+  struct staging_buffer *b = NULL;
+
+  ndk_mutex_lock(&cache.lock);
+
+  if (overlay_cache_find_resident(id) < 0 &&
+      overlay_cache_find_staged(id) == NULL &&
+      ndk_overlay_open(&h, ARM9, id) &&
+      ndk_overlay_get_file_size(&h) <= cache.buffer_size) {
+    b = overlay_cache_get_buffer();
+  }
+
+  if (b != NULL) {
+    if (b->id != NO_OVERLAY) {
+      cache.stats.staging_reuses++;
+    }
+
+    b->id = id;
+    b->size = ndk_overlay_get_file_size(&h);
+    b->last_use = ++cache.clock;
+
+    // The read may use DMA, nothing of the buffer may be left in the cache
+    ndk_cpu_invalidate_dcache_lines(b->data, cache.buffer_size);
+
+    aio_request_init(&b->req, h.info.fat_id, 0, b->data, b->size);
+    aio_submit(&b->req, 1);
+    cache.stats.preloads++;
+  }
+
+  ndk_mutex_unlock(&cache.lock);
+
+  return b != NULL;
+}
+
+void overlay_cache_unload(int id)
+{
+  ndk_mutex_lock(&cache.lock);
+
+  int index = overlay_cache_find_resident(id);
+
+  if (index >= 0) {
+    overlay_cache_remove(index);
+  }
+
+  ndk_mutex_unlock(&cache.lock);
+}
+
+bool overlay_cache_is_resident(int id)
+{
+  ndk_mutex_lock(&cache.lock);
+
+  bool resident = overlay_cache_find_resident(id) >= 0;
+
+  ndk_mutex_unlock(&cache.lock);
+
+  return resident;
+}
+
+void overlay_cache_get_stats(struct overlay_cache_stats *stats)
+{
+  ndk_mutex_lock(&cache.lock);
+  *stats = cache.stats;
+  ndk_mutex_unlock(&cache.lock);
+}
+
+int overlay_cache_find_resident(int id)
+{
+  for (int i = 0; i < cache.resident_count; i++) {
+    if (cache.resident[i].id == id) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+struct staging_buffer *overlay_cache_find_staged(int id)
+{
+  for (int i = 0; i < cache.staged_count; i++) {
+    if (cache.staged[i].id == id) {
+      return &cache.staged[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * A free buffer or else the least recently used one that isn't being read
+ * into.
+ */
+struct staging_buffer *overlay_cache_get_buffer(void)
+{
+  struct staging_buffer *lru = NULL;
+
+  for (int i = 0; i < cache.staged_count; i++) {
+    struct staging_buffer *b = &cache.staged[i];
+
+    if (b->id == NO_OVERLAY) {
+      return b;
+    }
+
+    if (b->req.status != AIO_QUEUED &&
+        (lru == NULL || b->last_use < lru->last_use)) {
+      lru = b;
+    }
+  }
+
+  return lru;
+}
+
+/*
+ * Unload the resident overlays that overlap [start, end).
+ */
+void overlay_cache_evict(unsigned int start, unsigned int end)
+{
+  for (int i = cache.resident_count - 1; i >= 0; i--) {
+    struct resident *r = &cache.resident[i];
+
+    if (r->start < end && start < r->end) {
+      overlay_cache_remove(i);
+      cache.stats.evictions++;
+    }
+  }
+}
+
+void overlay_cache_remove(int index)
+{
+  ndk_overlay_unload(ARM9, cache.resident[index].id);
+
+  cache.resident[index] = cache.resident[--cache.resident_count];
+}
+
+void overlay_cache_add_resident(int id, unsigned int start, unsigned int end)
+{
+  if (cache.resident_count == OVERLAY_CACHE_MAX_RESIDENT) {
+    int lru = 0;
+
+    for (int i = 1; i < cache.resident_count; i++) {
+      if (cache.resident[i].last_use < cache.resident[lru].last_use) {
+        lru = i;
+      }
+    }
+
+    overlay_cache_remove(lru);
+    cache.stats.evictions++;
+  }
+
+  cache.resident[cache.resident_count++] = (struct resident) {
+    .id = id,
+    .start = start,
+    .end = end,
+    .last_use = ++cache.clock
+  };
+}
+
+/*
+ * Do what ndk_overlay_read_into_ram does, from the staging buffer: the file
+ * at the overlay address (still compressed for compressed overlays,
+ * ndk_overlay_init_in_ram decompresses it) and a cleared BSS after the RAM
+ * image.
+ *
+ * The copy is made with the CPU, so it sits in the data cache. It's written
+ * to memory and the instruction cache lines of the range are dropped before
+ * any code in it can run.
+ */
+void overlay_cache_copy(struct overlay *h, struct staging_buffer *b)
+{
+  unsigned char *dst = (unsigned char *)h->info.ram_address;
+  int total = h->info.ram_size + h->info.bss_size;
+
+  ndk_memory_fast_32bit_copy(b->data, dst, (b->size + 3) & ~3);
+  ndk_memory_fast_32bit_fill(0, dst + h->info.ram_size, h->info.bss_size);
+
+  ndk_cpu_clean_dcache_lines(dst, total);
+  ndk_cpu_drain_write_buffer();
+  ndk_cpu_invalidate_icache_lines(dst, total);
+}
@@ -0,0 +1,98 @@
+/**
+ * ARM9 overlay residency manager.
+ *
+ * ndk_overlay_load reads an overlay from the cart every time, even when it's
+ * still in RAM from the last time it was used. This module remembers which
+ * overlays are resident and only loads what isn't.
+ *
+ * An overlay is linked to a fixed address, so it can only be in RAM where it
+ * was linked. Overlays linked to different parts of the overlay region stay
+ * resident together, each range is a slot. Loading an overlay unloads
+ * (ndk_overlay_fini_in_ram) the resident overlays its range overlaps.
+ *
+ * Overlays can be preloaded in the background into staging buffers in a
+ * memory pool. The file is read by the aio I/O thread while the game keeps
+ * running, usually while another overlay uses the range the preloaded one
+ * needs. Activating a staged overlay copies it to its address, clears its
+ * BSS and runs ndk_overlay_init_in_ram, the same steps ndk_overlay_load
+ * takes after reading the file. Staged copies are kept after activation so
+ * an overlay that was pushed out can come back without a cart read. When all
+ * staging buffers are used the least recently used one is reused.
+ *
+ *   overlay_cache_init(pool, sizeof pool, 2);
+ *
+ *   overlay_cache_load(MENU_OVERLAY);
+ *   overlay_cache_preload(BATTLE_OVERLAY);
+ *   run_menu();
+ *   // Usually no cart access here
+ *   overlay_cache_load(BATTLE_OVERLAY);
+ *
+ * NOTE: aio_init must have been called to preload. Without preloading the
+ * pool can be NULL.
+ *
+ * NOTE: Load, preload and unload all overlays through this module, it can't
+ * see overlays loaded with ndk_overlay_load.
+ */
+#ifndef UTIL_OVERLAY_CACHE_INCLUDE_FILE
+#define UTIL_OVERLAY_CACHE_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#define OVERLAY_CACHE_MAX_RESIDENT 16
+#define OVERLAY_CACHE_MAX_STAGED 8
+
+struct overlay_cache_stats {
+  // overlay_cache_load calls for overlays that were resident
+  unsigned int hits;
+  // loads from a staging buffer
+  unsigned int staged;
+  // loads that read the cart
+  unsigned int misses;
+  // resident overlays unloaded because another overlay needed the range
+  unsigned int evictions;
+  // preloads started and staging buffers reused for them
+  unsigned int preloads;
+  unsigned int staging_reuses;
+};
+
+/**
+ * @param pool memory for the staging buffers, 32 byte aligned. NULL if
+ * overlays aren't preloaded.
+ * @param size size of pool. Split into count buffers of the same size, an
+ * overlay file bigger than a buffer is never preloaded.
+ * @param count number of staging buffers, at most OVERLAY_CACHE_MAX_STAGED
+ */
+void overlay_cache_init(void *pool, int size, int count);
+
+/**
+ * Make an ARM9 overlay resident.
+ *
+ * Does nothing if it already is. Waits for its preload if that's still in
+ * progress. When this returns the overlay can be called.
+ *
+ * @param id overlay id
+ * @return false on failure
+ */
+bool overlay_cache_load(int id);
+
+/**
+ * Start reading an ARM9 overlay into a staging buffer. Returns immediately.
+ *
+ * @param id overlay id
+ * @return false if the overlay is resident or staged already, doesn't fit in a
+ * buffer or all buffers are being read into.
+ */
+bool overlay_cache_preload(int id);
+
+/**
+ * Unload an overlay. Its staged copy, if any, is kept.
+ *
+ * @param id overlay id
+ */
+void overlay_cache_unload(int id);
+
+bool overlay_cache_is_resident(int id);
+
+void overlay_cache_get_stats(struct overlay_cache_stats *stats);
+
+#endif // UTIL_OVERLAY_CACHE_INCLUDE_FILE
@@ -0,0 +1,59 @@
+#include <stddef.h>
+
+#include "overlay_fini.h"
+
+#include "cpu.h"
+#include "overlay.h"
+
+static void overlay_fini_run(void *object, int flag);
+
+
+void overlay_fini_register(struct overlay_fini *fini,
+                           struct overlay_fini **object)
+{
+  // The chain is shared with the rest of the game
+  int irq = ndk_cpu_disable_irq();
+
+  // An entry of ours with its object in this overlay's memory belongs to an
+  // overlay that was loaded over without unloading it, or to this overlay if
+  // it was loaded twice. The entry itself is resident so it's safe to unlink.
+  struct destructor_chain **p = &global_destructor_chain;
+
+  while (*p != NULL) {
+    struct destructor_chain *link = *p;
+    char *o = link->object;
+
+    if (link->destructor == &overlay_fini_run && o >= fini->ram_start &&
+        o < fini->ram_end) {
+      *p = link->next;
+    } else {
+      p = &link->next;
+    }
+  }
+
+  if (fini->start != fini->end) {
+    fini->link.destructor = &overlay_fini_run;
+    fini->link.object = object;
+    fini->link.next = global_destructor_chain;
+    global_destructor_chain = &fini->link;
+  }
+
+  ndk_cpu_write_irq_flag(irq);
+}
+
+/*
+ * Called by ndk_overlay_fini_in_ram, which has taken the entry out of the
+ * chain already. Like exit() the array is run back to front.
+ */
+void overlay_fini_run(void *object, int flag)
+{
+  struct overlay_fini *fini = *(struct overlay_fini **)object;
+
+  for (void (**f)(void) = fini->end; f != fini->start; ) {
+    f--;
+
+    if (*f != NULL) {
+      (*f)();
+    }
+  }
+}
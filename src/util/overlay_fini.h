@@ -0,0 +1,84 @@
+/**
+ * Run the .fini_array of an overlay when it's unloaded.
+ *
+ * ovlgen puts the .init_array of an overlay in the overlay table entry, so
+ * ndk_overlay_init_in_ram runs the constructors (__attribute__((constructor))
+ * functions) of an overlay after loading it. There is no fini array in the
+ * overlay table though. ndk_overlay_fini_in_ram only runs the destructors in
+ * the global destructor chain whose object is in the memory of the overlay.
+ *
+ * OVERLAY_FINI_ARRAY(<name>) adds a constructor to the overlay that
+ * registers its .fini_array in the chain. ndk_overlay_unload (or
+ * ndk_overlay_fini_in_ram) then calls the destructors, last one first.
+ * ovlgen writes overlay_fini.c with one OVERLAY_FINI_ARRAY for every main and
+ * dtcm overlay of the manifest, link it with the game:
+ *
+ *   // ovr_menu.c, the manifest line is: menu main ovr_menu.o
+ *   static short *table;
+ *
+ *   __attribute__((constructor)) static void build_table(void) { ... }
+ *   __attribute__((destructor)) static void free_table(void) { ... }
+ *
+ * The chain entry and the registration code are resident, only the object of
+ * the entry (a pointer to the entry) is in the overlay's data. An overlay
+ * loaded over another one without unloading it first removes the entries of
+ * the old one from the chain when it registers, their destructors don't run.
+ * Other chain entries with objects in the old overlay are left alone.
+ * overlay_cache always unloads.
+ */
+#ifndef UTIL_OVERLAY_FINI_INCLUDE_FILE
+#define UTIL_OVERLAY_FINI_INCLUDE_FILE
+
+#include "overlay.h"
+
+struct overlay_fini {
+  struct destructor_chain link;   // 0x0
+  void (**start)(void);           // 0xc
+  void (**end)(void);             // 0x10
+  // memory of the overlay, up to the end of the BSS
+  char *ram_start;                // 0x14
+  char *ram_end;                  // 0x18
+  // 0x1c
+};
+
+#define OVERLAY_FINI_ARRAY(name)                                            \
+  extern void (*_##name##_fini_array_start[])(void);                        \
+  extern void (*_##name##_fini_array_end[])(void);                          \
+  extern char _##name##_start[];                                            \
+  extern char _##name##_bss_end[];                                          \
+                                                                            \
+  static struct overlay_fini overlay_fini_##name = {                        \
+    .start = _##name##_fini_array_start,                                    \
+    .end = _##name##_fini_array_end,                                        \
+    .ram_start = _##name##_start,                                           \
+    .ram_end = _##name##_bss_end                                            \
+  };                                                                        \
+                                                                            \
+  static struct overlay_fini *overlay_fini_object_##name                    \
+  __attribute__((section(".ovl_fini." #name), used)) =                      \
+    &overlay_fini_##name;                                                   \
+                                                                            \
+  static void overlay_fini_register_##name(void)                            \
+  {                                                                         \
+    overlay_fini_register(&overlay_fini_##name,                             \
+                          &overlay_fini_object_##name);                     \
+  }                                                                         \
+                                                                            \
+  static void (*overlay_fini_init_##name)(void)                             \
+  __attribute__((section(".ovl_fini_init." #name), used)) =                 \
+    &overlay_fini_register_##name;
+
+/**
+ * Add the fini array to the global destructor chain, if it isn't empty.
+ * Called from the init array of the overlay.
+ *
+ * Entries added for overlays that were in the memory of this one before are
+ * removed first.
+ *
+ * @param fini fini array of an overlay, resident
+ * @param object pointer to fini in the overlay's data
+ */
+void overlay_fini_register(struct overlay_fini *fini,
+                           struct overlay_fini **object);
+
+#endif // UTIL_OVERLAY_FINI_INCLUDE_FILE
@@ -0,0 +1,148 @@
+#include <stddef.h>
+
+#include "pack.h"
+
+#include "hash.h"
+
+static bool pack_valid(struct pack_header *hdr, int file_size);
+static bool pack_read_at(struct pack *p, unsigned int offset, void *dst,
+                         unsigned int size);
+
+
+int pack_open(struct pack *p, char *path, void *dir, int size)
+{
+  ndk_file_init_handle(&p->h);
+
+  if (!ndk_file_open(&p->h, path)) {
+    return -1;
+  }
+
+  int file_size = ndk_file_size(&p->h);
+
+  if (dir == NULL) {
+    struct pack_header hdr;
+    int dir_size = -1;
+
+    if (ndk_file_read(&p->h, &hdr, sizeof hdr) == sizeof hdr &&
+        pack_valid(&hdr, file_size)) {
+      dir_size = hdr.dir_size;
+    }
+
+    ndk_file_close(&p->h);
+
+    return dir_size;
+  }
+
+  // The first block holds the header. Both reads take the DMA path.
+  struct pack_header *hdr = dir;
+
+  if ((p->h.start_offset & (PACK_ALIGN - 1)) != 0 || size < PACK_ALIGN ||
+      !pack_read_at(p, 0, dir, PACK_ALIGN) || !pack_valid(hdr, file_size) ||
+      size < hdr->dir_size) {
+    ndk_file_close(&p->h);
+    return -1;
+  }
+
+  if (hdr->dir_size > PACK_ALIGN &&
+      !pack_read_at(p, PACK_ALIGN, (char *)dir + PACK_ALIGN,
+                    hdr->dir_size - PACK_ALIGN)) {
+    ndk_file_close(&p->h);
+    return -1;
+  }
+
+  p->hdr = hdr;
+  p->entries = (struct pack_entry *)(hdr + 1);
+  p->groups = (struct pack_group *)(p->entries + hdr->count);
+
+  return hdr->dir_size;
+}
+
+void pack_close(struct pack *p)
+{
+  ndk_file_close(&p->h);
+  p->hdr = NULL;
+}
+
+int pack_find(struct pack *p, const char *name)
+{
+  unsigned int hash = hash_path(name, p->hdr->seed);
+
+  for (int i = 0; i < p->hdr->count; i++) {
+    if (p->entries[i].hash == hash) {
+      // Hashes of members are unique, a failed check means the name isn't
+      // in the pack
+      return p->entries[i].check == hash_path_check(name) ? i : -1;
+    }
+  }
+
+  return -1;
+}
+
+int pack_find_group(struct pack *p, const char *name)
+{
+  unsigned int hash = hash_path(name, p->hdr->seed);
+
+  for (int i = 0; i < p->hdr->group_count; i++) {
+    if (p->groups[i].hash == hash) {
+      return p->groups[i].check == hash_path_check(name) ? i : -1;
+    }
+  }
+
+  return -1;
+}
+
+bool pack_read(struct pack *p, int index, void *dst)
+{
+  if (index < 0 || index >= p->hdr->count) {
+    return false;
+  }
+
+  struct pack_entry *e = &p->entries[index];
+
+  return pack_read_at(p, e->offset, dst, e->padded_size);
+}
+
+bool pack_read_group(struct pack *p, int group, void *dst)
+{
+  if (group < 0 || group >= p->hdr->group_count) {
+    return false;
+  }
+
+  struct pack_group *g = &p->groups[group];
+
+  return pack_read_at(p, g->offset, dst, g->size);
+}
+
+void *pack_group_member(struct pack *p, int group, void *dst, int index)
+{
+  struct pack_group *g = &p->groups[group];
+
+  if (index < g->first || index >= g->first + g->count) {
+    return NULL;
+  }
+
+  return (char *)dst + (p->entries[index].offset - g->offset);
+}
+
+bool pack_valid(struct pack_header *hdr, int file_size)
+{
+  if (hdr->magic != PACK_MAGIC || hdr->version != PACK_VERSION ||
+      (hdr->dir_size & (PACK_ALIGN - 1)) != 0) {
+    return false;
+  }
+
+  return hdr->dir_size >= sizeof(struct pack_header) +
+                          hdr->count * sizeof(struct pack_entry) +
+                          hdr->group_count * sizeof(struct pack_group) &&
+         hdr->dir_size <= file_size;
+}
+
+bool pack_read_at(struct pack *p, unsigned int offset, void *dst,
+                  unsigned int size)
+{
+  if (!ndk_file_seek(&p->h, offset, FILE_SEEK_SET)) {
+    return false;
+  }
+
+  return ndk_file_read(&p->h, dst, size) == size;
+}
@@ -0,0 +1,157 @@
+/**
+ * Pack files with 512 byte aligned members.
+ *
+ * The file system only reads with DMA when the ROM address is a multiple of
+ * 512, the destination is 4 byte aligned and outside the TCMs and the size is
+ * a multiple of 512 (see file.h). Loose files rarely meet these conditions and
+ * fall back to CPU copies. A pack file is built so that every read meets them:
+ *  - the directory and every member start at a multiple of 512 in the pack.
+ *  - member sizes are padded to a multiple of 512.
+ *  - the pack file itself starts at a multiple of 512 in the ROM, ndstool
+ *    aligns files to 512 by default. pack_open checks it.
+ *
+ * Members and groups are found by a hash of their name, unique within the
+ * pack. A name that isn't in the pack can share that hash with one that is,
+ * so a second hash, hash_path_check, is checked too.
+ *
+ * Members are organized in groups, e.g. all assets of a level. The members of
+ * a group are stored back to back so the whole group can be read in one
+ * transfer with pack_read_group.
+ *
+ * Packs are built by the host tool src/host/packgen from a manifest.
+ *
+ * Layout of a pack:
+ *   struct pack_header
+ *   struct pack_entry[count]
+ *   struct pack_group[group_count]
+ *   padding to dir_size
+ *   member data, each member padded to a multiple of PACK_ALIGN
+ *
+ * NOTE: Destination buffers must be 4 byte aligned, outside ITCM and DTCM and
+ * large enough for the padded size, see pack_entry.padded_size.
+ */
+#ifndef UTIL_PACK_INCLUDE_FILE
+#define UTIL_PACK_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "file.h"
+
+#define PACK_MAGIC 0x4b434150 // 'PACK'
+#define PACK_VERSION 2
+#define PACK_ALIGN 0x200
+
+#define PACK_PAD(size) (((size) + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1))
+
+struct pack_header {
+  unsigned int magic;               // 0x00
+  unsigned int version;             // 0x04
+  // number of members
+  unsigned int count;               // 0x08
+  unsigned int group_count;         // 0x0c
+  // size of the header, directory and padding. Offset of the first member.
+  unsigned int dir_size;            // 0x10
+  // hash seed of names, see hash.h
+  unsigned int seed;                // 0x14
+  unsigned int unused[2];           // 0x18
+  // 0x20
+};
+
+struct pack_entry {
+  // hash of the member name
+  unsigned int hash;                // 0x00
+  // from the start of the pack, a multiple of PACK_ALIGN
+  unsigned int offset;              // 0x04
+  // size of the data
+  unsigned int size;                // 0x08
+  // size of the data padded to a multiple of PACK_ALIGN
+  unsigned int padded_size;         // 0x0c
+  // hash_path_check of the member name
+  unsigned int check;               // 0x10
+  // 0x14
+};
+
+struct pack_group {
+  // hash of the group name
+  unsigned int hash;                // 0x00
+  // index of the first member, members of a group are consecutive
+  unsigned int first;               // 0x04
+  unsigned int count;               // 0x08
+  // offset of the first member and padded size of all members
+  unsigned int offset;              // 0x0c
+  unsigned int size;                // 0x10
+  // hash_path_check of the group name
+  unsigned int check;               // 0x14
+  // 0x18
+};
+
+struct pack {
+  struct file h;
+  struct pack_header *hdr;
+  struct pack_entry *entries;
+  struct pack_group *groups;
+};
+
+/**
+ * Open a pack and read its directory.
+ *
+ * NOTE: Call with dir = NULL to get the size of the directory. The pack is
+ * not opened.
+ *
+ * @param p
+ * @param path of the pack file
+ * @param dir buffer for the directory, kept until pack_close
+ * @param size of dir
+ * @return the size of the directory, -1 if the pack is missing, invalid or not
+ * 512 byte aligned in ROM or if dir is too small.
+ */
+int pack_open(struct pack *p, char *path, void *dir, int size);
+
+void pack_close(struct pack *p);
+
+/**
+ * Find a member by name.
+ *
+ * @return member index or -1
+ */
+int pack_find(struct pack *p, const char *name);
+
+/**
+ * Find a group by name.
+ *
+ * @return group index or -1
+ */
+int pack_find_group(struct pack *p, const char *name);
+
+/**
+ * Read a member. Always reads the padded size.
+ *
+ * @param p
+ * @param index member index
+ * @param dst at least entries[index].padded_size bytes
+ * @return true on success
+ */
+bool pack_read(struct pack *p, int index, void *dst);
+
+/**
+ * Read all members of a group in one transfer.
+ *
+ * @param p
+ * @param group group index
+ * @param dst at least groups[group].size bytes
+ * @return true on success
+ */
+bool pack_read_group(struct pack *p, int group, void *dst);
+
+/**
+ * Where a member ends up in a buffer read with pack_read_group.
+ *
+ * @param p
+ * @param group
+ * @param dst the buffer passed to pack_read_group
+ * @param index member index
+ * @return pointer to the member data or NULL if it's not in the group
+ */
+void *pack_group_member(struct pack *p, int group, void *dst, int index);
+
+#endif // UTIL_PACK_INCLUDE_FILE
@@ -0,0 +1,183 @@
+/**
+ * Lock-free single producer single consumer ring buffer.
+ *
+ * Made for handing data from an IRQ handler to a thread (or the other way
+ * around) without disabling IRQs. Exactly one context may push and exactly
+ * one context may pop. The producer only writes head and the consumer only
+ * writes tail, so no locking is needed. Both are free running counters, the
+ * element count must be a power of two.
+ *
+ * The ARM946E-S is a single core with in order memory accesses, so compiler
+ * barriers are enough to make sure an element is written before head is
+ * advanced past it.
+ *
+ * Elements are a multiple of 4 bytes and are copied word by word. The buffer
+ * must be 4 byte aligned.
+ *
+ * Typical use with a VBlank handler, wake the consumer with the IRQ bit as
+ * usual:
+ *
+ *   static unsigned int touch_buf[RING_BUFFER_WORDS(16, 4)];
+ *   static struct ring touch_ring;
+ *
+ *   void vblank_handler(void)
+ *   {
+ *     ring_push(&touch_ring, &sample);
+ *     thread_irq_bits |= IS_VBLANK;
+ *   }
+ *
+ *   ring_init(&touch_ring, touch_buf, 16, 4);
+ *   ...
+ *   ndk_thread_wait_irq(true, IS_VBLANK);
+ *   while (ring_pop(&touch_ring, &sample)) { ... }
+ *
+ * NOTE: To place the ring in DTCM link the object file that defines the
+ * struct ring and the buffer into the DTCM sections, see src/tcm/link.ld.
+ */
+#ifndef UTIL_RING_INCLUDE_FILE
+#define UTIL_RING_INCLUDE_FILE
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Number of words needed for a buffer of count elements of elem_size bytes.
+ */
+#define RING_BUFFER_WORDS(count, elem_size) ((count) * (((elem_size) + 3) / 4))
+
+#define RING_BARRIER() asm volatile ("" ::: "memory")
+
+struct ring {
+  // written by the producer only
+  volatile unsigned int head;
+  // written by the consumer only
+  volatile unsigned int tail;
+  unsigned int mask;
+  // element size in words
+  unsigned int words;
+  unsigned int *data;
+};
+
+/**
+ * Initialize a ring buffer. Must be done before the producer or the consumer
+ * use it.
+ *
+ * @param r
+ * @param buffer RING_BUFFER_WORDS(count, elem_size) words
+ * @param count number of elements, a power of two
+ * @param elem_size element size in bytes, rounded up to a multiple of 4
+ */
+static inline void ring_init(struct ring *r, unsigned int *buffer, int count,
+                             int elem_size)
+{
+  r->head = 0;
+  r->tail = 0;
+  r->mask = count - 1;
+  r->words = (elem_size + 3) / 4;
+  r->data = buffer;
+}
+
+/**
+ * Number of elements in the ring. Exact when called by the consumer, a lower
+ * bound of the free space when called by the producer.
+ */
+static inline int ring_count(const struct ring *r)
+{
+  return r->head - r->tail;
+}
+
+static inline bool ring_empty(const struct ring *r)
+{
+  return r->head == r->tail;
+}
+
+static inline bool ring_full(const struct ring *r)
+{
+  return r->head - r->tail > r->mask;
+}
+
+/**
+ * Add an element. Producer only.
+ *
+ * @param r
+ * @param elem
+ * @return false if the ring is full, the element is dropped
+ */
+static inline bool ring_push(struct ring *r, const void *elem)
+{
+  unsigned int head = r->head;
+
+  if (head - r->tail > r->mask) {
+    return false;
+  }
+
+  const unsigned int *src = elem;
+  unsigned int *dst = &r->data[(head & r->mask) * r->words];
+
+  for (unsigned int i = 0; i < r->words; i++) {
+    dst[i] = src[i];
+  }
+
+  // The element must be in memory before the consumer can see it.
+  RING_BARRIER();
+  r->head = head + 1;
+
+  return true;
+}
+
+/**
+ * Get the oldest element without removing it. Consumer only.
+ *
+ * @param r
+ * @return pointer to the element in the ring or NULL if it's empty
+ */
+static inline void *ring_peek(struct ring *r)
+{
+  unsigned int tail = r->tail;
+
+  if (r->head == tail) {
+    return NULL;
+  }
+
+  RING_BARRIER();
+
+  return &r->data[(tail & r->mask) * r->words];
+}
+
+/**
+ * Remove the element returned by ring_peek. Consumer only.
+ */
+static inline void ring_skip(struct ring *r)
+{
+  // The element must be read before the producer can overwrite it.
+  RING_BARRIER();
+  r->tail = r->tail + 1;
+}
+
+/**
+ * Remove the oldest element. Consumer only.
+ *
+ * @param r
+ * @param[out] elem
+ * @return false if the ring is empty
+ */
+static inline bool ring_pop(struct ring *r, void *elem)
+{
+  const unsigned int *src = ring_peek(r);
+
+  if (src == NULL) {
+    return false;
+  }
+
+  unsigned int *dst = elem;
+
+  for (unsigned int i = 0; i < r->words; i++) {
+    dst[i] = src[i];
+  }
+
+  ring_skip(r);
+
+  return true;
+}
+
+#endif // UTIL_RING_INCLUDE_FILE
@@ -0,0 +1,403 @@
+#include <stddef.h>
+
+#include "save.h"
+
+#include "backup.h"
+#include "cart.h"
+#include "hash.h"
+#include "thread.h"
+
+#define NO_SLOT -1
+#define BITMAP_WORDS (SAVE_MAX_PAGES / 32)
+// Backup reads while comparing a slot and data pages staged for a write
+#define READ_SIZE 0x200
+
+struct save {
+  bool initialized;
+  struct mutex lock;
+  unsigned int base;
+  unsigned char *shadow;
+  unsigned int size;
+  unsigned int page_size;
+  int page_count;
+  unsigned int slot_size;
+  // slot holding the last committed data or NO_SLOT
+  int current;
+  unsigned int sequence;
+  // pages changed since the last commit
+  unsigned int dirty[BITMAP_WORDS];
+  // pages where the other slot differs from the last committed data
+  unsigned int stale[BITMAP_WORDS];
+  struct save_stats stats;
+  unsigned char buf[READ_SIZE] __attribute__((aligned(4)));
+};
+
+static bool save_read_header(int slot, struct save_header *h);
+static unsigned int save_crc(const struct save_header *h);
+static void save_diff_slot(int slot);
+static bool save_write_pages(int slot, const unsigned int *pages,
+                             unsigned int *crc);
+static bool save_backup_write(unsigned char *src, unsigned int dest,
+                              unsigned int size);
+static void save_mark_pages(unsigned int *pages, unsigned int offset,
+                            unsigned int size);
+static unsigned int save_slot_data(int slot);
+
+
+static struct save save;
+
+
+bool save_init(unsigned int base, void *shadow, unsigned int size)
+{
+  unsigned int page_size = cart_backup_state.page_size > 0
+                           ? cart_backup_state.page_size
+                           : SAVE_DEFAULT_PAGE_SIZE;
+  int page_count = (size + page_size - 1) / page_size;
+
+  if (page_size > SAVE_MAX_PAGE_SIZE || page_count > SAVE_MAX_PAGES) {
+    return false;
+  }
+
+  if (!save.initialized) {
+    ndk_mutex_init(&save.lock);
+    save.initialized = true;
+  }
+
+  ndk_mutex_lock(&save.lock);
+
+  save.base = base;
+  save.shadow = shadow;
+  save.size = size;
+  save.page_size = page_size;
+  save.page_count = page_count;
+  save.slot_size = save_backup_size(size, page_size) / 2;
+  save.current = NO_SLOT;
+  save.sequence = 0;
+
+  for (int i = 0; i < BITMAP_WORDS; i++) {
+    save.dirty[i] = 0;
+    save.stale[i] = 0;
+  }
+
+  save_mark_pages(save.dirty, 0, size);
+  save_mark_pages(save.stale, 0, size);
+
+  ndk_mutex_unlock(&save.lock);
+
+  return true;
+}
+
+bool save_load(void)
+{
+  struct save_header h[2];
+  bool valid[2];
+
+  ndk_mutex_lock(&save.lock);
+
+  for (int slot = 0; slot < 2; slot++) {
+    valid[slot] = save_read_header(slot, &h[slot]);
+  }
+
+  // Newest first, sequence numbers wrap
+  int first = valid[1] && (!valid[0] ||
+                           (int)(h[1].sequence - h[0].sequence) > 0);
+
+  save.current = NO_SLOT;
+
+  for (int i = 0; i < 2 && save.current == NO_SLOT; i++) {
+    int slot = first ^ i;
+
+    if (valid[slot] &&
+        ndk_backup_read(save_slot_data(slot), save.shadow, save.size) &&
+        save_crc(&h[slot]) == h[slot].crc) {
+      save.current = slot;
+      save.sequence = h[slot].sequence;
+    }
+  }
+
+  for (int i = 0; i < BITMAP_WORDS; i++) {
+    save.dirty[i] = 0;
+    save.stale[i] = 0;
+  }
+
+  if (save.current == NO_SLOT) {
+    save_mark_pages(save.dirty, 0, save.size);
+    save_mark_pages(save.stale, 0, save.size);
+  } else {
+    save_diff_slot(save.current ^ 1);
+  }
+
+  ndk_mutex_unlock(&save.lock);
+
+  return save.current != NO_SLOT;
+}
+
+void save_write(unsigned int offset, const void *src, unsigned int size)
+{
+  const unsigned char *p = src;
+
+  ndk_mutex_lock(&save.lock);
+
+  for (unsigned int i = 0; i < size && offset + i < save.size; i++) {
+    if (save.shadow[offset + i] != p[i]) {
+      save.shadow[offset + i] = p[i];
+      save_mark_pages(save.dirty, offset + i, 1);
+    }
+  }
+
+  ndk_mutex_unlock(&save.lock);
+}
+
+void save_mark_dirty(const void *p, unsigned int size)
+{
+  ndk_mutex_lock(&save.lock);
+  save_mark_pages(save.dirty, (const unsigned char *)p - save.shadow, size);
+  ndk_mutex_unlock(&save.lock);
+}
+
+bool save_commit(void)
+{
+  bool any = false;
+
+  ndk_mutex_lock(&save.lock);
+
+  for (int i = 0; i < BITMAP_WORDS; i++) {
+    any = any || save.dirty[i] != 0;
+  }
+
+  if (!any) {
+    ndk_mutex_unlock(&save.lock);
+    return true;
+  }
+
+  int slot = save.current == NO_SLOT ? 0 : save.current ^ 1;
+  unsigned int pages[BITMAP_WORDS];
+
+  // The slot is one commit behind, bring it up to date too
+  for (int i = 0; i < BITMAP_WORDS; i++) {
+    pages[i] = save.dirty[i] | save.stale[i];
+  }
+
+  struct save_header h = {
+    .magic = SAVE_MAGIC,
+    .sequence = save.sequence + 1,
+    .size = save.size
+  };
+
+  h.crc = hash_crc32(&h, offsetof(struct save_header, crc), HASH_CRC32_INIT);
+
+  // The CRC is of the bytes that went out, the shadow may be written
+  // directly during the commit
+  bool ok = save_write_pages(slot, pages, &h.crc);
+
+  if (ok) {
+    *(struct save_header *)save.buf = h;
+
+    for (unsigned int i = sizeof h; i < save.page_size; i++) {
+      save.buf[i] = 0;
+    }
+
+    // Header last, the slot only becomes valid when all data is there
+    ok = save_backup_write(save.buf, save.base + slot * save.slot_size,
+                           save.page_size);
+  }
+
+  if (ok) {
+    save.stats.commits++;
+    save.stats.pages++;
+
+    // The slot that was current lacks exactly this commit
+    for (int i = 0; i < BITMAP_WORDS; i++) {
+      save.stale[i] = save.dirty[i];
+      save.dirty[i] = 0;
+    }
+
+    save.current = slot;
+    save.sequence++;
+  } else {
+    save.stats.errors++;
+    // Unknown how far the slot got
+    save_mark_pages(save.stale, 0, save.size);
+  }
+
+  ndk_mutex_unlock(&save.lock);
+
+  return ok;
+}
+
+unsigned int save_backup_size(unsigned int size, unsigned int page_size)
+{
+  return 2 * (page_size + (size + page_size - 1) / page_size * page_size);
+}
+
+void save_get_stats(struct save_stats *stats)
+{
+  *stats = save.stats;
+}
+
+void save_reset_stats(void)
+{
+  save.stats = (struct save_stats){ 0 };
+}
+
+/*
+ * Read the header of a slot, false if it can't be one of ours. The ARM7 can't
+ * write to DTCM, where the stack is, so it's read into buf.
+ */
+bool save_read_header(int slot, struct save_header *h)
+{
+  if (!ndk_backup_read(save.base + slot * save.slot_size, save.buf,
+                       sizeof *h)) {
+    return false;
+  }
+
+  *h = *(struct save_header *)save.buf;
+
+  return h->magic == SAVE_MAGIC && h->size == save.size;
+}
+
+/*
+ * CRC of the header fields before crc and the shadow.
+ */
+unsigned int save_crc(const struct save_header *h)
+{
+  unsigned int crc = hash_crc32(h, offsetof(struct save_header, crc),
+                                HASH_CRC32_INIT);
+
+  return hash_crc32(save.shadow, save.size, crc);
+}
+
+/*
+ * Mark the pages where the data of a slot differs from the shadow as stale.
+ * A read error marks the pages of that read.
+ */
+void save_diff_slot(int slot)
+{
+  unsigned int chunk = READ_SIZE / save.page_size * save.page_size;
+
+  for (unsigned int offset = 0; offset < save.size; offset += chunk) {
+    unsigned int n = save.size - offset < chunk ? save.size - offset : chunk;
+
+    if (!ndk_backup_read(save_slot_data(slot) + offset, save.buf, n)) {
+      save_mark_pages(save.stale, offset, n);
+      continue;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+      if (save.buf[i] != save.shadow[offset + i]) {
+        save_mark_pages(save.stale, offset + i, 1);
+      }
+    }
+  }
+}
+
+/*
+ * Write the given pages of the shadow to the data of a slot and add the data
+ * of the slot to crc. Consecutive pages go in one write, up to READ_SIZE.
+ *
+ * The pages are staged in buf and the CRC is taken there, so it matches what
+ * was written even if the shadow changes meanwhile. The other pages are taken
+ * from the shadow, the slot already holds them.
+ */
+bool save_write_pages(int slot, const unsigned int *pages, unsigned int *crc)
+{
+  int per_write = READ_SIZE / save.page_size;
+  int page = 0;
+
+  while (page < save.page_count) {
+    unsigned int offset = page * save.page_size;
+
+    if ((pages[page / 32] & (1u << (page % 32))) == 0) {
+      unsigned int end = offset + save.page_size;
+
+      *crc = hash_crc32(save.shadow + offset,
+                        (end < save.size ? end : save.size) - offset, *crc);
+      page++;
+      continue;
+    }
+
+    int first = page;
+
+    while (page < save.page_count && page - first < per_write &&
+           (pages[page / 32] & (1u << (page % 32))) != 0) {
+      page++;
+    }
+
+    unsigned int end = page * save.page_size;
+
+    if (end > save.size) {
+      end = save.size;
+    }
+
+    for (unsigned int i = offset; i < end; i++) {
+      save.buf[i - offset] = save.shadow[i];
+    }
+
+    *crc = hash_crc32(save.buf, end - offset, *crc);
+
+    if (!save_backup_write(save.buf, save_slot_data(slot) + offset,
+                           end - offset)) {
+      return false;
+    }
+
+    save.stats.pages += page - first;
+  }
+
+  return true;
+}
+
+/*
+ * Write to backup memory in pieces no larger than the backup type allows,
+ * whole pages when the limit is at least a page.
+ */
+bool save_backup_write(unsigned char *src, unsigned int dest,
+                       unsigned int size)
+{
+  unsigned int max = cart_backup_state.max_write_count;
+
+  if (max == 0 || max > size) {
+    max = size;
+  } else if (max >= save.page_size) {
+    max -= max % save.page_size;
+  }
+
+  for (unsigned int done = 0; done < size; done += max) {
+    unsigned int n = size - done < max ? size - done : max;
+
+    if (!ndk_backup_write(src + done, dest + done, n)) {
+      return false;
+    }
+
+    save.stats.writes++;
+    save.stats.bytes += n;
+  }
+
+  return true;
+}
+
+/*
+ * Set the bits of the pages of [offset, offset + size) of the data.
+ */
+void save_mark_pages(unsigned int *pages, unsigned int offset,
+                     unsigned int size)
+{
+  if (size == 0 || offset >= save.size) {
+    return;
+  }
+
+  unsigned int last = offset + size - 1 < save.size ? offset + size - 1
+                                                    : save.size - 1;
+
+  for (unsigned int page = offset / save.page_size;
+       page <= last / save.page_size; page++) {
+    pages[page / 32] |= 1u << (page % 32);
+  }
+}
+
+/*
+ * Backup address of the data of a slot, after its header page.
+ */
+unsigned int save_slot_data(int slot)
+{
+  return save.base + slot * save.slot_size + save.page_size;
+}
@@ -0,0 +1,139 @@
+/**
+ * Journaled save data in backup memory.
+ *
+ * Backup reads and writes go over IPC to the ARM7 one command at a time (see
+ * backup.h), so many small writes are slow. This module keeps the save data
+ * in a RAM shadow and tracks which backup pages changed. A commit writes
+ * only those pages, runs of consecutive pages with one write command.
+ *
+ * The backup holds two slots, each a header page followed by the data pages.
+ * A commit goes to the slot that isn't current: first the data pages, then
+ * the header with the next sequence number and a CRC32 of the header and the
+ * data. The current slot isn't touched, if power is lost during a commit the
+ * half written slot fails its CRC and save_load picks the other one.
+ *
+ * The slot written to is one commit behind, it also gets the pages of the
+ * previous commit. save_load compares the older slot with the loaded data so
+ * this holds after a restart too.
+ *
+ *   static struct profile profile;
+ *
+ *   save_init(0, &profile, sizeof profile);
+ *
+ *   if (!save_load()) {
+ *     profile_defaults(&profile);
+ *   }
+ *   ...
+ *   profile.best_score = score;
+ *   save_mark_dirty(&profile.best_score, sizeof profile.best_score);
+ *   save_commit();
+ *
+ * Backup memory used: 2 * (page + data size rounded up to pages), see
+ * save_backup_size.
+ *
+ * NOTE: The backup sub-system must be initialized (ndk_backup_init) first,
+ * the page size and the largest write are taken from cart_backup_state.
+ *
+ * NOTE: The shadow must be in main RAM, the ARM7 reads and writes it.
+ *
+ * NOTE: save_commit blocks until all pages are written. Call it from an I/O
+ * thread to keep the game running. save_write and save_mark_dirty wait for a
+ * commit in progress. The commit copies every page it writes and takes the
+ * CRC from the copy, direct writes to those pages meanwhile are safe. A
+ * direct write to a page the commit doesn't write must not overlap the
+ * commit, the CRC could include it while the slot doesn't. Use save_write
+ * from other threads.
+ */
+#ifndef UTIL_SAVE_INCLUDE_FILE
+#define UTIL_SAVE_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#define SAVE_MAGIC 0x45564153 // 'SAVE'
+#define SAVE_MAX_PAGES 1024
+#define SAVE_MAX_PAGE_SIZE 256
+// Used when cart_backup_state has no page size, e.g. FRAM
+#define SAVE_DEFAULT_PAGE_SIZE 32
+
+struct save_header {
+  unsigned int magic;               // 0x00
+  // the slot with the highest sequence and a valid CRC is current
+  unsigned int sequence;            // 0x04
+  // size of the data
+  unsigned int size;                // 0x08
+  // CRC32 of bytes 0x00-0x0b and the data, see hash.h
+  unsigned int crc;                 // 0x0c
+  // 0x10
+};
+
+struct save_stats {
+  // commits that wrote anything
+  unsigned int commits;
+  // data and header pages written
+  unsigned int pages;
+  // backup write commands
+  unsigned int writes;
+  unsigned int bytes;
+  // commits that failed on a backup error
+  unsigned int errors;
+};
+
+/**
+ * Set up the journal. All pages are dirty until save_load finds a valid
+ * slot.
+ *
+ * @param base backup address of the journal, a multiple of the page size
+ * @param shadow RAM copy of the save data
+ * @param size of the save data
+ * @return false if the data has more than SAVE_MAX_PAGES pages or the page
+ * size is larger than SAVE_MAX_PAGE_SIZE
+ */
+bool save_init(unsigned int base, void *shadow, unsigned int size);
+
+/**
+ * Read the newest valid slot into the shadow.
+ *
+ * @return false if no slot is valid, e.g. on first boot. The shadow content
+ * is undefined then, fill in defaults. The next commit writes everything.
+ */
+bool save_load(void);
+
+/**
+ * Copy data into the shadow. Only pages whose content changes become dirty.
+ *
+ * @param offset in the save data
+ * @param src
+ * @param size
+ */
+void save_write(unsigned int offset, const void *src, unsigned int size);
+
+/**
+ * Mark part of the shadow as changed after writing it directly.
+ *
+ * @param p inside the shadow
+ * @param size
+ */
+void save_mark_dirty(const void *p, unsigned int size);
+
+/**
+ * Write the dirty pages to backup memory.
+ *
+ * @return false on a backup error, the data stays dirty and the current slot
+ * is still valid
+ */
+bool save_commit(void);
+
+/**
+ * Backup memory used by the journal.
+ *
+ * @param size of the save data
+ * @param page_size of the backup memory
+ * @return bytes from base
+ */
+unsigned int save_backup_size(unsigned int size, unsigned int page_size);
+
+void save_get_stats(struct save_stats *stats);
+
+void save_reset_stats(void);
+
+#endif // UTIL_SAVE_INCLUDE_FILE
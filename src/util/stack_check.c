@@ -0,0 +1,389 @@
+#include <stddef.h>
+
+#include "stack_check.h"
+
+#include "cart.h"
+#include "nds.h"
+#include "sound.h"
+
+#define NO_SLOT -1
+#define IRQ_SLOT 0
+
+// Keep this many bytes below the stack pointer untouched when painting a
+// running thread.
+#define PAINT_MARGIN 64
+
+struct stack {
+  bool in_use;
+  bool overflow;
+  struct thread *thread;
+  unsigned int *low;
+  unsigned int *high;
+};
+
+struct stack_checker {
+  bool running;
+  thread_switch_fn *prev_fn;
+  stack_check_overflow_fn *overflow_fn;
+  int last_slot;
+  struct stack stacks[STACK_CHECK_MAX_STACKS];
+};
+
+static void stack_check_switch_fn(struct thread *current, struct thread *next);
+static int stack_check_find(struct thread *t);
+static int stack_check_add(struct thread *t, unsigned int *low,
+                           unsigned int *high);
+static void stack_check_paint(unsigned int *from, unsigned int *to);
+static void stack_check_set_guard(struct stack *s);
+static bool stack_check_guard_ok(struct stack *s);
+static int stack_check_used(struct stack *s);
+static void stack_check_default_overflow_fn(struct thread *t);
+
+
+static struct stack_checker checker;
+
+
+static inline void *stack_check_get_sp(void)
+{
+  void *sp;
+
+  asm volatile ("mov %0, sp" : "=r" (sp));
+
+  return sp;
+}
+
+void stack_check_init(stack_check_overflow_fn *fn)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  checker.overflow_fn = fn != NULL ? fn : &stack_check_default_overflow_fn;
+  checker.last_slot = NO_SLOT;
+
+  // Nothing is on the IRQ stack while IRQs are disabled.
+  struct stack *irq = &checker.stacks[IRQ_SLOT];
+
+  irq->in_use = true;
+  irq->overflow = false;
+  irq->thread = NULL;
+  irq->low = (unsigned int *)STACK_CHECK_IRQ_STACK_LOW;
+  irq->high = (unsigned int *)STACK_CHECK_IRQ_STACK_HIGH;
+
+  stack_check_paint(irq->low, irq->high);
+  stack_check_set_guard(irq);
+
+  stack_check_register(&main_thread);
+  stack_check_register(&idle_thread);
+  stack_check_register(&cart_state.worker_thread);
+  stack_check_register(&sound_thread);
+
+  if (!checker.running) {
+    checker.prev_fn = ndk_thread_set_pre_resume_fn(&stack_check_switch_fn);
+    checker.running = true;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+bool stack_check_stop(void)
+{
+  int lock;
+  bool stopped = true;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (checker.running) {
+    // A hook installed after ours chains to ours, it must be removed first
+    if (thread_base.pre_resume_fn != &stack_check_switch_fn) {
+      stopped = false;
+    } else {
+      ndk_thread_set_pre_resume_fn(checker.prev_fn);
+      checker.running = false;
+    }
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return stopped;
+}
+
+void stack_check_create(struct thread *t, thread_worker_fn *fn, void *arg,
+                        void *stack_top, int size, int priority)
+{
+  unsigned int *high = stack_top;
+  unsigned int *low = (unsigned int *)((char *)stack_top - size);
+
+  stack_check_paint(low, high);
+
+  ndk_thread_create(t, fn, arg, stack_top, size, priority);
+
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  int slot = stack_check_find(t);
+
+  if (slot == NO_SLOT) {
+    slot = stack_check_add(t, low, high);
+  } else {
+    checker.stacks[slot].low = low;
+    checker.stacks[slot].high = high;
+    checker.stacks[slot].overflow = false;
+  }
+
+  if (slot != NO_SLOT) {
+    stack_check_set_guard(&checker.stacks[slot]);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+bool stack_check_register(struct thread *t)
+{
+  unsigned int *low = t->stack_bottom;
+  unsigned int *high = t->stack_top;
+
+  if (low == NULL || high == NULL || low == high) {
+    return false;
+  }
+
+  // The SDK doesn't agree on what end is the bottom, use the address order.
+  if (low > high) {
+    unsigned int *tmp = low;
+    low = high;
+    high = tmp;
+  }
+
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  int slot = stack_check_find(t);
+
+  if (slot == NO_SLOT) {
+    slot = stack_check_add(t, low, high);
+  }
+
+  if (slot == NO_SLOT) {
+    ndk_thread_critical_leave(&lock);
+    return false;
+  }
+
+  unsigned int *sp = t == thread_base.current ? stack_check_get_sp()
+                                               : (void *)t->ctx.registers[13];
+
+  if (sp > high || sp < low) {
+    sp = high;
+  }
+
+  unsigned int *paint_end = sp - PAINT_MARGIN / sizeof(unsigned int);
+
+  if (paint_end > low) {
+    stack_check_paint(low, paint_end);
+  }
+
+  stack_check_set_guard(&checker.stacks[slot]);
+
+  ndk_thread_critical_leave(&lock);
+
+  return true;
+}
+
+void stack_check_unregister(struct thread *t)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  int slot = stack_check_find(t);
+
+  if (slot != NO_SLOT && slot != IRQ_SLOT) {
+    checker.stacks[slot].in_use = false;
+    checker.last_slot = NO_SLOT;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+int stack_check_high_water(struct thread *t)
+{
+  int lock;
+  int used = -1;
+
+  ndk_thread_critical_enter(&lock);
+
+  int slot = stack_check_find(t);
+
+  if (slot != NO_SLOT) {
+    used = stack_check_used(&checker.stacks[slot]);
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return used;
+}
+
+bool stack_check_verify(void)
+{
+  int lock;
+  bool ok = true;
+
+  ndk_thread_critical_enter(&lock);
+
+  for (int i = 0; i < STACK_CHECK_MAX_STACKS; i++) {
+    struct stack *s = &checker.stacks[i];
+
+    if (s->in_use && !stack_check_guard_ok(s)) {
+      s->overflow = true;
+      ok = false;
+    }
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return ok;
+}
+
+int stack_check_report(struct stack_check_info *info, int max)
+{
+  int lock;
+  int count = 0;
+
+  ndk_thread_critical_enter(&lock);
+
+  for (int i = 0; i < STACK_CHECK_MAX_STACKS && count < max; i++) {
+    struct stack *s = &checker.stacks[i];
+
+    if (!s->in_use) {
+      continue;
+    }
+
+    info[count++] = (struct stack_check_info) {
+      .thread = s->thread,
+      .id = s->thread != NULL ? s->thread->id : -1,
+      .size = (s->high - s->low) * sizeof(unsigned int),
+      .used = stack_check_used(s),
+      .overflow = s->overflow || !stack_check_guard_ok(s)
+    };
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return count;
+}
+
+/*
+ * Called by the scheduler with IRQs disabled. Only the stack of the thread
+ * that was just suspended and the IRQ stack can have grown since the last
+ * switch.
+ */
+void stack_check_switch_fn(struct thread *current, struct thread *next)
+{
+  if (current != NULL) {
+    int slot = stack_check_find(current);
+
+    if (slot != NO_SLOT) {
+      struct stack *s = &checker.stacks[slot];
+
+      checker.last_slot = slot;
+
+      if (!s->overflow && !stack_check_guard_ok(s)) {
+        s->overflow = true;
+        checker.overflow_fn(current);
+      }
+    }
+  }
+
+  struct stack *irq = &checker.stacks[IRQ_SLOT];
+
+  if (!irq->overflow && !stack_check_guard_ok(irq)) {
+    irq->overflow = true;
+    checker.overflow_fn(NULL);
+  }
+
+  if (checker.prev_fn != NULL) {
+    checker.prev_fn(current, next);
+  }
+}
+
+int stack_check_find(struct thread *t)
+{
+  if (checker.last_slot != NO_SLOT &&
+      checker.stacks[checker.last_slot].in_use &&
+      checker.stacks[checker.last_slot].thread == t) {
+    return checker.last_slot;
+  }
+
+  for (int i = 0; i < STACK_CHECK_MAX_STACKS; i++) {
+    if (checker.stacks[i].in_use && checker.stacks[i].thread == t) {
+      return i;
+    }
+  }
+
+  return NO_SLOT;
+}
+
+int stack_check_add(struct thread *t, unsigned int *low, unsigned int *high)
+{
+  // Slot 0 is reserved for the IRQ stack.
+  for (int i = IRQ_SLOT + 1; i < STACK_CHECK_MAX_STACKS; i++) {
+    struct stack *s = &checker.stacks[i];
+
+    if (!s->in_use) {
+      s->in_use = true;
+      s->overflow = false;
+      s->thread = t;
+      s->low = low;
+      s->high = high;
+      return i;
+    }
+  }
+
+  return NO_SLOT;
+}
+
+void stack_check_paint(unsigned int *from, unsigned int *to)
+{
+  while (from < to) {
+    *from++ = STACK_CHECK_PAINT;
+  }
+}
+
+void stack_check_set_guard(struct stack *s)
+{
+  for (int i = 0; i < STACK_CHECK_GUARD_WORDS; i++) {
+    s->low[i] = STACK_CHECK_GUARD;
+  }
+}
+
+bool stack_check_guard_ok(struct stack *s)
+{
+  for (int i = 0; i < STACK_CHECK_GUARD_WORDS; i++) {
+    if (s->low[i] != STACK_CHECK_GUARD) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Stacks grow downwards so scan from the guard words up to the first word
+ * that has been written.
+ */
+int stack_check_used(struct stack *s)
+{
+  unsigned int *p = s->low + STACK_CHECK_GUARD_WORDS;
+
+  while (p < s->high && *p == STACK_CHECK_PAINT) {
+    p++;
+  }
+
+  return (s->high - p) * sizeof(unsigned int);
+}
+
+void stack_check_default_overflow_fn(struct thread *t)
+{
+  ndk_panic();
+}
@@ -0,0 +1,135 @@
+/**
+ * Stack high-water mark monitoring and overflow guards.
+ *
+ * Stacks are painted with a known pattern. The deepest word that no longer
+ * holds the pattern tells how much of the stack a thread has used so far, the
+ * high-water mark. The lowest words of every stack are set to a guard value.
+ * The guards are verified at every context switch by a scheduler hook
+ * installed with ndk_thread_set_pre_resume_fn. If a guard word has been
+ * overwritten the overflow function is called, the default is ndk_panic.
+ *
+ * Threads created with stack_check_create get their whole stack painted before
+ * they run. Threads that are already running (main, idle, cart and sound) are
+ * painted below their current stack pointer when they are registered, their
+ * high-water mark is exact from that point on.
+ *
+ * The IRQ stack in DTCM (see docs/memory_map.txt) is monitored as well. It's
+ * reported with thread set to NULL.
+ *
+ * Typical use, run the game through its worst case and then print the report.
+ * Shrink the stack sizes to the high-water mark plus a safety margin.
+ *
+ * NOTE: Painting is opt-in. Nothing is monitored until stack_check_init has
+ * been called.
+ */
+#ifndef UTIL_STACK_CHECK_INCLUDE_FILE
+#define UTIL_STACK_CHECK_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "thread.h"
+
+#define STACK_CHECK_MAX_STACKS 16
+
+#define STACK_CHECK_PAINT 0xfdfdfdfd
+#define STACK_CHECK_GUARD 0x4b415453 // 'STAK'
+#define STACK_CHECK_GUARD_WORDS 2
+
+// ARM9 IRQ stack, see docs/memory_map.txt
+#define STACK_CHECK_IRQ_STACK_LOW 0x027c3b80
+#define STACK_CHECK_IRQ_STACK_HIGH 0x027c3f80
+
+/**
+ * Called from the scheduler (IRQs disabled) when a guard word has been
+ * overwritten.
+ *
+ * @param t the thread or NULL for the IRQ stack
+ */
+typedef void stack_check_overflow_fn(struct thread *t);
+
+struct stack_check_info {
+  // NULL for the IRQ stack
+  struct thread *thread;
+  int id;
+  // stack size in bytes
+  int size;
+  // high-water mark in bytes
+  int used;
+  // true if a guard word has been overwritten
+  bool overflow;
+};
+
+/**
+ * Start monitoring.
+ *
+ * Registers the main, idle, cart and sound threads and the IRQ stack then
+ * installs the scheduler hook.
+ *
+ * NOTE: Must not be called from an IRQ handler, the IRQ stack is painted.
+ *
+ * @param fn overflow function, NULL to use the default (ndk_panic)
+ */
+void stack_check_init(stack_check_overflow_fn *fn);
+
+/**
+ * Stop checking guards at context switches and restore the previous scheduler
+ * hook. The high-water marks can still be read.
+ *
+ * Hooks must be removed in the reverse order they were installed. If another
+ * hook (e.g. thread_trace) was installed after the checker, nothing is changed
+ * and false is returned; stop that one first.
+ *
+ * @return true if checking is stopped
+ */
+bool stack_check_stop(void);
+
+/**
+ * Create a thread with a painted and guarded stack.
+ *
+ * Same arguments as ndk_thread_create.
+ */
+void stack_check_create(struct thread *t, thread_worker_fn *fn, void *arg,
+                        void *stack_top, int size, int priority);
+
+/**
+ * Register a thread that is already created. The stack below the threads
+ * current stack pointer is painted.
+ *
+ * @param t
+ * @return false if the stack bounds of the thread are unknown or there is no
+ * free slot.
+ */
+bool stack_check_register(struct thread *t);
+
+/**
+ * Stop monitoring a thread e.g. before its stack memory is reused.
+ *
+ * @param t
+ */
+void stack_check_unregister(struct thread *t);
+
+/**
+ * Get the high-water mark of a thread.
+ *
+ * @param t the thread or NULL for the IRQ stack
+ * @return used stack in bytes or -1 if t isn't monitored
+ */
+int stack_check_high_water(struct thread *t);
+
+/**
+ * Verify the guard words of all monitored stacks now.
+ *
+ * @return false if any stack has overflowed
+ */
+bool stack_check_verify(void);
+
+/**
+ * Get a report for all monitored stacks.
+ *
+ * @param[out] info array to fill
+ * @param max number of elements in info
+ * @return number of elements written
+ */
+int stack_check_report(struct stack_check_info *info, int max);
+
+#endif // UTIL_STACK_CHECK_INCLUDE_FILE
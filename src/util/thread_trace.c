@@ -0,0 +1,310 @@
+#include <stddef.h>
+
+#include "thread_trace.h"
+
+#include "cart.h"
+#include "dtcm.h"
+#include "nds.h"
+#include "sound.h"
+#include "util.h"
+
+#define NO_SLOT 0xff
+
+struct tracer {
+  bool running;
+  thread_switch_fn *prev_fn;
+  struct thread_trace_event *events;
+  unsigned int mask;
+  unsigned int write;
+  unsigned int overwritten;
+  unsigned int start_time;
+  unsigned int last_switch;
+  int last_slot;
+  int thread_count;
+  struct thread *threads[THREAD_TRACE_MAX_THREADS];
+  struct thread_trace_stats stats[THREAD_TRACE_MAX_THREADS];
+};
+
+static void thread_trace_switch_fn(struct thread *current, struct thread *next);
+static int thread_trace_get_slot(struct thread *t);
+static int thread_trace_wait_reason(struct thread *t);
+static void thread_trace_copy_name(char *dest, const char *name);
+
+
+static struct tracer tracer;
+
+
+void thread_trace_init(struct thread_trace_event *events, int count)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  tracer.events = events;
+  tracer.mask = count - 1;
+  tracer.last_slot = NO_SLOT;
+
+  thread_trace_name(&main_thread, "main");
+  thread_trace_name(&idle_thread, "idle");
+  thread_trace_name(&cart_state.worker_thread, "cart");
+  thread_trace_name(&sound_thread, "sound");
+
+  thread_trace_reset();
+
+  // Share the timers with io_trace
+  if ((TM2CNT_H & 0x80) == 0) {
+    timer_start();
+  }
+  tracer.start_time = timer_value();
+  tracer.last_switch = tracer.start_time;
+
+  if (!tracer.running) {
+    tracer.prev_fn = ndk_thread_set_pre_resume_fn(&thread_trace_switch_fn);
+    tracer.running = true;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+bool thread_trace_stop(void)
+{
+  int lock;
+  bool stopped = true;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (tracer.running) {
+    // A hook installed after ours chains to ours, it must be removed first
+    if (thread_base.pre_resume_fn != &thread_trace_switch_fn) {
+      stopped = false;
+    } else {
+      ndk_thread_set_pre_resume_fn(tracer.prev_fn);
+      tracer.running = false;
+    }
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return stopped;
+}
+
+void thread_trace_reset(void)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  for (int i = 0; i < tracer.thread_count; i++) {
+    struct thread_trace_stats *s = &tracer.stats[i];
+
+    s->run_cycles = 0;
+    s->switches_in = 0;
+
+    for (int r = 0; r < THREAD_TRACE_REASONS; r++) {
+      s->waits[r] = 0;
+    }
+  }
+
+  tracer.write = 0;
+  tracer.overwritten = 0;
+
+  if (tracer.running) {
+    tracer.start_time = timer_value();
+    tracer.last_switch = tracer.start_time;
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+void thread_trace_name(struct thread *t, const char *name)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  int slot = thread_trace_get_slot(t);
+
+  if (slot != NO_SLOT) {
+    thread_trace_copy_name(tracer.stats[slot].name, name);
+  }
+
+  ndk_thread_critical_leave(&lock);
+}
+
+int thread_trace_get_stats(struct thread_trace_stats *stats, int max)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  int count = tracer.thread_count < max ? tracer.thread_count : max;
+
+  for (int i = 0; i < count; i++) {
+    stats[i] = tracer.stats[i];
+  }
+
+  if (tracer.running && tracer.last_slot < count) {
+    stats[tracer.last_slot].run_cycles += timer_value() - tracer.last_switch;
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return count;
+}
+
+int thread_trace_dump(void *dest, int size)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  unsigned int capacity = tracer.mask + 1;
+  int event_count = tracer.write < capacity ? tracer.write : capacity;
+  int required = sizeof(struct thread_trace_header) +
+                 tracer.thread_count * sizeof(struct thread_trace_stats) +
+                 event_count * sizeof(struct thread_trace_event);
+
+  if (dest == NULL || size < required) {
+    ndk_thread_critical_leave(&lock);
+    return dest == NULL ? required : -1;
+  }
+
+  struct thread_trace_header *hdr = dest;
+
+  hdr->magic = THREAD_TRACE_MAGIC;
+  hdr->version = THREAD_TRACE_VERSION;
+  hdr->clock = BUS_CLOCK;
+  hdr->thread_count = tracer.thread_count;
+  hdr->event_count = event_count;
+  hdr->overwritten = tracer.overwritten;
+  hdr->start_time = tracer.start_time;
+  hdr->dump_time = timer_value();
+
+  struct thread_trace_stats *stats = (struct thread_trace_stats *)(hdr + 1);
+
+  thread_trace_get_stats(stats, tracer.thread_count);
+
+  struct thread_trace_event *ev =
+                      (struct thread_trace_event *)(stats + tracer.thread_count);
+  unsigned int first = tracer.write - event_count;
+
+  for (int i = 0; i < event_count; i++) {
+    ev[i] = tracer.events[(first + i) & tracer.mask];
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  return required;
+}
+
+/*
+ * Called by the scheduler with IRQs disabled.
+ */
+void thread_trace_switch_fn(struct thread *current, struct thread *next)
+{
+  unsigned int now = timer_value();
+  int from = NO_SLOT;
+  int reason = THREAD_TRACE_PREEMPTED;
+
+  if (current != NULL) {
+    from = thread_trace_get_slot(current);
+    reason = thread_trace_wait_reason(current);
+
+    if (from != NO_SLOT) {
+      tracer.stats[from].run_cycles += now - tracer.last_switch;
+      tracer.stats[from].waits[reason]++;
+    }
+  }
+
+  int to = thread_trace_get_slot(next);
+
+  if (to != NO_SLOT) {
+    tracer.stats[to].switches_in++;
+    tracer.stats[to].priority = next->priority;
+  }
+
+  if (tracer.write > tracer.mask) {
+    tracer.overwritten++;
+  }
+
+  struct thread_trace_event *ev = &tracer.events[tracer.write & tracer.mask];
+
+  ev->timestamp = now;
+  ev->from = from;
+  ev->to = to;
+  ev->reason = reason;
+
+  tracer.write++;
+  tracer.last_switch = now;
+  tracer.last_slot = to;
+
+  if (tracer.prev_fn != NULL) {
+    tracer.prev_fn(current, next);
+  }
+}
+
+/*
+ * Find or register the slot for a thread. The last resumed thread is almost
+ * always the one asked for next, so it's checked first.
+ */
+int thread_trace_get_slot(struct thread *t)
+{
+  if (tracer.last_slot != NO_SLOT && tracer.threads[tracer.last_slot] == t) {
+    return tracer.last_slot;
+  }
+
+  for (int i = 0; i < tracer.thread_count; i++) {
+    if (tracer.threads[i] == t) {
+      return i;
+    }
+  }
+
+  if (tracer.thread_count == THREAD_TRACE_MAX_THREADS) {
+    return NO_SLOT;
+  }
+
+  int slot = tracer.thread_count++;
+  struct thread_trace_stats *s = &tracer.stats[slot];
+
+  tracer.threads[slot] = t;
+
+  *s = (struct thread_trace_stats) {
+    .id = t->id,
+    .priority = t->priority
+  };
+
+  return slot;
+}
+
+int thread_trace_wait_reason(struct thread *t)
+{
+  if (t->status == 2)
+    return THREAD_TRACE_EXIT;
+
+  if (t->status == 1)
+    return THREAD_TRACE_PREEMPTED;
+
+  if (t->blocked_at != NULL)
+    return THREAD_TRACE_WAIT_MUTEX;
+
+  if (t->waiting_list == &waiting_irq_thread_list)
+    return THREAD_TRACE_WAIT_IRQ;
+
+  if (t->waiting_list != NULL)
+    return THREAD_TRACE_WAIT_LIST;
+
+  return THREAD_TRACE_SLEEP;
+}
+
+void thread_trace_copy_name(char *dest, const char *name)
+{
+  int i = 0;
+
+  for (; i < THREAD_TRACE_NAME_SIZE - 1 && name[i] != '\0'; i++) {
+    dest[i] = name[i];
+  }
+
+  for (; i < THREAD_TRACE_NAME_SIZE; i++) {
+    dest[i] = '\0';
+  }
+}
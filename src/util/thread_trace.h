@@ -0,0 +1,165 @@
+/**
+ * Thread CPU accounting and context switch tracing.
+ *
+ * The tracer hooks the scheduler with ndk_thread_set_pre_resume_fn. The hook is
+ * called with the thread being suspended and the thread about to be resumed.
+ * Every switch is timestamped with the free running bus cycle counter formed
+ * by timers 2 and 3 (see util.h). The time between two switches is charged to
+ * the thread that was running.
+ *
+ * Per thread the tracer accumulates run time, the number of times it was
+ * resumed and why it was suspended. Every switch is also written to a ring
+ * buffer of events. When the ring buffer is full the oldest events are
+ * overwritten, so the buffer always holds the latest part of the timeline.
+ *
+ * Use thread_trace_dump to serialize statistics and events into a memory
+ * buffer. Get it off the device by writing it to backup memory or by saving
+ * the memory range from an emulator. The host tool src/host/trace2json turns a
+ * dump into a Chrome trace / Perfetto JSON timeline.
+ *
+ * NOTE: Uses timers 2 and 3. They are started if not already running, so the
+ * tracer can run together with io_trace. Don't call timer_stop from util.h
+ * during a trace.
+ *
+ * NOTE: The hook runs inside the scheduler with IRQs disabled. It's kept short
+ * but it does add a few hundred cycles to every context switch.
+ */
+#ifndef UTIL_THREAD_TRACE_INCLUDE_FILE
+#define UTIL_THREAD_TRACE_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "thread.h"
+
+#define THREAD_TRACE_MAGIC 0x45435254 // 'TRCE'
+#define THREAD_TRACE_VERSION 1
+
+#define THREAD_TRACE_MAX_THREADS 16
+#define THREAD_TRACE_NAME_SIZE 12
+
+/**
+ * Reasons for a thread to be suspended.
+ */
+// Still scheduled, a thread with higher priority was made runnable.
+#define THREAD_TRACE_PREEMPTED 0
+// Waiting in ndk_thread_wait_irq.
+#define THREAD_TRACE_WAIT_IRQ 1
+// Blocked at a mutex.
+#define THREAD_TRACE_WAIT_MUTEX 2
+// Waiting in some other waiting list e.g. a file or cart transfer.
+#define THREAD_TRACE_WAIT_LIST 3
+// Waiting without a list e.g. ndk_thread_sleep or ndk_thread_yield(NULL).
+#define THREAD_TRACE_SLEEP 4
+// Removed from the priority list.
+#define THREAD_TRACE_EXIT 5
+#define THREAD_TRACE_REASONS 6
+
+/**
+ * One context switch.
+ *
+ * from and to are indices into the statistics array. 0xff means that the
+ * thread was unknown i.e. the thread table was full.
+ */
+struct thread_trace_event {
+  unsigned int timestamp;           // 0x00 bus cycles
+  unsigned char from;               // 0x04
+  unsigned char to;                 // 0x05
+  unsigned char reason;             // 0x06 reason 'from' was suspended
+  unsigned char unused;             // 0x07
+  // 0x08
+};
+
+/**
+ * Accumulated statistics for one thread.
+ */
+struct thread_trace_stats {
+  unsigned long long run_cycles;    // 0x00
+  int id;                           // 0x08
+  int priority;                     // 0x0c
+  char name[THREAD_TRACE_NAME_SIZE];  // 0x10
+  unsigned int switches_in;         // 0x1c
+  unsigned int waits[THREAD_TRACE_REASONS];  // 0x20
+  // 0x38
+};
+
+/**
+ * Dump header. Followed by thread_count thread_trace_stats structures and
+ * event_count thread_trace_event structures in chronological order.
+ */
+struct thread_trace_header {
+  unsigned int magic;               // 0x00
+  unsigned int version;             // 0x04
+  // timestamp frequency in Hz
+  unsigned int clock;               // 0x08
+  int thread_count;                 // 0x0c
+  int event_count;                  // 0x10
+  // number of events lost because the ring buffer wrapped
+  unsigned int overwritten;         // 0x14
+  // timestamp when the trace was started
+  unsigned int start_time;          // 0x18
+  // timestamp when the dump was made
+  unsigned int dump_time;           // 0x1c
+  // 0x20
+};
+
+/**
+ * Start tracing.
+ *
+ * Starts timers 2 and 3 if needed and installs the scheduler hook. The main,
+ * idle, cart and sound threads are registered with names. Other threads are
+ * registered the first time they are switched to, use thread_trace_name to
+ * give them a name.
+ *
+ * @param events ring buffer memory
+ * @param count number of events in the ring buffer. Must be a power of two.
+ */
+void thread_trace_init(struct thread_trace_event *events, int count);
+
+/**
+ * Stop tracing and restore the previous scheduler hook.
+ *
+ * Hooks must be removed in the reverse order they were installed. If another
+ * hook (e.g. stack_check) was installed after the tracer, nothing is changed
+ * and false is returned; stop that one first.
+ *
+ * @return true if tracing is stopped
+ */
+bool thread_trace_stop(void);
+
+/**
+ * Clear all statistics and events. Registered threads are kept.
+ */
+void thread_trace_reset(void);
+
+/**
+ * Register a thread and give it a name.
+ *
+ * @param t the thread
+ * @param name at most THREAD_TRACE_NAME_SIZE - 1 characters are kept
+ */
+void thread_trace_name(struct thread *t, const char *name);
+
+/**
+ * Get a snapshot of the per thread statistics.
+ *
+ * The run time of the currently executing thread is included up to now.
+ *
+ * @param[out] stats array to fill
+ * @param max number of elements in stats
+ * @return number of elements written
+ */
+int thread_trace_get_stats(struct thread_trace_stats *stats, int max);
+
+/**
+ * Serialize the trace into a buffer.
+ *
+ * NOTE: Call with dest = NULL to get the required size.
+ *
+ * @param dest destination buffer, 8 byte aligned
+ * @param size size of dest
+ * @return number of bytes written, the required size or -1 if dest is too
+ * small.
+ */
+int thread_trace_dump(void *dest, int size);
+
+#endif // UTIL_THREAD_TRACE_INCLUDE_FILE
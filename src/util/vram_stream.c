@@ -0,0 +1,180 @@
+#include <stddef.h>
+
+#include "vram_stream.h"
+
+#include "cart.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "nds.h"
+#include "thread.h"
+
+// Largest DMA read between two VBlank checks
+#define VBLANK_PIECE 0x400
+
+struct staging {
+  bool initialized;
+  struct mutex lock;
+  // Unaligned pieces go through here. Cache line aligned so invalidating it
+  // doesn't touch other data.
+  unsigned char buffer[VRAM_STREAM_STAGING_SIZE] __attribute__((aligned(32)));
+};
+
+static int vram_stream_read_staged(struct vram_stream *s, int n);
+
+
+static struct staging staging;
+
+
+bool vram_stream_open(struct vram_stream *s, char *path, void *dst, int size,
+                      bool vblank_only)
+{
+  int lock;
+
+  ndk_thread_critical_enter(&lock);
+
+  if (!staging.initialized) {
+    ndk_mutex_init(&staging.lock);
+    staging.initialized = true;
+  }
+
+  ndk_thread_critical_leave(&lock);
+
+  s->remaining = -1;
+
+  if (((unsigned int)dst & 1) != 0) {
+    return false;
+  }
+
+  ndk_file_init_handle(&s->h);
+
+  if (!ndk_file_open(&s->h, path)) {
+    return false;
+  }
+
+  int file_size = ndk_file_size(&s->h);
+
+  if (size < 0 || size > file_size) {
+    size = file_size;
+  }
+
+  s->dst = dst;
+  s->remaining = (size + 1) & ~1;
+  s->vblank_only = vblank_only;
+
+  return true;
+}
+
+int vram_stream_step(struct vram_stream *s, int budget)
+{
+  int left = budget > 0 ? budget & ~1 : s->remaining;
+
+  if (left == 0) {
+    left = 2;
+  }
+
+  while (s->remaining > 0 && left > 0) {
+    if (s->vblank_only && VCOUNT < SCREEN_HEIGHT) {
+      break;
+    }
+
+    unsigned int pos = s->h.current_offset;
+    int n = left < s->remaining ? left : s->remaining;
+
+    if ((pos & (CART_BLOCK_SIZE - 1)) == 0 &&
+        ((unsigned int)s->dst & 3) == 0 && n >= CART_BLOCK_SIZE) {
+      // DMA path, straight to the destination
+      n &= ~(CART_BLOCK_SIZE - 1);
+
+      if (s->vblank_only && n > VBLANK_PIECE) {
+        n = VBLANK_PIECE;
+      }
+
+      if (ndk_file_read(&s->h, s->dst, n) != n) {
+        s->remaining = -1;
+        break;
+      }
+    } else {
+      // Up to the next block boundary through the staging buffer. When pos is
+      // odd the destination can never be DMA aligned, read full buffers.
+      int to_boundary = CART_BLOCK_SIZE - (pos & (CART_BLOCK_SIZE - 1));
+
+      if ((pos & 1) == 0 && to_boundary < n) {
+        n = to_boundary;
+      }
+
+      if (n > VRAM_STREAM_STAGING_SIZE) {
+        n = VRAM_STREAM_STAGING_SIZE;
+      }
+
+      if (vram_stream_read_staged(s, n) < 0) {
+        s->remaining = -1;
+        break;
+      }
+    }
+
+    s->dst += n;
+    s->remaining -= n;
+    left -= n;
+  }
+
+  return s->remaining;
+}
+
+void vram_stream_close(struct vram_stream *s)
+{
+  ndk_file_close(&s->h);
+}
+
+int vram_stream_load(char *path, void *dst, int budget)
+{
+  struct vram_stream s;
+
+  if (!vram_stream_open(&s, path, dst, -1, budget > 0)) {
+    return -1;
+  }
+
+  int size = s.remaining;
+
+  while (s.remaining > 0) {
+    if (budget > 0) {
+      ndk_wait_vblank_intr();
+    }
+
+    vram_stream_step(&s, budget);
+  }
+
+  vram_stream_close(&s);
+
+  return s.remaining < 0 ? -1 : size;
+}
+
+/*
+ * Read n bytes (even) into the staging buffer and copy them with 16 bit
+ * writes.
+ *
+ * The buffer is invalidated before the read. Stale or dirty lines would
+ * otherwise hide or overwrite data written by DMA. A CPU read fills the cache
+ * normally, so nothing needs to be done after it.
+ */
+int vram_stream_read_staged(struct vram_stream *s, int n)
+{
+  ndk_mutex_lock(&staging.lock);
+
+  ndk_cpu_invalidate_dcache_lines(staging.buffer, VRAM_STREAM_STAGING_SIZE);
+
+  int got = ndk_file_read(&s->h, staging.buffer, n);
+
+  // The size was rounded up to even, the last byte may be past the end
+  if (got == n - 1 && s->remaining == n) {
+    staging.buffer[got++] = 0;
+  }
+
+  if (got == n) {
+    ndk_memory_16bit_copy(staging.buffer, s->dst, n);
+  }
+
+  ndk_mutex_unlock(&staging.lock);
+
+  return got == n ? n : -1;
+}
@@ -0,0 +1,110 @@
+/**
+ * Stream files from ROM straight into VRAM, palette memory and OAM.
+ *
+ * Loading graphics through a buffer in main RAM costs a second copy. Here the
+ * data is read from the cart directly into its destination. Whenever the file
+ * position is a multiple of 512 and the destination is 4 byte aligned the read
+ * takes the cart DMA path (see file.h). The remaining pieces are read into a
+ * small buffer in main RAM and copied with 16 bit writes. VRAM, palettes and
+ * OAM ignore 8 bit writes, so nothing is ever written there one byte at a
+ * time. The data cache lines of the buffer are invalidated around every
+ * read, the destinations themselves are not cached.
+ *
+ * A stream can be split over several frames. Call vram_stream_step right
+ * after VBlank starts with a byte budget that fits in the VBlank period. With
+ * vblank_only set a step also stops as soon as the display starts drawing,
+ * so a visible palette or OAM is never half updated. Set it for memory that
+ * is being displayed, clear it for VRAM banks that aren't.
+ *
+ *   struct vram_stream s;
+ *
+ *   vram_stream_open(&s, "title/bg.pal", VRAM_STREAM_BG_PALETTE_A, -1, true);
+ *
+ *   while (vram_stream_remaining(&s) > 0) {
+ *     ndk_wait_vblank_intr();
+ *     vram_stream_step(&s, VRAM_STREAM_VBLANK_BUDGET);
+ *   }
+ *
+ *   vram_stream_close(&s);
+ *
+ * NOTE: Destination and size must be even.
+ */
+#ifndef UTIL_VRAM_STREAM_INCLUDE_FILE
+#define UTIL_VRAM_STREAM_INCLUDE_FILE
+
+#include <stdbool.h>
+
+#include "file.h"
+
+#define VRAM_STREAM_BG_PALETTE_A ((void *)0x05000000)
+#define VRAM_STREAM_OBJ_PALETTE_A ((void *)0x05000200)
+#define VRAM_STREAM_BG_PALETTE_B ((void *)0x05000400)
+#define VRAM_STREAM_OBJ_PALETTE_B ((void *)0x05000600)
+#define VRAM_STREAM_BG_VRAM_A ((void *)0x06000000)
+#define VRAM_STREAM_BG_VRAM_B ((void *)0x06200000)
+#define VRAM_STREAM_OBJ_VRAM_A ((void *)0x06400000)
+#define VRAM_STREAM_OBJ_VRAM_B ((void *)0x06600000)
+#define VRAM_STREAM_LCDC_VRAM ((void *)0x06800000)
+#define VRAM_STREAM_OAM_A ((void *)0x07000000)
+#define VRAM_STREAM_OAM_B ((void *)0x07000400)
+
+/**
+ * Bytes that can be read in one VBlank with some margin. VBlank is 71 of 263
+ * scanlines, about 4.5 ms.
+ */
+#define VRAM_STREAM_VBLANK_BUDGET 0x2000
+
+#define VRAM_STREAM_STAGING_SIZE 0x200
+
+struct vram_stream {
+  struct file h;
+  unsigned char *dst;
+  // bytes left to read, -1 after an error
+  int remaining;
+  // stop a step when the display leaves VBlank
+  bool vblank_only;
+};
+
+/**
+ * Open a file for streaming.
+ *
+ * @param s
+ * @param path
+ * @param dst destination, even
+ * @param size number of bytes, -1 for the whole file. Rounded up to even.
+ * @param vblank_only only write during VBlank
+ * @return false if the file can't be opened or dst is odd
+ */
+bool vram_stream_open(struct vram_stream *s, char *path, void *dst, int size,
+                      bool vblank_only);
+
+/**
+ * Read the next part of the stream.
+ *
+ * @param s
+ * @param budget maximum number of bytes to read, 0 for no limit
+ * @return bytes left to read, -1 on error
+ */
+int vram_stream_step(struct vram_stream *s, int budget);
+
+static inline int vram_stream_remaining(struct vram_stream *s)
+{
+  return s->remaining;
+}
+
+void vram_stream_close(struct vram_stream *s);
+
+/**
+ * Stream a whole file, blocking the current thread.
+ *
+ * With a budget the file is read in parts of at most budget bytes, one per
+ * VBlank and only during VBlank. Without one (0) it's read at once.
+ *
+ * @param path
+ * @param dst
+ * @param budget bytes per VBlank or 0
+ * @return number of bytes read or -1 on error
+ */
+int vram_stream_load(char *path, void *dst, int budget);
+
+#endif // UTIL_VRAM_STREAM_INCLUDE_FILE